@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Counts allocations made by the program (and libraries it uses) for
+// benchmarks. Defines malloc and operator new, so it must be included by
+// exactly one translation unit of the benchmark.
+
+#ifndef NCMPCPP_EXTRAS_ALLOCATION_COUNTER_H
+#define NCMPCPP_EXTRAS_ALLOCATION_COUNTER_H
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+size_t allocations = 0;
+size_t allocated_bytes = 0;
+
+}
+
+#ifdef __GLIBC__
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	++allocations;
+	allocated_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	++allocations;
+	allocated_bytes += n*size;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++allocations;
+	allocated_bytes += size;
+	return __libc_realloc(ptr, size);
+}
+
+}
+#endif // __GLIBC__
+
+void *operator new(size_t size)
+{
+#ifndef __GLIBC__
+	++allocations;
+	allocated_bytes += size;
+#endif // !__GLIBC__
+	if (void *ptr = malloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+// Not inlined, otherwise GCC warns about free being called on pointers
+// returned by operator new.
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+#endif // NCMPCPP_EXTRAS_ALLOCATION_COUNTER_H
@@ -0,0 +1,90 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Measuring and reporting time and allocations of benchmarked code. Includes
+// allocation_counter.h, so it must be included by exactly one translation
+// unit of the benchmark as well.
+
+#ifndef NCMPCPP_EXTRAS_BENCHMARK_H
+#define NCMPCPP_EXTRAS_BENCHMARK_H
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+#include "allocation_counter.h"
+
+namespace {
+
+struct Result
+{
+	size_t allocations;
+	size_t allocated_bytes;
+	double seconds;
+	// returned by the measured function, keeps the compiler from optimizing
+	// the work away
+	size_t checksum;
+};
+
+// Run the function (which returns a checksum of its work) once.
+template <typename FunctionT>
+Result measure(FunctionT f)
+{
+	size_t allocations_before = allocations;
+	size_t bytes_before = allocated_bytes;
+	auto start = std::chrono::steady_clock::now();
+	size_t checksum = f();
+	auto end = std::chrono::steady_clock::now();
+	Result result;
+	result.allocations = allocations - allocations_before;
+	result.allocated_bytes = allocated_bytes - bytes_before;
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.checksum = checksum;
+	return result;
+}
+
+// Run the function the given number of times and return the fastest run.
+template <typename FunctionT>
+Result measureBest(int runs, FunctionT f)
+{
+	Result best = measure(f);
+	for (int i = 1; i < runs; ++i)
+	{
+		Result result = measure(f);
+		if (result.seconds < best.seconds)
+			best = result;
+	}
+	return best;
+}
+
+// Print the result, along with allocations per item if their number is given.
+void print(const char *name, const Result &result, size_t items = 0,
+           const char *item = "song")
+{
+	std::cout << name << ": " << result.allocations << " allocations";
+	if (items > 0)
+		std::cout << " (" << result.allocations / double(items) << " per " << item << ")";
+	std::cout << ", " << result.allocated_bytes / 1024 << " KiB allocated, "
+	          << result.seconds * 1000 << " ms\n";
+}
+
+}
+
+#endif // NCMPCPP_EXTRAS_BENCHMARK_H
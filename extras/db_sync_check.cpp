@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Checks that a database snapshot synchronized after songs were modified in
+// place (so that they are found by the modified-since search and not by
+// listing their directories) can be saved and loaded back. Meant to be run
+// against fake_mpd, e.g.
+//
+//   fake_mpd serve --port 6601 --modify-songs 10 &
+//   db_sync_check localhost 6601
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "db_sync.h"
+
+namespace {
+
+// Songs of the snapshot, by URI.
+std::map<std::string, std::string> contents(const MPD::DatabaseSnapshot &snapshot)
+{
+	std::map<std::string, std::string> result;
+	for (const auto &s : snapshot.songs())
+		result[s.getURI()] = std::to_string(s.getMTime()) + " " + s.getTitle();
+	return result;
+}
+
+bool check(bool condition, const char *what)
+{
+	if (!condition)
+		std::cerr << "FAILED: " << what << "\n";
+	return condition;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	int port = argc > 2 ? atoi(argv[2]) : 6600;
+	std::string path = argc > 3 ? argv[3] : "db_sync_check.snapshot";
+
+	try
+	{
+		MPD::Connection connection;
+		connection.SetHostname(host);
+		connection.SetPort(port);
+		connection.Connect();
+		auto tag_mask = MPD::DatabaseSnapshot::tagMask(connection.GetEnabledTagTypes());
+
+		// Initial snapshot, the way the worker makes it.
+		std::vector<MPD::Directory> directories;
+		std::vector<MPD::Song> songs;
+		auto db_update = connection.getStatistics().dbUpdateTime();
+		MPD::ItemIterator item = connection.GetDirectoryContent("/", true), end;
+		for (; item != end; ++item)
+		{
+			if (item->type() == MPD::Item::Type::Directory)
+				directories.push_back(std::move(item->directory()));
+			else if (item->type() == MPD::Item::Type::Song)
+				songs.push_back(std::move(item->song()));
+		}
+		std::sort(directories.begin(), directories.end(),
+		          [](const MPD::Directory &a, const MPD::Directory &b) {
+			          return a.path() < b.path();
+		          });
+		MPD::DatabaseSnapshot(path, db_update, tag_mask,
+		                      std::move(directories), std::move(songs)).save();
+		auto snapshot = MPD::DatabaseSnapshot::load(path, tag_mask);
+		if (!check(snapshot != nullptr, "initial snapshot loads back"))
+			return 1;
+
+		connection.UpdateDirectory("/");
+		for (int i = 0; i < 100 && connection.getStatistics().dbUpdateTime() == db_update; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		db_update = connection.getStatistics().dbUpdateTime();
+
+		MPD::DatabaseDelta delta;
+		auto synced = MPD::syncDatabase(connection, *snapshot, path, db_update, tag_mask, delta);
+		bool ok = check(!delta.added.empty(), "modified songs are found (use --modify-songs)");
+		std::cout << delta.added.size() << " songs added, "
+		          << delta.removed.size() << " removed, "
+		          << delta.listedDirectories << " directories listed\n";
+
+		try
+		{
+			synced->save();
+		}
+		catch (std::runtime_error &e)
+		{
+			std::cerr << e.what() << "\n";
+			ok = check(false, "synchronized snapshot is saved");
+		}
+		auto loaded = MPD::DatabaseSnapshot::load(path, tag_mask);
+		ok &= check(loaded != nullptr, "synchronized snapshot loads back");
+		if (loaded)
+		{
+			ok &= check(loaded->dbUpdate() == db_update, "loaded snapshot is up to date");
+			ok &= check(contents(*loaded) == contents(*synced),
+			            "loaded snapshot has the same songs");
+		}
+		remove(path.c_str());
+		std::cout << (ok ? "OK" : "FAILED") << "\n";
+		return ok ? 0 : 1;
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+}
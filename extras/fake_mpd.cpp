@@ -0,0 +1,1634 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Stand-in MPD server for measuring protocol heavy code paths of ncmpcpp
+// (and anything else that uses libmpdclient) without a real music library.
+//
+// Usage:
+//   fake_mpd serve [options]
+//     Serve a synthetic library. Options:
+//       --port N                port to listen on (6600)
+//       --songs N               number of songs (10000)
+//       --artists N             number of distinct artists (100)
+//       --albums-per-artist N   number of albums of each artist (5)
+//       --genres N              number of distinct genres (20)
+//       --extra-tags            add sort tags, labels and MusicBrainz ids
+//       --latency MS            delay each response by given time
+//       --update-events N       number of database events sent per update (1)
+//       --import-songs N        songs added in a new album on each update (0)
+//       --modify-songs N        songs modified in place on each update (0)
+//   fake_mpd record --upstream HOST:PORT --output FILE [--port N]
+//     Forward connections to a real server and record all traffic.
+//   fake_mpd replay --input FILE [--port N] [--latency MS]
+//     Replay recorded server responses byte for byte. N-th accepted
+//     connection replays N-th recorded one, data sent by the client is
+//     compared with the recorded one. Exits with 1 if it differs or
+//     a connection is closed before it's replayed.
+//
+// Supported commands: idle, noidle, status, stats, currentsong, listallinfo,
+// listall, lsinfo, playlistinfo, playlistid, plchanges, plchangesposid,
+// find, search, findadd, searchadd, searchaddpl, list, add, addid, move,
+// delete, deleteid, clear, tagtypes, play, stop, pause, setvol, update,
+// options toggles and a few which only need to succeed. Filter expressions
+// support ==, !=, contains, starts_with, =~, !, AND, base and modified-since.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char *Greeting = "OK MPD 0.23.0\n";
+
+struct Options
+{
+	int port = 6600;
+	size_t songs = 10000;
+	size_t artists = 100;
+	size_t albums_per_artist = 5;
+	size_t genres = 20;
+	bool extra_tags = false;
+	int latency = 0;
+	int update_events = 1;
+	size_t import_songs = 0;
+	size_t modify_songs = 0;
+	std::string upstream;
+	std::string file;
+};
+
+Options options;
+
+std::string lowercase(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+	return s;
+}
+
+std::string formatTime(time_t time)
+{
+	char buf[32];
+	tm t;
+	gmtime_r(&time, &t);
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &t);
+	return buf;
+}
+
+void sleepFor(int ms)
+{
+	if (ms > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/**********************************************************************/
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool readAll(int fd, char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = recv(fd, data, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+int listenOn(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw std::runtime_error("socket: " + std::string(strerror(errno)));
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+	    || listen(fd, 16) < 0)
+		throw std::runtime_error("bind/listen: " + std::string(strerror(errno)));
+	std::clog << "Listening on 127.0.0.1:" << port << "\n";
+	return fd;
+}
+
+int acceptClient(int listen_fd)
+{
+	int fd;
+	do
+		fd = accept(listen_fd, nullptr, nullptr);
+	while (fd < 0 && errno == EINTR);
+	if (fd < 0)
+		throw std::runtime_error("accept: " + std::string(strerror(errno)));
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+int connectTo(const std::string &address)
+{
+	auto colon = address.rfind(':');
+	std::string host = address.substr(0, colon);
+	std::string port = colon == std::string::npos ? "6600" : address.substr(colon+1);
+	addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+		throw std::runtime_error("couldn't resolve " + address);
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+	{
+		freeaddrinfo(res);
+		throw std::runtime_error("couldn't connect to " + address);
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/**********************************************************************/
+
+namespace Idle {
+
+enum Subsystem
+{
+	Database = 1 << 0,
+	StoredPlaylist = 1 << 1,
+	Playlist = 1 << 2,
+	Player = 1 << 3,
+	Mixer = 1 << 4,
+	Output = 1 << 5,
+	Options = 1 << 6,
+	Update = 1 << 7,
+};
+
+}
+
+const std::pair<Idle::Subsystem, const char *> SubsystemNames[] = {
+	{ Idle::Database, "database" },
+	{ Idle::StoredPlaylist, "stored_playlist" },
+	{ Idle::Playlist, "playlist" },
+	{ Idle::Player, "player" },
+	{ Idle::Mixer, "mixer" },
+	{ Idle::Output, "output" },
+	{ Idle::Options, "options" },
+	{ Idle::Update, "update" },
+};
+
+const char *TagTypes[] = {
+	"Artist", "ArtistSort", "Album", "AlbumSort", "AlbumArtist",
+	"AlbumArtistSort", "Title", "Track", "Name", "Genre", "Date", "Composer",
+	"Performer", "Comment", "Disc", "Label", "MUSICBRAINZ_ARTISTID",
+	"MUSICBRAINZ_ALBUMID", "MUSICBRAINZ_ALBUMARTISTID", "MUSICBRAINZ_TRACKID",
+	"MUSICBRAINZ_RELEASETRACKID",
+};
+
+struct Song
+{
+	std::string uri;
+	std::string directory;
+	time_t mtime;
+	unsigned duration;
+	std::vector<std::pair<std::string, std::string>> tags;
+
+	const std::string *tag(const std::string &lowercase_name) const
+	{
+		for (const auto &t : tags)
+			if (lowercase(t.first) == lowercase_name)
+				return &t.second;
+		return nullptr;
+	}
+};
+
+struct QueueEntry
+{
+	size_t song;
+	unsigned id;
+	unsigned version;
+};
+
+struct Client
+{
+	Client(int fd_)
+	: fd(fd_), events(0), enabled_tags(std::begin(TagTypes), std::end(TagTypes))
+	{
+		if (pipe(wake) != 0)
+			throw std::runtime_error("pipe: " + std::string(strerror(errno)));
+	}
+
+	~Client()
+	{
+		close(wake[0]);
+		close(wake[1]);
+		close(fd);
+	}
+
+	int fd;
+	int wake[2];
+	int events;
+	std::set<std::string> enabled_tags;
+};
+
+// Protocol error reported to the client as ACK.
+struct Ack
+{
+	Ack(int code_, std::string message_)
+	: code(code_), message(std::move(message_))
+	{ }
+
+	int code;
+	std::string message;
+};
+
+struct Database
+{
+	std::vector<Song> songs;
+	// Directories with their modification times, parents first.
+	std::map<std::string, time_t> directories;
+	time_t db_update;
+
+	std::vector<QueueEntry> queue;
+	unsigned playlist_version = 1;
+	unsigned next_id = 1;
+	std::map<std::string, std::vector<size_t>> playlists;
+
+	std::string state = "stop";
+	int current = -1;
+	int volume = 50;
+	bool repeat = false;
+	bool random = false;
+	bool single = false;
+	bool consume = false;
+	unsigned update_id = 0;
+
+	std::mutex mutex;
+	std::vector<Client *> clients;
+};
+
+Database db;
+
+Song makeSong(size_t i, size_t artist, size_t album, size_t track, time_t mtime)
+{
+	std::string artist_name = "Artist " + std::to_string(artist);
+	std::string album_name = "Album " + std::to_string(album);
+	std::string title = "Title " + std::to_string(i);
+	Song s;
+	s.directory = artist_name + "/" + album_name;
+	s.uri = s.directory + "/" + std::to_string(track) + " - " + title + ".flac";
+	s.mtime = mtime;
+	s.duration = 120 + i % 300;
+	s.tags = {
+		{ "Artist", artist_name },
+		{ "AlbumArtist", artist_name },
+		{ "Title", title },
+		{ "Album", album_name },
+		{ "Track", std::to_string(track) },
+		{ "Date", std::to_string(1970 + album % 50) },
+		{ "Genre", "Genre " + std::to_string(album % std::max<size_t>(1, options.genres)) },
+		{ "Disc", "1" },
+	};
+	if (options.extra_tags)
+	{
+		auto id = [](const char *prefix, size_t n) {
+			char buf[64];
+			snprintf(buf, sizeof(buf), "%s%04zx-0000-4000-8000-%012zx", prefix, n % 0x10000, n);
+			return std::string(buf);
+		};
+		s.tags.insert(s.tags.end(), {
+			{ "ArtistSort", artist_name },
+			{ "AlbumArtistSort", artist_name },
+			{ "AlbumSort", album_name },
+			{ "Composer", "Composer " + std::to_string(artist) },
+			{ "Label", "Label " + std::to_string(album % 7) },
+			{ "MUSICBRAINZ_ARTISTID", id("a", artist) },
+			{ "MUSICBRAINZ_ALBUMARTISTID", id("a", artist) },
+			{ "MUSICBRAINZ_ALBUMID", id("b", album) },
+			{ "MUSICBRAINZ_TRACKID", id("c", i) },
+			{ "MUSICBRAINZ_RELEASETRACKID", id("d", i) },
+		});
+	}
+	return s;
+}
+
+void generateLibrary()
+{
+	time_t now = time(nullptr);
+	size_t albums = std::max<size_t>(1, options.artists * options.albums_per_artist);
+	size_t songs_per_album = std::max<size_t>(1, (options.songs + albums - 1) / albums);
+	db.songs.reserve(options.songs);
+	for (size_t i = 0; i < options.songs; ++i)
+	{
+		size_t album = i / songs_per_album;
+		size_t artist = album / std::max<size_t>(1, options.albums_per_artist) % std::max<size_t>(1, options.artists);
+		size_t track = i % songs_per_album + 1;
+		Song s = makeSong(i, artist, album, track, now - static_cast<time_t>(i) * 60);
+		db.directories.emplace(s.directory.substr(0, s.directory.find('/')), s.mtime);
+		db.directories.emplace(s.directory, s.mtime);
+		db.songs.push_back(std::move(s));
+	}
+	db.db_update = now;
+}
+
+// Add a new album to the library as if it was imported. Must be called with
+// the database locked.
+void importAlbum()
+{
+	static size_t imported = 0;
+	time_t now = time(nullptr);
+	size_t album = options.artists * options.albums_per_artist + imported;
+	size_t artist = imported % std::max<size_t>(1, options.artists);
+	for (size_t track = 1; track <= options.import_songs; ++track)
+	{
+		Song s = makeSong(db.songs.size(), artist, album, track, now);
+		// Adding a subdirectory changes modification time of the parent.
+		db.directories[s.directory.substr(0, s.directory.find('/'))] = now;
+		db.directories[s.directory] = now;
+		db.songs.push_back(std::move(s));
+	}
+	++imported;
+}
+
+// Change tags of existing songs as if they were edited. Modification times of
+// their directories stay the same. Must be called with the database locked.
+void modifySongs(time_t mtime)
+{
+	static size_t modified = 0;
+	for (size_t i = 0; i < options.modify_songs && !db.songs.empty(); ++i, ++modified)
+	{
+		Song &s = db.songs[modified * 7919 % db.songs.size()];
+		s.mtime = mtime;
+		for (auto &tag : s.tags)
+			if (tag.first == "Title")
+				tag.second += " (modified)";
+	}
+}
+
+// Must be called with the database locked.
+void notify(int events)
+{
+	for (auto c : db.clients)
+	{
+		c->events |= events;
+		char x = 0;
+		if (write(c->wake[1], &x, 1) < 0)
+			std::cerr << "Couldn't wake up client: " << strerror(errno) << "\n";
+	}
+}
+
+/**********************************************************************/
+
+struct Filter
+{
+	enum class Kind { And, Not, Tag, Base, ModifiedSince } kind;
+	std::vector<Filter> children;
+	std::string tag;
+	std::string op;
+	std::string value;
+	std::regex regex;
+	bool fold_case;
+
+	bool matchValue(const std::string &v) const
+	{
+		if (op == "=~")
+			return std::regex_search(v, regex);
+		std::string lhs = fold_case ? lowercase(v) : v;
+		if (op == "==")
+			return lhs == value;
+		else if (op == "!=")
+			return lhs != value;
+		else if (op == "contains")
+			return lhs.find(value) != std::string::npos;
+		else if (op == "starts_with")
+			return lhs.compare(0, value.size(), value) == 0;
+		return false;
+	}
+
+	bool matches(const Song &s) const
+	{
+		switch (kind)
+		{
+			case Kind::And:
+				return std::all_of(children.begin(), children.end(),
+				                   [&s](const Filter &f) { return f.matches(s); });
+			case Kind::Not:
+				return !children[0].matches(s);
+			case Kind::ModifiedSince:
+				return s.mtime >= static_cast<time_t>(std::stoll(value));
+			case Kind::Base:
+				return s.uri.compare(0, value.size(), value) == 0
+				    && (s.uri.size() == value.size() || value.empty() || s.uri[value.size()] == '/');
+			case Kind::Tag:
+				if (tag == "file")
+					return matchValue(s.uri);
+				if (tag == "any")
+					return std::any_of(s.tags.begin(), s.tags.end(),
+					                   [this](const std::pair<std::string, std::string> &t) {
+						                   return matchValue(t.second);
+					                   });
+				if (auto v = s.tag(tag))
+					return matchValue(*v);
+				// Missing tag is equal to empty one.
+				return matchValue("");
+		}
+		return false;
+	}
+};
+
+Filter tagFilter(std::string tag, std::string op, std::string value, bool fold_case)
+{
+	Filter f;
+	f.kind = Filter::Kind::Tag;
+	f.tag = lowercase(std::move(tag));
+	f.op = std::move(op);
+	f.fold_case = fold_case;
+	if (f.op == "=~")
+	{
+		auto flags = std::regex::ECMAScript;
+		if (fold_case)
+			flags |= std::regex::icase;
+		f.regex = std::regex(value, flags);
+	}
+	f.value = fold_case ? lowercase(std::move(value)) : std::move(value);
+	return f;
+}
+
+struct ExpressionParser
+{
+	ExpressionParser(const std::string &s, bool fold_case)
+	: m_s(s), m_pos(0), m_fold_case(fold_case)
+	{ }
+
+	Filter parse()
+	{
+		Filter result = expression();
+		skipSpaces();
+		if (m_pos != m_s.size())
+			error();
+		return result;
+	}
+
+private:
+	Filter expression()
+	{
+		expect('(');
+		skipSpaces();
+		Filter result;
+		if (peek() == '(')
+		{
+			result.kind = Filter::Kind::And;
+			result.children.push_back(expression());
+			while (skipSpaces(), peek() != ')')
+			{
+				if (word() != "AND")
+					error();
+				skipSpaces();
+				result.children.push_back(expression());
+			}
+		}
+		else if (peek() == '!')
+		{
+			++m_pos;
+			skipSpaces();
+			result.kind = Filter::Kind::Not;
+			result.children.push_back(expression());
+			skipSpaces();
+		}
+		else
+		{
+			std::string tag = word();
+			skipSpaces();
+			if (tag == "base")
+			{
+				result.kind = Filter::Kind::Base;
+				result.value = quoted();
+			}
+			else if (tag == "modified-since")
+			{
+				// only UNIX timestamps are supported
+				result.kind = Filter::Kind::ModifiedSince;
+				result.value = quoted();
+				if (result.value.empty()
+				    || result.value.find_first_not_of("0123456789") != std::string::npos)
+					error();
+			}
+			else
+			{
+				std::string op = word();
+				skipSpaces();
+				result = tagFilter(tag, op, quoted(), m_fold_case);
+			}
+			skipSpaces();
+		}
+		expect(')');
+		return result;
+	}
+
+	std::string word()
+	{
+		size_t begin = m_pos;
+		while (m_pos < m_s.size() && !isspace(m_s[m_pos]) && m_s[m_pos] != ')')
+			++m_pos;
+		return m_s.substr(begin, m_pos - begin);
+	}
+
+	std::string quoted()
+	{
+		char quote = peek();
+		if (quote != '"' && quote != '\'')
+			error();
+		++m_pos;
+		std::string result;
+		for (; m_pos < m_s.size() && m_s[m_pos] != quote; ++m_pos)
+		{
+			if (m_s[m_pos] == '\\' && m_pos+1 < m_s.size())
+				++m_pos;
+			result += m_s[m_pos];
+		}
+		expect(quote);
+		return result;
+	}
+
+	void skipSpaces()
+	{
+		while (m_pos < m_s.size() && isspace(m_s[m_pos]))
+			++m_pos;
+	}
+
+	char peek() const
+	{
+		return m_pos < m_s.size() ? m_s[m_pos] : '\0';
+	}
+
+	void expect(char c)
+	{
+		if (peek() != c)
+			error();
+		++m_pos;
+	}
+
+	[[noreturn]] void error() const
+	{
+		throw Ack(2, "Invalid filter expression at position " + std::to_string(m_pos));
+	}
+
+	const std::string &m_s;
+	size_t m_pos;
+	bool m_fold_case;
+};
+
+// Parse filters from the arguments, either a single expression or old style
+// tag/value pairs. Recognized trailing arguments (window, sort, group) are
+// removed from the vector.
+struct SearchArgs
+{
+	Filter filter;
+	size_t window_begin = 0;
+	size_t window_end = std::numeric_limits<size_t>::max();
+	std::vector<std::string> groups;
+};
+
+std::pair<size_t, size_t> parseRange(const std::string &s)
+{
+	size_t colon = s.find(':');
+	try
+	{
+		if (colon == std::string::npos)
+		{
+			size_t n = std::stoul(s);
+			return { n, n+1 };
+		}
+		size_t begin = std::stoul(s.substr(0, colon));
+		size_t end = colon+1 == s.size()
+			? std::numeric_limits<size_t>::max()
+			: std::stoul(s.substr(colon+1));
+		return { begin, end };
+	}
+	catch (std::exception &)
+	{
+		throw Ack(2, "Integer or range expected: " + s);
+	}
+}
+
+SearchArgs parseSearchArgs(std::vector<std::string> args, bool fold_case)
+{
+	SearchArgs result;
+	while (args.size() >= 2)
+	{
+		const auto &key = args[args.size()-2];
+		if (key == "window")
+			std::tie(result.window_begin, result.window_end) = parseRange(args.back());
+		else if (key == "sort")
+		{ }
+		else if (key == "group")
+			result.groups.insert(result.groups.begin(), lowercase(args.back()));
+		else
+			break;
+		args.resize(args.size()-2);
+	}
+	result.filter.kind = Filter::Kind::And;
+	if (args.size() == 1 && !args[0].empty() && args[0][0] == '(')
+		result.filter.children.push_back(ExpressionParser(args[0], fold_case).parse());
+	else if (args.size() % 2 != 0)
+		throw Ack(2, "Incorrect number of filter arguments");
+	else
+	{
+		for (size_t i = 0; i < args.size(); i += 2)
+		{
+			if (lowercase(args[i]) == "base")
+			{
+				Filter f;
+				f.kind = Filter::Kind::Base;
+				f.value = args[i+1];
+				result.filter.children.push_back(std::move(f));
+			}
+			else
+				result.filter.children.push_back(
+					tagFilter(args[i], fold_case ? "contains" : "==", args[i+1], fold_case));
+		}
+	}
+	return result;
+}
+
+/**********************************************************************/
+
+struct Session
+{
+	Session(Client &client)
+	: m_client(client)
+	{ }
+
+	void run();
+
+private:
+	bool readLine(std::string &line);
+	bool waitForIdle(int mask);
+
+	void execute(const std::vector<std::string> &command, std::string &out);
+
+	void printSong(std::string &out, size_t song, const QueueEntry *entry = nullptr, size_t pos = 0);
+	void printQueue(std::string &out, size_t begin, size_t end, bool full, unsigned since);
+	std::vector<size_t> search(const Filter &filter, size_t window_begin, size_t window_end);
+	void addSongs(const std::vector<size_t> &songs, size_t position);
+	void changeQueue();
+
+	Client &m_client;
+	std::string m_buffer;
+};
+
+std::vector<std::string> tokenize(const std::string &line)
+{
+	std::vector<std::string> result;
+	size_t i = 0;
+	while (true)
+	{
+		while (i < line.size() && isspace(line[i]))
+			++i;
+		if (i == line.size())
+			break;
+		std::string token;
+		if (line[i] == '"')
+		{
+			for (++i; i < line.size() && line[i] != '"'; ++i)
+			{
+				if (line[i] == '\\' && i+1 < line.size())
+					++i;
+				token += line[i];
+			}
+			if (i == line.size())
+				throw Ack(2, "Missing closing '\"'");
+			++i;
+		}
+		else
+		{
+			while (i < line.size() && !isspace(line[i]))
+				token += line[i++];
+		}
+		result.push_back(std::move(token));
+	}
+	return result;
+}
+
+bool Session::readLine(std::string &line)
+{
+	size_t newline;
+	while ((newline = m_buffer.find('\n')) == std::string::npos)
+	{
+		char buf[4096];
+		ssize_t n = recv(m_client.fd, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		m_buffer.append(buf, n);
+	}
+	line = m_buffer.substr(0, newline);
+	m_buffer.erase(0, newline+1);
+	return true;
+}
+
+// Wait until any of the subsystems changes or noidle is received. Returns
+// false if the connection was closed.
+bool Session::waitForIdle(int mask)
+{
+	while (true)
+	{
+		std::string out;
+		{
+			std::lock_guard<std::mutex> lock(db.mutex);
+			if (m_client.events & mask)
+			{
+				for (const auto &s : SubsystemNames)
+					if (m_client.events & mask & s.first)
+						out += std::string("changed: ") + s.second + "\n";
+				m_client.events &= ~mask;
+			}
+		}
+		if (!out.empty() || m_buffer.find('\n') != std::string::npos)
+		{
+			std::string line;
+			if (out.empty() && readLine(line) && line != "noidle")
+				std::cerr << "Unexpected command while idle: " << line << "\n";
+			sleepFor(options.latency);
+			out += "OK\n";
+			return writeAll(m_client.fd, out.data(), out.size());
+		}
+
+		pollfd fds[2] = { { m_client.fd, POLLIN, 0 }, { m_client.wake[0], POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			return false;
+		if (fds[1].revents & POLLIN)
+		{
+			char buf[64];
+			if (read(m_client.wake[0], buf, sizeof(buf)) < 0)
+				return false;
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP))
+		{
+			char buf[4096];
+			ssize_t n = recv(m_client.fd, buf, sizeof(buf), 0);
+			if (n <= 0)
+				return false;
+			m_buffer.append(buf, n);
+		}
+	}
+}
+
+void Session::run()
+{
+	if (!writeAll(m_client.fd, Greeting, strlen(Greeting)))
+		return;
+
+	std::string line;
+	std::vector<std::vector<std::string>> command_list;
+	bool in_command_list = false, list_ok = false;
+	while (readLine(line))
+	{
+		std::vector<std::string> command;
+		try
+		{
+			command = tokenize(line);
+		}
+		catch (Ack &e)
+		{
+			std::string out = "ACK [" + std::to_string(e.code) + "@0] {} " + e.message + "\n";
+			if (!writeAll(m_client.fd, out.data(), out.size()))
+				return;
+			continue;
+		}
+		if (command.empty())
+			continue;
+
+		if (command[0] == "command_list_begin" || command[0] == "command_list_ok_begin")
+		{
+			in_command_list = true;
+			list_ok = command[0] == "command_list_ok_begin";
+			continue;
+		}
+		if (in_command_list && command[0] != "command_list_end")
+		{
+			command_list.push_back(std::move(command));
+			continue;
+		}
+		if (command[0] == "idle")
+		{
+			int mask = 0;
+			for (size_t i = 1; i < command.size(); ++i)
+				for (const auto &s : SubsystemNames)
+					if (command[i] == s.second)
+						mask |= s.first;
+			if (!waitForIdle(mask ? mask : ~0))
+				return;
+			continue;
+		}
+		if (command[0] == "noidle")
+			continue;
+		if (command[0] == "close")
+			return;
+
+		if (!in_command_list)
+			command_list.push_back(std::move(command));
+		in_command_list = false;
+
+		std::string out;
+		size_t i = 0;
+		try
+		{
+			for (; i < command_list.size(); ++i)
+			{
+				execute(command_list[i], out);
+				if (list_ok)
+					out += "list_OK\n";
+			}
+			out += "OK\n";
+		}
+		catch (Ack &e)
+		{
+			out += "ACK [" + std::to_string(e.code) + "@" + std::to_string(i) + "] {"
+				+ command_list[i][0] + "} " + e.message + "\n";
+		}
+		catch (std::exception &e)
+		{
+			out += "ACK [2@" + std::to_string(i) + "] {" + command_list[i][0] + "} "
+				+ e.what() + "\n";
+		}
+		command_list.clear();
+		list_ok = false;
+		sleepFor(options.latency);
+		if (!writeAll(m_client.fd, out.data(), out.size()))
+			return;
+	}
+}
+
+void Session::printSong(std::string &out, size_t song, const QueueEntry *entry, size_t pos)
+{
+	const Song &s = db.songs[song];
+	out += "file: " + s.uri + "\n";
+	out += "Last-Modified: " + formatTime(s.mtime) + "\n";
+	for (const auto &tag : s.tags)
+		if (m_client.enabled_tags.count(tag.first))
+			out += tag.first + ": " + tag.second + "\n";
+	out += "Time: " + std::to_string(s.duration) + "\n";
+	out += "duration: " + std::to_string(s.duration) + ".000\n";
+	if (entry != nullptr)
+	{
+		out += "Pos: " + std::to_string(pos) + "\n";
+		out += "Id: " + std::to_string(entry->id) + "\n";
+	}
+}
+
+void Session::printQueue(std::string &out, size_t begin, size_t end, bool full, unsigned since)
+{
+	end = std::min(end, db.queue.size());
+	for (size_t i = begin; i < end; ++i)
+	{
+		const auto &entry = db.queue[i];
+		if (entry.version <= since)
+			continue;
+		if (full)
+			printSong(out, entry.song, &entry, i);
+		else
+		{
+			out += "cpos: " + std::to_string(i) + "\n";
+			out += "Id: " + std::to_string(entry.id) + "\n";
+		}
+	}
+}
+
+std::vector<size_t> Session::search(const Filter &filter, size_t window_begin, size_t window_end)
+{
+	std::vector<size_t> result;
+	size_t matched = 0;
+	for (size_t i = 0; i < db.songs.size() && matched < window_end; ++i)
+	{
+		if (filter.matches(db.songs[i]))
+		{
+			if (matched >= window_begin)
+				result.push_back(i);
+			++matched;
+		}
+	}
+	return result;
+}
+
+void Session::changeQueue()
+{
+	++db.playlist_version;
+	notify(Idle::Playlist);
+}
+
+void Session::addSongs(const std::vector<size_t> &songs, size_t position)
+{
+	position = std::min(position, db.queue.size());
+	std::vector<QueueEntry> entries;
+	for (auto s : songs)
+		entries.push_back({ s, db.next_id++, db.playlist_version + 1 });
+	db.queue.insert(db.queue.begin() + position, entries.begin(), entries.end());
+	// Positions of the following songs changed.
+	for (size_t i = position + entries.size(); i < db.queue.size(); ++i)
+		db.queue[i].version = db.playlist_version + 1;
+	changeQueue();
+}
+
+size_t findId(unsigned id)
+{
+	for (size_t i = 0; i < db.queue.size(); ++i)
+		if (db.queue[i].id == id)
+			return i;
+	throw Ack(50, "No such song");
+}
+
+void Session::execute(const std::vector<std::string> &command, std::string &out)
+{
+	const std::string &name = command[0];
+	auto arg = [&command](size_t i) -> const std::string & {
+		if (i >= command.size())
+			throw Ack(2, "too few arguments for \"" + command[0] + "\"");
+		return command[i];
+	};
+	auto number = [&arg](size_t i) {
+		try
+		{
+			return std::stoi(arg(i));
+		}
+		catch (std::invalid_argument &)
+		{
+			throw Ack(2, "Integer expected: " + arg(i));
+		}
+	};
+	auto rest = [&command](size_t i) {
+		return std::vector<std::string>(command.begin() + std::min(i, command.size()), command.end());
+	};
+
+	std::lock_guard<std::mutex> lock(db.mutex);
+	if (name == "ping" || name == "password" || name == "binarylimit")
+	{ }
+	else if (name == "status")
+	{
+		out += "volume: " + std::to_string(db.volume) + "\n";
+		out += std::string("repeat: ") + (db.repeat ? "1" : "0") + "\n";
+		out += std::string("random: ") + (db.random ? "1" : "0") + "\n";
+		out += std::string("single: ") + (db.single ? "1" : "0") + "\n";
+		out += std::string("consume: ") + (db.consume ? "1" : "0") + "\n";
+		out += "playlist: " + std::to_string(db.playlist_version) + "\n";
+		out += "playlistlength: " + std::to_string(db.queue.size()) + "\n";
+		out += "state: " + db.state + "\n";
+		if (db.current >= 0 && static_cast<size_t>(db.current) < db.queue.size())
+		{
+			const auto &entry = db.queue[db.current];
+			out += "song: " + std::to_string(db.current) + "\n";
+			out += "songid: " + std::to_string(entry.id) + "\n";
+			if (db.state != "stop")
+			{
+				unsigned duration = db.songs[entry.song].duration;
+				out += "time: 0:" + std::to_string(duration) + "\n";
+				out += "elapsed: 0.000\n";
+				out += "bitrate: 320\n";
+				out += "duration: " + std::to_string(duration) + ".000\n";
+				out += "audio: 44100:16:2\n";
+			}
+		}
+		if (db.update_id)
+			out += "updating_db: " + std::to_string(db.update_id) + "\n";
+	}
+	else if (name == "stats")
+	{
+		std::set<std::string> artists, albums;
+		unsigned long playtime = 0;
+		for (const auto &s : db.songs)
+		{
+			if (auto a = s.tag("artist"))
+				artists.insert(*a);
+			if (auto a = s.tag("album"))
+				albums.insert(*a);
+			playtime += s.duration;
+		}
+		out += "artists: " + std::to_string(artists.size()) + "\n";
+		out += "albums: " + std::to_string(albums.size()) + "\n";
+		out += "songs: " + std::to_string(db.songs.size()) + "\n";
+		out += "uptime: 1\n";
+		out += "db_playtime: " + std::to_string(playtime) + "\n";
+		out += "db_update: " + std::to_string(db.db_update) + "\n";
+		out += "playtime: 0\n";
+	}
+	else if (name == "currentsong")
+	{
+		if (db.current >= 0 && static_cast<size_t>(db.current) < db.queue.size())
+			printSong(out, db.queue[db.current].song, &db.queue[db.current], db.current);
+	}
+	else if (name == "tagtypes")
+	{
+		if (command.size() == 1)
+		{
+			for (const auto &tag : TagTypes)
+				out += std::string("tagtype: ") + tag + "\n";
+		}
+		else if (command[1] == "clear")
+			m_client.enabled_tags.clear();
+		else if (command[1] == "all")
+			m_client.enabled_tags.insert(std::begin(TagTypes), std::end(TagTypes));
+		else if (command[1] == "enable" || command[1] == "disable")
+		{
+			for (size_t i = 2; i < command.size(); ++i)
+			{
+				auto tag = std::find_if(std::begin(TagTypes), std::end(TagTypes),
+				                        [&command, i](const char *t) {
+					                        return lowercase(t) == lowercase(command[i]);
+				                        });
+				if (tag == std::end(TagTypes))
+					throw Ack(2, "Unknown tag type: " + command[i]);
+				if (command[1] == "enable")
+					m_client.enabled_tags.insert(*tag);
+				else
+					m_client.enabled_tags.erase(*tag);
+			}
+		}
+		else
+			throw Ack(2, "Unknown sub command");
+	}
+	else if (name == "listallinfo" || name == "listall")
+	{
+		std::string base = command.size() > 1 ? command[1] : "";
+		if (base == "/")
+			base.clear();
+		std::string directory;
+		std::set<std::string> printed;
+		auto print_directory = [&](const std::string &path) {
+			if (!printed.insert(path).second)
+				return;
+			out += "directory: " + path + "\n";
+			if (name == "listallinfo")
+				out += "Last-Modified: " + formatTime(db.directories[path]) + "\n";
+		};
+		for (size_t i = 0; i < db.songs.size(); ++i)
+		{
+			const auto &s = db.songs[i];
+			if (!base.empty() && s.uri.compare(0, base.size(), base) != 0)
+				continue;
+			if (s.directory != directory)
+			{
+				print_directory(s.directory.substr(0, s.directory.find('/')));
+				print_directory(s.directory);
+				directory = s.directory;
+			}
+			if (name == "listall")
+				out += "file: " + s.uri + "\n";
+			else
+				printSong(out, i);
+		}
+	}
+	else if (name == "lsinfo")
+	{
+		std::string base = command.size() > 1 ? command[1] : "";
+		if (base == "/")
+			base.clear();
+		auto print_directory = [&out](const std::pair<const std::string, time_t> &d) {
+			out += "directory: " + d.first + "\n";
+			out += "Last-Modified: " + formatTime(d.second) + "\n";
+		};
+		if (base.empty())
+		{
+			for (const auto &d : db.directories)
+				if (d.first.find('/') == std::string::npos)
+					print_directory(d);
+		}
+		else if (db.directories.count(base))
+		{
+			for (const auto &d : db.directories)
+				if (d.first.size() > base.size()+1
+				    && d.first.compare(0, base.size()+1, base + "/") == 0
+				    && d.first.find('/', base.size()+1) == std::string::npos)
+					print_directory(d);
+			for (size_t i = 0; i < db.songs.size(); ++i)
+				if (db.songs[i].directory == base)
+					printSong(out, i);
+		}
+		else
+			throw Ack(50, "No such directory");
+	}
+	else if (name == "playlistinfo")
+	{
+		size_t begin = 0, end = db.queue.size();
+		if (command.size() > 1)
+		{
+			std::tie(begin, end) = parseRange(command[1]);
+			if (begin >= db.queue.size() && !(begin == 0 && db.queue.empty()))
+				throw Ack(2, "Bad song index");
+		}
+		printQueue(out, begin, end, true, 0);
+	}
+	else if (name == "playlistid")
+	{
+		if (command.size() > 1)
+		{
+			size_t pos = findId(number(1));
+			printSong(out, db.queue[pos].song, &db.queue[pos], pos);
+		}
+		else
+			printQueue(out, 0, db.queue.size(), true, 0);
+	}
+	else if (name == "plchanges" || name == "plchangesposid")
+	{
+		unsigned since = number(1);
+		size_t begin = 0, end = db.queue.size();
+		if (command.size() > 2)
+			std::tie(begin, end) = parseRange(command[2]);
+		printQueue(out, begin, end, name == "plchanges", since);
+	}
+	else if (name == "find" || name == "search")
+	{
+		auto args = parseSearchArgs(rest(1), name == "search");
+		for (auto s : search(args.filter, args.window_begin, args.window_end))
+			printSong(out, s);
+	}
+	else if (name == "findadd" || name == "searchadd")
+	{
+		auto args = parseSearchArgs(rest(1), name == "searchadd");
+		addSongs(search(args.filter, 0, std::numeric_limits<size_t>::max()), db.queue.size());
+	}
+	else if (name == "searchaddpl")
+	{
+		auto args = parseSearchArgs(rest(2), true);
+		auto &pl = db.playlists[arg(1)];
+		auto songs = search(args.filter, 0, std::numeric_limits<size_t>::max());
+		pl.insert(pl.end(), songs.begin(), songs.end());
+		notify(Idle::StoredPlaylist);
+	}
+	else if (name == "list")
+	{
+		std::string tag = lowercase(arg(1));
+		auto filter_args = rest(2);
+		// Old syntax: list album ARTIST.
+		if (tag == "album" && filter_args.size() == 1 && filter_args[0].compare(0, 1, "(") != 0)
+			filter_args.insert(filter_args.begin(), "artist");
+		auto args = parseSearchArgs(filter_args, false);
+		std::set<std::vector<std::string>> values;
+		std::vector<std::string> row(args.groups.size() + 1);
+		for (const auto &s : db.songs)
+		{
+			if (!args.filter.matches(s))
+				continue;
+			for (size_t i = 0; i < args.groups.size(); ++i)
+			{
+				auto v = s.tag(args.groups[i]);
+				row[i] = v ? *v : "";
+			}
+			auto v = tag == "file" ? &s.uri : s.tag(tag);
+			if (v == nullptr)
+				continue;
+			row.back() = *v;
+			values.insert(row);
+		}
+		auto tag_name = [](const std::string &t) -> std::string {
+			for (const auto &known : TagTypes)
+				if (lowercase(known) == t)
+					return known;
+			return t;
+		};
+		std::vector<std::string> previous;
+		for (const auto &v : values)
+		{
+			for (size_t i = 0; i < args.groups.size(); ++i)
+				if (previous.empty() || previous[i] != v[i])
+				{
+					out += tag_name(args.groups[i]) + ": " + v[i] + "\n";
+					previous.clear();
+				}
+			out += tag_name(tag) + ": " + v.back() + "\n";
+			previous = v;
+		}
+	}
+	else if (name == "add" || name == "addid")
+	{
+		std::vector<size_t> songs;
+		const std::string &uri = arg(1);
+		for (size_t i = 0; i < db.songs.size(); ++i)
+		{
+			const auto &s = db.songs[i];
+			if (s.uri == uri || uri.empty() || uri == "/"
+			    || (s.uri.compare(0, uri.size()+1, uri + "/") == 0))
+				songs.push_back(i);
+		}
+		if (songs.empty())
+			throw Ack(50, "No such directory");
+		size_t position = command.size() > 2 ? number(2) : db.queue.size();
+		if (name == "addid")
+		{
+			if (songs.size() != 1)
+				throw Ack(2, "Not a file");
+			out += "Id: " + std::to_string(db.next_id) + "\n";
+		}
+		addSongs(songs, position);
+	}
+	else if (name == "move" || name == "moveid")
+	{
+		size_t begin, end;
+		if (name == "moveid")
+		{
+			begin = findId(number(1));
+			end = begin+1;
+		}
+		else
+			std::tie(begin, end) = parseRange(arg(1));
+		end = std::min(end, db.queue.size());
+		size_t to = number(2);
+		if (begin >= end || to + (end - begin) > db.queue.size())
+			throw Ack(2, "Bad song index");
+		std::vector<QueueEntry> moved(db.queue.begin() + begin, db.queue.begin() + end);
+		db.queue.erase(db.queue.begin() + begin, db.queue.begin() + end);
+		db.queue.insert(db.queue.begin() + to, moved.begin(), moved.end());
+		for (size_t i = std::min(begin, to); i < std::max(end, to + moved.size()); ++i)
+			db.queue[i].version = db.playlist_version + 1;
+		changeQueue();
+	}
+	else if (name == "delete" || name == "deleteid")
+	{
+		size_t begin, end;
+		if (name == "deleteid")
+		{
+			begin = findId(number(1));
+			end = begin+1;
+		}
+		else
+			std::tie(begin, end) = parseRange(arg(1));
+		end = std::min(end, db.queue.size());
+		if (begin >= end)
+			throw Ack(2, "Bad song index");
+		db.queue.erase(db.queue.begin() + begin, db.queue.begin() + end);
+		for (size_t i = begin; i < db.queue.size(); ++i)
+			db.queue[i].version = db.playlist_version + 1;
+		if (db.current >= static_cast<int>(begin))
+			db.current = db.current < static_cast<int>(end) ? -1 : db.current - (end - begin);
+		changeQueue();
+	}
+	else if (name == "clear")
+	{
+		db.queue.clear();
+		db.current = -1;
+		db.state = "stop";
+		changeQueue();
+		notify(Idle::Player);
+	}
+	else if (name == "play" || name == "playid")
+	{
+		int pos = 0;
+		if (command.size() > 1)
+			pos = name == "play" ? number(1) : findId(number(1));
+		if (pos < 0 || static_cast<size_t>(pos) >= db.queue.size())
+			throw Ack(2, "Bad song index");
+		db.current = pos;
+		db.state = "play";
+		notify(Idle::Player);
+	}
+	else if (name == "stop" || name == "pause")
+	{
+		if (name == "stop")
+			db.state = "stop";
+		else if (db.state != "stop")
+			db.state = command.size() > 1 && command[1] == "0" ? "play" : "pause";
+		notify(Idle::Player);
+	}
+	else if (name == "setvol")
+	{
+		db.volume = number(1);
+		notify(Idle::Mixer);
+	}
+	else if (name == "repeat" || name == "random" || name == "single" || name == "consume")
+	{
+		bool value = arg(1) == "1";
+		if (name == "repeat")
+			db.repeat = value;
+		else if (name == "random")
+			db.random = value;
+		else if (name == "single")
+			db.single = value;
+		else
+			db.consume = value;
+		notify(Idle::Options);
+	}
+	else if (name == "update" || name == "rescan")
+	{
+		db.update_id = 1;
+		out += "updating_db: 1\n";
+		notify(Idle::Update);
+		// Simulate a burst of events sent during database update.
+		std::thread([] {
+			for (int i = 0; i < options.update_events; ++i)
+			{
+				sleepFor(1);
+				std::lock_guard<std::mutex> l(db.mutex);
+				// Clients compare it with the previous one, so it needs to
+				// change even if the update is finished within a second.
+				time_t db_update = std::max(time(nullptr), db.db_update + 1);
+				if (i == 0 && options.import_songs > 0)
+					importAlbum();
+				if (i == 0 && options.modify_songs > 0)
+					modifySongs(db_update);
+				db.db_update = db_update;
+				notify(Idle::Database);
+			}
+			std::lock_guard<std::mutex> l(db.mutex);
+			db.update_id = 0;
+			notify(Idle::Update);
+		}).detach();
+	}
+	else if (name == "listplaylists")
+	{
+		for (const auto &pl : db.playlists)
+			out += "playlist: " + pl.first + "\n";
+	}
+	else if (name == "listplaylistinfo" || name == "listplaylist")
+	{
+		auto pl = db.playlists.find(arg(1));
+		if (pl == db.playlists.end())
+			throw Ack(50, "No such playlist");
+		for (auto s : pl->second)
+		{
+			if (name == "listplaylist")
+				out += "file: " + db.songs[s].uri + "\n";
+			else
+				printSong(out, s);
+		}
+	}
+	else if (name == "outputs")
+		out += "outputid: 0\noutputname: Null\nplugin: null\noutputenabled: 1\n";
+	else if (name == "urlhandlers")
+		out += "handler: http://\n";
+	else if (name == "commands")
+	{
+		for (const char *c : { "add", "addid", "clear", "currentsong", "delete",
+		                       "deleteid", "find", "findadd", "idle", "list",
+		                       "listall", "listallinfo", "lsinfo", "move",
+		                       "moveid", "noidle", "outputs", "pause", "play",
+		                       "playid", "playlistid", "playlistinfo",
+		                       "plchanges", "plchangesposid", "search",
+		                       "searchadd", "searchaddpl", "setvol", "stats",
+		                       "status", "stop", "tagtypes", "update" })
+			out += std::string("command: ") + c + "\n";
+	}
+	else if (name == "replay_gain_status")
+		out += "replay_gain_mode: off\n";
+	else
+		throw Ack(5, "unknown command \"" + name + "\"");
+}
+
+/**********************************************************************/
+
+int serve()
+{
+	generateLibrary();
+	std::clog << "Generated " << db.songs.size() << " songs in "
+	          << db.directories.size() << " directories\n";
+	int listen_fd = listenOn(options.port);
+	while (true)
+	{
+		int fd = acceptClient(listen_fd);
+		std::thread([fd] {
+			auto client = std::make_unique<Client>(fd);
+			{
+				std::lock_guard<std::mutex> lock(db.mutex);
+				db.clients.push_back(client.get());
+			}
+			Session(*client).run();
+			std::lock_guard<std::mutex> lock(db.mutex);
+			db.clients.erase(std::find(db.clients.begin(), db.clients.end(), client.get()));
+		}).detach();
+	}
+}
+
+// Recording consists of chunks, each one preceded by a header line with
+// connection number, direction (C - client, S - server) and length and
+// followed by a new line.
+
+int record()
+{
+	std::ofstream output(options.file, std::ios::binary);
+	if (!output)
+		throw std::runtime_error("couldn't open " + options.file);
+	std::mutex output_mutex;
+	int listen_fd = listenOn(options.port);
+	for (int connection = 0;; ++connection)
+	{
+		int client = acceptClient(listen_fd);
+		int server = connectTo(options.upstream);
+		auto forward = [&output, &output_mutex, connection](int from, int to, char direction) {
+			char buf[65536];
+			ssize_t n;
+			while ((n = recv(from, buf, sizeof(buf), 0)) > 0)
+			{
+				{
+					std::lock_guard<std::mutex> lock(output_mutex);
+					output << connection << ' ' << direction << ' ' << n << '\n';
+					output.write(buf, n);
+					output << '\n';
+					output.flush();
+				}
+				if (!writeAll(to, buf, n))
+					break;
+			}
+			shutdown(to, SHUT_WR);
+		};
+		std::thread([=] {
+			std::thread upstream(forward, server, client, 'S');
+			forward(client, server, 'C');
+			upstream.join();
+			close(client);
+			close(server);
+		}).detach();
+		std::clog << "Recording connection " << connection << "\n";
+	}
+}
+
+struct Chunk
+{
+	char direction;
+	std::string data;
+};
+
+int replay()
+{
+	std::ifstream input(options.file, std::ios::binary);
+	if (!input)
+		throw std::runtime_error("couldn't open " + options.file);
+	std::map<int, std::vector<Chunk>> connections;
+	int connection;
+	Chunk chunk;
+	size_t size;
+	while (input >> connection >> chunk.direction >> size)
+	{
+		input.get();
+		chunk.data.resize(size);
+		input.read(&chunk.data[0], size);
+		input.get();
+		connections[connection].push_back(chunk);
+	}
+	std::clog << "Loaded " << connections.size() << " recorded connections\n";
+
+	int listen_fd = listenOn(options.port);
+	std::vector<std::thread> threads;
+	std::atomic<bool> failed(false);
+	for (auto &c : connections)
+	{
+		int fd = acceptClient(listen_fd);
+		threads.emplace_back([fd, &c, &failed] {
+			size_t mismatches = 0;
+			size_t replayed = 0;
+			for (const auto &ch : c.second)
+			{
+				if (ch.direction == 'S')
+				{
+					sleepFor(options.latency);
+					if (!writeAll(fd, ch.data.data(), ch.data.size()))
+						break;
+				}
+				else
+				{
+					std::string received(ch.data.size(), '\0');
+					if (!readAll(fd, &received[0], received.size()))
+						break;
+					if (received != ch.data && mismatches++ == 0)
+						std::cerr << "Connection " << c.first
+						          << ": client sent different data than recorded\n";
+				}
+				++replayed;
+			}
+			close(fd);
+			if (mismatches > 0 || replayed < c.second.size())
+				failed = true;
+			std::clog << "Connection " << c.first << " replayed, "
+			          << mismatches << " mismatched chunks, "
+			          << c.second.size() - replayed << " not replayed\n";
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	return failed ? 1 : 0;
+}
+
+void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " serve|record|replay [options]\n"
+	          << "See the top of fake_mpd.cpp for the list of options.\n";
+	exit(1);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage(argv[0]);
+	std::string mode = argv[1];
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string option = argv[i];
+		auto value = [&]() -> std::string {
+			if (++i == argc)
+				usage(argv[0]);
+			return argv[i];
+		};
+		if (option == "--port")
+			options.port = std::stoi(value());
+		else if (option == "--songs")
+			options.songs = std::stoul(value());
+		else if (option == "--artists")
+			options.artists = std::stoul(value());
+		else if (option == "--albums-per-artist")
+			options.albums_per_artist = std::stoul(value());
+		else if (option == "--genres")
+			options.genres = std::stoul(value());
+		else if (option == "--extra-tags")
+			options.extra_tags = true;
+		else if (option == "--latency")
+			options.latency = std::stoi(value());
+		else if (option == "--update-events")
+			options.update_events = std::stoi(value());
+		else if (option == "--import-songs")
+			options.import_songs = std::stoul(value());
+		else if (option == "--modify-songs")
+			options.modify_songs = std::stoul(value());
+		else if (option == "--upstream")
+			options.upstream = value();
+		else if (option == "--output" || option == "--input")
+			options.file = value();
+		else
+			usage(argv[0]);
+	}
+
+	try
+	{
+		if (mode == "serve")
+			return serve();
+		else if (mode == "record" && !options.upstream.empty() && !options.file.empty())
+			return record();
+		else if (mode == "replay" && !options.file.empty())
+			return replay();
+		usage(argv[0]);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Measures how filtering of NC::Menu with a regular expression (the way
+// screens do it) scales with the number of threads used by Parallel::filter.
+// Unlike other benchmarks it doesn't use benchmark.h, as counting allocations
+// of all threads in one place would serialize them and skew the scaling.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "curses/menu_impl.h"
+#include "regex_filter.h"
+#include "utility/parallel.h"
+
+namespace {
+
+const char *words[] = {
+	"love", "night", "dance", "fire", "heart", "rain", "blue", "moon",
+	"street", "summer", "dream", "light", "river", "gold", "shadow", "road",
+};
+
+std::string makeItem(size_t i)
+{
+	// A cheap LCG keeps the list the same between runs.
+	size_t x = i*2654435761u + 12345;
+	std::string result = "Artist " + std::to_string(x % 997) + " - ";
+	for (int j = 0; j < 3; ++j)
+	{
+		x = x*6364136223846793005u + 1442695040888963407u;
+		result += words[(x >> 33) % 16];
+		result += ' ';
+	}
+	result += "(" + std::to_string(1970 + x % 50) + ")";
+	return result;
+}
+
+bool itemMatches(const Regex::Regex &rx, const std::string &item)
+{
+	return Regex::search(item, rx, false);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	size_t rows = argc > 1 ? atoll(argv[1]) : 1000000;
+	unsigned max_threads = argc > 2
+		? atoi(argv[2])
+		: std::max(1u, std::thread::hardware_concurrency());
+	int runs = argc > 3 ? atoi(argv[3]) : 5;
+	std::string constraint = argc > 4 ? argv[4] : "ni.*(dream|gold)";
+
+	NC::Menu<std::string> menu;
+	for (size_t i = 0; i < rows; ++i)
+		menu.addItem(makeItem(i));
+	Regex::Filter<std::string> filter(
+		constraint, boost::regex::perl | boost::regex::icase, itemMatches);
+
+	std::cout << rows << " rows, constraint \"" << constraint << "\"\n";
+	Parallel::Threshold = 1;
+	double single_thread = 0;
+	for (unsigned threads = 1; threads <= max_threads; ++threads)
+	{
+		Parallel::Threads = threads;
+		double best = 0;
+		size_t found = 0;
+		for (int i = 0; i < runs; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			menu.applyFilter(filter);
+			auto end = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(end - start).count();
+			if (i == 0 || seconds < best)
+				best = seconds;
+			found = menu.size();
+			menu.clearFilter();
+		}
+		if (threads == 1)
+			single_thread = best;
+		std::cout << threads << " thread(s): "
+		          << best * 1000 << " ms, "
+		          << found << " found, "
+		          << "speedup " << single_thread / best << "\n";
+	}
+	return 0;
+}
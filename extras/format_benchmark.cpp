@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Compares printing songs with the default formats by running their compiled
+// programs (what Format::print does) and by walking the expression tree with
+// a visitor (what it used to do), and checks that both produce the same
+// output. Songs are generated, some of them have missing tags so that all
+// branches of groups and alternatives are taken.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "format_impl.h"
+#include "mutable_song.h"
+#include "song_store.h"
+#include "utility/type_conversions.h"
+#include "utility/wide_string.h"
+
+// Tag setters are referenced by type conversions, but editing tags pulls in
+// the whole interface and isn't needed here.
+namespace MPD {
+void MutableSong::setArtist(const std::string &, unsigned) { }
+void MutableSong::setAlbumArtist(const std::string &, unsigned) { }
+void MutableSong::setTitle(const std::string &, unsigned) { }
+void MutableSong::setAlbum(const std::string &, unsigned) { }
+void MutableSong::setTrack(const std::string &, unsigned) { }
+void MutableSong::setDate(const std::string &, unsigned) { }
+void MutableSong::setGenre(const std::string &, unsigned) { }
+void MutableSong::setComposer(const std::string &, unsigned) { }
+void MutableSong::setPerformer(const std::string &, unsigned) { }
+void MutableSong::setDisc(const std::string &, unsigned) { }
+void MutableSong::setComment(const std::string &, unsigned) { }
+}
+
+namespace {
+
+// Format::Printer before formats were compiled.
+template <typename CharT>
+struct VisitorPrinter: boost::static_visitor<Format::Result>
+{
+	typedef std::basic_string<CharT> StringT;
+	typedef Format::Result Result;
+
+	VisitorPrinter(NC::BasicBuffer<CharT> &os, const MPD::Song *song, const unsigned flags)
+	: m_output(os), m_song(song), m_no_output(0), m_flags(flags)
+	{ }
+
+	Result operator()(const StringT &s)
+	{
+		if (!s.empty())
+		{
+			output(s);
+			return Result::Ok;
+		}
+		else
+			return Result::Empty;
+	}
+
+	Result operator()(const NC::Color &c)
+	{
+		if (m_flags & Format::Flags::Color)
+			output(c);
+		return Result::Empty;
+	}
+
+	Result operator()(NC::Format fmt)
+	{
+		if (m_flags & Format::Flags::Format)
+			output(fmt);
+		return Result::Empty;
+	}
+
+	Result operator()(Format::OutputSwitch)
+	{
+		return Result::Ok;
+	}
+
+	Result operator()(const Format::SongTag &st)
+	{
+		StringT tags;
+		if (m_flags & Format::Flags::Tag && m_song != nullptr)
+		{
+			tags = convertString<CharT, char>::apply(
+				m_song->getTags(st.function())
+			);
+		}
+		if (!tags.empty())
+		{
+			if (st.delimiter() > 0)
+			{
+				if (st.function() == &MPD::Song::getDate
+				    || st.function() == &MPD::Song::getLength)
+					tags.resize(st.delimiter());
+				else
+					tags = wideShorten(tags, st.delimiter());
+			}
+			output(tags);
+			return Result::Ok;
+		}
+		else
+			return Result::Missing;
+	}
+
+	Result operator()(const Format::Group<CharT> &group)
+	{
+		auto visit = [this, &group] {
+			Result result = Result::Empty;
+			for (const auto &ex : group.base())
+			{
+				result += boost::apply_visitor(*this, ex);
+				if (result == Result::Missing)
+				{
+					result = Result::Empty;
+					break;
+				}
+			}
+			return result;
+		};
+
+		++m_no_output;
+		Result result = visit();
+		--m_no_output;
+		if (!m_no_output && result == Result::Ok)
+			visit();
+		return result;
+	}
+
+	Result operator()(const Format::FirstOf<CharT> &first_of)
+	{
+		for (const auto &ex : first_of.base())
+		{
+			if (boost::apply_visitor(*this, ex) == Result::Ok)
+				return Result::Ok;
+		}
+		return Result::Empty;
+	}
+
+private:
+	template <typename ValueT>
+	void output(const ValueT &value)
+	{
+		if (!m_no_output)
+			m_output << value;
+	}
+
+	NC::BasicBuffer<CharT> &m_output;
+	const MPD::Song *m_song;
+	unsigned m_no_output;
+	const unsigned m_flags;
+};
+
+template <typename CharT>
+void visitorPrint(const Format::AST<CharT> &ast, NC::BasicBuffer<CharT> &buffer,
+                  const MPD::Song *song)
+{
+	VisitorPrinter<CharT> printer(buffer, song, Format::Flags::All);
+	for (const auto &ex : ast.base())
+		boost::apply_visitor(printer, ex);
+}
+
+const char *words[] = {
+	"love", "night", "dance", "fire", "heart", "rain", "blue", "moon",
+	"street", "summer", "dream", "light", "river", "gold", "shadow", "road",
+};
+
+std::vector<MPD::Song> makeSongs(size_t count)
+{
+	auto store = std::make_shared<MPD::SongStore>();
+	std::vector<MPD::Song> songs;
+	songs.reserve(count);
+	// A cheap LCG keeps the songs the same between runs.
+	size_t x = 12345;
+	auto next = [&x] {
+		x = x*6364136223846793005u + 1442695040888963407u;
+		return x >> 33;
+	};
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::string uri = "music/" + std::to_string(i) + ".flac";
+		std::string artist = "Artist " + std::to_string(next() % 997);
+		std::string album = "Album " + std::to_string(next() % 4999);
+		std::string date = std::to_string(1970 + next() % 50) + "-01-01";
+		std::string track = std::to_string(1 + next() % 15);
+		std::string title;
+		for (int j = 0; j < 3; ++j)
+		{
+			title += words[next() % 16];
+			title += ' ';
+		}
+		std::string time = std::to_string(60 + next() % 600);
+
+		mpd_pair pair = { "file", uri.c_str() };
+		store->begin(&pair);
+		auto feed = [&store](const char *name, const std::string &value) {
+			mpd_pair tag = { name, value.c_str() };
+			store->feed(&tag);
+		};
+		// Every 8th song is only a file name, every 4th doesn't have an album.
+		if (i % 8 != 0)
+		{
+			feed("Artist", artist);
+			feed("Title", title);
+			if (i % 4 != 0)
+			{
+				feed("Album", album);
+				feed("Date", date);
+				feed("Track", track);
+			}
+		}
+		feed("Time", time);
+		songs.emplace_back(store, store->commit());
+	}
+	return songs;
+}
+
+// The default columns, built the way columns_to_format does it.
+Format::AST<char> defaultColumnsFormat()
+{
+	std::vector<Format::Expression<char>> result;
+	std::vector<std::string> columns = { "a", "N", "tf", "b", "l" };
+	for (size_t i = 0; i < columns.size(); ++i)
+	{
+		Format::FirstOf<char> first_of;
+		for (char type : columns[i])
+			first_of.base().push_back(Format::SongTag(charToGetFunction(type)));
+		result.push_back(std::move(first_of));
+		if (i + 1 != columns.size())
+			result.push_back(std::string(" "));
+	}
+	return Format::AST<char>(std::move(result));
+}
+
+template <typename CharT>
+bool compare(const std::string &name, const Format::AST<CharT> &ast,
+             const std::vector<MPD::Song> &songs, int runs)
+{
+	for (const auto &s : songs)
+	{
+		NC::BasicBuffer<CharT> visited, run;
+		visitorPrint(ast, visited, &s);
+		Format::print(ast, run, &s, &run, Format::Flags::All);
+		if (!(visited == run))
+		{
+			std::cout << name << ": output differs for " << s.getURI() << "\n";
+			return false;
+		}
+	}
+
+	auto visitor = measureBest(runs, [&] {
+		size_t checksum = 0;
+		for (const auto &s : songs)
+		{
+			NC::BasicBuffer<CharT> buffer;
+			visitorPrint(ast, buffer, &s);
+			checksum += buffer.str().size();
+		}
+		return checksum;
+	});
+	auto compiled = measureBest(runs, [&] {
+		size_t checksum = 0;
+		for (const auto &s : songs)
+		{
+			NC::BasicBuffer<CharT> buffer;
+			Format::print(ast, buffer, &s, &buffer, Format::Flags::All);
+			checksum += buffer.str().size();
+		}
+		return checksum;
+	});
+	print((name + "visitor ").c_str(), visitor, songs.size());
+	print((name + "compiled").c_str(), compiled, songs.size());
+	std::cout << name << "speedup " << visitor.seconds / compiled.seconds << "\n";
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? atoll(argv[1]) : 100000;
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+	auto songs = makeSongs(count);
+	std::cout << count << " songs\n";
+
+	const unsigned no_switch = Format::Flags::All ^ Format::Flags::OutputSwitch;
+	bool ok = true;
+	ok &= compare("song_list_format      ",
+		Format::parse("{%a - }{%t}|{$8%f$9}$R{$3%l$9}"), songs, runs);
+	ok &= compare("song_status_format    ",
+		Format::parse("{{%a{ \"%b\"{ (%y)}} - }{%t}}|{%f}", no_switch), songs, runs);
+	ok &= compare("song_status_wformat   ",
+		Format::parse(L"{{%a{ \"%b\"{ (%y)}} - }{%t}}|{%f}", no_switch), songs, runs);
+	ok &= compare("song_library_format   ",
+		Format::parse("{%n - }{%t}|{%f}"), songs, runs);
+	ok &= compare("song_columns_format   ",
+		defaultColumnsFormat(), songs, runs);
+	ok &= compare("header_first_line     ",
+		Format::parse(L"$b$1$aqqu$/a$9 {%t}|{%f} $1$atqq$/a$9$/b", no_switch), songs, runs);
+	ok &= compare("header_second_line    ",
+		Format::parse(L"{{$4$b%a$/b$9}{ - $7%b$9}{ ($4%y$9)}}|{%D}", no_switch), songs, runs);
+	return ok ? 0 : 1;
+}
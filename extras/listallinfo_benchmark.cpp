@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Compares decoding of listallinfo using mpd_entity/mpd_song (the way
+// MPD::SongIterator used to work) with decoding into MPD::SongStore and prints
+// memory used by its columns. The whole database is listed several times, so
+// it's best run against fake_mpd for repeatable results, e.g.
+//
+//   fake_mpd serve --port 6601 --songs 100000 --extra-tags &
+//   listallinfo_benchmark localhost 6601
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "mpdpp.h"
+
+namespace {
+
+// Lists the database into a fresh vector, the number of songs is the checksum.
+template <typename FunctionT>
+Result measureListing(FunctionT f)
+{
+	std::vector<MPD::Song> songs;
+	return measure([&f, &songs] {
+		f(songs);
+		return songs.size();
+	});
+}
+
+void listEntities(mpd_connection *conn, std::vector<MPD::Song> &songs)
+{
+	mpd_send_list_all_meta(conn, "");
+	while (mpd_entity *entity = mpd_recv_entity(conn))
+	{
+		if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG)
+			songs.push_back(MPD::Song(mpd_song_dup(mpd_entity_get_song(entity))));
+		mpd_entity_free(entity);
+	}
+	mpd_response_finish(conn);
+	MPD::checkConnectionErrors(conn);
+}
+
+void listStore(MPD::Connection &connection, std::vector<MPD::Song> &songs)
+{
+	for (MPD::SongIterator s = connection.GetDirectoryRecursive("/"), end; s != end; ++s)
+		songs.push_back(std::move(*s));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	int port = argc > 2 ? atoi(argv[2]) : 6600;
+	int runs = argc > 3 ? atoi(argv[3]) : 3;
+
+	try
+	{
+		MPD::Connection connection;
+		connection.SetHostname(host);
+		connection.SetPort(port);
+		connection.Connect();
+
+		mpd_connection *conn = mpd_connection_new(host, port, 0);
+		MPD::checkConnectionErrors(conn);
+
+		for (int i = 0; i < runs; ++i)
+		{
+			auto entities = measureListing([conn](std::vector<MPD::Song> &songs) {
+				listEntities(conn, songs);
+			});
+			print("mpd_entity", entities, entities.checksum);
+			auto store = measureListing([&connection](std::vector<MPD::Song> &songs) {
+				listStore(connection, songs);
+			});
+			print("SongStore ", store, store.checksum);
+		}
+
+		std::vector<MPD::Song> songs;
+		listStore(connection, songs);
+		if (!songs.empty() && songs.front().store())
+		{
+			size_t total = 0;
+			for (const auto &column : songs.front().store()->memoryUsage())
+			{
+				std::cout << column.name << ": " << column.bytes / 1024 << " KiB, "
+				          << column.values << " values";
+				if (column.distinct)
+					std::cout << " (" << column.distinct << " distinct)";
+				std::cout << "\n";
+				total += column.bytes;
+			}
+			std::cout << "total: " << total / 1024 << " KiB\n";
+		}
+		mpd_connection_free(conn);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Compares memory usage and scan times of NC::Menu with the layout it used to
+// have, i.e. a separately allocated std::tuple of value and properties for
+// each row, shared with the filtered view through std::shared_ptr. Values are
+// songs decoded into a song store beforehand, so that only the cost of the menu
+// itself is measured, but with values of the size of what it really holds.
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "benchmark.h"
+#include "curses/menu_impl.h"
+#include "song.h"
+#include "song_store.h"
+
+namespace {
+
+typedef MPD::Song Value;
+
+std::vector<MPD::Song> makeSongs(size_t count)
+{
+	auto store = std::make_shared<MPD::SongStore>();
+	std::vector<MPD::Song> songs;
+	songs.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::string uri = "music/" + std::to_string(i) + ".flac";
+		std::string title = "Title " + std::to_string(i);
+		mpd_pair pair = { "file", uri.c_str() };
+		store->begin(&pair);
+		pair = { "Title", title.c_str() };
+		store->feed(&pair);
+		songs.emplace_back(store, store->commit());
+	}
+	return songs;
+}
+
+// Storage of NC::Menu before values and properties were split.
+struct OldMenu
+{
+	struct OldProperties
+	{
+		unsigned properties = NC::List::Properties::Selectable;
+	};
+	typedef std::shared_ptr<std::tuple<Value, OldProperties>> Item;
+
+	std::vector<Item> all_items;
+	std::vector<Item> filtered_items;
+};
+
+}
+
+int main(int argc, char **argv)
+{
+	size_t rows = argc > 1 ? atoll(argv[1]) : 1000000;
+	int runs = argc > 2 ? atoi(argv[2]) : 3;
+
+	auto songs = makeSongs(rows);
+	MPD::Song::Hash hash;
+	std::cout << rows << " rows, " << sizeof(Value) << " bytes per value\n";
+	for (int i = 0; i < runs; ++i)
+	{
+		OldMenu old_menu;
+		NC::Menu<Value> menu;
+
+		print("fill, old            ", measure([&] {
+			for (size_t j = 0; j < rows; ++j)
+				old_menu.all_items.push_back(
+					std::make_shared<std::tuple<Value, OldMenu::OldProperties>>(
+						songs[j], OldMenu::OldProperties()));
+			return old_menu.all_items.size();
+		}));
+		print("fill, new            ", measure([&] {
+			for (size_t j = 0; j < rows; ++j)
+				menu.addItem(songs[j]);
+			return menu.size();
+		}));
+
+		// Resize the list and assign values in place, which is how the playlist
+		// is filled.
+		OldMenu old_resized;
+		NC::Menu<Value> resized;
+		print("resize, old          ", measure([&] {
+			for (size_t j = 0; j < rows; ++j)
+				old_resized.all_items.push_back(
+					std::make_shared<std::tuple<Value, OldMenu::OldProperties>>());
+			for (size_t j = 0; j < rows; ++j)
+				std::get<0>(*old_resized.all_items[j]) = songs[j];
+			return old_resized.all_items.size();
+		}));
+		print("resize, new          ", measure([&] {
+			resized.resizeList(rows);
+			for (size_t j = 0; j < rows; ++j)
+				resized[j].value() = songs[j];
+			return resized.size();
+		}));
+
+		// Select every 16th row, then look for selected rows the way
+		// e.g. selectCurrentIfNoneSelected does.
+		for (size_t j = 0; j < rows; j += 16)
+		{
+			std::get<1>(*old_menu.all_items[j]).properties
+				|= NC::List::Properties::Selected;
+			menu[j].setSelected(true);
+		}
+		print("count selected, old  ", measure([&] {
+			size_t selected = 0;
+			for (const auto &item : old_menu.all_items)
+				selected += (std::get<1>(*item).properties & NC::List::Properties::Selected) != 0;
+			return selected;
+		}));
+		print("count selected, new  ", measure([&] {
+			size_t selected = 0;
+			for (auto &&item : menu)
+				selected += item.isSelected();
+			return selected;
+		}));
+
+		print("sum values, old      ", measure([&] {
+			size_t sum = 0;
+			for (const auto &item : old_menu.all_items)
+				sum += hash(std::get<0>(*item));
+			return sum;
+		}));
+		print("sum values, new      ", measure([&] {
+			size_t sum = 0;
+			for (auto it = menu.beginV(); it != menu.endV(); ++it)
+				sum += hash(*it);
+			return sum;
+		}));
+
+		print("filter, old          ", measure([&] {
+			for (const auto &item : old_menu.all_items)
+				if (hash(std::get<0>(*item)) % 3 == 0)
+					old_menu.filtered_items.push_back(item);
+			return old_menu.filtered_items.size();
+		}));
+		print("filter, new          ", measure([&] {
+			menu.applyFilter([&hash](const NC::Menu<Value>::ItemRef &item) {
+				return hash(item.value()) % 3 == 0;
+			});
+			return menu.size();
+		}));
+	}
+	return 0;
+}
@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Runs the session recorded in replay_check.session through MPD::Connection
+// and checks that responses are parsed as expected. Meant to be run against
+// fake_mpd replaying it, which reports commands that differ from the recorded
+// ones, e.g.
+//
+//   fake_mpd replay --input replay_check.session --port 6602 &
+//   replay_check localhost 6602
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mpdpp.h"
+
+namespace {
+
+bool check(bool condition, const char *what)
+{
+	if (!condition)
+		std::cerr << "FAILED: " << what << "\n";
+	return condition;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " HOST PORT\n";
+		return 1;
+	}
+
+	MPD::Connection connection;
+	connection.SetHostname(argv[1]);
+	connection.SetPort(atoi(argv[2]));
+	connection.SetTimeout(5);
+
+	bool ok = true;
+	try
+	{
+		connection.Connect();
+		ok &= check(connection.Version() == 23, "server version");
+
+		auto status = connection.getStatus();
+		ok &= check(status.volume() == 50, "volume");
+		ok &= check(status.random() && !status.repeat(), "playback options");
+		ok &= check(status.playlistVersion() == 7, "playlist version");
+		ok &= check(status.playlistLength() == 2, "playlist length");
+		ok &= check(status.playerState() == MPD::psPlay, "player state");
+		ok &= check(status.currentSongPosition() == 1, "current song position");
+		ok &= check(status.currentSongID() == 2, "current song id");
+		ok &= check(status.elapsedTime() == 12, "elapsed time");
+		ok &= check(status.totalTime() == 180, "total time");
+
+		std::vector<MPD::Song> songs;
+		for (MPD::SongIterator s = connection.GetPlaylistChanges(0), end; s != end; ++s)
+			songs.push_back(std::move(*s));
+		ok &= check(songs.size() == 2, "number of changed songs");
+		if (songs.size() == 2)
+		{
+			ok &= check(songs[0].getURI() == "a/one.flac", "uri");
+			ok &= check(songs[0].getName() == "one.flac", "name");
+			ok &= check(songs[0].getDirectory() == "a", "directory");
+			ok &= check(songs[0].getTitle() == "One", "title");
+			ok &= check(songs[0].getDuration() == 200, "duration");
+			ok &= check(songs[0].getPosition() == 0 && songs[0].getID() == 1,
+			            "position and id");
+			ok &= check(songs[1].getArtist(0) == "Artist B"
+			            && songs[1].getArtist(1) == "Artist C"
+			            && songs[1].getArtist(2).empty(),
+			            "multiple values of a tag");
+			ok &= check(songs[1].getPosition() == 1 && songs[1].getID() == 2,
+			            "position and id");
+		}
+
+		auto current = connection.GetCurrentSong();
+		ok &= check(!current.empty() && current.getID() == 2, "current song");
+
+		connection.SetVolume(70);
+		connection.Play();
+
+		bool rejected = false;
+		try
+		{
+			connection.SetVolume(101);
+		}
+		catch (MPD::ServerError &e)
+		{
+			rejected = e.code() == MPD_SERVER_ERROR_ARG;
+		}
+		ok &= check(rejected, "server error");
+	}
+	catch (MPD::Error &e)
+	{
+		std::cerr << "FAILED: " << e.what() << "\n";
+		ok = false;
+	}
+
+	if (ok)
+		std::cout << "OK\n";
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Compares allocations made by reading tags of songs with the std::string
+// getters (the way the format renderer, search engine and album separators
+// used to do it) and with the string_view accessors and tag iterators. The
+// whole database is listed once, it's best run against fake_mpd, e.g.
+//
+//   fake_mpd serve --port 6601 --songs 100000 --extra-tags &
+//   song_tags_benchmark localhost 6601
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "mpdpp.h"
+
+namespace {
+
+const MPD::Song::GetFunction Getters[] = {
+	&MPD::Song::getArtist,
+	&MPD::Song::getAlbumArtist,
+	&MPD::Song::getTitle,
+	&MPD::Song::getAlbum,
+	&MPD::Song::getComposer,
+	&MPD::Song::getPerformer,
+	&MPD::Song::getGenre,
+	&MPD::Song::getDate,
+	&MPD::Song::getComment,
+};
+
+// MPD::Song::getTags as it used to be, a string for each value.
+std::string joinWithGetters(const MPD::Song &s, MPD::Song::GetFunction f)
+{
+	std::string result;
+	unsigned idx = 0;
+	for (std::string tag; !(tag = (s.*f)(idx)).empty(); ++idx)
+	{
+		if (!result.empty())
+			result += MPD::Song::TagsSeparator;
+		result += tag;
+	}
+	return result;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	int port = argc > 2 ? atoi(argv[2]) : 6600;
+	int runs = argc > 3 ? atoi(argv[3]) : 3;
+
+	try
+	{
+		MPD::Connection connection;
+		connection.SetHostname(host);
+		connection.SetPort(port);
+		connection.Connect();
+
+		std::vector<MPD::Song> songs;
+		for (MPD::SongIterator s = connection.GetDirectoryRecursive("/"), end; s != end; ++s)
+			songs.push_back(std::move(*s));
+		std::cout << songs.size() << " songs\n";
+
+		for (int i = 0; i < runs; ++i)
+		{
+			print("format, getters      ", measure([&songs] {
+				size_t checksum = 0;
+				for (const auto &s : songs)
+					for (auto get : Getters)
+						checksum += joinWithGetters(s, get).size();
+				return checksum;
+			}), songs.size());
+			print("format, tag iterator ", measure([&songs] {
+				size_t checksum = 0;
+				for (const auto &s : songs)
+					for (auto get : Getters)
+						checksum += s.getTags(get).size();
+				return checksum;
+			}), songs.size());
+			print("search, getters      ", measure([&songs] {
+				size_t checksum = 0;
+				for (const auto &s : songs)
+					for (auto get : Getters)
+						checksum += (s.*get)(0).size();
+				return checksum;
+			}), songs.size());
+			print("search, views        ", measure([&songs] {
+				size_t checksum = 0;
+				for (const auto &s : songs)
+					for (auto get : Getters)
+						checksum += s.tag(MPD::Song::tagType(get)).size();
+				return checksum;
+			}), songs.size());
+			print("separators, getters  ", measure([&songs] {
+				size_t checksum = 0;
+				for (size_t j = 1; j < songs.size(); ++j)
+					checksum += songs[j-1].getAlbum() != songs[j].getAlbum()
+					         || songs[j-1].getAlbumArtist() != songs[j].getAlbumArtist();
+				return checksum;
+			}), songs.size());
+			print("separators, views    ", measure([&songs] {
+				size_t checksum = 0;
+				for (size_t j = 1; j < songs.size(); ++j)
+					checksum += songs[j-1].tag(MPD_TAG_ALBUM) != songs[j].tag(MPD_TAG_ALBUM)
+					         || songs[j-1].tag(MPD_TAG_ALBUM_ARTIST) != songs[j].tag(MPD_TAG_ALBUM_ARTIST);
+				return checksum;
+			}), songs.size());
+		}
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
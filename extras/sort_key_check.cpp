@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+// Compares sorting with collation keys (sortByKey with
+// LocaleStringComparison::appendSortKey) with the pairwise comparison it
+// replaced (LocaleStringComparison::compare) on a mix of names, numbers and
+// strings starting with numbers. The pairwise comparison orders two numbers
+// by value and everything else by collation, which isn't transitive when both
+// kinds are mixed (9 < 10 < 10a < 9), so keys can only agree with it on pairs
+// of numbers and pairs of strings not starting with one. Strings starting
+// with a number are checked to be ordered by it before the rest (but after
+// empty strings) instead.
+// Collation of the locale set in the environment is used, e.g.
+//
+//   LC_ALL=en_US.UTF-8 sort_key_check
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <locale>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "settings.h"
+#include "utility/comparators.h"
+#include "utility/parallel.h"
+
+// Referenced by sorting of browser items, which isn't checked here.
+Configuration Config;
+
+namespace {
+
+typedef std::pair<std::string, size_t> Value;
+
+bool check(bool condition, const char *what)
+{
+	if (!condition)
+		std::cerr << "FAILED: " << what << "\n";
+	return condition;
+}
+
+int sign(long long n)
+{
+	return (n > 0) - (n < 0);
+}
+
+bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+bool isNumber(const std::string &s)
+{
+	return !s.empty() && std::all_of(s.begin(), s.end(), isDigit);
+}
+
+std::string withoutThe(const std::string &s)
+{
+	if (s.size() >= 4 && (s.compare(0, 4, "The ") == 0 || s.compare(0, 4, "the ") == 0))
+		return s.substr(4);
+	return s;
+}
+
+// Value of the number the string starts with, -1 if it doesn't.
+long long leadingNumber(const std::string &s)
+{
+	if (s.empty() || !isDigit(s[0]))
+		return -1;
+	return atoll(s.c_str());
+}
+
+std::vector<std::string> makeInput()
+{
+	std::vector<std::string> result = {
+		"", "a", "A", "abc", "Abc", "b", "Band", "band", "The Band", "the band",
+		"The", "Them", "zebra", "Zebra", "éclair", "eclair", "Ærø", "  space",
+		"-5", "+5", "0", "00", "010", "10", "9", "2001", "2001-05-03",
+		"2001 Odyssey", "2001: A Space Odyssey", "10 Songs", "9 Songs",
+		"09 Songs", "1abc", "1", "The 5th", "Track 2", "Track 10",
+		std::string("a\0b", 3), std::string("a\0c", 3),
+	};
+	// A cheap LCG keeps the input the same between runs.
+	const char *words[] = { "love", "Night", "the dance", "10", "7", "01", "ü", " " };
+	size_t x = 12345;
+	for (int i = 0; i < 300; ++i)
+	{
+		std::string s;
+		int parts = 1 + i % 3;
+		for (int j = 0; j < parts; ++j)
+		{
+			x = x*6364136223846793005u + 1442695040888963407u;
+			s += words[(x >> 33) % 8];
+		}
+		result.push_back(s);
+	}
+	// duplicates check stability
+	size_t size = result.size();
+	for (size_t i = 0; i < size; i += 7)
+		result.push_back(result[i]);
+	return result;
+}
+
+}
+
+int main()
+{
+	try
+	{
+		std::locale::global(std::locale(""));
+	}
+	catch (std::runtime_error &)
+	{
+		std::cerr << "Unknown locale set in the environment, using the default one\n";
+	}
+	std::cout << "locale: " << std::locale().name() << "\n";
+
+	bool ok = true;
+	for (bool ignore_the : { false, true })
+	{
+		LocaleStringComparison cmp(std::locale(), ignore_the);
+		auto key = [&cmp](const std::string &s) {
+			std::string result;
+			cmp.appendSortKey(result, s);
+			return result;
+		};
+
+		std::vector<Value> values;
+		for (const auto &s : makeInput())
+			values.emplace_back(s, values.size());
+
+		// Sort in parallel to go through merging of sorted ranges too.
+		Parallel::Threshold = 1;
+		Parallel::Threads = 4;
+		sortByKey(values.begin(), values.end(), [&cmp](std::string &k, const Value &v) {
+			cmp.appendSortKey(k, v.first);
+		});
+
+		bool sorted = true, stable = true, agrees = true, numbers_first = true;
+		size_t differing = 0, mixed = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			for (size_t j = i+1; j < values.size(); ++j)
+			{
+				const auto &a = values[i], &b = values[j];
+				int by_key = sign(key(a.first).compare(key(b.first)));
+				int by_compare = sign(cmp.compare(a.first.data(), a.first.size(),
+				                                  b.first.data(), b.first.size()));
+				sorted &= by_key <= 0;
+				stable &= by_key != 0 || a.second < b.second;
+
+				std::string a_name = ignore_the ? withoutThe(a.first) : a.first;
+				std::string b_name = ignore_the ? withoutThe(b.first) : b.first;
+				long long a_number = leadingNumber(a_name), b_number = leadingNumber(b_name);
+				if ((isNumber(a.first) && isNumber(b.first))
+				    || (a_number < 0 && b_number < 0))
+					agrees &= by_key == by_compare;
+				else
+				{
+					++mixed;
+					differing += by_key != by_compare;
+					// Empty strings go first, then the ones starting with a number.
+					if (a_number < 0 || b_number < 0)
+						numbers_first &= a_name.empty() || a_number >= 0;
+					else
+						numbers_first &= a_number <= b_number;
+				}
+			}
+		}
+		ok &= check(sorted, "order of keys");
+		ok &= check(stable, "stability");
+		ok &= check(agrees, "agreement with compare() on numbers and other strings");
+		ok &= check(numbers_first, "strings starting with a number first, ordered by it");
+		std::cout << (ignore_the ? "ignoring \"the\": " : "") << values.size() << " strings, "
+		          << differing << " of " << mixed
+		          << " pairs involving a string starting with a number ordered"
+		          << " differently than by compare()\n";
+	}
+
+	if (ok)
+		std::cout << "OK\n";
+	return ok ? 0 : 1;
+}
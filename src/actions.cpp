@@ -34,6 +34,7 @@
 #include "display.h"
 #include "global.h"
 #include "mpdpp.h"
+#include "mpd_worker.h"
 #include "helpers.h"
 #include "statusbar.h"
 #include "utility/comparators.h"
@@ -215,6 +216,7 @@ void resizeScreen(bool reload_main_window)
 		++MainHeight;
 
 	setResizeFlags();
+	Display::clearRenderCache();
 
 	applyToVisibleWindows(&BaseScreen::resize);
 
@@ -2248,12 +2250,34 @@ void AddRandomItems::run()
 	}
 	if (number > 0)
 	{
-		bool success;
 		if (rnd_type == 's')
-			success = Mpd.AddRandomSongs(number, Config.random_exclude_pattern, Global::RNG);
-		else
-			success = Mpd.AddRandomTag(tag_type, number, Global::RNG);
-		if (success)
+		{
+			// Listing all files in a big database takes a while, so do it using the
+			// background connection and report back when it's done.
+			MpdWorker.run([number,
+			               exclude_pattern = Config.random_exclude_pattern,
+			               use_snapshot = Config.database_snapshot,
+			               rng = std::mt19937(Global::RNG())](MPD::Connection &c) mutable {
+				bool added;
+				if (use_snapshot)
+				{
+					std::vector<std::string> files;
+					MpdWorker.listDatabase(c, [&files](MPD::Song &&s) {
+						files.push_back(s.getURI());
+						return true;
+					});
+					added = c.AddRandomSongs(std::move(files), number, exclude_pattern, rng);
+				}
+				else
+					added = c.AddRandomSongs(number, exclude_pattern, rng);
+				if (added)
+					MpdWorker.post([number] {
+						Statusbar::printf("%1% random song%2% added to playlist", number, number == 1 ? "" : "s");
+					});
+			});
+			Statusbar::print("Adding random songs...");
+		}
+		else if (Mpd.AddRandomTag(tag_type, number, Global::RNG))
 			Statusbar::printf("%1% random %2%%3% added to playlist", number, tag_type_str, number == 1 ? "" : "s");
 	}
 }
@@ -2290,7 +2314,7 @@ void ToggleBrowserSortMode::run()
 	if (Config.browser_sort_mode != SortMode::None)
 	{
 		size_t sort_offset = myBrowser->inRootDirectory() ? 0 : 1;
-		std::stable_sort(
+		sortByKey(
 			myBrowser->main().begin()+sort_offset, myBrowser->main().end(),
 			LocaleBasedItemSorting(std::locale(), Config.ignore_leading_the,
 			                       Config.browser_sort_mode));
@@ -30,6 +30,7 @@
 #include "configuration.h"
 #include "config.h"
 #include "mpdpp.h"
+#include "mpd_worker.h"
 #include "format_impl.h"
 #include "settings.h"
 #include "utility/string.h"
@@ -199,6 +200,11 @@ bool configure(int argc, char **argv)
 		// create directories
 		boost::filesystem::create_directories(Config.ncmpcpp_directory);
 		boost::filesystem::create_directory(Config.lyrics_directory);
+		if (Config.database_snapshot)
+		{
+			boost::filesystem::create_directories(Config.cache_directory);
+			MpdWorker.setSnapshotDirectory(Config.cache_directory);
+		}
 
 		// try to get MPD connection details from environment variables
 		// as they take precedence over these from the configuration.
@@ -225,6 +231,7 @@ bool configure(int argc, char **argv)
 		if (!vm["port"].defaulted())
 			Mpd.SetPort(vm["port"].as<int>());
 		Mpd.SetTimeout(Config.mpd_connection_timeout);
+		Mpd.SetTagTypes(Config.mpd_tag_types);
 
 		// print current song
 		if (vm.count("current-song"))
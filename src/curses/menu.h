@@ -21,13 +21,15 @@
 #ifndef NCMPCPP_MENU_H
 #define NCMPCPP_MENU_H
 
-#include <boost/iterator/transform_iterator.hpp>
 #include <boost/range/detail/any_iterator.hpp>
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <memory>
 #include <set>
+#include <stdexcept>
+#include <vector>
 
 #include "curses/formatted_color.h"
 #include "curses/strbuffer.h"
@@ -49,7 +51,7 @@ struct List
 		};
 
 		Properties(Type properties = Selectable)
-		: m_properties(properties)
+		: m_properties(uint8_t(properties))
 		{ }
 
 		void setSelectable(bool is_selectable)
@@ -88,8 +90,11 @@ struct List
 		bool isInactive() const { return m_properties & Inactive; }
 		bool isSeparator() const { return m_properties & Separator; }
 
+		bool operator==(const Properties &rhs) const { return m_properties == rhs.m_properties; }
+		bool operator!=(const Properties &rhs) const { return !(*this == rhs); }
+
 	private:
-		unsigned m_properties;
+		uint8_t m_properties;
 	};
 
 	template <typename ValueT>
@@ -144,32 +149,77 @@ inline List::Iterator end(List &list) { return list.endP(); }
 inline List::ConstIterator end(const List &list) { return list.endP(); }
 
 /// Generic menu capable of holding any std::vector compatible values.
+///
+/// Values and their properties are kept in two separate contiguous arrays
+/// indexed by row, so scanning the properties (e.g. looking for selected
+/// items) doesn't touch the values at all and there is no per row
+/// allocation. A filtered view is a list of rows of the underlying arrays.
 template <typename ItemT>
 struct Menu: Window, List
 {
-	struct Item
+	struct Entry;
+
+	/// Reference to the value and properties of a single row. It's cheap to
+	/// copy and stays valid as long as the row isn't moved by the menu, so it
+	/// should be passed around by value. Copies (including `auto` ones) refer
+	/// to the same row, so iterate with `auto &&` to make that clear. Only
+	/// temporaries (e.g. `*it` or `menu[i]`) can be assigned to, which modifies
+	/// the referenced row (as with std::vector<bool>).
+	struct ItemRef
 	{
 		friend struct Menu<ItemT>;
 
 		typedef ItemT Type;
 
-		Item()
-			: m_impl(std::make_shared<std::tuple<ItemT, Properties>>())
+		ItemRef(ItemT *value_, Properties *properties_)
+			: m_value(value_), m_properties(properties_)
 		{ }
 
-		template <typename ValueT, typename PropertiesT>
-		Item(ValueT &&value_, PropertiesT properties_)
-			: m_impl(
-				std::make_shared<std::tuple<ItemT, List::Properties>>(
-					std::forward<ValueT>(value_),
-					std::forward<PropertiesT>(properties_)))
-		{ }
+		ItemRef(const ItemRef &rhs) = default;
+
+		ItemRef &operator=(const ItemRef &rhs) &&
+		{
+			if (m_value != rhs.m_value)
+			{
+				*m_value = *rhs.m_value;
+				*m_properties = *rhs.m_properties;
+			}
+			return *this;
+		}
+		ItemRef &operator=(ItemRef &&rhs) &&
+		{
+			if (m_value != rhs.m_value)
+			{
+				*m_value = std::move(*rhs.m_value);
+				*m_properties = *rhs.m_properties;
+			}
+			return *this;
+		}
+		ItemRef &operator=(const Entry &rhs) &&
+		{
+			*m_value = rhs.value;
+			*m_properties = rhs.properties;
+			return *this;
+		}
+		ItemRef &operator=(Entry &&rhs) &&
+		{
+			*m_value = std::move(rhs.value);
+			*m_properties = rhs.properties;
+			return *this;
+		}
+
+		friend void swap(ItemRef lhs, ItemRef rhs)
+		{
+			using std::swap;
+			swap(*lhs.m_value, *rhs.m_value);
+			swap(*lhs.m_properties, *rhs.m_properties);
+		}
 
-		ItemT &value() { return std::get<0>(*m_impl); }
-		const ItemT &value() const { return std::get<0>(*m_impl); }
+		ItemT &value() { return *m_value; }
+		const ItemT &value() const { return *m_value; }
 
-		Properties &properties() { return std::get<1>(*m_impl); }
-		const Properties &properties() const { return std::get<1>(*m_impl); }
+		Properties &properties() { return *m_properties; }
+		const Properties &properties() const { return *m_properties; }
 
 		// Forward methods to List::Properties.
 		void setSelectable(bool is_selectable) { properties().setSelectable(is_selectable); }
@@ -182,81 +232,182 @@ struct Menu: Window, List
 		bool isInactive() const { return properties().isInactive(); }
 		bool isSeparator() const { return properties().isSeparator(); }
 
-		// Make a deep copy of Item.
-		Item copy() const {
-			return Item(value(), properties());
+	private:
+		ItemT *m_value;
+		Properties *m_properties;
+	};
+
+	/// Copy of the value and properties of a row that is independent of the
+	/// menu. Used as the value type of item iterators so that algorithms that
+	/// need temporaries (e.g. std::sort) work on them.
+	struct Entry
+	{
+		typedef ItemT Type;
+
+		Entry(const ItemRef &item)
+			: value(item.value()), properties(item.properties())
+		{ }
+		Entry(ItemRef &&item)
+			: value(std::move(item.value())), properties(item.properties())
+		{ }
+
+		operator ItemRef() { return ItemRef(&value, &properties); }
+		operator const ItemRef() const {
+			return ItemRef(const_cast<ItemT *>(&value), const_cast<Properties *>(&properties));
 		}
 
+		ItemT value;
+		Properties properties;
+	};
+
+private:
+	template <typename ReferenceT>
+	struct ArrowProxy
+	{
+		ArrowProxy(ReferenceT ref)
+			: m_ref(ref)
+		{ }
+
+		ReferenceT *operator->() { return &m_ref; }
+
 	private:
-		template <Const const_>
-		struct ExtractProperties
+		ReferenceT m_ref;
+	};
+
+	template <Const const_>
+	struct AccessItem
+	{
+		typedef Entry value_type;
+		typedef typename std::conditional<
+			const_ == Const::Yes,
+			const ItemRef,
+			ItemRef>::type reference;
+		typedef ArrowProxy<reference> pointer;
+
+		static reference get(const ItemT *value, const Properties *properties)
 		{
-			typedef ExtractProperties type;
-
-			typedef typename std::conditional<
-				const_ == Const::Yes,
-				const Properties,
-				Properties>::type Properties_;
-			typedef typename std::conditional<
-				const_ == Const::Yes,
-				const Item,
-				Item>::type Item_;
-
-			Properties_ &operator()(Item_ &i) const {
-				return i.properties();
-			}
-		};
+			return ItemRef(const_cast<ItemT *>(value), const_cast<Properties *>(properties));
+		}
+		static pointer arrow(reference item) { return pointer(item); }
+	};
 
-		template <Const const_>
-		struct ExtractValue
+	template <Const const_>
+	struct AccessValue
+	{
+		typedef ItemT value_type;
+		typedef typename std::conditional<
+			const_ == Const::Yes,
+			const ItemT,
+			ItemT>::type &reference;
+		typedef typename std::remove_reference<reference>::type *pointer;
+
+		static reference get(const ItemT *value, const Properties *)
 		{
-			typedef ExtractValue type;
-
-			typedef typename std::conditional<
-				const_ == Const::Yes,
-				const ItemT,
-				ItemT>::type Value_;
-			typedef typename std::conditional<
-				const_ == Const::Yes,
-				const Item,
-				Item>::type Item_;
-
-			Value_ &operator()(Item_ &i) const {
-				return i.value();
-			}
-		};
+			return *const_cast<ItemT *>(value);
+		}
+		static pointer arrow(reference ref) { return &ref; }
+	};
 
-		static Item mkSeparator()
+	template <Const const_>
+	struct AccessProperties
+	{
+		typedef Properties value_type;
+		typedef typename std::conditional<
+			const_ == Const::Yes,
+			const Properties,
+			Properties>::type &reference;
+		typedef typename std::remove_reference<reference>::type *pointer;
+
+		static reference get(const ItemT *, const Properties *properties)
 		{
-			Item item;
-			item.setSelectable(false);
-			item.setSeparator(true);
-			return item;
+			return *const_cast<Properties *>(properties);
 		}
-		
-		std::shared_ptr<std::tuple<ItemT, Properties>> m_impl;
+		static pointer arrow(reference ref) { return &ref; }
 	};
 
-	typedef typename std::vector<Item>::iterator Iterator;
-	typedef typename std::vector<Item>::const_iterator ConstIterator;
+	/// Random access iterator over the rows of a view. If rows is null, the
+	/// view consists of all rows in order.
+	template <Const const_, template <Const> class AccessT>
+	struct ViewIterator
+	{
+		friend struct ViewIterator<Const::Yes, AccessT>;
+
+		typedef AccessT<const_> Access;
+
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef typename Access::value_type value_type;
+		typedef typename Access::reference reference;
+		typedef typename Access::pointer pointer;
+		typedef std::ptrdiff_t difference_type;
+
+		ViewIterator()
+			: m_values(nullptr), m_properties(nullptr), m_rows(nullptr), m_pos(0)
+		{ }
+
+		ViewIterator(const ItemT *values, const Properties *properties,
+		             const size_t *rows, size_t pos)
+			: m_values(values), m_properties(properties), m_rows(rows), m_pos(pos)
+		{ }
+
+		template <Const rhs_const_,
+		          typename = typename std::enable_if<
+			          rhs_const_ != const_ && const_ == Const::Yes>::type>
+		ViewIterator(const ViewIterator<rhs_const_, AccessT> &rhs)
+			: m_values(rhs.m_values), m_properties(rhs.m_properties)
+			, m_rows(rhs.m_rows), m_pos(rhs.m_pos)
+		{ }
+
+		reference operator*() const
+		{
+			size_t row = m_rows != nullptr ? m_rows[m_pos] : m_pos;
+			return Access::get(m_values+row, m_properties+row);
+		}
+		pointer operator->() const { return Access::arrow(**this); }
+		reference operator[](difference_type n) const { return *(*this+n); }
+
+		ViewIterator &operator++() { ++m_pos; return *this; }
+		ViewIterator &operator--() { --m_pos; return *this; }
+		ViewIterator operator++(int) { auto it = *this; ++m_pos; return it; }
+		ViewIterator operator--(int) { auto it = *this; --m_pos; return it; }
+
+		ViewIterator &operator+=(difference_type n) { m_pos += n; return *this; }
+		ViewIterator &operator-=(difference_type n) { m_pos -= n; return *this; }
+
+		friend ViewIterator operator+(ViewIterator it, difference_type n) { return it += n; }
+		friend ViewIterator operator+(difference_type n, ViewIterator it) { return it += n; }
+		friend ViewIterator operator-(ViewIterator it, difference_type n) { return it -= n; }
+		friend difference_type operator-(const ViewIterator &lhs, const ViewIterator &rhs)
+		{
+			return difference_type(lhs.m_pos) - difference_type(rhs.m_pos);
+		}
+
+		friend bool operator==(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos == rhs.m_pos; }
+		friend bool operator!=(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos != rhs.m_pos; }
+		friend bool operator<(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos < rhs.m_pos; }
+		friend bool operator>(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos > rhs.m_pos; }
+		friend bool operator<=(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos <= rhs.m_pos; }
+		friend bool operator>=(const ViewIterator &lhs, const ViewIterator &rhs) { return lhs.m_pos >= rhs.m_pos; }
+
+	private:
+		const ItemT *m_values;
+		const Properties *m_properties;
+		const size_t *m_rows;
+		size_t m_pos;
+	};
+
+public:
+	typedef ViewIterator<Const::No, AccessItem> Iterator;
+	typedef ViewIterator<Const::Yes, AccessItem> ConstIterator;
 	typedef std::reverse_iterator<Iterator> ReverseIterator;
 	typedef std::reverse_iterator<ConstIterator> ConstReverseIterator;
 
-	typedef boost::transform_iterator<
-		typename Item::template ExtractValue<Const::No>,
-		Iterator> ValueIterator;
-	typedef boost::transform_iterator<
-		typename Item::template ExtractValue<Const::Yes>,
-		ConstIterator> ConstValueIterator;
+	typedef ViewIterator<Const::No, AccessValue> ValueIterator;
+	typedef ViewIterator<Const::Yes, AccessValue> ConstValueIterator;
 	typedef std::reverse_iterator<ValueIterator> ReverseValueIterator;
 	typedef std::reverse_iterator<ConstValueIterator> ConstReverseValueIterator;
 	
-	typedef boost::transform_iterator<
-		typename Item::template ExtractProperties<Const::No>,
-		Iterator> PropertiesIterator;
-	typedef boost::transform_iterator<
-		typename Item::template ExtractProperties<Const::Yes>,
-		ConstIterator> ConstPropertiesIterator;
+	typedef ViewIterator<Const::No, AccessProperties> PropertiesIterator;
+	typedef ViewIterator<Const::Yes, AccessProperties> ConstPropertiesIterator;
 
 	// For compliance with boost utilities.
 	typedef Iterator iterator;
@@ -267,7 +418,12 @@ struct Menu: Window, List
 	/// @see setItemDisplayer()
 	typedef std::function<void(Menu<ItemT> &)> ItemDisplayer;
 
-	typedef std::function<bool(const Item &)> FilterPredicate;
+	typedef std::function<bool(const ItemRef &)> FilterPredicate;
+
+	/// Function helper prototype used to identify what is displayed for the
+	/// item returned by drawn(), apart from its properties and highlight.
+	/// @see setRowKey()
+	typedef std::function<size_t(const Menu<ItemT> &)> RowKey;
 
 	Menu();
 	
@@ -282,6 +438,22 @@ struct Menu: Window, List
 	/// @param ptr function pointer that matches the ItemDisplayer prototype
 	template <typename ItemDisplayerT>
 	void setItemDisplayer(ItemDisplayerT &&displayer);
+
+	/// Sets helper function that returns keys of displayed rows. If it's set,
+	/// refresh() draws only rows whose key, properties or highlight changed
+	/// since they were drawn (and the ones that scrolled into view), so the key
+	/// needs to change whenever the item displayer would draw something else.
+	/// Rows with key 0 are drawn every time.
+	/// @param key function pointer that matches the RowKey prototype
+	template <typename RowKeyT>
+	void setRowKey(RowKeyT &&key);
+
+	/// Makes the next refresh() draw all rows, e.g. if something else drew
+	/// over the window.
+	void damage() { m_drawn_rows.clear(); }
+
+	/// @return number of rows drawn by the last refresh()
+	size_t redrawnRows() const { return m_redrawn_rows; }
 	
 	/// Resizes the list to given size (adequate to std::vector::resize())
 	/// @param size requested size
@@ -307,14 +479,19 @@ struct Menu: Window, List
 	
 	/// Checks if list is empty
 	/// @return true if list is empty, false otherwise
-	virtual bool empty() const override { return m_items->empty(); }
+	virtual bool empty() const override { return size() == 0; }
 
 	/// @return size of the list
-	virtual size_t size() const override { return m_items->size(); }
+	virtual size_t size() const override {
+		return m_show_filtered ? m_filtered_rows.size() : m_values.size();
+	}
 
 	/// @return currently highlighted position
 	virtual size_t choice() const override;
 
+	/// @return position of the first item visible in the window
+	size_t firstVisible() const { return m_beginning; }
+
 	/// Highlights given position
 	/// @param pos position to be highlighted
 	virtual void highlight(size_t position) override;
@@ -343,34 +520,55 @@ struct Menu: Window, List
 	/// Reapply previously applied filter.
 	void reapplyFilter();
 
+	/// Reapply previously applied filter only to the given range of rows of the
+	/// unfiltered list (e.g. the ones that were replaced or appended) and keep
+	/// the rest of the filtered view as it is.
+	void reapplyFilter(size_t first_row, size_t last_row);
+
 	/// Get current filter predicate.
 	template <typename TargetT>
 	const TargetT *filterPredicate() const;
 
+	/// Set filter predicate without applying it, e.g. if rows that satisfy it
+	/// are found elsewhere and then passed to setFilteredRows().
+	template <typename PredicateT>
+	void setFilterPredicate(PredicateT &&pred);
+
+	/// Show given rows of the unfiltered list as filtered items. They need
+	/// to be sorted.
+	void setFilteredRows(std::vector<size_t> rows);
+
+	/// Add rows to the filtered items. They need to be sorted and follow the
+	/// rows that are already there.
+	void appendFilteredRows(const std::vector<size_t> &rows);
+
+	/// @return rows of the unfiltered list that are filtered items
+	const std::vector<size_t> &filteredRows() const { return m_filtered_rows; }
+
 	/// Clear results of applyFilter and show all items.
 	void clearFilter();
 
 	/// @return true if menu is filtered.
-	bool isFiltered() const { return m_items == &m_filtered_items; }
+	bool isFiltered() const { return m_show_filtered; }
 
 	/// Show all items.
-	void showAllItems() { m_items = &m_all_items; }
+	void showAllItems() { m_show_filtered = false; }
 
 	/// Show filtered items.
-	void showFilteredItems() { m_items = &m_filtered_items; }
+	void showFilteredItems() { m_show_filtered = true; }
 
 	/// Sets prefix, that is put before each selected item to indicate its selection
 	/// Note that the passed variable is not deleted along with menu object.
 	/// @param b pointer to buffer that contains the prefix
-	void setSelectedPrefix(const Buffer &b) { m_selected_prefix = b; }
+	void setSelectedPrefix(const Buffer &b) { setDecoration(m_selected_prefix, b); }
 	
 	/// Sets suffix, that is put after each selected item to indicate its selection
 	/// Note that the passed variable is not deleted along with menu object.
 	/// @param b pointer to buffer that contains the suffix
-	void setSelectedSuffix(const Buffer &b) { m_selected_suffix = b; }
+	void setSelectedSuffix(const Buffer &b) { setDecoration(m_selected_suffix, b); }
 
-	void setHighlightPrefix(const Buffer &b) { m_highlight_prefix = b; }
-	void setHighlightSuffix(const Buffer &b) { m_highlight_suffix = b; }
+	void setHighlightPrefix(const Buffer &b) { setDecoration(m_highlight_prefix, b); }
+	void setHighlightSuffix(const Buffer &b) { setDecoration(m_highlight_suffix, b); }
 
 	const Buffer &highlightPrefix() const { return m_highlight_prefix; }
 	const Buffer &highlightSuffix() const { return m_highlight_suffix; }
@@ -389,6 +587,13 @@ struct Menu: Window, List
 	/// Turns on/off centered cursor
 	/// @param state state of centered cursor
 	void centeredCursor(bool state) { m_autocenter_cursor = state; }
+
+	/// Turns on/off evaluation of filter predicates in multiple threads for
+	/// big lists (see Parallel::Threshold). It's off by default and may only
+	/// be turned on if every predicate the menu is filtered with is safe to
+	/// call concurrently.
+	/// @param state state of parallel filtering
+	void parallelFilter(bool state) { m_parallel_filter = state; }
 	
 	/// @return currently drawn item. The result is defined only within
 	/// drawing function that is called by refresh()
@@ -398,23 +603,23 @@ struct Menu: Window, List
 	/// @param pos requested position
 	/// @return reference to item at given position
 	/// @throw std::out_of_range if given position is out of range
-	Menu<ItemT>::Item &at(size_t pos) { return m_items->at(pos); }
+	ItemRef at(size_t pos) { return makeIterator<Iterator>(checkedPosition(pos))[0]; }
 	
 	/// @param pos requested position
 	/// @return const reference to item at given position
 	/// @throw std::out_of_range if given position is out of range
-	const Menu<ItemT>::Item &at(size_t pos) const { return m_items->at(pos); }
+	const ItemRef at(size_t pos) const { return makeIterator<ConstIterator>(checkedPosition(pos))[0]; }
 	
 	/// @param pos requested position
 	/// @return const reference to item at given position
-	const Menu<ItemT>::Item &operator[](size_t pos) const { return (*m_items)[pos]; }
+	const ItemRef operator[](size_t pos) const { return makeIterator<ConstIterator>(pos)[0]; }
 	
 	/// @param pos requested position
-	/// @return const reference to item at given position
-	Menu<ItemT>::Item &operator[](size_t pos) { return (*m_items)[pos]; }
+	/// @return reference to item at given position
+	ItemRef operator[](size_t pos) { return makeIterator<Iterator>(pos)[0]; }
 	
-	Iterator current() { return Iterator(m_items->begin() + m_highlight); }
-	ConstIterator current() const { return ConstIterator(m_items->begin() + m_highlight); }
+	Iterator current() { return makeIterator<Iterator>(m_highlight); }
+	ConstIterator current() const { return makeIterator<ConstIterator>(m_highlight); }
 	ReverseIterator rcurrent() {
 		if (empty())
 			return rend();
@@ -428,8 +633,8 @@ struct Menu: Window, List
 			return ConstReverseIterator(++current());
 	}
 
-	ValueIterator currentV() { return ValueIterator(m_items->begin() + m_highlight); }
-	ConstValueIterator currentV() const { return ConstValueIterator(m_items->begin() + m_highlight); }
+	ValueIterator currentV() { return makeIterator<ValueIterator>(m_highlight); }
+	ConstValueIterator currentV() const { return makeIterator<ConstValueIterator>(m_highlight); }
 	ReverseValueIterator rcurrentV() {
 		if (empty())
 			return rendV();
@@ -443,20 +648,20 @@ struct Menu: Window, List
 			return ConstReverseValueIterator(++currentV());
 	}
 	
-	Iterator begin() { return Iterator(m_items->begin()); }
-	ConstIterator begin() const { return ConstIterator(m_items->begin()); }
-	Iterator end() { return Iterator(m_items->end()); }
-	ConstIterator end() const { return ConstIterator(m_items->end()); }
+	Iterator begin() { return makeIterator<Iterator>(0); }
+	ConstIterator begin() const { return makeIterator<ConstIterator>(0); }
+	Iterator end() { return makeIterator<Iterator>(size()); }
+	ConstIterator end() const { return makeIterator<ConstIterator>(size()); }
 	
 	ReverseIterator rbegin() { return ReverseIterator(end()); }
 	ConstReverseIterator rbegin() const { return ConstReverseIterator(end()); }
 	ReverseIterator rend() { return ReverseIterator(begin()); }
 	ConstReverseIterator rend() const { return ConstReverseIterator(begin()); }
 	
-	ValueIterator beginV() { return ValueIterator(begin()); }
-	ConstValueIterator beginV() const { return ConstValueIterator(begin()); }
-	ValueIterator endV() { return ValueIterator(end()); }
-	ConstValueIterator endV() const { return ConstValueIterator(end()); }
+	ValueIterator beginV() { return makeIterator<ValueIterator>(0); }
+	ConstValueIterator beginV() const { return makeIterator<ConstValueIterator>(0); }
+	ValueIterator endV() { return makeIterator<ValueIterator>(size()); }
+	ConstValueIterator endV() const { return makeIterator<ConstValueIterator>(size()); }
 	
 	ReverseValueIterator rbeginV() { return ReverseValueIterator(endV()); }
 	ConstReverseIterator rbeginV() const { return ConstReverseValueIterator(endV()); }
@@ -464,37 +669,104 @@ struct Menu: Window, List
 	ConstReverseValueIterator rendV() const { return ConstReverseValueIterator(beginV()); }
 	
 	virtual List::Iterator currentP() override {
-		return List::Iterator(PropertiesIterator(m_items->begin() + m_highlight));
+		return List::Iterator(makeIterator<PropertiesIterator>(m_highlight));
 	}
 	virtual List::ConstIterator currentP() const override {
-		return List::ConstIterator(ConstPropertiesIterator(m_items->begin() + m_highlight));
+		return List::ConstIterator(makeIterator<ConstPropertiesIterator>(m_highlight));
 	}
 	virtual List::Iterator beginP() override {
-		return List::Iterator(PropertiesIterator(m_items->begin()));
+		return List::Iterator(makeIterator<PropertiesIterator>(0));
 	}
 	virtual List::ConstIterator beginP() const override {
-		return List::ConstIterator(ConstPropertiesIterator(m_items->begin()));
+		return List::ConstIterator(makeIterator<ConstPropertiesIterator>(0));
 	}
 	virtual List::Iterator endP() override {
-		return List::Iterator(PropertiesIterator(m_items->end()));
+		return List::Iterator(makeIterator<PropertiesIterator>(size()));
 	}
 	virtual List::ConstIterator endP() const override {
-		return List::ConstIterator(ConstPropertiesIterator(m_items->end()));
+		return List::ConstIterator(makeIterator<ConstPropertiesIterator>(size()));
 	}
 
+protected:
+	virtual void recreate(size_t width, size_t height) override;
+
 private:
+	/// What was drawn in a line of the window by refresh().
+	struct DrawnRow
+	{
+		DrawnRow()
+			: valid(false), row(0), key(0), highlighted(false)
+		{ }
+
+		bool operator==(const DrawnRow &rhs) const
+		{
+			return valid && rhs.valid
+				&& row == rhs.row
+				&& key == rhs.key
+				&& properties == rhs.properties
+				&& highlighted == rhs.highlighted;
+		}
+
+		bool valid;
+		// Row of the underlying arrays, -1 if the line is empty.
+		size_t row;
+		size_t key;
+		Properties properties;
+		bool highlighted;
+	};
+
+	void setDecoration(Buffer &decoration, const Buffer &b)
+	{
+		if (!(decoration == b))
+		{
+			decoration = b;
+			damage();
+		}
+	}
+
+	/// Shift drawn rows along with the window contents so that they match the
+	/// current beginning.
+	void scrollDrawnRows();
+
 	bool isHighlightable(size_t pos)
 	{
-		return !(*m_items)[pos].isSeparator()
-			&& !(*m_items)[pos].isInactive();
+		const auto &properties = m_properties[row(pos)];
+		return !properties.isSeparator() && !properties.isInactive();
+	}
+
+	/// @return row of the underlying arrays at given position of the view
+	size_t row(size_t pos) const
+	{
+		return m_show_filtered ? m_filtered_rows[pos] : pos;
+	}
+
+	void shiftFilteredRows(size_t row);
+
+	std::vector<size_t> filterRows(size_t first_row, size_t last_row);
+
+	size_t checkedPosition(size_t pos) const
+	{
+		if (pos >= size())
+			throw std::out_of_range("NC::Menu::at: position out of range");
+		return pos;
+	}
+
+	template <typename IteratorT>
+	IteratorT makeIterator(size_t pos) const
+	{
+		return IteratorT(m_values.data(), m_properties.data(),
+		                 m_show_filtered ? m_filtered_rows.data() : nullptr,
+		                 pos);
 	}
 
 	ItemDisplayer m_item_displayer;
 	FilterPredicate m_filter_predicate;
+	RowKey m_row_key;
 
-	std::vector<Item> *m_items;
-	std::vector<Item> m_all_items;
-	std::vector<Item> m_filtered_items;
+	std::vector<ItemT> m_values;
+	std::vector<Properties> m_properties;
+	std::vector<size_t> m_filtered_rows;
+	bool m_show_filtered;
 	
 	size_t m_beginning;
 	size_t m_highlight;
@@ -503,9 +775,16 @@ private:
 	bool m_cyclic_scroll_enabled;
 	
 	bool m_autocenter_cursor;
+	bool m_parallel_filter;
 	
 	size_t m_drawn_position;
 
+	// Rows drawn in each line of the window, empty if they need to be drawn
+	// again, along with the beginning they were drawn at.
+	std::vector<DrawnRow> m_drawn_rows;
+	size_t m_drawn_beginning;
+	size_t m_redrawn_rows;
+
 	Buffer m_highlight_prefix;
 	Buffer m_highlight_suffix;
 
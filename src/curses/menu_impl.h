@@ -21,15 +21,20 @@
 #ifndef NCMPCPP_MENU_IMPL_H
 #define NCMPCPP_MENU_IMPL_H
 
+#include <algorithm>
+
 #include "menu.h"
+#include "utility/parallel.h"
 
 namespace NC {
 
 template <typename ItemT>
 Menu<ItemT>::Menu()
-{
-	m_items = &m_all_items;
-}
+	: m_show_filtered(false)
+	, m_parallel_filter(false)
+	, m_drawn_beginning(0)
+	, m_redrawn_rows(0)
+{ }
 
 template <typename ItemT>
 Menu<ItemT>::Menu(size_t startx,
@@ -42,16 +47,19 @@ Menu<ItemT>::Menu(size_t startx,
 	: Window(startx, starty, width, height, title, color, border)
 	, m_item_displayer(nullptr)
 	, m_filter_predicate(nullptr)
+	, m_show_filtered(false)
 	, m_beginning(0)
 	, m_highlight(0)
 	, m_highlight_enabled(true)
 	, m_cyclic_scroll_enabled(false)
 	, m_autocenter_cursor(false)
+	, m_parallel_filter(false)
+	, m_drawn_beginning(0)
+	, m_redrawn_rows(0)
 {
 	auto fc = FormattedColor(m_base_color, {Format::Reverse});
 	m_highlight_prefix << fc;
 	m_highlight_suffix << FormattedColor::End<>(fc);
-	m_items = &m_all_items;
 }
 
 template <typename ItemT>
@@ -59,47 +67,52 @@ Menu<ItemT>::Menu(const Menu &rhs)
 	: Window(rhs)
 	, m_item_displayer(rhs.m_item_displayer)
 	, m_filter_predicate(rhs.m_filter_predicate)
+	, m_row_key(rhs.m_row_key)
+	, m_values(rhs.m_values)
+	, m_properties(rhs.m_properties)
+	, m_filtered_rows(rhs.m_filtered_rows)
+	, m_show_filtered(rhs.m_show_filtered)
 	, m_beginning(rhs.m_beginning)
 	, m_highlight(rhs.m_highlight)
 	, m_highlight_enabled(rhs.m_highlight_enabled)
 	, m_cyclic_scroll_enabled(rhs.m_cyclic_scroll_enabled)
 	, m_autocenter_cursor(rhs.m_autocenter_cursor)
+	, m_parallel_filter(rhs.m_parallel_filter)
 	, m_drawn_position(rhs.m_drawn_position)
+	, m_drawn_rows(rhs.m_drawn_rows)
+	, m_drawn_beginning(rhs.m_drawn_beginning)
+	, m_redrawn_rows(rhs.m_redrawn_rows)
 	, m_highlight_prefix(rhs.m_highlight_prefix)
 	, m_highlight_suffix(rhs.m_highlight_suffix)
 	, m_selected_prefix(rhs.m_selected_prefix)
 	, m_selected_suffix(rhs.m_selected_suffix)
-{
-	// TODO: move filtered items
-	m_all_items.reserve(rhs.m_all_items.size());
-	for (const auto &item : rhs.m_all_items)
-		m_all_items.push_back(item.copy());
-	m_items = &m_all_items;
-}
+{ }
 
 template <typename ItemT>
 Menu<ItemT>::Menu(Menu &&rhs)
 	: Window(rhs)
 	, m_item_displayer(std::move(rhs.m_item_displayer))
 	, m_filter_predicate(std::move(rhs.m_filter_predicate))
-	, m_all_items(std::move(rhs.m_all_items))
-	, m_filtered_items(std::move(rhs.m_filtered_items))
+	, m_row_key(std::move(rhs.m_row_key))
+	, m_values(std::move(rhs.m_values))
+	, m_properties(std::move(rhs.m_properties))
+	, m_filtered_rows(std::move(rhs.m_filtered_rows))
+	, m_show_filtered(rhs.m_show_filtered)
 	, m_beginning(rhs.m_beginning)
 	, m_highlight(rhs.m_highlight)
 	, m_highlight_enabled(rhs.m_highlight_enabled)
 	, m_cyclic_scroll_enabled(rhs.m_cyclic_scroll_enabled)
 	, m_autocenter_cursor(rhs.m_autocenter_cursor)
+	, m_parallel_filter(rhs.m_parallel_filter)
 	, m_drawn_position(rhs.m_drawn_position)
+	, m_drawn_rows(std::move(rhs.m_drawn_rows))
+	, m_drawn_beginning(rhs.m_drawn_beginning)
+	, m_redrawn_rows(rhs.m_redrawn_rows)
 	, m_highlight_prefix(std::move(rhs.m_highlight_prefix))
 	, m_highlight_suffix(std::move(rhs.m_highlight_suffix))
 	, m_selected_prefix(std::move(rhs.m_selected_prefix))
 	, m_selected_suffix(std::move(rhs.m_selected_suffix))
-{
-	if (rhs.m_items == &rhs.m_all_items)
-		m_items = &m_all_items;
-	else
-		m_items = &m_filtered_items;
-}
+{ }
 
 template <typename ItemT>
 Menu<ItemT> &Menu<ItemT>::operator=(Menu rhs)
@@ -107,22 +120,25 @@ Menu<ItemT> &Menu<ItemT>::operator=(Menu rhs)
 	std::swap(static_cast<Window &>(*this), static_cast<Window &>(rhs));
 	std::swap(m_item_displayer, rhs.m_item_displayer);
 	std::swap(m_filter_predicate, rhs.m_filter_predicate);
-	std::swap(m_all_items, rhs.m_all_items);
-	std::swap(m_filtered_items, rhs.m_filtered_items);
+	std::swap(m_row_key, rhs.m_row_key);
+	std::swap(m_values, rhs.m_values);
+	std::swap(m_properties, rhs.m_properties);
+	std::swap(m_filtered_rows, rhs.m_filtered_rows);
+	std::swap(m_show_filtered, rhs.m_show_filtered);
 	std::swap(m_beginning, rhs.m_beginning);
 	std::swap(m_highlight, rhs.m_highlight);
 	std::swap(m_highlight_enabled, rhs.m_highlight_enabled);
 	std::swap(m_cyclic_scroll_enabled, rhs.m_cyclic_scroll_enabled);
 	std::swap(m_autocenter_cursor, rhs.m_autocenter_cursor);
+	std::swap(m_parallel_filter, rhs.m_parallel_filter);
 	std::swap(m_drawn_position, rhs.m_drawn_position);
+	std::swap(m_drawn_rows, rhs.m_drawn_rows);
+	std::swap(m_drawn_beginning, rhs.m_drawn_beginning);
+	std::swap(m_redrawn_rows, rhs.m_redrawn_rows);
 	std::swap(m_highlight_prefix, rhs.m_highlight_prefix);
 	std::swap(m_highlight_suffix, rhs.m_highlight_suffix);
 	std::swap(m_selected_prefix, rhs.m_selected_prefix);
 	std::swap(m_selected_suffix, rhs.m_selected_suffix);
-	if (rhs.m_items == &rhs.m_all_items)
-		m_items = &m_all_items;
-	else
-		m_items = &m_filtered_items;
 	return *this;
 }
 
@@ -130,36 +146,68 @@ template <typename ItemT> template <typename ItemDisplayerT>
 void Menu<ItemT>::setItemDisplayer(ItemDisplayerT &&displayer)
 {
 	m_item_displayer = std::forward<ItemDisplayerT>(displayer);
+	damage();
+}
+
+template <typename ItemT> template <typename RowKeyT>
+void Menu<ItemT>::setRowKey(RowKeyT &&key)
+{
+	m_row_key = std::forward<RowKeyT>(key);
+	damage();
 }
 
 template <typename ItemT>
 void Menu<ItemT>::resizeList(size_t new_size)
 {
-	m_all_items.resize(new_size);
+	if (new_size < m_values.size())
+	{
+		// Rows that no longer exist can't be a part of the filtered view.
+		m_filtered_rows.erase(
+			std::remove_if(m_filtered_rows.begin(), m_filtered_rows.end(),
+			               [new_size](size_t row) { return row >= new_size; }),
+			m_filtered_rows.end());
+	}
+	m_values.resize(new_size);
+	m_properties.resize(new_size);
 }
 
 template <typename ItemT>
 void Menu<ItemT>::addItem(ItemT item, Properties::Type properties)
 {
-	m_all_items.push_back(Item(std::move(item), properties));
+	m_values.push_back(std::move(item));
+	m_properties.push_back(properties);
 }
 
 template <typename ItemT>
 void Menu<ItemT>::addSeparator()
 {
-	m_all_items.push_back(Item::mkSeparator());
+	m_values.emplace_back();
+	m_properties.push_back(Properties::Separator);
 }
 
 template <typename ItemT>
 void Menu<ItemT>::insertItem(size_t pos, ItemT item, Properties::Type properties)
 {
-	m_all_items.insert(m_all_items.begin()+pos, Item(std::move(item), properties));
+	m_values.insert(m_values.begin()+pos, std::move(item));
+	m_properties.insert(m_properties.begin()+pos, properties);
+	shiftFilteredRows(pos);
 }
 
 template <typename ItemT>
 void Menu<ItemT>::insertSeparator(size_t pos)
 {
-	m_all_items.insert(m_all_items.begin()+pos, Item::mkSeparator());
+	m_values.insert(m_values.begin()+pos, ItemT());
+	m_properties.insert(m_properties.begin()+pos, Properties::Separator);
+	shiftFilteredRows(pos);
+}
+
+template <typename ItemT>
+void Menu<ItemT>::shiftFilteredRows(size_t row)
+{
+	// Keep the filtered view pointing to the same items.
+	for (auto &filtered_row : m_filtered_rows)
+		if (filtered_row >= row)
+			++filtered_row;
 }
 
 template <typename ItemT>
@@ -174,22 +222,24 @@ bool Menu<ItemT>::Goto(size_t y)
 template <typename ItemT>
 void Menu<ItemT>::refresh()
 {
-	if (m_items->empty())
+	if (empty())
 	{
 		Window::clear();
 		Window::refresh();
+		damage();
+		m_redrawn_rows = 0;
 		return;
 	}
 
 	size_t max_beginning = 0;
-	if (m_items->size() > m_height)
-		max_beginning = m_items->size() - m_height;
+	if (size() > m_height)
+		max_beginning = size() - m_height;
 	m_beginning = std::min(m_beginning, max_beginning);
 
 	// if highlighted position is off the screen, make it visible
 	m_highlight = std::min(m_highlight, m_beginning+m_height-1);
 	// if highlighted position is invalid, correct it
-	m_highlight = std::min(m_highlight, m_items->size()-1);
+	m_highlight = std::min(m_highlight, size()-1);
 
 	if (!isHighlightable(m_highlight))
 	{
@@ -198,45 +248,111 @@ void Menu<ItemT>::refresh()
 			scroll(Scroll::Down);
 	}
 
-	size_t line = 0;
-	const size_t end_ = m_beginning+m_height;
+	if (!m_row_key || m_drawn_rows.size() != m_height)
+		m_drawn_rows.assign(m_height, DrawnRow());
+	else
+		scrollDrawnRows();
+	m_drawn_beginning = m_beginning;
+
+	m_redrawn_rows = 0;
 	m_drawn_position = m_beginning;
-	for (; m_drawn_position < end_; ++m_drawn_position, ++line)
+	for (size_t line = 0; line < m_height; ++m_drawn_position, ++line)
 	{
+		DrawnRow drawn;
+		drawn.valid = true;
+		if (m_drawn_position >= size())
+			drawn.row = -1;
+		else
+		{
+			drawn.row = row(m_drawn_position);
+			drawn.properties = m_properties[drawn.row];
+			drawn.highlighted = m_highlight_enabled && m_drawn_position == m_highlight;
+			if (m_row_key && !drawn.properties.isSeparator())
+			{
+				drawn.key = m_row_key(*this);
+				// Rows that can't be identified are drawn every time.
+				drawn.valid = drawn.key != 0;
+			}
+		}
+		if (drawn == m_drawn_rows[line])
+			continue;
+		m_drawn_rows[line] = drawn;
+		++m_redrawn_rows;
+
 		goToXY(0, line);
-		if (m_drawn_position >= m_items->size())
+		if (m_drawn_position >= size())
 		{
-			for (; line < m_height; ++line)
-				mvwhline(m_window, line, 0, NC::Key::Space, m_width);
-			break;
+			mvwhline(m_window, line, 0, NC::Key::Space, m_width);
+			continue;
 		}
-		if ((*m_items)[m_drawn_position].isSeparator())
+		if (drawn.properties.isSeparator())
 		{
 			mvwhline(m_window, line, 0, 0, m_width);
 			continue;
 		}
-		if (m_highlight_enabled && m_drawn_position == m_highlight)
+		if (drawn.highlighted)
 			*this << m_highlight_prefix;
-		if ((*m_items)[m_drawn_position].isSelected())
+		if (drawn.properties.isSelected())
 			*this << m_selected_prefix;
 		*this << NC::TermManip::ClearToEOL;
 		if (m_item_displayer)
 			m_item_displayer(*this);
-		if ((*m_items)[m_drawn_position].isSelected())
+		if (drawn.properties.isSelected())
 			*this << m_selected_suffix;
-		if (m_highlight_enabled && m_drawn_position == m_highlight)
+		if (drawn.highlighted)
 			*this << m_highlight_suffix;
 	}
+	// Lines that weren't drawn need to be copied to the screen too if something
+	// else was displayed there in the meantime.
+	touchDamagedLines();
 	Window::refresh();
 }
 
+template <typename ItemT>
+void Menu<ItemT>::scrollDrawnRows()
+{
+	if (m_beginning == m_drawn_beginning)
+		return;
+	bool down = m_beginning > m_drawn_beginning;
+	size_t lines = down
+		? m_beginning - m_drawn_beginning
+		: m_drawn_beginning - m_beginning;
+	if (lines >= m_height)
+	{
+		m_drawn_rows.assign(m_height, DrawnRow());
+		return;
+	}
+	// Move the lines that stay visible instead of drawing them again.
+	scrollok(m_window, true);
+	wsetscrreg(m_window, 0, m_height-1);
+	wscrl(m_window, down ? int(lines) : -int(lines));
+	scrollok(m_window, false);
+	if (down)
+	{
+		m_drawn_rows.erase(m_drawn_rows.begin(), m_drawn_rows.begin()+lines);
+		m_drawn_rows.resize(m_height);
+	}
+	else
+	{
+		m_drawn_rows.insert(m_drawn_rows.begin(), lines, DrawnRow());
+		m_drawn_rows.resize(m_height);
+	}
+}
+
+template <typename ItemT>
+void Menu<ItemT>::recreate(size_t width, size_t height)
+{
+	Window::recreate(width, height);
+	damage();
+}
+
 template <typename ItemT>
 void Menu<ItemT>::scroll(Scroll where)
 {
-	if (m_items->empty())
+	if (empty())
 		return;
-	size_t max_highlight = m_items->size()-1;
-	size_t max_beginning = m_items->size() < m_height ? 0 : m_items->size()-m_height;
+	size_t max_highlight = size()-1;
+	size_t max_beginning = size() < m_height ? 0 : size()-m_height;
 	size_t max_visible_highlight = m_beginning+m_height-1;
 	switch (where)
 	{
@@ -332,14 +448,18 @@ template <typename ItemT>
 void Menu<ItemT>::clear()
 {
 	// Don't clear filter related stuff here.
-	m_all_items.clear();
-	m_filtered_items.clear();
+	m_values.clear();
+	m_properties.clear();
+	m_filtered_rows.clear();
+	// Keys of new items might be the same as of the ones they replace (e.g.
+	// if a song was allocated where the previous one was).
+	damage();
 }
 
 template <typename ItemT>
 void Menu<ItemT>::highlight(size_t pos)
 {
-	assert(pos < m_items->size());
+	assert(pos < size());
 	m_highlight = pos;
 	size_t half_height = m_height/2;
 	if (pos < half_height)
@@ -359,13 +479,8 @@ template <typename ItemT> template <typename PredicateT>
 void Menu<ItemT>::applyFilter(PredicateT &&pred)
 {
 	m_filter_predicate = std::forward<PredicateT>(pred);
-	m_filtered_items.clear();
-
-	for (const auto &item : m_all_items)
-		if (m_filter_predicate(item))
-			m_filtered_items.push_back(item);
-
-	m_items = &m_filtered_items;
+	m_filtered_rows = filterRows(0, m_values.size());
+	m_show_filtered = true;
 }
 
 template <typename ItemT>
@@ -374,18 +489,73 @@ void Menu<ItemT>::reapplyFilter()
 	applyFilter(m_filter_predicate);
 }
 
+template <typename ItemT>
+void Menu<ItemT>::reapplyFilter(size_t first_row, size_t last_row)
+{
+	if (!m_filter_predicate)
+		return;
+	last_row = std::min(last_row, m_values.size());
+	if (first_row >= last_row)
+		return;
+
+	auto matching_rows = filterRows(first_row, last_row);
+
+	// Filtered rows are sorted, so the ones within the range are contiguous.
+	auto first = std::lower_bound(
+		m_filtered_rows.begin(), m_filtered_rows.end(), first_row);
+	auto last = std::lower_bound(first, m_filtered_rows.end(), last_row);
+	first = m_filtered_rows.erase(first, last);
+	m_filtered_rows.insert(first, matching_rows.begin(), matching_rows.end());
+}
+
+template <typename ItemT>
+std::vector<size_t> Menu<ItemT>::filterRows(size_t first_row, size_t last_row)
+{
+	// Each thread gets its own copy of the lambda and thus the predicate.
+	auto matches = [this, pred = m_filter_predicate](size_t row) {
+		const ItemRef item(&m_values[row], &m_properties[row]);
+		return pred(item);
+	};
+	if (m_parallel_filter)
+		return Parallel::filter(first_row, last_row, matches);
+	else
+		return Parallel::filter(first_row, last_row, matches, 1);
+}
+
 template <typename ItemT> template <typename TargetT>
 const TargetT *Menu<ItemT>::filterPredicate() const
 {
 	return m_filter_predicate.template target<TargetT>();
 }
 
+template <typename ItemT> template <typename PredicateT>
+void Menu<ItemT>::setFilterPredicate(PredicateT &&pred)
+{
+	m_filter_predicate = std::forward<PredicateT>(pred);
+}
+
+template <typename ItemT>
+void Menu<ItemT>::setFilteredRows(std::vector<size_t> rows)
+{
+	assert(std::is_sorted(rows.begin(), rows.end()));
+	m_filtered_rows = std::move(rows);
+	m_show_filtered = true;
+}
+
+template <typename ItemT>
+void Menu<ItemT>::appendFilteredRows(const std::vector<size_t> &rows)
+{
+	assert(rows.empty() || m_filtered_rows.empty()
+	       || m_filtered_rows.back() < rows.front());
+	m_filtered_rows.insert(m_filtered_rows.end(), rows.begin(), rows.end());
+}
+
 template <typename ItemT>
 void Menu<ItemT>::clearFilter()
 {
 	m_filter_predicate = nullptr;
-	m_filtered_items.clear();
-	m_items = &m_all_items;
+	m_filtered_rows.clear();
+	m_show_filtered = false;
 }
 
 }
@@ -196,6 +196,42 @@ int add_base()
 
 }
 
+// Areas of the screen that windows were copied to, along with the serial
+// of the latest copy. Windows use it to find out which of their lines were
+// overwritten by something else since they were refreshed.
+struct RefreshedRegion
+{
+	size_t x, y, width, height;
+	size_t serial;
+};
+
+const size_t max_refreshed_regions = 64;
+std::vector<RefreshedRegion> refreshed_regions;
+size_t last_refresh_serial = 0;
+// Refreshes up to this serial are no longer known.
+size_t forgotten_refresh_serial = 0;
+
+size_t recordRefresh(size_t x, size_t y, size_t width, size_t height)
+{
+	++last_refresh_serial;
+	auto it = std::find_if(refreshed_regions.begin(), refreshed_regions.end(),
+		[&](const RefreshedRegion &r) {
+			return r.x == x && r.y == y && r.width == width && r.height == height;
+		});
+	if (it != refreshed_regions.end())
+		it->serial = last_refresh_serial;
+	else
+	{
+		if (refreshed_regions.size() == max_refreshed_regions)
+		{
+			refreshed_regions.clear();
+			forgotten_refresh_serial = last_refresh_serial-1;
+		}
+		refreshed_regions.push_back({x, y, width, height, last_refresh_serial});
+	}
+	return last_refresh_serial;
+}
+
 int color_pair_counter;
 std::vector<int> color_pair_map;
 
@@ -504,7 +540,8 @@ Window::Window(size_t startx, size_t starty, size_t width, size_t height,
 	  m_underline_counter(0),
 	  m_reverse_counter(0),
 	  m_alt_charset_counter(0),
-	  m_italic_counter(0)
+	  m_italic_counter(0),
+	  m_last_refresh(0)
 {
 	if (m_border)
 	{
@@ -547,6 +584,7 @@ Window::Window(const Window &rhs)
 , m_reverse_counter(rhs.m_reverse_counter)
 , m_alt_charset_counter(rhs.m_alt_charset_counter)
 , m_italic_counter(rhs.m_italic_counter)
+, m_last_refresh(0)
 {
 	setColor(m_color);
 }
@@ -572,6 +610,7 @@ Window::Window(Window &&rhs)
 , m_reverse_counter(rhs.m_reverse_counter)
 , m_alt_charset_counter(rhs.m_alt_charset_counter)
 , m_italic_counter(rhs.m_italic_counter)
+, m_last_refresh(rhs.m_last_refresh)
 {
 	rhs.m_window = nullptr;
 }
@@ -598,6 +637,7 @@ Window &Window::operator=(Window rhs)
 	std::swap(m_reverse_counter, rhs.m_reverse_counter);
 	std::swap(m_alt_charset_counter, rhs.m_alt_charset_counter);
 	std::swap(m_italic_counter, rhs.m_italic_counter);
+	std::swap(m_last_refresh, rhs.m_last_refresh);
 	return *this;
 }
 
@@ -672,6 +712,7 @@ void Window::recreate(size_t width, size_t height)
 	m_window = newpad(height, width);
 	wtimeout(m_window, 0);
 	setColor(m_color);
+	m_last_refresh = 0;
 }
 
 void Window::moveTo(size_t new_x, size_t new_y)
@@ -685,6 +726,7 @@ void Window::moveTo(size_t new_x, size_t new_y)
 	}
 	if (!m_title.empty())
 		m_start_y += 2;
+	m_last_refresh = 0;
 }
 
 void Window::adjustDimensions(size_t width, size_t height)
@@ -733,6 +775,9 @@ void Window::refreshBorder() const
 			mvaddch(start_y+2, start_x+width-1, 'u');
 		}
 		attroff(A_ALTCHARSET);
+		// Lines of stdscr are copied from the leftmost to the rightmost change,
+		// i.e. over the window itself.
+		recordRefresh(start_x, start_y, width, height);
 	}
 	else
 		color_set(m_base_color.pairNumber(), nullptr);
@@ -758,7 +803,32 @@ void Window::display()
 
 void Window::refresh()
 {
-	prefresh(m_window, 0, 0, m_start_y, m_start_x, m_start_y+m_height-1, m_start_x+m_width-1);
+	copyToScreen(0);
+}
+
+void Window::copyToScreen(size_t first_line)
+{
+	prefresh(m_window, first_line, 0, m_start_y, m_start_x, m_start_y+m_height-1, m_start_x+m_width-1);
+	m_last_refresh = recordRefresh(m_start_x, m_start_y, m_width, m_height);
+}
+
+void Window::touchDamagedLines(size_t first_line)
+{
+	if (m_last_refresh <= forgotten_refresh_serial)
+	{
+		touchwin(m_window);
+		return;
+	}
+	for (const auto &r : refreshed_regions)
+	{
+		if (r.serial <= m_last_refresh
+		 || r.x >= m_start_x+m_width || r.x+r.width <= m_start_x
+		 || r.y >= m_start_y+m_height || r.y+r.height <= m_start_y)
+			continue;
+		size_t begin = std::max(r.y, m_start_y);
+		size_t end = std::min(r.y+r.height, m_start_y+m_height);
+		touchline(m_window, first_line+begin-m_start_y, end-begin);
+	}
 }
 
 void Window::clear()
@@ -487,6 +487,16 @@ protected:
 	/// @see resize()
 	///
 	virtual void recreate(size_t width, size_t height);
+
+	/// Marks lines of the window that were covered by something else since
+	/// it was last refreshed as changed, so that the next refresh copies them
+	/// to the screen even if they weren't drawn again.
+	/// @param first_line line of the pad displayed at the top of the window
+	void touchDamagedLines(size_t first_line = 0);
+
+	/// Copies the window to the screen.
+	/// @param first_line line of the pad displayed at the top of the window
+	void copyToScreen(size_t first_line);
 	
 	/// internal WINDOW pointers
 	WINDOW *m_window;
@@ -568,6 +578,9 @@ private:
 	int m_reverse_counter;
 	int m_alt_charset_counter;
 	int m_italic_counter;
+
+	/// serial of the last refresh of the window, 0 if it wasn't refreshed
+	size_t m_last_refresh;
 };
 
 }
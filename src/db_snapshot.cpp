@@ -0,0 +1,261 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "db_snapshot.h"
+
+namespace {
+
+const char Magic[8] = { 'N', 'C', 'M', 'P', 'C', 'D', 'B', '\0' };
+const uint32_t FormatVersion = 3;
+
+// The file consists of the header, song entries, tag entries of all songs
+// one after another, directory entries, string table and padding. Strings are referenced by
+// their offsets in the table and each distinct one is stored only once.
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t db_update;
+	uint64_t tag_mask;
+	uint64_t songs;
+	uint64_t tags;
+	uint64_t directories;
+	uint64_t strings_size;
+};
+
+struct SongEntry
+{
+	int64_t mtime;
+	uint32_t uri;
+	uint32_t duration;
+	uint32_t tags;
+	uint32_t reserved;
+};
+
+struct TagEntry
+{
+	uint32_t type;
+	uint32_t value;
+};
+
+struct DirectoryEntry
+{
+	int64_t mtime;
+	uint32_t path;
+	uint32_t reserved;
+};
+
+// Zeros written at the end of the file.
+const char Padding[16] = { };
+
+}
+
+namespace MPD {
+
+DatabaseSnapshot::DatabaseSnapshot(std::string path, unsigned long db_update,
+                                   uint64_t tag_mask, std::vector<Directory> directories,
+                                   std::vector<Song> songs)
+: m_path(std::move(path))
+, m_db_update(db_update)
+, m_tag_mask(tag_mask)
+, m_directories(std::move(directories))
+, m_songs(std::move(songs))
+{ }
+
+std::shared_ptr<const DatabaseSnapshot> DatabaseSnapshot::load(const std::string &path,
+                                                               uint64_t tag_mask)
+{
+	std::shared_ptr<const DatabaseSnapshot> result;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return result;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+	{
+		close(fd);
+		return result;
+	}
+	size_t size = st.st_size;
+	void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		return result;
+	auto mapping = std::shared_ptr<void>(memory, [size](void *p) { munmap(p, size); });
+
+	const Header *header = static_cast<const Header *>(memory);
+	if (memcmp(header->magic, Magic, sizeof(Magic)) != 0
+	    || header->version != FormatVersion
+	    || header->tag_mask != tag_mask
+	    || sizeof(Header) + header->songs*sizeof(SongEntry) + header->tags*sizeof(TagEntry)
+	       + header->directories*sizeof(DirectoryEntry) + header->strings_size
+	       + sizeof(Padding) != size)
+		return result;
+
+	auto songs_begin = reinterpret_cast<const SongEntry *>(header + 1);
+	auto tags_begin = reinterpret_cast<const TagEntry *>(songs_begin + header->songs);
+	auto directories_begin = reinterpret_cast<const DirectoryEntry *>(tags_begin + header->tags);
+	auto strings = reinterpret_cast<const char *>(directories_begin + header->directories);
+	// All strings need to be terminated within the table.
+	if (header->strings_size > 0 && strings[header->strings_size-1] != '\0')
+		return result;
+
+	// Strings are used in place, the store only references them.
+	auto store = std::make_shared<SongStore>();
+	store->adopt(mapping);
+	std::vector<Song> songs;
+	songs.reserve(header->songs);
+	SongStore::Tags tags;
+	auto tag = tags_begin, tags_end = tags_begin + header->tags;
+	for (auto entry = songs_begin; entry != songs_begin + header->songs; ++entry)
+	{
+		if (entry->uri >= header->strings_size
+		    || static_cast<size_t>(tags_end - tag) < entry->tags)
+			return result;
+		tags.clear();
+		for (auto end = tag + entry->tags; tag != end; ++tag)
+		{
+			if (tag->type >= MPD_TAG_COUNT || tag->value >= header->strings_size)
+				return result;
+			tags.emplace_back(static_cast<mpd_tag_type>(tag->type), strings + tag->value);
+		}
+		songs.emplace_back(store, store->add(strings + entry->uri, entry->mtime,
+		                                     entry->duration, tags, true));
+	}
+
+	std::vector<Directory> directories;
+	directories.reserve(header->directories);
+	for (auto entry = directories_begin; entry != directories_begin + header->directories; ++entry)
+	{
+		if (entry->path >= header->strings_size)
+			return result;
+		directories.emplace_back(strings + entry->path, entry->mtime);
+	}
+
+	result = std::make_shared<DatabaseSnapshot>(
+		path, header->db_update, tag_mask, std::move(directories), std::move(songs));
+	return result;
+}
+
+void DatabaseSnapshot::save() const
+{
+	std::vector<SongEntry> entries;
+	std::vector<TagEntry> tags;
+	std::string strings;
+	std::unordered_map<std::string_view, uint32_t> offsets;
+	auto add_string = [&](const char *s) {
+		auto it = offsets.find(s);
+		if (it != offsets.end())
+			return it->second;
+		uint32_t offset = strings.size();
+		strings.append(s, strlen(s) + 1);
+		offsets.emplace(s, offset);
+		return offset;
+	};
+
+	entries.reserve(m_songs.size());
+	for (const auto &s : m_songs)
+	{
+		const auto &row = s.row();
+		if (!row)
+			throw std::runtime_error("song " + s.getURI() + " is not backed by the store");
+		SongEntry entry;
+		entry.mtime = row.mtime();
+		entry.uri = add_string(row.uri());
+		entry.duration = row.duration();
+		entry.tags = row.tagsCount();
+		entry.reserved = 0;
+		entries.push_back(entry);
+		for (size_t i = 0; i < row.tagsCount(); ++i)
+		{
+			auto tag = row.tagAt(i);
+			tags.push_back({ static_cast<uint32_t>(tag.first), add_string(tag.second) });
+		}
+	}
+
+	std::vector<DirectoryEntry> directories;
+	directories.reserve(m_directories.size());
+	for (const auto &directory : m_directories)
+		directories.push_back({ directory.lastModified(), add_string(directory.path().c_str()), 0 });
+
+	Header header;
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = FormatVersion;
+	header.reserved = 0;
+	header.db_update = m_db_update;
+	header.tag_mask = m_tag_mask;
+	header.songs = entries.size();
+	header.tags = tags.size();
+	header.directories = directories.size();
+	header.strings_size = strings.size();
+
+	// Write to a temporary file first so that the snapshot is replaced
+	// atomically and never seen half-written.
+	std::string tmp_path = m_path + ".tmp";
+	std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!f.is_open())
+		throw std::runtime_error("couldn't open " + tmp_path + " for writing");
+	f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	f.write(reinterpret_cast<const char *>(entries.data()), entries.size()*sizeof(SongEntry));
+	f.write(reinterpret_cast<const char *>(tags.data()), tags.size()*sizeof(TagEntry));
+	f.write(reinterpret_cast<const char *>(directories.data()),
+	        directories.size()*sizeof(DirectoryEntry));
+	f.write(strings.data(), strings.size());
+	f.write(Padding, sizeof(Padding));
+	f.close();
+	if (!f || rename(tmp_path.c_str(), m_path.c_str()) != 0)
+	{
+		remove(tmp_path.c_str());
+		throw std::runtime_error("couldn't write " + m_path);
+	}
+}
+
+std::string DatabaseSnapshot::path(const std::string &directory, const std::string &host, int port)
+{
+	// Host might be a path to the socket.
+	std::string name = host;
+	for (auto &c : name)
+		if (!isalnum(c) && c != '.' && c != '-')
+			c = '_';
+	return directory + "database-" + name + "-" + std::to_string(port);
+}
+
+uint64_t DatabaseSnapshot::tagMask(const std::vector<mpd_tag_type> &tag_types)
+{
+	static_assert(MPD_TAG_COUNT <= 64, "tag types don't fit in the mask");
+	if (tag_types.empty())
+		return ~uint64_t(0);
+	uint64_t result = 0;
+	for (const auto &type : tag_types)
+		result |= uint64_t(1) << type;
+	return result;
+}
+
+}
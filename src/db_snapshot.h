@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_DB_SNAPSHOT_H
+#define NCMPCPP_DB_SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mpdpp.h"
+
+namespace MPD {
+
+// Copy of the whole database (as returned by listallinfo) stored on disk
+// with deduplicated strings, so that it can be mapped back into memory and
+// referenced by the song store instead of fetching the library from the
+// server again. It's up to date as long as the database update time reported
+// by the server doesn't change, otherwise it can be synchronized using
+// modification times of directories (see db_sync.h).
+struct DatabaseSnapshot
+{
+	DatabaseSnapshot(std::string path, unsigned long db_update, uint64_t tag_mask,
+	                 std::vector<Directory> directories, std::vector<Song> songs);
+
+	// Map the snapshot stored in the file. Returns null if it doesn't exist,
+	// is damaged or was made with different tag types enabled.
+	static std::shared_ptr<const DatabaseSnapshot> load(const std::string &path,
+	                                                    uint64_t tag_mask);
+
+	// Write the snapshot to its file. All songs need to be backed by the song
+	// store. Throws std::runtime_error on failure.
+	void save() const;
+
+	static std::string path(const std::string &directory, const std::string &host, int port);
+	static uint64_t tagMask(const std::vector<mpd_tag_type> &tag_types);
+
+	bool matches(const std::string &path, unsigned long db_update, uint64_t tag_mask) const
+	{
+		return m_path == path && m_db_update == db_update && m_tag_mask == tag_mask;
+	}
+
+	unsigned long dbUpdate() const { return m_db_update; }
+
+	// All directories except the root one, sorted by path.
+	const std::vector<Directory> &directories() const { return m_directories; }
+	const std::vector<Song> &songs() const { return m_songs; }
+
+private:
+	std::string m_path;
+	unsigned long m_db_update;
+	uint64_t m_tag_mask;
+	std::vector<Directory> m_directories;
+	std::vector<Song> m_songs;
+};
+
+}
+
+#endif // NCMPCPP_DB_SNAPSHOT_H
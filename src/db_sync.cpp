@@ -0,0 +1,237 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "db_sync.h"
+
+namespace {
+
+std::string parentDirectory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash != nullptr ? std::string(path, slash) : std::string();
+}
+
+// Directory as seen in the snapshot.
+struct DirectoryContent
+{
+	DirectoryContent()
+	: mtime(0), hasSubdirectories(false)
+	{ }
+
+	time_t mtime;
+	bool hasSubdirectories;
+	// indices of songs in the snapshot
+	std::vector<size_t> songs;
+};
+
+}
+
+namespace MPD {
+
+bool DatabaseDelta::directoryChanged(const std::string &directory) const
+{
+	return std::binary_search(directories.begin(), directories.end(), directory);
+}
+
+void DatabaseDelta::merge(DatabaseDelta &&rhs)
+{
+	added.insert(added.end(),
+	             std::make_move_iterator(rhs.added.begin()),
+	             std::make_move_iterator(rhs.added.end()));
+	removed.insert(removed.end(),
+	               std::make_move_iterator(rhs.removed.begin()),
+	               std::make_move_iterator(rhs.removed.end()));
+	size_t middle = directories.size();
+	directories.insert(directories.end(),
+	                   std::make_move_iterator(rhs.directories.begin()),
+	                   std::make_move_iterator(rhs.directories.end()));
+	std::inplace_merge(directories.begin(), directories.begin() + middle, directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+	listedDirectories += rhs.listedDirectories;
+}
+
+std::shared_ptr<const DatabaseSnapshot> syncDatabase(Connection &connection,
+                                                     const DatabaseSnapshot &snapshot,
+                                                     std::string path,
+                                                     unsigned long db_update,
+                                                     uint64_t tag_mask,
+                                                     DatabaseDelta &delta)
+{
+	const auto &old_songs = snapshot.songs();
+
+	std::unordered_map<std::string, DirectoryContent> old_directories;
+	old_directories[""];
+	for (const auto &directory : snapshot.directories())
+	{
+		old_directories[directory.path()].mtime = directory.lastModified();
+		old_directories[parentDirectory(directory.path().c_str())].hasSubdirectories = true;
+	}
+	std::unordered_map<std::string_view, size_t> old_uris;
+	old_uris.reserve(old_songs.size());
+	for (size_t i = 0; i < old_songs.size(); ++i)
+	{
+		old_directories[parentDirectory(old_songs[i].c_uri())].songs.push_back(i);
+		old_uris.emplace(old_songs[i].c_uri(), i);
+	}
+
+	std::vector<bool> removed(old_songs.size(), false);
+	size_t removed_count = 0;
+	std::vector<Song> added;
+	std::unordered_set<std::string> changed;
+	auto remove = [&](size_t i) {
+		removed[i] = true;
+		++removed_count;
+		delta.removed.push_back(old_songs[i]);
+	};
+
+	std::vector<Directory> directories;
+	std::unordered_set<std::string> listed;
+	std::vector<std::string> pending = { "" };
+	while (!pending.empty())
+	{
+		std::string directory = std::move(pending.back());
+		pending.pop_back();
+
+		std::vector<Song> songs;
+		ItemIterator item = connection.GetDirectoryContent(directory, false), end;
+		for (; item != end; ++item)
+		{
+			if (item->type() == Item::Type::Directory)
+			{
+				auto it = old_directories.find(item->directory().path());
+				if (it == old_directories.end())
+					changed.insert(directory);
+				if (it == old_directories.end()
+				    || it->second.mtime != item->directory().lastModified()
+				    || it->second.hasSubdirectories)
+					pending.push_back(item->directory().path());
+				directories.push_back(std::move(item->directory()));
+			}
+			else if (item->type() == Item::Type::Song)
+				songs.push_back(std::move(item->song()));
+		}
+		listed.insert(directory);
+		++delta.listedDirectories;
+
+		// Compare songs of the directory with the ones in the snapshot.
+		std::unordered_map<std::string_view, size_t> old_content;
+		auto it = old_directories.find(directory);
+		if (it != old_directories.end())
+		{
+			for (size_t i : it->second.songs)
+				old_content.emplace(old_songs[i].c_uri(), i);
+		}
+		for (auto &s : songs)
+		{
+			auto old = old_content.find(s.c_uri());
+			if (old == old_content.end())
+			{
+				changed.insert(directory);
+				added.push_back(std::move(s));
+			}
+			else
+			{
+				if (old_songs[old->second].getMTime() != s.getMTime())
+				{
+					changed.insert(directory);
+					remove(old->second);
+					added.push_back(std::move(s));
+				}
+				old_content.erase(old);
+			}
+		}
+		for (const auto &old : old_content)
+		{
+			changed.insert(directory);
+			remove(old.second);
+		}
+	}
+
+	// Directories that are no longer there (the ones that still are were seen
+	// while listing their parents).
+	std::sort(directories.begin(), directories.end(),
+	          [](const Directory &a, const Directory &b) {
+		          return a.path() < b.path();
+	          });
+	for (const auto &directory : snapshot.directories())
+	{
+		auto it = std::lower_bound(
+			directories.begin(), directories.end(), directory.path(),
+			[](const Directory &a, const std::string &b) { return a.path() < b; });
+		if (it != directories.end() && it->path() == directory.path())
+			continue;
+		changed.insert(directory.path());
+		changed.insert(parentDirectory(directory.path().c_str()));
+		for (size_t i : old_directories[directory.path()].songs)
+			if (!removed[i])
+				remove(i);
+	}
+
+	// Songs modified in place don't change modification times of their
+	// directories. Filter expressions require MPD >= 0.21, without them only
+	// modifications in directories that were listed are noticed.
+	try
+	{
+		connection.StartSearch(true);
+		connection.AddSearchExpression(
+			"(modified-since '" + std::to_string(snapshot.dbUpdate()) + "')");
+		for (SongIterator s = connection.CommitSearchSongs(), end; s != end; ++s)
+		{
+			auto directory = parentDirectory(s->c_uri());
+			if (listed.count(directory) > 0)
+				continue;
+			auto old = old_uris.find(s->c_uri());
+			if (old != old_uris.end())
+			{
+				if (removed[old->second]
+				    || old_songs[old->second].getMTime() == s->getMTime())
+					continue;
+				remove(old->second);
+			}
+			changed.insert(std::move(directory));
+			added.push_back(std::move(*s));
+		}
+	}
+	catch (ServerError &)
+	{ }
+
+	std::vector<Song> songs;
+	songs.reserve(old_songs.size() - removed_count + added.size());
+	for (size_t i = 0; i < old_songs.size(); ++i)
+		if (!removed[i])
+			songs.push_back(old_songs[i]);
+	songs.insert(songs.end(), added.begin(), added.end());
+	delta.added.insert(delta.added.end(),
+	                   std::make_move_iterator(added.begin()),
+	                   std::make_move_iterator(added.end()));
+	delta.directories.assign(changed.begin(), changed.end());
+	std::sort(delta.directories.begin(), delta.directories.end());
+
+	return std::make_shared<DatabaseSnapshot>(
+		std::move(path), db_update, tag_mask, std::move(directories), std::move(songs));
+}
+
+}
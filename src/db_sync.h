@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_DB_SYNC_H
+#define NCMPCPP_DB_SYNC_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db_snapshot.h"
+
+namespace MPD {
+
+// Differences between two versions of the database. Modified songs are in
+// both lists, the old version in removed and the new one in added.
+struct DatabaseDelta
+{
+	DatabaseDelta() : listedDirectories(0) { }
+
+	bool empty() const { return added.empty() && removed.empty() && directories.empty(); }
+
+	// Whether songs or subdirectories of the directory changed.
+	bool directoryChanged(const std::string &directory) const;
+
+	// Add changes made after the ones in this delta.
+	void merge(DatabaseDelta &&rhs);
+
+	std::vector<Song> added;
+	std::vector<Song> removed;
+	// Directories whose content changed, sorted.
+	std::vector<std::string> directories;
+
+	// Number of directories listed to obtain the delta.
+	size_t listedDirectories;
+};
+
+// Bring the snapshot up to date with the database without listing all of
+// it. Modification time of a directory changes only if its own entries are
+// added or removed, so the ones that didn't change and have no
+// subdirectories (modification times of which are known only after listing
+// their parent) are not listed again. Songs modified in place are found
+// using the modified-since filter. Returns the new snapshot and fills the
+// delta.
+std::shared_ptr<const DatabaseSnapshot> syncDatabase(Connection &connection,
+                                                     const DatabaseSnapshot &snapshot,
+                                                     std::string path,
+                                                     unsigned long db_update,
+                                                     uint64_t tag_mask,
+                                                     DatabaseDelta &delta);
+
+}
+
+#endif // NCMPCPP_DB_SYNC_H
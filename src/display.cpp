@@ -18,6 +18,7 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <boost/functional/hash.hpp>
 #include <cassert>
 
 #include "curses/menu_impl.h"
@@ -30,6 +31,7 @@
 #include "screens/playlist.h"
 #include "global.h"
 #include "screens/tag_editor.h"
+#include "utility/lru_cache.h"
 #include "utility/string.h"
 #include "utility/type_conversions.h"
 
@@ -78,10 +80,86 @@ const wchar_t *toColumnName(char c)
 	}
 }
 
+// Row of a song that was laid out by showSongs or showSongsInColumns. It's
+// identified by the song (its serial number, which also changes along with
+// its metadata), the format, available width and whether colors are
+// discarded.
+struct RenderKey
+{
+	uint64_t serial;
+	const void *format;
+	int width;
+	bool discard_colors;
+
+	bool operator==(const RenderKey &rhs) const
+	{
+		return serial == rhs.serial
+			&& format == rhs.format
+			&& width == rhs.width
+			&& discard_colors == rhs.discard_colors;
+	}
+};
+
+struct RenderKeyHash
+{
+	size_t operator()(const RenderKey &key) const
+	{
+		size_t seed = 0;
+		boost::hash_combine(seed, key.serial);
+		boost::hash_combine(seed, key.format);
+		boost::hash_combine(seed, key.width);
+		boost::hash_combine(seed, key.discard_colors);
+		return seed;
+	}
+};
+
+struct RenderedRow
+{
+	NC::Buffer buffer;
+	NC::Buffer right_aligned;
+	size_t right_aligned_width = 0;
+};
+
+// The cache is meant to hold rows that are on the screen (of all screens
+// and a few pages around them), so the least recently drawn ones are dropped
+// when it grows beyond that.
+const size_t RenderCacheSize = 4096;
+
+LRUCache<RenderKey, RenderedRow, RenderKeyHash> render_cache(RenderCacheSize);
+// Placeholders and songs with modified tags can't be told apart by value, so
+// they're laid out each time.
+RenderedRow uncached_row;
+Display::RenderCacheStats render_cache_stats;
+
+template <typename RenderT>
+const RenderedRow &renderRow(const MPD::Song &s, const void *format, int width,
+                             bool discard_colors, RenderT &&render)
+{
+	RenderKey key{s.serial(), format, width, discard_colors};
+	bool cacheable = key.serial != 0 && !s.isPlaceholder();
+	if (cacheable)
+	{
+		if (auto row = render_cache.find(key))
+		{
+			++render_cache_stats.hits;
+			return *row;
+		}
+	}
+	++render_cache_stats.misses;
+
+	RenderedRow row;
+	render(row);
+	if (!cacheable)
+	{
+		uncached_row = std::move(row);
+		return uncached_row;
+	}
+	return render_cache.insert(key, std::move(row));
+}
+
 template <typename T>
-void setProperties(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list,
-                   bool &separate_albums, bool &is_now_playing, bool &is_selected,
-                   bool &is_in_playlist, bool &discard_colors)
+void songState(const NC::Menu<T> &menu, const MPD::Song &s, const SongList &list,
+               bool &separate_albums, bool &is_now_playing, bool &is_in_playlist)
 {
 	size_t drawn_pos = menu.drawn() - menu.begin();
 	separate_albums = false;
@@ -95,26 +173,55 @@ void setProperties(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list,
 				// Draw a separator when the next album is different than the current
 				// one. In case there are two albums with the same name, but a different
 				// album artist, compare also album artists.
-				separate_albums = next->song()->getAlbum() != s.getAlbum()
-				               || next->song()->getAlbumArtist() != s.getAlbumArtist();
+				separate_albums = next->song()->tag(MPD_TAG_ALBUM) != s.tag(MPD_TAG_ALBUM)
+				               || next->song()->tag(MPD_TAG_ALBUM_ARTIST) != s.tag(MPD_TAG_ALBUM_ARTIST);
 			}
 		}
 	}
-	if (separate_albums)
-	{
-		menu << NC::Format::Underline;
-		mvwhline(menu.raw(), menu.getY(), 0, NC::Key::Space, menu.getWidth());
-	}
 
 	int song_pos = s.getPosition();
 	is_now_playing = Status::State::player() != MPD::psStop
 		&& myPlaylist->isActiveWindow(menu)
 		&& song_pos == Status::State::currentSongPosition();
-	if (is_now_playing)
-		menu << Config.now_playing_prefix;
 
 	is_in_playlist = !myPlaylist->isActiveWindow(menu)
 		&& myPlaylist->checkForSong(s);
+}
+
+// Key of the drawn row of a song for NC::Menu::setRowKey. Everything that
+// showSongs and showSongsInColumns depend on other than the song and the
+// menu (properties, highlight, width) ends up in its state.
+template <typename T>
+size_t songKey(const NC::Menu<T> &menu, const MPD::Song &s, const SongList &list)
+{
+	// Songs with modified tags have no serial and can't be told apart from
+	// a different version of the same song.
+	uint64_t serial = s.serial();
+	if (serial == 0)
+		return 0;
+	bool separate_albums, is_now_playing, is_in_playlist;
+	songState(menu, s, list, separate_albums, is_now_playing, is_in_playlist);
+	size_t key = 0;
+	boost::hash_combine(key, serial);
+	boost::hash_combine(key, separate_albums);
+	boost::hash_combine(key, is_now_playing);
+	boost::hash_combine(key, is_in_playlist);
+	return key;
+}
+
+template <typename T>
+void setProperties(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list,
+                   bool &separate_albums, bool &is_now_playing, bool &is_selected,
+                   bool &is_in_playlist, bool &discard_colors)
+{
+	songState(menu, s, list, separate_albums, is_now_playing, is_in_playlist);
+	if (separate_albums)
+	{
+		menu << NC::Format::Underline;
+		mvwhline(menu.raw(), menu.getY(), 0, NC::Key::Space, menu.getWidth());
+	}
+	if (is_now_playing)
+		menu << Config.now_playing_prefix;
 	if (is_in_playlist)
 		menu << NC::Format::Bold;
 
@@ -144,13 +251,17 @@ void showSongs(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list, cons
 	              is_in_playlist, discard_colors);
 
 	const size_t y = menu.getY();
-	NC::Buffer right_aligned;
-	Format::print(ast, menu, &s, &right_aligned,
-		discard_colors ? Format::Flags::Tag | Format::Flags::OutputSwitch : Format::Flags::All
-	);
-	if (!right_aligned.str().empty())
+	const auto &row = renderRow(s, &ast, menu.getWidth(), discard_colors,
+		[&](RenderedRow &r) {
+			Format::print(ast, r.buffer, &s, &r.right_aligned,
+				discard_colors ? Format::Flags::Tag | Format::Flags::OutputSwitch : Format::Flags::All
+			);
+			r.right_aligned_width = wideLength(ToWString(r.right_aligned.str()));
+		});
+	menu << row.buffer;
+	if (!row.right_aligned.str().empty())
 	{
-		size_t x_off = menu.getWidth() - wideLength(ToWString(right_aligned.str()));
+		size_t x_off = menu.getWidth() - row.right_aligned_width;
 		if (menu.isHighlighted() && list.currentS()->song() == &s)
 		{
 			if (menu.highlightSuffix() == Config.current_item_suffix)
@@ -162,55 +273,21 @@ void showSongs(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list, cons
 			x_off -= Config.now_playing_suffix_length;
 		if (is_selected)
 			x_off -= Config.selected_item_suffix_length;
-		menu << NC::TermManip::ClearToEOL << NC::XY(x_off, y) << right_aligned;
+		menu << NC::TermManip::ClearToEOL << NC::XY(x_off, y) << row.right_aligned;
 	}
 
 	unsetProperties(menu, separate_albums, is_now_playing, is_in_playlist);
 }
 
-template <typename T>
-void showSongsInColumns(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list)
+void layOutColumns(NC::Buffer &buffer, const MPD::Song &s, int menu_width,
+                   bool discard_colors)
 {
-	if (Config.columns.empty())
-		return;
-
-	bool separate_albums, is_now_playing, is_selected, is_in_playlist, discard_colors;
-	setProperties(menu, s, list, separate_albums, is_now_playing, is_selected,
-	              is_in_playlist, discard_colors);
-
-	int menu_width = menu.getWidth();
-	if (menu.isHighlighted() && list.currentS()->song() == &s)
-	{
-		if (menu.highlightPrefix() == Config.current_item_prefix)
-			menu_width -= Config.current_item_prefix_length;
-		else
-			menu_width -= Config.current_item_inactive_column_prefix_length;
-
-		if (menu.highlightSuffix() == Config.current_item_suffix)
-			menu_width -= Config.current_item_suffix_length;
-		else
-			menu_width -= Config.current_item_inactive_column_suffix_length;
-	}
-	if (is_now_playing)
-	{
-		menu_width -= Config.now_playing_prefix_length;
-		menu_width -= Config.now_playing_suffix_length;
-	}
-	if (is_selected)
-	{
-		menu_width -= Config.selected_item_prefix_length;
-		menu_width -= Config.selected_item_suffix_length;
-	}
-
 	int width;
-	int y = menu.getY();
 	int remained_width = menu_width;
 
 	std::vector<Column>::const_iterator it, last = Config.columns.end() - 1;
 	for (it = Config.columns.begin(); it != Config.columns.end(); ++it)
 	{
-		// check current X coordinate
-		int x = menu.getX();
 		// column has relative width and all after it have fixed width,
 		// so stretch it so it fills whole screen along with these after.
 		if (it->stretch_limit >= 0) // (*)
@@ -242,35 +319,84 @@ void showSongsInColumns(NC::Menu<T> &menu, const MPD::Song &s, const SongList &l
 			tag = ToWString(Config.empty_tag);
 		wideCut(tag, width);
 
-		if (!discard_colors && it->color != NC::Color::Default)
-			menu << it->color;
-
-		int x_off = 0;
 		// if column uses right alignment, calculate proper offset.
 		// otherwise just assume offset is 0, ie. we start from the left.
-		if (it->right_alignment)
-			x_off = std::max(0, width - int(wideLength(tag)));
+		int tag_width = wideLength(tag);
+		int x_off = it->right_alignment ? std::max(0, width - tag_width) : 0;
+
+		if (!discard_colors && it->color != NC::Color::Default)
+			buffer << it->color;
 
-		whline(menu.raw(), NC::Key::Space, width);
-		menu.goToXY(x + x_off, y);
-		menu << tag;
-		menu.goToXY(x + width, y);
+		buffer << std::string(x_off, NC::Key::Space)
+		       << ToString(tag)
+		       << std::string(width - x_off - tag_width, NC::Key::Space);
 		if (it != last)
 		{
 			// add missing width's part and restore the value.
-			menu << ' ';
+			buffer << ' ';
 			remained_width -= width+1;
 		}
 
 		if (!discard_colors && it->color != NC::Color::Default)
-			menu << NC::Color::End;
+			buffer << NC::Color::End;
+	}
+}
+
+template <typename T>
+void showSongsInColumns(NC::Menu<T> &menu, const MPD::Song &s, const SongList &list)
+{
+	if (Config.columns.empty())
+		return;
+
+	bool separate_albums, is_now_playing, is_selected, is_in_playlist, discard_colors;
+	setProperties(menu, s, list, separate_albums, is_now_playing, is_selected,
+	              is_in_playlist, discard_colors);
+
+	int menu_width = menu.getWidth();
+	if (menu.isHighlighted() && list.currentS()->song() == &s)
+	{
+		if (menu.highlightPrefix() == Config.current_item_prefix)
+			menu_width -= Config.current_item_prefix_length;
+		else
+			menu_width -= Config.current_item_inactive_column_prefix_length;
+
+		if (menu.highlightSuffix() == Config.current_item_suffix)
+			menu_width -= Config.current_item_suffix_length;
+		else
+			menu_width -= Config.current_item_inactive_column_suffix_length;
+	}
+	if (is_now_playing)
+	{
+		menu_width -= Config.now_playing_prefix_length;
+		menu_width -= Config.now_playing_suffix_length;
+	}
+	if (is_selected)
+	{
+		menu_width -= Config.selected_item_prefix_length;
+		menu_width -= Config.selected_item_suffix_length;
 	}
 
+	const auto &row = renderRow(s, &Config.columns, menu_width, discard_colors,
+		[&](RenderedRow &r) {
+			layOutColumns(r.buffer, s, menu_width, discard_colors);
+		});
+	menu << row.buffer;
+
 	unsetProperties(menu, separate_albums, is_now_playing, is_in_playlist);
 }
 
 }
 
+const Display::RenderCacheStats &Display::renderCacheStats()
+{
+	return render_cache_stats;
+}
+
+void Display::clearRenderCache()
+{
+	render_cache.clear();
+}
+
 std::string Display::Columns(size_t list_width)
 {
 	std::string result;
@@ -351,6 +477,11 @@ void Display::Songs(NC::Menu<MPD::Song> &menu, const SongList &list, const Forma
 	showSongs(menu, menu.drawn()->value(), list, ast);
 }
 
+size_t Display::SongsKey(const NC::Menu<MPD::Song> &menu, const SongList &list)
+{
+	return songKey(menu, menu.drawn()->value(), list);
+}
+
 #ifdef HAVE_TAGLIB_H
 void Display::Tags(NC::Menu<MPD::MutableSong> &menu)
 {
@@ -404,6 +535,32 @@ void Display::Items(NC::Menu<MPD::Item> &menu, const SongList &list)
 	}
 }
 
+size_t Display::ItemsKey(const NC::Menu<MPD::Item> &menu, const SongList &list)
+{
+	const MPD::Item &item = menu.drawn()->value();
+	size_t key = 0;
+	boost::hash_combine(key, static_cast<int>(item.type()));
+	switch (item.type())
+	{
+		case MPD::Item::Type::Directory:
+			boost::hash_combine(key, item.directory().path());
+			break;
+		case MPD::Item::Type::Song:
+		{
+			size_t song_key = songKey(menu, item.song(), list);
+			if (song_key == 0)
+				return 0;
+			boost::hash_combine(key, static_cast<int>(Config.browser_display_mode));
+			boost::hash_combine(key, song_key);
+			break;
+		}
+		case MPD::Item::Type::Playlist:
+			boost::hash_combine(key, item.playlist().path());
+			break;
+	}
+	return key;
+}
+
 void Display::SEItems(NC::Menu<SEItem> &menu, const SongList &list)
 {
 	const SEItem &si = menu.drawn()->value();
@@ -422,3 +579,20 @@ void Display::SEItems(NC::Menu<SEItem> &menu, const SongList &list)
 	else
 		menu << si.buffer();
 }
+
+size_t Display::SEItemsKey(const NC::Menu<SEItem> &menu, const SongList &list)
+{
+	const SEItem &si = menu.drawn()->value();
+	size_t key = 0;
+	if (si.isSong())
+	{
+		size_t song_key = songKey(menu, si.song(), list);
+		if (song_key == 0)
+			return 0;
+		boost::hash_combine(key, static_cast<int>(Config.search_engine_display_mode));
+		boost::hash_combine(key, song_key);
+	}
+	else
+		boost::hash_combine(key, si.bufferSerial());
+	return key;
+}
@@ -30,6 +30,19 @@
 
 namespace Display {
 
+/// Songs are laid out once and then redrawn from the cache as long as
+/// nothing that affects their look changes.
+struct RenderCacheStats
+{
+	size_t hits = 0;
+	size_t misses = 0;
+};
+
+const RenderCacheStats &renderCacheStats();
+
+/// Drop all cached rows, e.g. after the screen was resized.
+void clearRenderCache();
+
 std::string Columns(size_t);
 
 void SongsInColumns(NC::Menu<MPD::Song> &menu, const SongList &list);
@@ -42,6 +55,13 @@ void SEItems(NC::Menu<SEItem> &menu, const SongList &list);
 
 void Items(NC::Menu<MPD::Item> &menu, const SongList &list);
 
+/// Keys of rows drawn by the functions above, see NC::Menu::setRowKey().
+size_t SongsKey(const NC::Menu<MPD::Song> &menu, const SongList &list);
+
+size_t SEItemsKey(const NC::Menu<SEItem> &menu, const SongList &list);
+
+size_t ItemsKey(const NC::Menu<MPD::Item> &menu, const SongList &list);
+
 }
 
 #endif // NCMPCPP_DISPLAY_H
@@ -221,10 +221,101 @@ expressions<CharT> parseBracket(const string<CharT> &s,
 	return result;
 }
 
+template <typename CharT>
+struct Compiler: boost::static_visitor<>
+{
+	typedef Format::Program<CharT> ProgramT;
+	typedef typename ProgramT::Op Op;
+
+	Compiler(ProgramT &program)
+	: m_program(program)
+	{ }
+
+	void operator()(const string<CharT> &s)
+	{
+		// Empty strings don't print anything, so they're left out.
+		if (!s.empty())
+		{
+			emit(Op::String, m_program.strings.size());
+			m_program.strings.push_back(s);
+		}
+	}
+
+	void operator()(const NC::Color &c)
+	{
+		emit(Op::Color, m_program.colors.size());
+		m_program.colors.push_back(c);
+	}
+
+	void operator()(NC::Format fmt)
+	{
+		emit(Op::Format, static_cast<uint32_t>(fmt));
+	}
+
+	void operator()(Format::OutputSwitch)
+	{
+		emit(Op::OutputSwitch, 0);
+	}
+
+	void operator()(const Format::SongTag &st)
+	{
+		emit(Op::SongTag, m_program.tags.size());
+		m_program.tags.push_back(st);
+	}
+
+	void operator()(const Format::Group<CharT> &group)
+	{
+		list(Op::Group, group.base());
+	}
+
+	void operator()(const Format::FirstOf<CharT> &first_of)
+	{
+		list(Op::FirstOf, first_of.base());
+	}
+
+	void list(Op op, const expressions<CharT> &exprs)
+	{
+		size_t pc = emit(op, 0);
+		for (const auto &ex : exprs)
+			boost::apply_visitor(*this, ex);
+		m_program.code[pc].next = m_program.code.size();
+	}
+
+private:
+	size_t emit(Op op, size_t arg)
+	{
+		size_t pc = m_program.code.size();
+		m_program.code.push_back({op, uint32_t(arg), uint32_t(pc + 1)});
+		return pc;
+	}
+
+	ProgramT &m_program;
+};
+
+template <typename CharT>
+Format::Program<CharT> compileExpressions(const expressions<CharT> &exprs)
+{
+	Format::Program<CharT> program;
+	Compiler<CharT> compiler(program);
+	for (const auto &ex : exprs)
+		boost::apply_visitor(compiler, ex);
+	return program;
+}
+
 }
 
 namespace Format {
 
+Program<char> compile(const std::vector<Expression<char>> &expressions)
+{
+	return compileExpressions(expressions);
+}
+
+Program<wchar_t> compile(const std::vector<Expression<wchar_t>> &expressions)
+{
+	return compileExpressions(expressions);
+}
+
 AST<char> parse(const std::string &s, const unsigned flags)
 {
 	return AST<char>(parseBracket(s, s.begin(), s.end(), flags));
@@ -22,6 +22,8 @@
 #define NCMPCPP_HAVE_FORMAT_H
 
 #include <boost/variant.hpp>
+#include <cstdint>
+#include <memory>
 
 #include "curses/menu.h"
 #include "song.h"
@@ -106,6 +108,56 @@ private:
 	Base m_base;
 };
 
+// Format lowered to a flat list of instructions, which is what print() and
+// friends run instead of walking the tree.
+template <typename CharT>
+struct Program
+{
+	enum class Op : uint8_t { String, Color, Format, OutputSwitch, SongTag, Group, FirstOf };
+
+	struct Instruction
+	{
+		Op op;
+		// Index into strings, colors or tags, or value of NC::Format.
+		uint32_t arg;
+		// Index of the instruction that follows this expression. Body of a
+		// group is a sequence of expressions between the group and its next
+		// instruction, body of FirstOf is a sequence of its alternatives.
+		uint32_t next;
+	};
+
+	std::vector<Instruction> code;
+	std::vector<std::basic_string<CharT>> strings;
+	std::vector<NC::Color> colors;
+	std::vector<SongTag> tags;
+};
+
+Program<char> compile(const std::vector<Expression<char>> &expressions);
+Program<wchar_t> compile(const std::vector<Expression<wchar_t>> &expressions);
+
+template <typename CharT>
+struct List<ListType::AST, CharT>
+{
+	typedef std::vector<Expression<CharT>> Base;
+
+	List() { }
+	List(Base &&base_)
+	: m_base(std::move(base_))
+	, m_program(std::make_shared<Program<CharT>>(compile(m_base)))
+	{ }
+
+	// The program is compiled from the expressions, so they can't be modified.
+	const Base &base() const { return m_base; }
+
+	// Null if the format was default constructed.
+	const Program<CharT> *program() const { return m_program.get(); }
+
+private:
+	Base m_base;
+	// Shared between copies, they're immutable.
+	std::shared_ptr<const Program<CharT>> m_program;
+};
+
 template <typename CharT, typename VisitorT>
 void visit(VisitorT &visitor, const AST<CharT> &ast);
 
@@ -117,12 +169,21 @@ template <typename CharT>
 void print(const AST<CharT> &ast, NC::BasicBuffer<CharT> &buffer,
            const MPD::Song *song, const unsigned flags = Flags::All);
 
+template <typename CharT>
+void print(const AST<CharT> &ast, NC::BasicBuffer<CharT> &buffer,
+           const MPD::Song *song, NC::BasicBuffer<CharT> *second_buffer,
+           const unsigned flags = Flags::All);
+
 template <typename CharT>
 std::basic_string<CharT> stringify(const AST<CharT> &ast, const MPD::Song *song);
 
 template <typename CharT>
 TagVector<CharT> flatten(const AST<CharT> &ast, const MPD::Song &song);
 
+// Return distinct song tag functions referenced anywhere in the format.
+template <typename CharT>
+std::vector<MPD::Song::GetFunction> songTags(const AST<CharT> &ast);
+
 AST<char> parse(const std::string &s, const unsigned flags = Flags::All);
 AST<wchar_t> parse(const std::wstring &ws, const unsigned flags = Flags::All);
 
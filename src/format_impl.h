@@ -21,6 +21,9 @@
 #ifndef NCMPCPP_HAVE_FORMAT_IMPL_H
 #define NCMPCPP_HAVE_FORMAT_IMPL_H
 
+#include <algorithm>
+#include <cassert>
+#include <boost/optional.hpp>
 #include <boost/variant.hpp>
 
 #include "curses/menu.h"
@@ -66,9 +69,11 @@ inline Result &operator+=(Result &base, Result result)
 }*/
 
 template <typename CharT, typename OutputT, typename SecondOutputT = OutputT>
-struct Printer: boost::static_visitor<Result>
+struct Printer
 {
 	typedef std::basic_string<CharT> StringT;
+	typedef Program<CharT> ProgramT;
+	typedef typename ProgramT::Op Op;
 
 	Printer(OutputT &os, const MPD::Song *song, SecondOutputT *second_os, const unsigned flags)
 	: m_output(os)
@@ -77,105 +82,141 @@ struct Printer: boost::static_visitor<Result>
 	, m_second_os(second_os)
 	, m_no_output(0)
 	, m_flags(flags)
+	, m_program(nullptr)
 	{ }
 
-	Result operator()(const StringT &s)
+	void run(const AST<CharT> &ast)
 	{
-		if (!s.empty())
-		{
-			output(s);
-			return Result::Ok;
-		}
-		else
-			return Result::Empty;
-	}
-
-	Result operator()(const NC::Color &c)
-	{
-		if (m_flags & Flags::Color)
-			output(c);
-		return Result::Empty;
+		m_program = ast.program();
+		if (m_program == nullptr)
+			return;
+		m_tags.clear();
+		for (uint32_t pc = 0; pc < m_program->code.size();)
+			exec(pc);
 	}
 
-	Result operator()(NC::Format fmt)
-	{
-		if (m_flags & Flags::Format)
-			output(fmt);
-		return Result::Empty;
-	}
-
-	Result operator()(OutputSwitch)
-	{
-		if (!m_no_output)
-			m_output_switched = true;
-		return Result::Ok;
-	}
-
-	Result operator()(const SongTag &st)
+private:
+	// Execute expression at pc and move pc to the one after it.
+	Result exec(uint32_t &pc)
 	{
-		StringT tags;
-		if (m_flags & Flags::Tag && m_song != nullptr)
-		{
-			tags = convertString<CharT, char>::apply(
-				m_song->getTags(st.function())
-			);
-		}
-		if (!tags.empty())
+		const auto &ins = m_program->code[pc];
+		switch (ins.op)
 		{
-			if (st.delimiter() > 0)
+			case Op::String:
+				++pc;
+				output(m_program->strings[ins.arg]);
+				return Result::Ok;
+			case Op::Color:
+				++pc;
+				if (m_flags & Flags::Color)
+					output(m_program->colors[ins.arg]);
+				return Result::Empty;
+			case Op::Format:
+				++pc;
+				if (m_flags & Flags::Format)
+					output(static_cast<NC::Format>(ins.arg));
+				return Result::Empty;
+			case Op::OutputSwitch:
+				++pc;
+				if (!m_no_output)
+					m_output_switched = true;
+				return Result::Ok;
+			case Op::SongTag:
 			{
-				// shorten date/length by simple truncation
-				if (st.function() == &MPD::Song::getDate
-				    || st.function() == &MPD::Song::getLength)
-					tags.resize(st.delimiter());
+				++pc;
+				const StringT &tags = tag(ins.arg);
+				if (!tags.empty())
+				{
+					output(tags, &m_program->tags[ins.arg]);
+					return Result::Ok;
+				}
 				else
-					tags = wideShorten(tags, st.delimiter());
+					return Result::Missing;
+			}
+			case Op::Group:
+			{
+				// Check whether the group is printed without printing it, then
+				// print it if it is (unless it's nested in another group that
+				// is being checked).
+				uint32_t begin = pc + 1;
+				pc = ins.next;
+				++m_no_output;
+				Result result = sequence(begin, pc);
+				--m_no_output;
+				if (!m_no_output && result == Result::Ok)
+					sequence(begin, pc);
+				return result;
+			}
+			case Op::FirstOf:
+			{
+				// If all Empty or Missing -> Empty, if any Ok -> stop with Ok.
+				uint32_t end = ins.next;
+				for (uint32_t alt = pc + 1; alt < end;)
+				{
+					if (exec(alt) == Result::Ok)
+					{
+						pc = end;
+						return Result::Ok;
+					}
+				}
+				pc = end;
+				return Result::Empty;
 			}
-			output(tags, &st);
-			return Result::Ok;
 		}
-		else
-			return Result::Missing;
+		assert(false);
+		return Result::Empty;
 	}
 
 	// If all Empty -> Empty, if any Ok -> continue with Ok, if any Missing ->
 	// stop with Empty.
-	Result operator()(const Group<CharT> &group)
+	Result sequence(uint32_t pc, uint32_t end)
 	{
-		auto visit = [this, &group] {
-			Result result = Result::Empty;
-			for (const auto &ex : group.base())
-			{
-				result += boost::apply_visitor(*this, ex);
-				if (result == Result::Missing)
-				{
-					result = Result::Empty;
-					break;
-				}
-			}
-			return result;
-		};
-
-		++m_no_output;
-		Result result = visit();
-		--m_no_output;
-		if (!m_no_output && result == Result::Ok)
-			visit();
+		Result result = Result::Empty;
+		while (pc < end)
+		{
+			result += exec(pc);
+			if (result == Result::Missing)
+				return Result::Empty;
+		}
 		return result;
 	}
 
-	// If all Empty or Missing -> Empty, if any Ok -> stop with Ok.
-	Result operator()(const FirstOf<CharT> &first_of)
+	// Tags within groups are needed twice, first to check whether the group
+	// is printed and then to print it, so the ones fetched during the check
+	// are kept until the end.
+	const StringT &tag(uint32_t idx)
 	{
-		for (const auto &ex : first_of.base())
+		if (idx < m_tags.size() && m_tags[idx])
+			return *m_tags[idx];
+		StringT *result = &m_tag;
+		if (m_no_output)
 		{
-			if (boost::apply_visitor(*this, ex) == Result::Ok)
-				return Result::Ok;
+			if (m_tags.empty())
+				m_tags.resize(m_program->tags.size());
+			m_tags[idx].emplace();
+			result = &*m_tags[idx];
 		}
-		return Result::Empty;
+		const SongTag &st = m_program->tags[idx];
+		if (m_flags & Flags::Tag && m_song != nullptr)
+		{
+			*result = convertString<CharT, char>::apply(
+				m_song->getTags(st.function())
+			);
+		}
+		else
+			result->clear();
+		if (!result->empty() && st.delimiter() > 0)
+		{
+			// shorten date/length by simple truncation
+			if (st.function() == &MPD::Song::getDate
+			    || st.function() == &MPD::Song::getLength)
+				result->resize(st.delimiter());
+			else
+				*result = wideShorten(*result, st.delimiter());
+		}
+		return *result;
 	}
 
-private:
 	// generic version for streams (buffers, menus)
 	template <typename ValueT, typename OutputStreamT>
 	struct output_ {
@@ -251,6 +292,37 @@ private:
 
 	unsigned m_no_output;
 	const unsigned m_flags;
+
+	const ProgramT *m_program;
+	std::vector<boost::optional<StringT>> m_tags;
+	StringT m_tag;
+};
+
+template <typename CharT>
+struct TagCollector: boost::static_visitor<>
+{
+	TagCollector(std::vector<MPD::Song::GetFunction> &tags)
+	: m_tags(tags)
+	{ }
+
+	template <typename T>
+	void operator()(const T &) { }
+
+	void operator()(const SongTag &st)
+	{
+		if (std::find(m_tags.begin(), m_tags.end(), st.function()) == m_tags.end())
+			m_tags.push_back(st.function());
+	}
+
+	template <ListType Type>
+	void operator()(const List<Type, CharT> &list)
+	{
+		for (const auto &ex : list.base())
+			boost::apply_visitor(*this, ex);
+	}
+
+private:
+	std::vector<MPD::Song::GetFunction> &m_tags;
 };
 
 template <typename CharT, typename VisitorT>
@@ -265,7 +337,7 @@ void print(const AST<CharT> &ast, NC::Menu<ItemT> &menu, const MPD::Song *song,
            NC::BasicBuffer<CharT> *buffer, const unsigned flags)
 {
 	Printer<CharT, NC::Menu<ItemT>, NC::Buffer> printer(menu, song, buffer, flags);
-	visit(printer, ast);
+	printer.run(ast);
 }
 
 template <typename CharT>
@@ -273,7 +345,16 @@ void print(const AST<CharT> &ast, NC::BasicBuffer<CharT> &buffer,
            const MPD::Song *song, const unsigned flags)
 {
 	Printer<CharT, NC::BasicBuffer<CharT>> printer(buffer, song, &buffer, flags);
-	visit(printer, ast);
+	printer.run(ast);
+}
+
+template <typename CharT>
+void print(const AST<CharT> &ast, NC::BasicBuffer<CharT> &buffer,
+           const MPD::Song *song, NC::BasicBuffer<CharT> *second_buffer,
+           const unsigned flags)
+{
+	Printer<CharT, NC::BasicBuffer<CharT>> printer(buffer, song, second_buffer, flags);
+	printer.run(ast);
 }
 
 template <typename CharT>
@@ -281,7 +362,7 @@ std::basic_string<CharT> stringify(const AST<CharT> &ast, const MPD::Song *song)
 {
 	std::basic_string<CharT> result;
 	Printer<CharT, std::basic_string<CharT>> printer(result, song, &result, Flags::Tag);
-	visit(printer, ast);
+	printer.run(ast);
 	return result;
 }
 
@@ -290,7 +371,16 @@ TagVector<CharT> flatten(const AST<CharT> &ast, const MPD::Song &song)
 {
 	TagVector<CharT> result;
 	Printer<CharT, TagVector<CharT>> printer(result, &song, &result, Flags::Tag);
-	visit(printer, ast);
+	printer.run(ast);
+	return result;
+}
+
+template <typename CharT>
+std::vector<MPD::Song::GetFunction> songTags(const AST<CharT> &ast)
+{
+	std::vector<MPD::Song::GetFunction> result;
+	TagCollector<CharT> collector(result);
+	visit(collector, ast);
 	return result;
 }
 
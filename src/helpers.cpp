@@ -47,7 +47,7 @@ void deleteSelectedSongsFromPlaylist(NC::Menu<MPD::Song> &playlist)
 	selectCurrentIfNoneSelected(playlist);
 	boost::optional<int> range_end;
 	Mpd.StartCommandsList();
-	for (auto &s : boost::adaptors::reverse(playlist))
+	for (auto &&s : boost::adaptors::reverse(playlist))
 	{
 		if (s.isSelected())
 		{
@@ -29,7 +29,7 @@ template <typename SongT>
 struct SongPropertiesExtractor
 {
 	template <typename ItemT>
-	auto &operator()(ItemT &item) const
+	auto &operator()(ItemT &&item) const
 	{
 		return m_cache.assign(&item.properties(), &item.value());
 	}
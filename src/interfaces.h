@@ -25,6 +25,7 @@
 #include <boost/tuple/tuple.hpp>
 #include <string>
 #include "enums.h"
+#include "mpdpp.h"
 #include "screens/screen.h"
 #include "song.h"
 
@@ -58,6 +59,14 @@ struct HasSongs
 	virtual std::vector<MPD::Song> getSelectedSongs() = 0;
 };
 
+// Screens that can describe their selected songs as database queries, so that
+// MPD can add them to playlists without sending them to the client first.
+struct HasSongQueries
+{
+	// Empty result means the selection can't be described this way.
+	virtual std::vector<MPD::TagConstraints> getSelectedQueries() = 0;
+};
+
 struct HasColumns
 {
 	virtual bool previousColumnAvailable() = 0;
@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "library_index.h"
+
+namespace {
+
+// Distinct values of the tag. Songs without it have a single empty value.
+std::vector<std::string> tagValues(const MPD::Song &s, mpd_tag_type type)
+{
+	std::vector<std::string> result;
+	std::string value;
+	for (unsigned idx = 0; !(value = s.get(type, idx)).empty(); ++idx)
+		if (std::find(result.begin(), result.end(), value) == result.end())
+			result.push_back(std::move(value));
+	if (result.empty())
+		result.emplace_back();
+	return result;
+}
+
+}
+
+namespace MPD {
+
+bool songMatches(const Song &s, const TagConstraints &query)
+{
+	return std::all_of(query.begin(), query.end(), [&s](const TagConstraints::value_type &constraint) {
+		// An empty value matches songs without the tag.
+		if (constraint.second.empty())
+			return s.get(constraint.first).empty();
+		std::string value;
+		unsigned idx = 0;
+		while (!(value = s.get(constraint.first, idx++)).empty())
+			if (value == constraint.second)
+				return true;
+		return false;
+	});
+}
+
+void LibraryIndex::add(const Song &s)
+{
+	++m_size;
+	auto album = std::make_tuple(s.getAlbum(), m_split_by_date ? s.getDate() : "");
+	time_t mtime = s.getMTime();
+	for (auto &tag : tagValues(s, m_primary_tag))
+	{
+		if (tag.empty())
+			break;
+		time_t &tag_mtime = m_tags[tag];
+		tag_mtime = std::max(tag_mtime, mtime);
+		time_t &album_mtime = m_tag_albums[tag][album];
+		album_mtime = std::max(album_mtime, mtime);
+		m_tag_songs[std::move(tag)].push_back(s);
+	}
+	for (auto &value : tagValues(s, MPD_TAG_ALBUM))
+		m_album_songs[std::move(value)].push_back(s);
+}
+
+const LibraryIndex::TagAlbums &LibraryIndex::albums(const std::string &tag) const
+{
+	static const TagAlbums empty;
+	auto it = m_tag_albums.find(tag);
+	return it != m_tag_albums.end() ? it->second : empty;
+}
+
+LibraryIndex::Albums LibraryIndex::albums(bool by_tag) const
+{
+	Albums result;
+	for (const auto &tag : m_tag_albums)
+	{
+		for (const auto &album : tag.second)
+		{
+			time_t &mtime = result[std::make_tuple(
+				by_tag ? tag.first : "",
+				std::get<0>(album.first),
+				std::get<1>(album.first))];
+			mtime = std::max(mtime, album.second);
+		}
+	}
+	return result;
+}
+
+std::vector<Song> LibraryIndex::songs(const TagConstraints &query) const
+{
+	// Start with the smallest group of songs the query is constrained to.
+	const std::vector<Song> *candidates = nullptr;
+	for (const auto &constraint : query)
+	{
+		const std::map<std::string, std::vector<Song>> *groups;
+		if (constraint.first == MPD_TAG_ALBUM)
+			groups = &m_album_songs;
+		else if (constraint.first == m_primary_tag && !constraint.second.empty())
+			groups = &m_tag_songs;
+		else
+			continue;
+		auto it = groups->find(constraint.second);
+		if (it == groups->end())
+			return {};
+		if (candidates == nullptr || it->second.size() < candidates->size())
+			candidates = &it->second;
+	}
+	if (candidates == nullptr)
+		throw std::logic_error("query is not constrained by the primary tag or album");
+
+	std::vector<Song> result;
+	for (const auto &s : *candidates)
+		if (songMatches(s, query))
+			result.push_back(s);
+	return result;
+}
+
+}
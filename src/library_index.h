@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_LIBRARY_INDEX_H
+#define NCMPCPP_LIBRARY_INDEX_H
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "mpdpp.h"
+#include "song.h"
+
+namespace MPD {
+
+// Whether the song would be found by an exact search with the query.
+bool songMatches(const Song &s, const TagConstraints &query);
+
+// Songs of the database grouped by the primary tag of the media library and
+// their albums, so that its columns can be filled without asking MPD.
+// Songs without the primary tag are only reachable through their albums.
+struct LibraryIndex
+{
+	typedef std::map<std::string, time_t> Tags;
+	// Album and date (empty if albums are not split by date).
+	typedef std::map<std::tuple<std::string, std::string>, time_t> TagAlbums;
+	// Primary tag (empty if not grouped by it), album and date.
+	typedef std::map<std::tuple<std::string, std::string, std::string>, time_t> Albums;
+
+	LibraryIndex(mpd_tag_type primary_tag, bool split_by_date)
+	: m_primary_tag(primary_tag), m_split_by_date(split_by_date), m_size(0)
+	{ }
+
+	LibraryIndex(const LibraryIndex &) = delete;
+	LibraryIndex &operator=(const LibraryIndex &) = delete;
+
+	void add(const Song &s);
+
+	mpd_tag_type primaryTag() const { return m_primary_tag; }
+	bool splitByDate() const { return m_split_by_date; }
+
+	// Values of the primary tag with the modification time of their newest song.
+	const Tags &tags() const { return m_tags; }
+
+	// Albums of songs with the given value of the primary tag.
+	const TagAlbums &albums(const std::string &tag) const;
+
+	// Albums of songs with the primary tag, grouped by it if by_tag is set.
+	Albums albums(bool by_tag) const;
+
+	// Songs that would be found by an exact search with the query, which
+	// needs to be constrained by the primary tag or the album.
+	std::vector<Song> songs(const TagConstraints &query) const;
+
+	size_t size() const { return m_size; }
+
+private:
+	mpd_tag_type m_primary_tag;
+	bool m_split_by_date;
+	size_t m_size;
+
+	Tags m_tags;
+	std::map<std::string, TagAlbums> m_tag_albums;
+	std::map<std::string, std::vector<Song>> m_tag_songs;
+	std::map<std::string, std::vector<Song>> m_album_songs;
+};
+
+}
+
+#endif // NCMPCPP_LIBRARY_INDEX_H
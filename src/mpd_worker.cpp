@@ -0,0 +1,499 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mpd_worker.h"
+#include "statusbar.h"
+
+MPD::Worker MpdWorker;
+
+namespace {
+
+// number of songs handed over to the main thread at once
+const size_t SongBatchSize = 1024;
+
+}
+
+namespace MPD {
+
+bool SongStream::take(std::vector<Song> &songs, bool wait)
+{
+	assert(active());
+	std::unique_lock<std::mutex> lock(m_state->mutex);
+	if (wait)
+		m_state->cv.wait(lock, [this] { return m_state->finished; });
+	if (songs.empty())
+		songs = std::move(m_state->songs);
+	else
+		songs.insert(songs.end(),
+		             std::make_move_iterator(m_state->songs.begin()),
+		             std::make_move_iterator(m_state->songs.end()));
+	m_state->songs.clear();
+	if (!m_state->finished)
+		return true;
+	auto error = m_state->error;
+	lock.unlock();
+	m_state = nullptr;
+	if (error)
+		std::rethrow_exception(error);
+	return false;
+}
+
+void SongStream::cancel()
+{
+	if (m_state)
+	{
+		m_state->cancelled = true;
+		m_state = nullptr;
+	}
+}
+
+Worker::Worker()
+: m_state(std::make_shared<State>())
+{
+	if (pipe(m_state->notification_pipe) == 0)
+	{
+		for (int fd : m_state->notification_pipe)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	else
+		m_state->notification_pipe[0] = m_state->notification_pipe[1] = -1;
+}
+
+Worker::~Worker()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->stop = true;
+		// Tasks reference the worker, so the one that is running can't outlive
+		// it. If it waits for the server, make it fail right away.
+		if (m_state->connection_fd >= 0)
+			shutdown(m_state->connection_fd, SHUT_RDWR);
+	}
+	m_state->cv.notify_one();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+int Worker::notificationFD()
+{
+	return m_state->notification_pipe[0];
+}
+
+void Worker::dispatch()
+{
+	char buf[64];
+	while (read(m_state->notification_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	std::vector<std::function<void()>> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		callbacks.swap(m_state->callbacks);
+	}
+	for (auto &callback : callbacks)
+		callback();
+}
+
+void Worker::run(Task task)
+{
+	Job job;
+	job.task = std::move(task);
+	job.host = Mpd.GetHostname();
+	job.port = Mpd.GetPort();
+	job.timeout = Mpd.GetTimeout();
+	job.password = Mpd.GetPassword();
+	job.tag_types = Mpd.GetEnabledTagTypes();
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->jobs.push_back(std::move(job));
+	}
+	m_state->cv.notify_one();
+	if (!m_thread.joinable())
+		m_thread = std::thread(loop, m_state);
+}
+
+void Worker::post(std::function<void()> callback)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->callbacks.push_back(std::move(callback));
+	}
+	notify(*m_state);
+}
+
+SongStream Worker::streamDirectoryRecursive(const std::string &directory)
+{
+	return streamSongs([directory](Connection &connection, const SongSink &sink) {
+		SongIterator s = connection.GetDirectoryRecursive(directory), end;
+		for (; s != end && sink(std::move(*s)); ++s)
+			;
+	});
+}
+
+SongStream Worker::streamDatabase()
+{
+	return streamSongs([this](Connection &connection, const SongSink &sink) {
+		listDatabase(connection, sink);
+	});
+}
+
+SongStream Worker::streamDatabase(std::vector<SearchIndex::Query> queries)
+{
+	return streamSongs([this, queries](Connection &connection, const SongSink &sink) {
+		if (m_snapshot_directory.empty() || queries.empty())
+		{
+			listDatabase(connection, sink);
+			return;
+		}
+		if (updateSnapshot(connection, &sink) || !m_state->snapshot)
+			return;
+
+		auto &index = m_state->index;
+		bool built = !index;
+		if (built)
+		{
+			auto start = std::chrono::steady_clock::now();
+			index = std::make_unique<SearchIndex>();
+			for (const auto &s : m_state->snapshot->songs())
+				index->add(s);
+			m_state->index_build_time = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count();
+		}
+		IndexStatistics statistics;
+		statistics.songs = index->songs();
+		statistics.bytes = index->bytes();
+		statistics.buildTime = m_state->index_build_time;
+		post([this, statistics, built] {
+			m_index_statistics = statistics;
+			if (built)
+				Statusbar::printf("Search index of %1% songs built in %2% ms (%3% KiB)",
+				                  statistics.songs,
+				                  static_cast<unsigned>(statistics.buildTime),
+				                  statistics.bytes / 1024);
+		});
+
+		std::vector<Song> candidates;
+		if (index->candidates(queries, candidates))
+		{
+			for (auto &s : candidates)
+				if (!sink(std::move(s)))
+					break;
+		}
+		else
+		{
+			for (auto s : m_state->snapshot->songs())
+				if (!sink(std::move(s)))
+					break;
+		}
+	});
+}
+
+void Worker::listDatabase(Connection &connection, const std::function<bool(Song &&)> &sink)
+{
+	if (m_snapshot_directory.empty())
+	{
+		SongIterator s = connection.GetDirectoryRecursive("/"), end;
+		for (; s != end && sink(std::move(*s)); ++s)
+			;
+		return;
+	}
+
+	if (updateSnapshot(connection, &sink) || !m_state->snapshot)
+		return;
+	for (auto s : m_state->snapshot->songs())
+		if (!sink(std::move(s)))
+			break;
+}
+
+void Worker::syncDatabase(DeltaCallback callback)
+{
+	if (m_snapshot_directory.empty())
+	{
+		callback(nullptr);
+		return;
+	}
+	run([this, callback](Connection &connection) {
+		try
+		{
+			// Fetching the whole database is left for when it's actually needed.
+			updateSnapshot(connection, nullptr);
+		}
+		catch (...)
+		{
+			// The database might have changed while it was being listed, the
+			// next attempt will start from the snapshot stored on disk.
+			m_state->snapshot.reset();
+			m_state->delta = std::make_unique<DatabaseDelta>();
+			post([callback] {
+				callback(nullptr);
+			});
+			throw;
+		}
+		std::shared_ptr<const DatabaseDelta> delta;
+		if (m_state->snapshot)
+			delta = std::move(m_state->delta);
+		m_state->delta = std::make_unique<DatabaseDelta>();
+		post([callback, delta] {
+			callback(delta);
+		});
+	});
+}
+
+void Worker::buildLibraryIndex(mpd_tag_type primary_tag, bool split_by_date,
+                               LibraryIndexCallback callback)
+{
+	assert(!m_snapshot_directory.empty());
+	run([this, primary_tag, split_by_date, callback](Connection &connection) {
+		auto index = std::make_shared<LibraryIndex>(primary_tag, split_by_date);
+		listDatabase(connection, [&index](Song &&s) {
+			index->add(s);
+			return true;
+		});
+		post([callback, index] {
+			callback(index);
+		});
+	});
+}
+
+bool Worker::updateSnapshot(Connection &connection, const SongSink *sink)
+{
+	auto db_update = connection.getStatistics().dbUpdateTime();
+	auto path = DatabaseSnapshot::path(
+		m_snapshot_directory, connection.GetHostname(), connection.GetPort());
+	auto tag_mask = DatabaseSnapshot::tagMask(connection.GetEnabledTagTypes());
+
+	bool streamed = false;
+	auto &snapshot = m_state->snapshot;
+	if (snapshot && snapshot->matches(path, db_update, tag_mask))
+		return streamed;
+	if (!snapshot || !snapshot->matches(path, snapshot->dbUpdate(), tag_mask))
+	{
+		snapshot = DatabaseSnapshot::load(path, tag_mask);
+		m_state->index.reset();
+	}
+
+	if (snapshot)
+	{
+		if (snapshot->dbUpdate() == db_update)
+			return streamed;
+		DatabaseDelta delta;
+		snapshot = MPD::syncDatabase(connection, *snapshot, std::move(path), db_update, tag_mask, delta);
+		if (auto &index = m_state->index)
+		{
+			for (const auto &s : delta.removed)
+				index->remove(s);
+			for (const auto &s : delta.added)
+				index->add(s);
+		}
+		if (m_state->delta)
+			m_state->delta->merge(std::move(delta));
+	}
+	else if (sink != nullptr)
+	{
+		// Without the previous version of the database it's not known what
+		// changed, so the whole one needs to be fetched.
+		m_state->delta.reset();
+		m_state->index.reset();
+		streamed = true;
+		std::vector<Directory> directories;
+		std::vector<Song> songs;
+		ItemIterator item = connection.GetDirectoryContent("/", true), end;
+		for (; item != end; ++item)
+		{
+			if (item->type() == Item::Type::Directory)
+				directories.push_back(std::move(item->directory()));
+			else if (item->type() == Item::Type::Song)
+			{
+				songs.push_back(item->song());
+				if (!(*sink)(std::move(item->song())))
+					return streamed;
+			}
+		}
+		std::sort(directories.begin(), directories.end(),
+		          [](const Directory &a, const Directory &b) {
+			          return a.path() < b.path();
+		          });
+		snapshot = std::make_shared<DatabaseSnapshot>(
+			std::move(path), db_update, tag_mask, std::move(directories), std::move(songs));
+	}
+	else
+		return streamed;
+
+	try
+	{
+		snapshot->save();
+	}
+	catch (std::runtime_error &e)
+	{
+		std::cerr << "Couldn't save database snapshot: " << e.what() << "\n";
+	}
+	return streamed;
+}
+
+SongStream Worker::streamSearch(const std::string &expression, bool exact_match,
+                                unsigned window_size)
+{
+	assert(window_size > 0);
+	return streamSongs([expression, exact_match, window_size](Connection &connection, const SongSink &sink) {
+		for (unsigned start = 0;; start += window_size)
+		{
+			connection.StartSearch(exact_match);
+			connection.AddSearchExpression(expression);
+			connection.AddSearchWindow(start, start + window_size);
+			unsigned received = 0;
+			SongIterator s = connection.CommitSearchSongs(), end;
+			for (; s != end; ++s, ++received)
+				if (!sink(std::move(*s)))
+					return;
+			// the last window is not full
+			if (received < window_size)
+				break;
+		}
+	});
+}
+
+SongStream Worker::streamSongs(SongProducer producer)
+{
+	SongStream stream;
+	stream.m_state = std::make_shared<SongStream::State>();
+	auto state = stream.m_state;
+	auto worker_state = m_state;
+	run([state, worker_state, producer](Connection &connection) {
+		auto push = [&](std::vector<Song> &batch) {
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->songs.insert(state->songs.end(),
+				                    std::make_move_iterator(batch.begin()),
+				                    std::make_move_iterator(batch.end()));
+			}
+			batch.clear();
+			notify(*worker_state);
+		};
+		std::exception_ptr error;
+		try
+		{
+			std::vector<Song> batch;
+			producer(connection, [&](Song &&s) {
+				if (state->cancelled || worker_state->stop)
+					return false;
+				batch.push_back(std::move(s));
+				if (batch.size() == SongBatchSize)
+					push(batch);
+				return true;
+			});
+			push(batch);
+		}
+		catch (ClientError &)
+		{
+			disconnect(*worker_state, connection);
+			error = std::current_exception();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->finished = true;
+			state->error = error;
+		}
+		state->cv.notify_all();
+		notify(*worker_state);
+	});
+	return stream;
+}
+
+void Worker::loop(std::shared_ptr<State> state)
+{
+	Connection connection;
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->cv.wait(lock, [&state] {
+				return state->stop || !state->jobs.empty();
+			});
+			if (state->stop)
+				break;
+			job = std::move(state->jobs.front());
+			state->jobs.pop_front();
+		}
+		try
+		{
+			if (connection.Connected()
+			    && (connection.GetHostname() != job.host
+			        || connection.GetPort() != job.port
+			        || connection.GetPassword() != job.password))
+				disconnect(*state, connection);
+			if (!connection.Connected())
+			{
+				connection.SetHostname(job.host);
+				connection.SetPort(job.port);
+				connection.SetTimeout(job.timeout);
+				connection.SetPassword(job.password);
+				connection.SetTagTypes(job.tag_types);
+				connection.Connect();
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (state->stop)
+					break;
+				state->connection_fd = connection.GetFD();
+			}
+			job.task(connection);
+		}
+		catch (std::exception &e)
+		{
+			if (dynamic_cast<ClientError *>(&e))
+				disconnect(*state, connection);
+			std::string msg = e.what();
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->callbacks.push_back([msg] {
+					Statusbar::printf("MPD (background connection): %1%", msg);
+				});
+			}
+			notify(*state);
+		}
+	}
+}
+
+void Worker::notify(State &state)
+{
+	[[maybe_unused]] ssize_t written = write(state.notification_pipe[1], "", 1);
+}
+
+void Worker::disconnect(State &state, Connection &connection)
+{
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.connection_fd = -1;
+	connection.Disconnect();
+}
+
+}
@@ -0,0 +1,218 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_MPD_WORKER_H
+#define NCMPCPP_MPD_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "db_snapshot.h"
+#include "db_sync.h"
+#include "library_index.h"
+#include "mpdpp.h"
+#include "search_index.h"
+
+namespace MPD {
+
+// Songs streamed by the worker, handed over to the main thread in batches.
+struct SongStream
+{
+	friend struct Worker;
+
+	bool active() const { return m_state.get() != nullptr; }
+
+	// Move songs received so far to the end of the vector and return true if
+	// there are more to come. If wait is set, block until the stream is
+	// exhausted. Errors that occurred in the worker are rethrown here.
+	bool take(std::vector<Song> &songs, bool wait = false);
+
+	// Stop the stream and detach from it.
+	void cancel();
+
+private:
+	struct State
+	{
+		State()
+		: cancelled(false), finished(false)
+		{ }
+
+		std::atomic<bool> cancelled;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::vector<Song> songs;
+		bool finished;
+		std::exception_ptr error;
+	};
+
+	std::shared_ptr<State> m_state;
+};
+
+// Dedicated connection to MPD living in a background thread, used for bulk
+// operations so that the main connection stays responsive.
+struct Worker
+{
+	typedef std::function<void(Connection &)> Task;
+
+	Worker();
+	~Worker();
+
+	// Descriptor that becomes readable when the worker has something for the
+	// main thread, which should then call dispatch().
+	int notificationFD();
+	void dispatch();
+
+	// Run the task on the background connection (tasks are run in order).
+	// Errors are reported in the statusbar.
+	void run(Task task);
+
+	// Schedule the callback to be run in the main thread.
+	void post(std::function<void()> callback);
+
+	SongStream streamDirectoryRecursive(const std::string &directory);
+
+	// Stream all songs in the database. If the snapshot directory is set, they
+	// are read from the snapshot, which is synchronized with the database
+	// first if it changed since the snapshot was made (or built from scratch
+	// if there is none).
+	SongStream streamDatabase();
+
+	// Stream songs in the database that may match the queries. If the snapshot
+	// directory is set, they are looked up in the search index built over the
+	// snapshot, otherwise all songs are streamed.
+	SongStream streamDatabase(std::vector<SearchIndex::Query> queries);
+
+	// Same as above, but to be called from tasks run by the worker.
+	void listDatabase(Connection &connection, const std::function<bool(Song &&)> &sink);
+
+	// Synchronize the snapshot with the database and pass changes made since
+	// the previous call to the callback (run in the main thread). It gets null
+	// if snapshots are disabled or the changes are not known as the snapshot
+	// had to be built from scratch.
+	typedef std::function<void(std::shared_ptr<const DatabaseDelta>)> DeltaCallback;
+	void syncDatabase(DeltaCallback callback);
+
+	// Build the media library index over the snapshot, bringing it up to date
+	// first, and pass it to the callback (run in the main thread). The callback
+	// is not called if the index couldn't be built.
+	typedef std::function<void(std::shared_ptr<const LibraryIndex>)> LibraryIndexCallback;
+	void buildLibraryIndex(mpd_tag_type primary_tag, bool split_by_date,
+	                       LibraryIndexCallback callback);
+
+	// Directory for snapshots of the database (disabled if empty).
+	void setSnapshotDirectory(std::string directory) { m_snapshot_directory = std::move(directory); }
+	bool snapshotsEnabled() const { return !m_snapshot_directory.empty(); }
+
+	struct IndexStatistics
+	{
+		IndexStatistics() : songs(0), bytes(0), buildTime(0) { }
+
+		size_t songs;
+		size_t bytes;
+		// in milliseconds
+		double buildTime;
+	};
+
+	// Statistics of the search index as of the last search using it.
+	const IndexStatistics &indexStatistics() const { return m_index_statistics; }
+
+	// Search the database using the filter expression. Results are requested
+	// in windows of the given size, so that the server doesn't need to build
+	// the whole response at once.
+	SongStream streamSearch(const std::string &expression, bool exact_match,
+	                        unsigned window_size);
+
+private:
+	// Songs passed to the sink are handed over to the main thread in batches.
+	// It returns false if the stream was cancelled.
+	typedef std::function<bool(Song &&)> SongSink;
+	typedef std::function<void(Connection &, const SongSink &)> SongProducer;
+
+	SongStream streamSongs(SongProducer producer);
+
+	// Bring the snapshot up to date. If there is none, it's built from scratch
+	// only if the sink is given, songs are then passed to it as they arrive
+	// and true is returned.
+	bool updateSnapshot(Connection &connection, const SongSink *sink);
+
+	struct Job
+	{
+		Task task;
+		std::string host;
+		int port;
+		int timeout;
+		std::string password;
+		std::vector<mpd_tag_type> tag_types;
+	};
+
+	struct State
+	{
+		State()
+		: stop(false)
+		, connection_fd(-1)
+		, delta(std::make_unique<DatabaseDelta>())
+		, index_build_time(0)
+		{ }
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<Job> jobs;
+		std::atomic<bool> stop;
+		// Descriptor of the background connection, shut down on destruction
+		// so that the task waiting for the server is interrupted.
+		int connection_fd;
+
+		std::vector<std::function<void()>> callbacks;
+		int notification_pipe[2];
+
+		// Only accessed from the worker thread.
+		std::shared_ptr<const DatabaseSnapshot> snapshot;
+		// Changes made to the snapshot since the last synchronization
+		// requested by the main thread, null if they are not known.
+		std::unique_ptr<DatabaseDelta> delta;
+		// Built over the snapshot when it's first needed and kept up to date
+		// with it afterwards.
+		std::unique_ptr<SearchIndex> index;
+		double index_build_time;
+	};
+
+	static void loop(std::shared_ptr<State> state);
+	static void notify(State &state);
+	static void disconnect(State &state, Connection &connection);
+
+	std::shared_ptr<State> m_state;
+	std::thread m_thread;
+	std::string m_snapshot_directory;
+	IndexStatistics m_index_statistics;
+};
+
+}
+
+extern MPD::Worker MpdWorker;
+
+#endif // NCMPCPP_MPD_WORKER_H
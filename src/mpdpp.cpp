@@ -20,6 +20,7 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
 #include <map>
 #include <boost/regex.hpp>
@@ -57,28 +58,136 @@ defaultFetcher(SourceT *(fetcher)(mpd_connection *))
 	};
 }
 
-bool fetchItemSong(MPD::SongIterator::State &state)
+bool isEntityStart(const mpd_pair *pair)
 {
-	auto src = mpd_recv_entity(state.connection());
-	while (src != nullptr && mpd_entity_get_type(src) != MPD_ENTITY_TYPE_SONG)
+	return strcmp(pair->name, "file") == 0
+	    || strcmp(pair->name, "directory") == 0
+	    || strcmp(pair->name, "playlist") == 0;
+}
+
+// Decode the song starting with the pair into the store.
+MPD::Song receiveSong(mpd_connection *conn, mpd_pair *pair,
+                      const std::shared_ptr<MPD::SongStore> &store)
+{
+	store->begin(pair);
+	mpd_return_pair(conn, pair);
+	while ((pair = mpd_recv_pair(conn)) != nullptr)
 	{
-		mpd_entity_free(src);
-		src = mpd_recv_entity(state.connection());
+		if (isEntityStart(pair))
+		{
+			// it belongs to the next entity
+			mpd_enqueue_pair(conn, pair);
+			break;
+		}
+		store->feed(pair);
+		mpd_return_pair(conn, pair);
 	}
-	if (src != nullptr)
-	{
-		state.setObject(mpd_song_dup(mpd_entity_get_song(src)));
-		mpd_entity_free(src);
+	return MPD::Song(store, store->commit());
+}
+
+// Decode songs directly into the store instead of going through mpd_entity
+// and mpd_song, skip directories and playlists.
+std::function<bool(MPD::SongIterator::State &)> storeSongFetcher()
+{
+	auto store = std::make_shared<MPD::SongStore>();
+	return [store](MPD::SongIterator::State &state) {
+		mpd_connection *conn = state.connection();
+		mpd_pair *pair;
+		while ((pair = mpd_recv_pair(conn)) != nullptr
+		       && strcmp(pair->name, "file") != 0)
+			mpd_return_pair(conn, pair);
+		if (pair == nullptr)
+			return false;
+		state.setObject(receiveSong(conn, pair, store));
 		return true;
-	}
-	else
-		return false;
+	};
+}
+
+// Same as above, but keep directories.
+std::function<bool(MPD::ItemIterator::State &)> storeItemFetcher()
+{
+	auto store = std::make_shared<MPD::SongStore>();
+	return [store](MPD::ItemIterator::State &state) {
+		mpd_connection *conn = state.connection();
+		mpd_pair *pair;
+		while ((pair = mpd_recv_pair(conn)) != nullptr
+		       && strcmp(pair->name, "file") != 0
+		       && strcmp(pair->name, "directory") != 0)
+			mpd_return_pair(conn, pair);
+		if (pair == nullptr)
+			return false;
+		if (strcmp(pair->name, "file") == 0)
+		{
+			state.setObject(MPD::Item(receiveSong(conn, pair, store)));
+			return true;
+		}
+		mpd_directory *directory = mpd_directory_begin(pair);
+		mpd_return_pair(conn, pair);
+		if (directory == nullptr)
+			throw std::bad_alloc();
+		while ((pair = mpd_recv_pair(conn)) != nullptr)
+		{
+			if (isEntityStart(pair))
+			{
+				mpd_enqueue_pair(conn, pair);
+				break;
+			}
+			mpd_directory_feed(directory, pair);
+			mpd_return_pair(conn, pair);
+		}
+		state.setObject(MPD::Item(MPD::Directory(directory)));
+		mpd_directory_free(directory);
+		return true;
+	};
+}
+
+MPD::Connection::CommandSender searchAddSender(bool exact_match, MPD::TagConstraints constraints)
+{
+	return [exact_match, constraints = std::move(constraints)](mpd_connection *conn) {
+		if (!mpd_search_add_db_songs(conn, exact_match))
+			return false;
+		for (const auto &constraint : constraints)
+			mpd_search_add_tag_constraint(conn, MPD_OPERATOR_DEFAULT,
+			                              constraint.first, constraint.second.c_str());
+		return mpd_search_commit(conn);
+	};
 }
 
 }
 
 namespace MPD {
 
+std::string filterExpression(const TagConstraints &constraints, bool exact_match)
+{
+	std::string result;
+	for (const auto &constraint : constraints)
+	{
+		if (!result.empty())
+			result += " AND ";
+		result += '(';
+		result += mpd_tag_name(constraint.first);
+		result += exact_match ? " == " : " contains ";
+		result += quoteFilterValue(constraint.second);
+		result += ')';
+	}
+	if (constraints.size() > 1)
+		result = "(" + result + ")";
+	return result;
+}
+
+std::string quoteFilterValue(const std::string &value)
+{
+	std::string result = "\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\'' || c == '\\')
+			result += '\\';
+		result += c;
+	}
+	result += '"';
+	return result;
+}
+
 void checkConnectionErrors(mpd_connection *conn)
 {
 	mpd_error code = mpd_connection_get_error(conn);
@@ -117,6 +226,8 @@ void Connection::Connect()
 		checkErrors();
 		if (!m_password.empty())
 			SendPassword();
+		if (!m_tag_types.empty())
+			applyTagTypes();
 		m_fd = mpd_connection_get_fd(m_connection.get());
 		checkErrors();
 	}
@@ -197,7 +308,7 @@ void Connection::setNoidleCallback(NoidleCallback callback)
 
 Statistics Connection::getStatistics()
 {
-	prechecks();
+	prechecksNoCommandsList();
 	mpd_stats *stats = mpd_run_stats(m_connection.get());
 	checkErrors();
 	return Statistics(stats);
@@ -205,7 +316,7 @@ Statistics Connection::getStatistics()
 
 Status Connection::getStatus()
 {
-	prechecks();
+	prechecksNoCommandsList();
 	mpd_status *status = mpd_run_status(m_connection.get());
 	checkErrors();
 	return Status(status);
@@ -213,128 +324,103 @@ Status Connection::getStatus()
 
 void Connection::UpdateDirectory(const std::string &path)
 {
-	prechecksNoCommandsList();
-	// Use update as mpd_run_update doesn't call mpd_response_finish if the id
-	// returned from mpd_recv_update_id is 0 which breaks mopidy.
-	mpd_send_update(m_connection.get(), path.c_str());
-	mpd_recv_update_id(m_connection.get());
-	mpd_response_finish(m_connection.get());
-	checkErrors();
+	// The update id is not needed, so just make sure the response is consumed
+	// as a whole (mpd_run_update doesn't call mpd_response_finish if the id
+	// returned from mpd_recv_update_id is 0 which breaks mopidy).
+	runCommand([&path](mpd_connection *conn) {
+		return mpd_send_update(conn, path.c_str());
+	});
 }
 
 void Connection::Play()
 {
-	prechecksNoCommandsList();
-	mpd_run_play(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_play);
 }
 
 void Connection::Play(int pos)
 {
-	prechecksNoCommandsList();
-	mpd_run_play_pos(m_connection.get(), pos);
-	checkErrors();
+	runCommand([pos](mpd_connection *conn) {
+		return mpd_send_play_pos(conn, pos);
+	});
 }
 
 void Connection::PlayID(int id)
 {
-	prechecksNoCommandsList();
-	mpd_run_play_id(m_connection.get(), id);
-	checkErrors();
+	runCommand([id](mpd_connection *conn) {
+		return mpd_send_play_id(conn, id);
+	});
 }
 
 void Connection::Pause(bool state)
 {
-	prechecksNoCommandsList();
-	mpd_run_pause(m_connection.get(), state);
-	checkErrors();
+	runCommand([state](mpd_connection *conn) {
+		return mpd_send_pause(conn, state);
+	});
 }
 
 void Connection::Toggle()
 {
-	prechecksNoCommandsList();
-	mpd_run_toggle_pause(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_toggle_pause);
 }
 
 void Connection::Stop()
 {
-	prechecksNoCommandsList();
-	mpd_run_stop(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_stop);
 }
 
 void Connection::Next()
 {
-	prechecksNoCommandsList();
-	mpd_run_next(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_next);
 }
 
 void Connection::Prev()
 {
-	prechecksNoCommandsList();
-	mpd_run_previous(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_previous);
 }
 
 void Connection::Move(unsigned from, unsigned to)
 {
-	prechecks();
-	if (m_command_list_active)
-		mpd_send_move(m_connection.get(), from, to);
-	else
-	{
-		mpd_run_move(m_connection.get(), from, to);
-		checkErrors();
-	}
+	queueCommand([from, to](mpd_connection *conn) {
+		return mpd_send_move(conn, from, to);
+	});
 }
 
 void Connection::Swap(unsigned from, unsigned to)
 {
-	prechecks();
-	if (m_command_list_active)
-		mpd_send_swap(m_connection.get(), from, to);
-	else
-	{
-		mpd_run_swap(m_connection.get(), from, to);
-		checkErrors();
-	}
+	queueCommand([from, to](mpd_connection *conn) {
+		return mpd_send_swap(conn, from, to);
+	});
 }
 
 void Connection::Seek(unsigned pos, unsigned where)
 {
-	prechecksNoCommandsList();
-	mpd_run_seek_pos(m_connection.get(), pos, where);
-	checkErrors();
+	runCommand([pos, where](mpd_connection *conn) {
+		return mpd_send_seek_pos(conn, pos, where);
+	});
 }
 
 void Connection::Shuffle()
 {
-	prechecksNoCommandsList();
-	mpd_run_shuffle(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_shuffle);
 }
 
 void Connection::ShuffleRange(unsigned start, unsigned end)
 {
-	prechecksNoCommandsList();
-	mpd_run_shuffle_range(m_connection.get(), start, end);
-	checkErrors();
+	runCommand([start, end](mpd_connection *conn) {
+		return mpd_send_shuffle_range(conn, start, end);
+	});
 }
 
 void Connection::ClearMainPlaylist()
 {
-	prechecksNoCommandsList();
-	mpd_run_clear(m_connection.get());
-	checkErrors();
+	runCommand(mpd_send_clear);
 }
 
 void Connection::ClearPlaylist(const std::string &playlist)
 {
-	prechecksNoCommandsList();
-	mpd_run_playlist_clear(m_connection.get(), playlist.c_str());
-	checkErrors();
+	runCommand([&playlist](mpd_connection *conn) {
+		return mpd_send_playlist_clear(conn, playlist.c_str());
+	});
 }
 
 void Connection::AddToPlaylist(const std::string &path, const Song &s)
@@ -344,34 +430,23 @@ void Connection::AddToPlaylist(const std::string &path, const Song &s)
 
 void Connection::AddToPlaylist(const std::string &path, const std::string &file)
 {
-	prechecks();
-	if (m_command_list_active)
-		mpd_send_playlist_add(m_connection.get(), path.c_str(), file.c_str());
-	else
-	{
-		mpd_run_playlist_add(m_connection.get(), path.c_str(), file.c_str());
-		checkErrors();
-	}
+	queueCommand([path, file](mpd_connection *conn) {
+		return mpd_send_playlist_add(conn, path.c_str(), file.c_str());
+	});
 }
 
 void Connection::PlaylistMove(const std::string &path, int from, int to)
 {
-	prechecks();
-	if (m_command_list_active)
-		mpd_send_playlist_move(m_connection.get(), path.c_str(), from, to);
-	else
-	{
-		mpd_send_playlist_move(m_connection.get(), path.c_str(), from, to);
-		mpd_response_finish(m_connection.get());
-		checkErrors();
-	}
+	queueCommand([path, from, to](mpd_connection *conn) {
+		return mpd_send_playlist_move(conn, path.c_str(), from, to);
+	});
 }
 
 void Connection::Rename(const std::string &from, const std::string &to)
 {
-	prechecksNoCommandsList();
-	mpd_run_rename(m_connection.get(), from.c_str(), to.c_str());
-	checkErrors();
+	runCommand([&from, &to](mpd_connection *conn) {
+		return mpd_send_rename(conn, from.c_str(), to.c_str());
+	});
 }
 
 SongIterator Connection::GetPlaylistChanges(unsigned version)
@@ -382,6 +457,92 @@ SongIterator Connection::GetPlaylistChanges(unsigned version)
 	return SongIterator(m_connection.get(), defaultFetcher<Song>(mpd_recv_song));
 }
 
+SongIterator Connection::GetPlaylistChangesPosId(unsigned version)
+{
+	prechecksNoCommandsList();
+	mpd_send_queue_changes_brief(m_connection.get(), version);
+	checkErrors();
+	auto store = std::make_shared<SongStore>();
+	return SongIterator(m_connection.get(), [store](SongIterator::State &state) {
+		unsigned position, id;
+		if (mpd_recv_queue_change_brief(state.connection(), &position, &id))
+		{
+			state.setObject(Song(store, store->placeholder(position, id)));
+			return true;
+		}
+		else
+			return false;
+	});
+}
+
+SongIterator Connection::GetPlaylistContentRange(unsigned start, unsigned end)
+{
+	prechecksNoCommandsList();
+	mpd_send_list_queue_range_meta(m_connection.get(), start, end);
+	checkErrors();
+	return SongIterator(m_connection.get(), storeSongFetcher());
+}
+
+std::vector<QueueEntry> Connection::GetPlaylistEntries(unsigned start, unsigned end)
+{
+	// Tags are not needed here, so if the server supports it, disable them for
+	// the duration of the command to cut down the amount of transferred data.
+	bool tags_disabled = true;
+	try
+	{
+		runCommand([](mpd_connection *conn) {
+			return mpd_send_command(conn, "tagtypes", "clear", NULL);
+		});
+	}
+	catch (ServerError &)
+	{
+		tags_disabled = false;
+	}
+
+	auto restore_tags = [this, tags_disabled] {
+		if (tags_disabled)
+			applyTagTypes();
+	};
+
+	std::vector<QueueEntry> result;
+	try
+	{
+		prechecksNoCommandsList();
+		mpd_send_list_queue_range_meta(m_connection.get(), start, end);
+		mpd_pair *pair;
+		while ((pair = mpd_recv_pair(m_connection.get())) != nullptr)
+		{
+			if (strcmp(pair->name, "file") == 0)
+			{
+				result.emplace_back();
+				result.back().uri = pair->value;
+			}
+			else if (!result.empty())
+			{
+				auto &entry = result.back();
+				if (strcmp(pair->name, "Pos") == 0)
+					entry.position = strtoul(pair->value, nullptr, 10);
+				else if (strcmp(pair->name, "Id") == 0)
+					entry.id = strtoul(pair->value, nullptr, 10);
+				else if (strcmp(pair->name, "Time") == 0)
+					entry.duration = strtoul(pair->value, nullptr, 10);
+				else if (strcmp(pair->name, "duration") == 0 && entry.duration == 0)
+					entry.duration = strtod(pair->value, nullptr) + 0.5;
+			}
+			mpd_return_pair(m_connection.get(), pair);
+		}
+		mpd_response_finish(m_connection.get());
+		checkErrors();
+	}
+	catch (ServerError &)
+	{
+		restore_tags();
+		throw;
+	}
+	restore_tags();
+	return result;
+}
+
 Song Connection::GetCurrentSong()
 {
 	prechecksNoCommandsList();
@@ -444,44 +605,44 @@ StringIterator Connection::GetSupportedExtensions()
 
 void Connection::SetRepeat(bool mode)
 {
-	prechecksNoCommandsList();
-	mpd_run_repeat(m_connection.get(), mode);
-	checkErrors();
+	runCommand([mode](mpd_connection *conn) {
+		return mpd_send_repeat(conn, mode);
+	});
 }
 
 void Connection::SetRandom(bool mode)
 {
-	prechecksNoCommandsList();
-	mpd_run_random(m_connection.get(), mode);
-	checkErrors();
+	runCommand([mode](mpd_connection *conn) {
+		return mpd_send_random(conn, mode);
+	});
 }
 
 void Connection::SetSingle(bool mode)
 {
-	prechecksNoCommandsList();
-	mpd_run_single(m_connection.get(), mode);
-	checkErrors();
+	runCommand([mode](mpd_connection *conn) {
+		return mpd_send_single(conn, mode);
+	});
 }
 
 void Connection::SetConsume(bool mode)
 {
-	prechecksNoCommandsList();
-	mpd_run_consume(m_connection.get(), mode);
-	checkErrors();
+	runCommand([mode](mpd_connection *conn) {
+		return mpd_send_consume(conn, mode);
+	});
 }
 
 void Connection::SetVolume(unsigned vol)
 {
-	prechecksNoCommandsList();
-	mpd_run_set_volume(m_connection.get(), vol);
-	checkErrors();
+	runCommand([vol](mpd_connection *conn) {
+		return mpd_send_set_volume(conn, vol);
+	});
 }
 
 void Connection::ChangeVolume(int change)
 {
-	prechecksNoCommandsList();
-	mpd_run_change_volume(m_connection.get(), change);
-	checkErrors();
+	runCommand([change](mpd_connection *conn) {
+		return mpd_send_change_volume(conn, change);
+	});
 }
 
 
@@ -502,7 +663,6 @@ std::string Connection::GetReplayGainMode()
 
 void Connection::SetReplayGainMode(ReplayGainMode mode)
 {
-	prechecksNoCommandsList();
 	const char *rg_mode;
 	switch (mode)
 	{
@@ -519,46 +679,49 @@ void Connection::SetReplayGainMode(ReplayGainMode mode)
 			rg_mode = "";
 			break;
 	}
-	mpd_send_command(m_connection.get(), "replay_gain_mode", rg_mode, NULL);
-	mpd_response_finish(m_connection.get());
-	checkErrors();
+	runCommand([rg_mode](mpd_connection *conn) {
+		return mpd_send_command(conn, "replay_gain_mode", rg_mode, NULL);
+	});
 }
 
 void Connection::SetCrossfade(unsigned crossfade)
 {
-	prechecksNoCommandsList();
-	mpd_run_crossfade(m_connection.get(), crossfade);
-	checkErrors();
+	runCommand([crossfade](mpd_connection *conn) {
+		return mpd_send_crossfade(conn, crossfade);
+	});
 }
 
 void Connection::SetPriority(const Song &s, int prio)
 {
-	prechecks();
-	if (m_command_list_active)
-		mpd_send_prio_id(m_connection.get(), prio, s.getID());
-	else
-	{
-		mpd_run_prio_id(m_connection.get(), prio, s.getID());
-		checkErrors();
-	}
+	unsigned id = s.getID();
+	queueCommand([prio, id](mpd_connection *conn) {
+		return mpd_send_prio_id(conn, prio, id);
+	});
 }
 
 int Connection::AddSong(const std::string &path, int pos)
 {
-	prechecks();
+	auto sender = [path, pos](mpd_connection *conn) {
+		if (pos < 0)
+			return mpd_send_add_id(conn, path.c_str());
+		else
+			return mpd_send_add_id_to(conn, path.c_str(), pos);
+	};
 	int id;
-	if (pos < 0)
-		mpd_send_add_id(m_connection.get(), path.c_str());
+	if (m_command_list_active)
+	{
+		prechecks();
+		sender(m_connection.get());
+		id = 0;
+	}
 	else
-		mpd_send_add_id_to(m_connection.get(), path.c_str(), pos);
-	if (!m_command_list_active)
 	{
+		prechecksNoCommandsList();
+		sender(m_connection.get());
 		id = mpd_recv_song_id(m_connection.get());
 		mpd_response_finish(m_connection.get());
 		checkErrors();
 	}
-	else
-		id = 0;
 	return id;
 }
 
@@ -569,16 +732,10 @@ int Connection::AddSong(const Song &s, int pos)
 
 bool Connection::Add(const std::string &path)
 {
-	bool result;
-	prechecks();
-	if (m_command_list_active)
-		result = mpd_send_add(m_connection.get(), path.c_str());
-	else
-	{
-		result = mpd_run_add(m_connection.get(), path.c_str());
-		checkErrors();
-	}
-	return result;
+	queueCommand([path](mpd_connection *conn) {
+		return mpd_send_add(conn, path.c_str());
+	});
+	return true;
 }
 
 bool Connection::AddRandomTag(mpd_tag_type tag, size_t number, std::mt19937 &rng)
@@ -591,20 +748,11 @@ bool Connection::AddRandomTag(mpd_tag_type tag, size_t number, std::mt19937 &rng
 		return false;
 
 	std::shuffle(tags.begin(), tags.end(), rng);
+	StartCommandsList();
 	auto it = tags.begin();
 	for (size_t i = 0; i < number && it != tags.end(); ++i)
-	{
-		StartSearch(true);
-		AddSearch(tag, *it++);
-		std::vector<std::string> paths;
-		MPD::SongIterator s = CommitSearchSongs(), end;
-		for (; s != end; ++s)
-			paths.push_back(s->getURI());
-		StartCommandsList();
-		for (const auto &path : paths)
-			AddSong(path);
-		CommitCommandsList();
-	}
+		FindAdd({{tag, *it++}});
+	CommitCommandsList();
 	return true;
 }
 
@@ -620,7 +768,12 @@ bool Connection::AddRandomSongs(size_t number, const std::string &random_exclude
 	}
 	mpd_response_finish(m_connection.get());
 	checkErrors();
-	
+	return AddRandomSongs(std::move(files), number, random_exclude_pattern, rng);
+}
+
+bool Connection::AddRandomSongs(std::vector<std::string> files, size_t number,
+                                const std::string &random_exclude_pattern, std::mt19937 &rng)
+{
 	if (number > files.size())
 	{
 		//if (itsErrorHandler)
@@ -646,35 +799,23 @@ bool Connection::AddRandomSongs(size_t number, const std::string &random_exclude
 
 void Connection::Delete(unsigned pos)
 {
-	prechecks();
-	mpd_send_delete(m_connection.get(), pos);
-	if (!m_command_list_active)
-	{
-		mpd_response_finish(m_connection.get());
-		checkErrors();
-	}
+	queueCommand([pos](mpd_connection *conn) {
+		return mpd_send_delete(conn, pos);
+	});
 }
 
 void Connection::DeleteRange(unsigned begin, unsigned end)
 {
-	prechecks();
-	mpd_send_delete_range(m_connection.get(), begin, end);
-	if (!m_command_list_active)
-	{
-		mpd_response_finish(m_connection.get());
-		checkErrors();
-	}
+	queueCommand([begin, end](mpd_connection *conn) {
+		return mpd_send_delete_range(conn, begin, end);
+	});
 }
 
 void Connection::PlaylistDelete(const std::string &playlist, unsigned pos)
 {
-	prechecks();
-	mpd_send_playlist_delete(m_connection.get(), playlist.c_str(), pos);
-	if (!m_command_list_active)
-	{
-		mpd_response_finish(m_connection.get());
-		checkErrors();
-	}
+	queueCommand([playlist, pos](mpd_connection *conn) {
+		return mpd_send_playlist_delete(conn, playlist.c_str(), pos);
+	});
 }
 
 void Connection::StartCommandsList()
@@ -697,25 +838,24 @@ void Connection::CommitCommandsList()
 
 void Connection::DeletePlaylist(const std::string &name)
 {
-	prechecksNoCommandsList();
-	mpd_run_rm(m_connection.get(), name.c_str());
-	checkErrors();
+	runCommand([&name](mpd_connection *conn) {
+		return mpd_send_rm(conn, name.c_str());
+	});
 }
 
 bool Connection::LoadPlaylist(const std::string &name)
 {
-	prechecksNoCommandsList();
-	bool result = mpd_run_load(m_connection.get(), name.c_str());
-	checkErrors();
-	return result;
+	runCommand([&name](mpd_connection *conn) {
+		return mpd_send_load(conn, name.c_str());
+	});
+	return true;
 }
 
 void Connection::SavePlaylist(const std::string &name)
 {
-	prechecksNoCommandsList();
-	mpd_send_save(m_connection.get(), name.c_str());
-	mpd_response_finish(m_connection.get());
-	checkErrors();
+	runCommand([&name](mpd_connection *conn) {
+		return mpd_send_save(conn, name.c_str());
+	});
 }
 
 PlaylistIterator Connection::GetPlaylists()
@@ -745,6 +885,42 @@ StringIterator Connection::GetList(mpd_tag_type type)
 	});
 }
 
+TagGroupIterator Connection::GetGroupedList(mpd_tag_type type,
+                                            const std::vector<mpd_tag_type> &groups,
+                                            const TagConstraints &constraints)
+{
+	prechecksNoCommandsList();
+	mpd_search_db_tags(m_connection.get(), type);
+	for (const auto &constraint : constraints)
+		mpd_search_add_tag_constraint(m_connection.get(), MPD_OPERATOR_DEFAULT,
+		                              constraint.first, constraint.second.c_str());
+	for (const auto &group : groups)
+		mpd_search_add_group_tag(m_connection.get(), group);
+	mpd_search_commit(m_connection.get());
+	checkErrors();
+	// Values of the group tags are sent only when they change, so the current
+	// ones need to be remembered between the calls.
+	auto current_groups = std::make_shared<std::vector<std::string>>(groups.size());
+	return TagGroupIterator(m_connection.get(), [type, groups, current_groups](TagGroupIterator::State &state) {
+		mpd_pair *pair;
+		while ((pair = mpd_recv_pair(state.connection())) != nullptr)
+		{
+			mpd_tag_type pair_type = mpd_tag_name_parse(pair->name);
+			if (pair_type == type)
+			{
+				state.setObject(TagGroup(pair->value, *current_groups));
+				mpd_return_pair(state.connection(), pair);
+				return true;
+			}
+			auto it = std::find(groups.begin(), groups.end(), pair_type);
+			if (it != groups.end())
+				(*current_groups)[it - groups.begin()] = pair->value;
+			mpd_return_pair(state.connection(), pair);
+		}
+		return false;
+	});
+}
+
 void Connection::StartSearch(bool exact_match)
 {
 	prechecksNoCommandsList();
@@ -775,12 +951,45 @@ void Connection::AddSearchURI(const std::string &str) const
 	mpd_search_add_uri_constraint(m_connection.get(), MPD_OPERATOR_DEFAULT, str.c_str());
 }
 
+void Connection::AddSearchExpression(const std::string &expression) const
+{
+	checkConnection();
+	mpd_search_add_expression(m_connection.get(), expression.c_str());
+}
+
+void Connection::AddSearchWindow(unsigned start, unsigned end) const
+{
+	checkConnection();
+	mpd_search_add_window(m_connection.get(), start, end);
+}
+
 SongIterator Connection::CommitSearchSongs()
 {
 	prechecksNoCommandsList();
 	mpd_search_commit(m_connection.get());
 	checkErrors();
-	return SongIterator(m_connection.get(), defaultFetcher<Song>(mpd_recv_song));
+	return SongIterator(m_connection.get(), storeSongFetcher());
+}
+
+void Connection::FindAdd(const TagConstraints &constraints)
+{
+	queueCommand(searchAddSender(true, constraints));
+}
+
+void Connection::SearchAdd(const TagConstraints &constraints)
+{
+	queueCommand(searchAddSender(false, constraints));
+}
+
+void Connection::SearchAddToPlaylist(const std::string &playlist,
+                                     const TagConstraints &constraints,
+                                     bool exact_match)
+{
+	queueCommand([playlist, expression = filterExpression(constraints, exact_match)](mpd_connection *conn) {
+		return mpd_search_add_db_songs_to_playlist(conn, playlist.c_str())
+			&& mpd_search_add_expression(conn, expression.c_str())
+			&& mpd_search_commit(conn);
+	});
 }
 
 ItemIterator Connection::GetDirectory(const std::string &directory)
@@ -796,7 +1005,18 @@ SongIterator Connection::GetDirectoryRecursive(const std::string &directory)
 	prechecksNoCommandsList();
 	mpd_send_list_all_meta(m_connection.get(), mpdDirectory(directory));
 	checkErrors();
-	return SongIterator(m_connection.get(), fetchItemSong);
+	return SongIterator(m_connection.get(), storeSongFetcher());
+}
+
+ItemIterator Connection::GetDirectoryContent(const std::string &directory, bool recursive)
+{
+	prechecksNoCommandsList();
+	if (recursive)
+		mpd_send_list_all_meta(m_connection.get(), mpdDirectory(directory));
+	else
+		mpd_send_list_meta(m_connection.get(), mpdDirectory(directory));
+	checkErrors();
+	return ItemIterator(m_connection.get(), storeItemFetcher());
 }
 
 DirectoryIterator Connection::GetDirectories(const std::string &directory)
@@ -825,16 +1045,16 @@ OutputIterator Connection::GetOutputs()
 
 void Connection::EnableOutput(int id)
 {
-	prechecksNoCommandsList();
-	mpd_run_enable_output(m_connection.get(), id);
-	checkErrors();
+	runCommand([id](mpd_connection *conn) {
+		return mpd_send_enable_output(conn, id);
+	});
 }
 
 void Connection::DisableOutput(int id)
 {
-	prechecksNoCommandsList();
-	mpd_run_disable_output(m_connection.get(), id);
-	checkErrors();
+	runCommand([id](mpd_connection *conn) {
+		return mpd_send_disable_output(conn, id);
+	});
 }
 
 StringIterator Connection::GetURLHandlers()
@@ -874,6 +1094,47 @@ StringIterator Connection::GetTagTypes()
 	});
 }
 
+void Connection::runCommand(CommandSender sender)
+{
+	prechecksNoCommandsList();
+	sender(m_connection.get());
+	mpd_response_finish(m_connection.get());
+	checkErrors();
+}
+
+void Connection::queueCommand(CommandSender sender)
+{
+	if (m_command_list_active)
+	{
+		prechecks();
+		sender(m_connection.get());
+	}
+	else
+		runCommand(std::move(sender));
+}
+
+void Connection::applyTagTypes()
+{
+	try
+	{
+		if (m_tag_types.empty())
+			runCommand([](mpd_connection *conn) {
+				return mpd_send_command(conn, "tagtypes", "all", NULL);
+			});
+		else
+		{
+			runCommand(mpd_send_clear_tag_types);
+			runCommand([this](mpd_connection *conn) {
+				return mpd_send_enable_tag_types(conn, m_tag_types.data(), m_tag_types.size());
+			});
+		}
+	}
+	catch (ServerError &)
+	{
+		// Servers without tag type negotiation always send all tags.
+	}
+}
+
 void Connection::checkConnection() const
 {
 	if (!m_connection)
@@ -23,6 +23,7 @@
 
 #include <cassert>
 #include <exception>
+#include <functional>
 #include <random>
 #include <set>
 #include <stdexcept>
@@ -352,6 +353,38 @@ private:
 	std::shared_ptr<mpd_output> m_output;
 };
 
+// Value of a tag returned by grouped list along with values of the tags it
+// was grouped by, in the order they were requested.
+struct TagGroup
+{
+	TagGroup() { }
+	TagGroup(std::string value_, std::vector<std::string> groups_)
+	: m_value(std::move(value_)), m_groups(std::move(groups_))
+	{ }
+
+	const std::string &value() const { return m_value; }
+	const std::string &group(size_t idx) const
+	{
+		assert(idx < m_groups.size());
+		return m_groups[idx];
+	}
+
+private:
+	std::string m_value;
+	std::vector<std::string> m_groups;
+};
+
+// Song in the queue as listed without its tags.
+struct QueueEntry
+{
+	QueueEntry() : position(0), id(0), duration(0) { }
+
+	unsigned position;
+	unsigned id;
+	unsigned duration;
+	std::string uri;
+};
+
 template <typename ObjectT>
 struct Iterator
 {
@@ -490,10 +523,22 @@ typedef Iterator<Output> OutputIterator;
 typedef Iterator<Playlist> PlaylistIterator;
 typedef Iterator<Song> SongIterator;
 typedef Iterator<std::string> StringIterator;
+typedef Iterator<TagGroup> TagGroupIterator;
+
+// Tag constraints of a database search, all of them need to match.
+typedef std::vector<std::pair<mpd_tag_type, std::string>> TagConstraints;
+
+// Build MPD filter expression (MPD >= 0.21) out of tag constraints. If
+// exact_match is set, tags are compared with ==, otherwise with contains.
+std::string filterExpression(const TagConstraints &constraints, bool exact_match);
+
+// Quote the string so that it can be used as a value in filter expressions.
+std::string quoteFilterValue(const std::string &value);
 
 struct Connection
 {
 	typedef std::function<void(int)> NoidleCallback;
+	typedef std::function<bool(mpd_connection *)> CommandSender;
 
 	Connection();
 	
@@ -512,7 +557,13 @@ struct Connection
 	void SetPort(int port) { m_port = port; }
 	void SetTimeout(int timeout) { m_timeout = timeout; }
 	void SetPassword(const std::string &password) { m_password = password; }
+	const std::string &GetPassword() const { return m_password; }
+	int GetTimeout() const { return m_timeout; }
 	void SendPassword();
+
+	// Restrict tags sent by the server to the given ones (all if empty).
+	void SetTagTypes(std::vector<mpd_tag_type> tag_types) { m_tag_types = std::move(tag_types); }
+	const std::vector<mpd_tag_type> &GetEnabledTagTypes() const { return m_tag_types; }
 	
 	Statistics getStatistics();
 	Status getStatus();
@@ -535,6 +586,10 @@ struct Connection
 	void ClearMainPlaylist();
 	
 	SongIterator GetPlaylistChanges(unsigned);
+	SongIterator GetPlaylistChangesPosId(unsigned);
+	SongIterator GetPlaylistContentRange(unsigned start, unsigned end);
+	// Entries of the queue in the given range, end may be UINT_MAX.
+	std::vector<QueueEntry> GetPlaylistEntries(unsigned start, unsigned end);
 	
 	Song GetCurrentSong();
 	Song GetSong(const std::string &);
@@ -560,6 +615,8 @@ struct Connection
 	int AddSong(const Song &, int = -1); // returns id of added song
 	bool AddRandomTag(mpd_tag_type, size_t, std::mt19937 &rng);
 	bool AddRandomSongs(size_t number, const std::string &random_exclude_pattern, std::mt19937 &rng);
+	bool AddRandomSongs(std::vector<std::string> files, size_t number,
+	                    const std::string &random_exclude_pattern, std::mt19937 &rng);
 	bool Add(const std::string &path);
 	void Delete(unsigned int pos);
 	void DeleteRange(unsigned begin, unsigned end);
@@ -581,12 +638,31 @@ struct Connection
 	void AddSearch(mpd_tag_type item, const std::string &str) const;
 	void AddSearchAny(const std::string &str) const;
 	void AddSearchURI(const std::string &str) const;
+	void AddSearchExpression(const std::string &expression) const;
+	void AddSearchWindow(unsigned start, unsigned end) const;
 	SongIterator CommitSearchSongs();
+
+	// findadd/searchadd/searchaddpl, i.e. add songs matching the constraints
+	// to the queue or to the stored playlist without transferring them to the
+	// client. They can be used within command lists. Adding to stored playlist
+	// uses filter expressions, so it requires MPD >= 0.21.
+	void FindAdd(const TagConstraints &constraints);
+	void SearchAdd(const TagConstraints &constraints);
+	void SearchAddToPlaylist(const std::string &playlist,
+	                         const TagConstraints &constraints,
+	                         bool exact_match = true);
 	
 	PlaylistIterator GetPlaylists();
 	StringIterator GetList(mpd_tag_type type);
+	// list TYPE [CONSTRAINTS] group GROUP1 group GROUP2 ..., requires MPD >= 0.21.
+	TagGroupIterator GetGroupedList(mpd_tag_type type,
+	                                const std::vector<mpd_tag_type> &groups,
+	                                const TagConstraints &constraints = TagConstraints());
 	ItemIterator GetDirectory(const std::string &directory);
 	SongIterator GetDirectoryRecursive(const std::string &directory);
+	// Directories and songs (decoded into the song store) in the directory,
+	// playlists are skipped.
+	ItemIterator GetDirectoryContent(const std::string &directory, bool recursive);
 	SongIterator GetSongs(const std::string &directory);
 	DirectoryIterator GetDirectories(const std::string &directory);
 	
@@ -613,6 +689,13 @@ private:
 	void prechecksNoCommandsList();
 	void checkErrors() const;
 
+	// Send the command and consume its response. Queued commands are only sent
+	// if a command list is active, their responses are read when it's
+	// committed.
+	void runCommand(CommandSender sender);
+	void queueCommand(CommandSender sender);
+	void applyTagTypes();
+
 	NoidleCallback m_noidle_callback;
 	std::unique_ptr<mpd_connection, ConnectionDeleter> m_connection;
 	bool m_command_list_active;
@@ -624,6 +707,7 @@ private:
 	int m_port;
 	int m_timeout;
 	std::string m_password;
+	std::vector<mpd_tag_type> m_tag_types;
 };
 
 }
@@ -68,6 +68,8 @@ struct MutableSong : public Song
 	
 	void setTags(SetFunction set, const std::string &value);
 	
+	virtual bool hasModifiedTags() const override { return !m_tags.empty(); }
+
 	bool isModified() const;
 	void clearModifications();
 	
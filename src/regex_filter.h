@@ -33,6 +33,8 @@
 
 #include <cassert>
 #include <iostream>
+#include <memory>
+#include <string_view>
 
 #include "utility/functional.h"
 
@@ -47,8 +49,8 @@ struct StripDiacritics
 		if (m_converter == nullptr)
 		{
 			icu::ErrorCode result;
-			m_converter = icu::Transliterator::createInstance(
-				"NFD; [:M:] Remove; NFC", UTRANS_FORWARD, result);
+			m_converter.reset(icu::Transliterator::createInstance(
+				"NFD; [:M:] Remove; NFC", UTRANS_FORWARD, result));
 			if (result.isFailure())
 				throw std::runtime_error(
 					"instantiation of transliterator instance failed with "
@@ -58,10 +60,12 @@ struct StripDiacritics
 	}
 
 private:
-	static icu::Transliterator *m_converter;
+	// Transliterators can't be used by multiple threads at once, so each
+	// thread that matches songs (see Parallel::filter) gets its own.
+	static thread_local std::unique_ptr<icu::Transliterator> m_converter;
 };
 
-icu::Transliterator *StripDiacritics::m_converter;
+thread_local std::unique_ptr<icu::Transliterator> StripDiacritics::m_converter;
 
 #endif // BOOST_REGEX_ICU
 
@@ -120,11 +124,41 @@ inline bool search(const std::basic_string<CharT> &s,
 	}
 }
 
+// Same as above, but searches the string in place.
+inline bool search(std::string_view s,
+                   const Regex &rx,
+                   bool ignore_diacritics)
+{
+	try {
+#ifdef BOOST_REGEX_ICU
+		if (ignore_diacritics)
+		{
+			auto us = icu::UnicodeString::fromUTF8(
+				icu::StringPiece(s.data(), s.size()));
+			StripDiacritics::convert(us);
+			return boost::u32regex_search(us, rx);
+		}
+		else
+			return boost::u32regex_search(s.data(), s.data() + s.size(), rx);
+#else
+		return boost::regex_search(s.data(), s.data() + s.size(), rx);
+#endif // BOOST_REGEX_ICU
+	} catch (std::out_of_range &e) {
+		// Invalid UTF-8 sequence, ignore the string.
+		std::cerr << "Regex::search: error while processing \""
+		          << s
+		          << "\": "
+		          << e.what()
+		          << "\n";
+		return false;
+	}
+}
+
 template <typename T>
 struct Filter
 {
 	typedef NC::Menu<T> MenuT;
-	typedef typename NC::Menu<T>::Item Item;
+	typedef typename NC::Menu<T>::ItemRef Item;
 	typedef std::function<bool(const Regex &, const T &)> FilterFunction;
 
 	Filter() { }
@@ -147,6 +181,10 @@ struct Filter
 		return m_constraint;
 	}
 
+	const Regex &regex() const {
+		return m_rx;
+	}
+
 	bool operator()(const Item &item) const {
 		assert(defined());
 		return m_filter(m_rx, item.value());
@@ -166,7 +204,7 @@ private:
 template <typename T> struct ItemFilter
 {
 	typedef NC::Menu<T> MenuT;
-	typedef typename NC::Menu<T>::Item Item;
+	typedef typename NC::Menu<T>::ItemRef Item;
 	typedef std::function<bool(const Regex &, const Item &)> FilterFunction;
 	
 	ItemFilter() { }
@@ -78,7 +78,7 @@ template <>
 struct SongPropertiesExtractor<MPD::Item>
 {
 	template <typename ItemT>
-	auto &operator()(ItemT &item) const
+	auto &operator()(ItemT &&item) const
 	{
 		auto s = item.value().type() == MPD::Item::Type::Song
 			? &item.value().song()
@@ -139,9 +139,12 @@ Browser::Browser()
 	setHighlightFixes(w);
 	w.cyclicScrolling(Config.use_cyclic_scrolling);
 	w.centeredCursor(Config.centered_cursor);
+	// browserEntryMatcher only reads the item and the configuration.
+	w.parallelFilter(true);
 	w.setSelectedPrefix(Config.selected_item_prefix);
 	w.setSelectedSuffix(Config.selected_item_suffix);
 	w.setItemDisplayer(std::bind(Display::Items, ph::_1, std::cref(w)));
+	w.setRowKey(std::bind(Display::ItemsKey, ph::_1, std::cref(w)));
 }
 
 void Browser::resize()
@@ -516,7 +519,7 @@ void Browser::getDirectory(std::string directory)
 
 		if (Config.browser_sort_mode != SortMode::None)
 		{
-			std::stable_sort(
+			sortByKey(
 				w.begin() + (is_root ? 0 : 1), w.end(),
 				LocaleBasedItemSorting(std::locale(), Config.ignore_leading_the,
 				                       Config.browser_sort_mode));
@@ -698,9 +701,11 @@ void getLocalDirectoryRecursively(std::vector<MPD::Song> &songs, const std::stri
 
 	if (Config.browser_sort_mode != SortMode::None)
 	{
-		std::stable_sort(songs.begin()+sort_offset, songs.end(),
-		                 LocaleBasedSorting(std::locale(), Config.ignore_leading_the)
-		);
+		LocaleStringComparison cmp(std::locale(), Config.ignore_leading_the);
+		sortByKey(songs.begin()+sort_offset, songs.end(),
+		          [&cmp](std::string &key, const MPD::Song &s) {
+			          cmp.appendSortKey(key, s.getName());
+		          });
 	}
 }
 
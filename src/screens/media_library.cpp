@@ -71,34 +71,61 @@ std::string Date_(std::string date)
 	return date;
 }
 
-MPD::SongIterator getSongsFromAlbum(const AlbumEntry &album)
+// Grouping by more than one tag is supported since MPD 0.21.
+bool groupedListSupported()
 {
-	Mpd.StartSearch(true);
+	return Mpd.Version() >= 21;
+}
+
+MPD::TagConstraints getAlbumQuery(const AlbumEntry &album)
+{
+	MPD::TagConstraints result;
 	if (!isAlbumOnly)
-		Mpd.AddSearch(Config.media_lib_primary_tag, album.entry().tag());
+		result.emplace_back(Config.media_lib_primary_tag, album.entry().tag());
 	if (!album.isAllTracksEntry())
 	{
-		Mpd.AddSearch(MPD_TAG_ALBUM, album.entry().album());
+		result.emplace_back(MPD_TAG_ALBUM, album.entry().album());
 		if (Config.media_library_albums_split_by_date)
-			Mpd.AddSearch(MPD_TAG_DATE, album.entry().date());
+			result.emplace_back(MPD_TAG_DATE, album.entry().date());
+	}
+	return result;
+}
+
+// Add songs matching the query at the end of the playlist without fetching
+// them, so they are added in database order. If play is set, start playing
+// the first one.
+bool addQueryToPlaylist(const MPD::TagConstraints &query, bool play)
+{
+	size_t position = Status::State::playlistLength();
+	try
+	{
+		Mpd.FindAdd(query);
+		if (play)
+			Mpd.Play(position);
+		return true;
+	}
+	catch (MPD::ServerError &e)
+	{
+		Status::handleServerError(e);
+		return false;
 	}
-	return Mpd.CommitSearchSongs();
 }
 
 std::string AlbumToString(const AlbumEntry &ae);
 std::string SongToString(const MPD::Song &s);
 
 bool TagEntryMatcher(const Regex::Regex &rx, const MediaLibrary::PrimaryTag &tagmtime);
-bool AlbumEntryMatcher(const Regex::Regex &rx, const NC::Menu<AlbumEntry>::Item &item, bool filter);
+bool AlbumEntryMatcher(const Regex::Regex &rx, const NC::Menu<AlbumEntry>::ItemRef &item, bool filter);
 bool SongEntryMatcher(const Regex::Regex &rx, const MPD::Song &s);
 
 bool MoveToTag(NC::Menu<PrimaryTag> &tags, const std::string &primary_tag);
 bool MoveToAlbum(NC::Menu<AlbumEntry> &albums, const std::string &primary_tag, const MPD::Song &s, bool consider_date);
 
+// Sort key functions for sortByKey.
 struct SortSongs {
-	typedef NC::Menu<MPD::Song>::Item SongItem;
+	typedef NC::Menu<MPD::Song>::ItemRef SongItem;
 	
-	static const std::array<MPD::Song::GetFunction, 4> GetFuns;
+	static const std::array<mpd_tag_type, 4> Tags;
 	
 	LocaleStringComparison m_cmp;
 
@@ -106,27 +133,50 @@ public:
 	SortSongs()
 	: m_cmp(std::locale(), Config.ignore_leading_the) { }
 	
-	bool operator()(const SongItem &a, const SongItem &b) {
-		return (*this)(a.value(), b.value());
-	}
-	bool operator()(const MPD::Song &a, const MPD::Song &b) {
-		int ret;
-		for (auto get : GetFuns) {
-			ret = m_cmp(a.getTags(get), b.getTags(get));
-			if (ret != 0)
-				return ret < 0;
+	void operator()(std::string &key, const SongItem &item) const {
+		(*this)(key, item.value());
+	}
+	void operator()(std::string &key, const MPD::Song &s) const {
+		for (auto type : Tags)
+		{
+			// Multiple values are joined like in getTags(). Numbers are compared
+			// by value, so disc and track numbers don't need to be formatted,
+			// only the total number of tracks is cut off.
+			auto values = s.tags(type);
+			auto value = values.begin();
+			if (value == values.end())
+				m_cmp.appendSortKey(key, std::string_view());
+			else if (std::next(value) == values.end())
+				m_cmp.appendSortKey(key, type == MPD_TAG_TRACK
+				                         ? value->substr(0, value->find('/'))
+				                         : *value);
+			else
+				m_cmp.appendSortKey(key, s.getTags(getFunction(type)));
 		}
+		appendBinarySortKey(key, Format::stringify<char>(Config.song_library_format, &s));
+	}
 
-		return Format::stringify<char>(Config.song_library_format, &a)
-		     < Format::stringify<char>(Config.song_library_format, &b);
+private:
+	static MPD::Song::GetFunction getFunction(mpd_tag_type type) {
+		switch (type)
+		{
+			case MPD_TAG_DATE:
+				return &MPD::Song::getDate;
+			case MPD_TAG_ALBUM:
+				return &MPD::Song::getAlbum;
+			case MPD_TAG_DISC:
+				return &MPD::Song::getDisc;
+			default:
+				return &MPD::Song::getTrackNumber;
+		}
 	}
 };
 
-const std::array<MPD::Song::GetFunction, 4> SortSongs::GetFuns = {{
-	&MPD::Song::getDate,
-	&MPD::Song::getAlbum,
-	&MPD::Song::getDisc,
-	&MPD::Song::getTrackNumber,
+const std::array<mpd_tag_type, 4> SortSongs::Tags = {{
+	MPD_TAG_DATE,
+	MPD_TAG_ALBUM,
+	MPD_TAG_DISC,
+	MPD_TAG_TRACK,
 }};
 
 class SortAlbumEntries {
@@ -137,23 +187,18 @@ class SortAlbumEntries {
 public:
 	SortAlbumEntries() : m_cmp(std::locale(), Config.ignore_leading_the) { }
 	
-	bool operator()(const AlbumEntry &a, const AlbumEntry &b) const {
-		return (*this)(a.entry(), b.entry());
+	void operator()(std::string &key, const AlbumEntry &a) const {
+		(*this)(key, a.entry());
 	}
 
-	bool operator()(const Album &a, const Album &b) const {
+	void operator()(std::string &key, const Album &a) const {
 		if (Config.media_library_sort_by_mtime)
-			return a.mtime() > b.mtime();
+			appendReverseSortKey(key, a.mtime());
 		else
 		{
-			int result;
-			result = m_cmp(a.tag(), b.tag());
-			if (result != 0)
-				return result < 0;
-			result = m_cmp(a.date(), b.date());
-			if (result != 0)
-				return result < 0;
-			return m_cmp(a.album(), b.album()) < 0;
+			m_cmp.appendSortKey(key, a.tag());
+			m_cmp.appendSortKey(key, a.date());
+			m_cmp.appendSortKey(key, a.album());
 		}
 	}
 };
@@ -164,11 +209,11 @@ class SortPrimaryTags {
 public:
 	SortPrimaryTags() : m_cmp(std::locale(), Config.ignore_leading_the) { }
 	
-	bool operator()(const PrimaryTag &a, const PrimaryTag &b) const {
+	void operator()(std::string &key, const PrimaryTag &a) const {
 		if (Config.media_library_sort_by_mtime)
-			return a.mtime() > b.mtime();
+			appendReverseSortKey(key, a.mtime());
 		else
-			return m_cmp(a.tag(), b.tag()) < 0;
+			m_cmp.appendSortKey(key, a.tag());
 	}
 };
 
@@ -176,6 +221,7 @@ public:
 
 MediaLibrary::MediaLibrary()
 : m_timer(boost::posix_time::from_time_t(0))
+, m_library_index_requested(false)
 , m_window_timeout(Config.data_fetching_delay ? 250 : BaseScreen::defaultWindowTimeout)
 , m_fetching_delay(boost::posix_time::milliseconds(Config.data_fetching_delay ? 250 : -1))
 {
@@ -196,6 +242,8 @@ MediaLibrary::MediaLibrary()
 	setHighlightFixes(Tags);
 	Tags.cyclicScrolling(Config.use_cyclic_scrolling);
 	Tags.centeredCursor(Config.centered_cursor);
+	// Entry matchers of all columns only read the item and the configuration.
+	Tags.parallelFilter(true);
 	Tags.setSelectedPrefix(Config.selected_item_prefix);
 	Tags.setSelectedSuffix(Config.selected_item_suffix);
 	Tags.setItemDisplayer([](NC::Menu<PrimaryTag> &menu) {
@@ -210,6 +258,7 @@ MediaLibrary::MediaLibrary()
 	setHighlightInactiveColumnFixes(Albums);
 	Albums.cyclicScrolling(Config.use_cyclic_scrolling);
 	Albums.centeredCursor(Config.centered_cursor);
+	Albums.parallelFilter(true);
 	Albums.setSelectedPrefix(Config.selected_item_prefix);
 	Albums.setSelectedSuffix(Config.selected_item_suffix);
 	Albums.setItemDisplayer([](NC::Menu<AlbumEntry> &menu) {
@@ -220,11 +269,13 @@ MediaLibrary::MediaLibrary()
 	setHighlightInactiveColumnFixes(Songs);
 	Songs.cyclicScrolling(Config.use_cyclic_scrolling);
 	Songs.centeredCursor(Config.centered_cursor);
+	Songs.parallelFilter(true);
 	Songs.setSelectedPrefix(Config.selected_item_prefix);
 	Songs.setSelectedSuffix(Config.selected_item_suffix);
 	Songs.setItemDisplayer(std::bind(
 		Display::Songs, ph::_1, std::cref(Songs), std::cref(Config.song_library_format)
 	));
+	Songs.setRowKey(std::bind(Display::SongsKey, ph::_1, std::cref(Songs)));
 	
 	w = &Tags;
 }
@@ -277,7 +328,9 @@ void MediaLibrary::refresh()
 	Songs.display();
 	if (Albums.empty())
 	{
-		Albums << NC::XY(0, 0) << "No albums found.";
+		Albums << NC::XY(0, 0) << (m_library_stream.active()
+		                           ? "Fetching library..."
+		                           : "No albums found.");
 		Albums.Window::refresh();
 	}
 }
@@ -296,116 +349,69 @@ std::wstring MediaLibrary::title()
 
 void MediaLibrary::update()
 {
+	if (m_library_stream.active())
+		receiveLibrary(false);
+
+	if (libraryIndexReady())
+	{
+		m_library_stream.cancel();
+		updateFromIndex();
+		return;
+	}
+
 	if (hasTwoColumns)
 	{
 		ScopedUnfilteredMenu<AlbumEntry> sunfilter_albums(ReapplyFilter::No, Albums);
-		if (Albums.empty() || m_albums_update_request)
+		if ((Albums.empty() && !m_library_stream.active()) || m_albums_update_request)
 		{
 			m_albums_update_request = false;
-			sunfilter_albums.set(ReapplyFilter::Yes, true);
-			std::map<std::tuple<std::string, std::string, std::string>, time_t> albums;
-			MPD::SongIterator s, end;
-			try
+			// Modification times can be obtained only by listing all songs.
+			if (!Config.media_library_sort_by_mtime && groupedListSupported())
 			{
-				s = Mpd.GetDirectoryRecursive("/");
-			}
-			catch (MPD::Error &e)
-			{
-				// If there was a problem, fall back to a different column mode.
-				toggleColumnsMode();
-				throw;
-			}
-			for (; s != end; ++s)
-			{
-				std::string tag;
-				unsigned idx = 0;
-				while (!(tag = s->get(Config.media_lib_primary_tag, idx++)).empty())
+				m_library_stream.cancel();
+				sunfilter_albums.set(ReapplyFilter::Yes, true);
+				std::vector<mpd_tag_type> groups = { Config.media_lib_primary_tag };
+				if (Config.media_library_albums_split_by_date)
+					groups.push_back(MPD_TAG_DATE);
+				std::map<std::tuple<std::string, std::string, std::string>, time_t> albums;
+				MPD::TagGroupIterator album = Mpd.GetGroupedList(MPD_TAG_ALBUM, groups), end;
+				for (; album != end; ++album)
 				{
-					auto key = std::make_tuple(
-						isAlbumOnly ? "" : std::move(tag),
-						s->getAlbum(),
-						Date_(s->getDate()));
-					auto it = albums.find(key);
-					if (it == albums.end())
-						albums[std::move(key)] = s->getMTime();
-					else
-						it->second = s->getMTime();
+					// albums of songs without the primary tag are not shown
+					if (album->group(0).empty())
+						continue;
+					albums.emplace(
+						std::make_tuple(
+							isAlbumOnly ? "" : album->group(0),
+							album->value(),
+							Config.media_library_albums_split_by_date ? album->group(1) : ""),
+						0);
 				}
+				setAlbums(albums);
 			}
-			size_t idx = 0;
-			for (const auto &album : albums)
-			{
-				auto entry = AlbumEntry(
-					Album(std::get<0>(album.first),
-					      std::get<1>(album.first),
-					      std::get<2>(album.first),
-					      album.second));
-				if (idx < Albums.size())
-					Albums[idx].value() = std::move(entry);
-				else
-					Albums.addItem(std::move(entry));
-				++idx;
-			}
-			if (idx < Albums.size())
-				Albums.resizeList(idx);
-			std::sort(Albums.beginV(), Albums.endV(), SortAlbumEntries());
+			else
+				fetchLibrary();
 		}
 	}
 	else
 	{
 		{
 			ScopedUnfilteredMenu<PrimaryTag> sunfilter_tags(ReapplyFilter::No, Tags);
-			if (Tags.empty() || m_tags_update_request)
+			if ((Tags.empty() && !m_library_stream.active()) || m_tags_update_request)
 			{
 				m_tags_update_request = false;
-				sunfilter_tags.set(ReapplyFilter::Yes, true);
-				std::map<std::string, time_t> tags;
 				if (Config.media_library_sort_by_mtime)
-				{
-					MPD::SongIterator s, end;
-					try
-					{
-						s = Mpd.GetDirectoryRecursive("/");
-					}
-					catch (MPD::Error &e)
-					{
-						// If there was a problem, fall back to a different sorting mode.
-						toggleSortMode();
-						throw;
-					}
-					for (; s != end; ++s)
-					{
-						std::string tag;
-						unsigned idx = 0;
-						while (!(tag = s->get(Config.media_lib_primary_tag, idx++)).empty())
-						{
-							auto it = tags.find(tag);
-							if (it == tags.end())
-								tags[std::move(tag)] = s->getMTime();
-							else
-								it->second = std::max(it->second, s->getMTime());
-						}
-					}
-				}
+					fetchLibrary();
 				else
 				{
+					m_library_stream.cancel();
+					sunfilter_tags.set(ReapplyFilter::Yes, true);
+					std::map<std::string, time_t> tags;
 					MPD::StringIterator tag = Mpd.GetList(Config.media_lib_primary_tag), end;
 					for (; tag != end; ++tag)
 						tags[std::move(*tag)] = 0;
+					setTags(tags);
 				}
-				size_t idx = 0;
-				for (const auto &tag : tags)
-				{
-					auto ptag = PrimaryTag(std::move(tag.first), tag.second);
-					if (idx < Tags.size())
-						Tags[idx].value() = std::move(ptag);
-					else
-						Tags.addItem(std::move(ptag));
-					++idx;
-				}
-				if (idx < Tags.size())
-					Tags.resizeList(idx);
-				std::sort(Tags.beginV(), Tags.endV(), SortPrimaryTags());
 			}
 		}
 
@@ -418,43 +424,38 @@ void MediaLibrary::update()
 				m_albums_update_request = false;
 				sunfilter_albums.set(ReapplyFilter::Yes, true);
 				auto &primary_tag = Tags.current()->value().tag();
-				Mpd.StartSearch(true);
-				Mpd.AddSearch(Config.media_lib_primary_tag, primary_tag);
 				std::map<std::tuple<std::string, std::string>, time_t> albums;
-				for (MPD::SongIterator s = Mpd.CommitSearchSongs(), end; s != end; ++s)
-				{
-					auto key = std::make_tuple(s->getAlbum(), Date_(s->getDate()));
-					auto it = albums.find(key);
-					if (it == albums.end())
-						albums[std::move(key)] = s->getMTime();
-					else
-						it->second = std::max(it->second, s->getMTime());
-				};
-				size_t idx = 0;
-				for (const auto &album : albums)
+				if (!Config.media_library_sort_by_mtime && groupedListSupported())
 				{
-					auto entry = AlbumEntry(
-						Album(primary_tag,
-						      std::get<0>(album.first),
-						      std::get<1>(album.first),
-						      album.second));
-					if (idx < Albums.size())
+					std::vector<mpd_tag_type> groups;
+					if (Config.media_library_albums_split_by_date)
+						groups.push_back(MPD_TAG_DATE);
+					MPD::TagGroupIterator album = Mpd.GetGroupedList(
+						MPD_TAG_ALBUM, groups, {{Config.media_lib_primary_tag, primary_tag}});
+					for (MPD::TagGroupIterator end; album != end; ++album)
 					{
-						Albums[idx].value() = std::move(entry);
-						Albums[idx].setSeparator(false);
+						albums.emplace(
+							std::make_tuple(
+								album->value(),
+								Config.media_library_albums_split_by_date ? album->group(0) : ""),
+							0);
 					}
-					else
-						Albums.addItem(std::move(entry));
-					++idx;
 				}
-				if (idx < Albums.size())
-					Albums.resizeList(idx);
-				std::sort(Albums.beginV(), Albums.endV(), SortAlbumEntries());
-				if (albums.size() > 1)
+				else
 				{
-					Albums.addSeparator();
-					Albums.addItem(AlbumEntry::mkAllTracksEntry(primary_tag));
+					Mpd.StartSearch(true);
+					Mpd.AddSearch(Config.media_lib_primary_tag, primary_tag);
+					for (MPD::SongIterator s = Mpd.CommitSearchSongs(), end; s != end; ++s)
+					{
+						auto key = std::make_tuple(s->getAlbum(), Date_(s->getDate()));
+						auto it = albums.find(key);
+						if (it == albums.end())
+							albums[std::move(key)] = s->getMTime();
+						else
+							it->second = std::max(it->second, s->getMTime());
+					}
 				}
+				setAlbums(primary_tag, albums);
 			}
 		}
 	}
@@ -466,19 +467,7 @@ void MediaLibrary::update()
 	{
 		m_songs_update_request = false;
 		sunfilter_songs.set(ReapplyFilter::Yes, true);
-		auto &album = Albums.current()->value();
-		size_t idx = 0;
-		for (MPD::SongIterator s = getSongsFromAlbum(album), end;
-		     s != end; ++s, ++idx)
-		{
-			if (idx < Songs.size())
-				Songs[idx].value() = std::move(*s);
-			else
-				Songs.addItem(std::move(*s));
-		};
-		if (idx < Songs.size())
-			Songs.resizeList(idx);
-		std::sort(Songs.begin(), Songs.end(), SortSongs());
+		setSongs(findSongs(getAlbumQuery(Albums.current()->value())));
 	}
 }
 
@@ -725,13 +714,8 @@ bool MediaLibrary::addItemToPlaylist(bool play)
 		if (isActiveWindow(Tags)
 		||  (isActiveWindow(Albums) && Albums.current()->value().isAllTracksEntry()))
 		{
-			Mpd.StartSearch(true);
-			Mpd.AddSearch(Config.media_lib_primary_tag, Tags.current()->value().tag());
-			std::vector<MPD::Song> list(
-				std::make_move_iterator(Mpd.CommitSearchSongs()),
-				std::make_move_iterator(MPD::SongIterator()));
-			std::sort(list.begin(), list.end(), SortSongs());
-			result = addSongsToPlaylist(list.begin(), list.end(), play, -1);
+			result = addQueryToPlaylist(
+				{{Config.media_lib_primary_tag, Tags.current()->value().tag()}}, play);
 			std::string tag_type = boost::locale::to_lower(
 				tagTypeToString(Config.media_lib_primary_tag));
 			Statusbar::printf("Songs with %1% \"%2%\" added%3%",
@@ -739,11 +723,7 @@ bool MediaLibrary::addItemToPlaylist(bool play)
 		}
 		else if (isActiveWindow(Albums))
 		{
-			std::vector<MPD::Song> list(
-				std::make_move_iterator(getSongsFromAlbum(Albums.current()->value())),
-				std::make_move_iterator(MPD::SongIterator()));
-			std::sort(list.begin(), list.end(), SortSongs());
-			result = addSongsToPlaylist(list.begin(), list.end(), play, -1);
+			result = addQueryToPlaylist(getAlbumQuery(Albums.current()->value()), play);
 			Statusbar::printf("Songs from album \"%1%\" added%2%",
 				Albums.current()->value().entry().album(), withErrors(result));
 		}
@@ -754,72 +734,68 @@ bool MediaLibrary::addItemToPlaylist(bool play)
 std::vector<MPD::Song> MediaLibrary::getSelectedSongs()
 {
 	std::vector<MPD::Song> result;
-	if (isActiveWindow(Tags))
+	if (isActiveWindow(Songs))
+		result = Songs.getSelectedSongs();
+	else
 	{
-		auto tag_handler = [&result](const std::string &tag) {
-			Mpd.StartSearch(true);
-			Mpd.AddSearch(Config.media_lib_primary_tag, tag);
-			size_t begin = result.size();
-			std::copy(
-				std::make_move_iterator(Mpd.CommitSearchSongs()),
-				std::make_move_iterator(MPD::SongIterator()),
-				std::back_inserter(result));
-			std::sort(result.begin()+begin, result.end(), SortSongs());
-		};
-		bool any_selected = false;
-		for (auto &e : Tags)
+		ScopedUnfilteredMenu<MPD::Song> sunfilter_songs(ReapplyFilter::No, Songs);
+		for (const auto &query : selectedItemQueries())
 		{
-			if (e.isSelected())
-			{
-				any_selected = true;
-				tag_handler(e.value().tag());
-			}
+			auto songs = findSongs(query);
+			sortByKey(songs.begin(), songs.end(), SortSongs());
+			std::move(songs.begin(), songs.end(), std::back_inserter(result));
 		}
+	}
+	return result;
+}
+
+std::vector<MPD::TagConstraints> MediaLibrary::getSelectedQueries()
+{
+	// Songs from the right column are added one by one. Otherwise the server
+	// adds songs of each query in database order, not sorted by date, album,
+	// disc and track as getSelectedSongs() does, which saves fetching them.
+	auto result = selectedItemQueries();
+	for (const auto &query : result)
+		if (query.empty())
+			return {};
+	return result;
+}
+
+std::vector<MPD::TagConstraints> MediaLibrary::selectedItemQueries()
+{
+	std::vector<MPD::TagConstraints> result;
+	if (isActiveWindow(Tags))
+	{
+		for (auto &&e : Tags)
+			if (e.isSelected())
+				result.push_back({{Config.media_lib_primary_tag, e.value().tag()}});
 		// if no item is selected, add current one
-		if (!any_selected && !Tags.empty())
-			tag_handler(Tags.current()->value().tag());
+		if (result.empty() && !Tags.empty())
+			result.push_back({{Config.media_lib_primary_tag, Tags.current()->value().tag()}});
 	}
 	else if (isActiveWindow(Albums))
 	{
-		bool any_selected = false;
 		for (auto it = Albums.begin(); it != Albums.end() && !it->isSeparator(); ++it)
 		{
 			if (it->isSelected())
 			{
-				any_selected = true;
 				auto &sc = it->value();
-				Mpd.StartSearch(true);
+				MPD::TagConstraints query;
 				if (hasTwoColumns)
-					Mpd.AddSearch(Config.media_lib_primary_tag, sc.entry().tag());
+					query.emplace_back(Config.media_lib_primary_tag, sc.entry().tag());
 				else
-					Mpd.AddSearch(Config.media_lib_primary_tag,
-					              Tags.current()->value().tag());
-				Mpd.AddSearch(MPD_TAG_ALBUM, sc.entry().album());
+					query.emplace_back(Config.media_lib_primary_tag,
+					                   Tags.current()->value().tag());
+				query.emplace_back(MPD_TAG_ALBUM, sc.entry().album());
 				if (Config.media_library_albums_split_by_date)
-					Mpd.AddSearch(MPD_TAG_DATE, sc.entry().date());
-				size_t begin = result.size();
-				std::copy(
-					std::make_move_iterator(Mpd.CommitSearchSongs()),
-					std::make_move_iterator(MPD::SongIterator()),
-					std::back_inserter(result));
-				std::sort(result.begin()+begin, result.end(), SortSongs());
+					query.emplace_back(MPD_TAG_DATE, sc.entry().date());
+				result.push_back(std::move(query));
 			}
 		}
 		// if no item is selected, add songs from right column
-		ScopedUnfilteredMenu<MPD::Song> sunfilter_songs(ReapplyFilter::No, Songs);
-		if (!any_selected && !Albums.empty())
-		{
-			size_t begin = result.size();
-			std::copy(
-				std::make_move_iterator(getSongsFromAlbum(Albums.current()->value())),
-				std::make_move_iterator(MPD::SongIterator()),
-				std::back_inserter(result)
-			);
-			std::sort(result.begin()+begin, result.end(), SortSongs());
-		}
+		if (result.empty() && !Albums.empty())
+			result.push_back(getAlbumQuery(Albums.current()->value()));
 	}
-	else if (isActiveWindow(Songs))
-		result = Songs.getSelectedSongs();
 	return result;
 }
 
@@ -899,6 +875,244 @@ void MediaLibrary::nextColumn()
 
 /***********************************************************************/
 
+bool MediaLibrary::libraryIndexReady()
+{
+	if (m_library_index
+	    && m_library_index->primaryTag() == Config.media_lib_primary_tag
+	    && m_library_index->splitByDate() == Config.media_library_albums_split_by_date)
+		return true;
+	// The index is built over the snapshot of the database, so without it
+	// MPD is queried every time.
+	if (!m_library_index_requested && MpdWorker.snapshotsEnabled())
+	{
+		m_library_index_requested = true;
+		MpdWorker.buildLibraryIndex(
+			Config.media_lib_primary_tag, Config.media_library_albums_split_by_date,
+			[this](std::shared_ptr<const MPD::LibraryIndex> index) {
+				m_library_index = std::move(index);
+				m_library_index_requested = false;
+			});
+	}
+	return false;
+}
+
+void MediaLibrary::updateFromIndex()
+{
+	const auto &index = *m_library_index;
+	if (hasTwoColumns)
+	{
+		ScopedUnfilteredMenu<AlbumEntry> sunfilter_albums(ReapplyFilter::No, Albums);
+		if (Albums.empty() || m_albums_update_request)
+		{
+			m_albums_update_request = false;
+			sunfilter_albums.set(ReapplyFilter::Yes, true);
+			setAlbums(index.albums(!isAlbumOnly));
+		}
+	}
+	else
+	{
+		{
+			ScopedUnfilteredMenu<PrimaryTag> sunfilter_tags(ReapplyFilter::No, Tags);
+			if (Tags.empty() || m_tags_update_request)
+			{
+				m_tags_update_request = false;
+				sunfilter_tags.set(ReapplyFilter::Yes, true);
+				setTags(index.tags());
+			}
+		}
+
+		{
+			ScopedUnfilteredMenu<AlbumEntry> sunfilter_albums(ReapplyFilter::No, Albums);
+			if (!Tags.empty() && (Albums.empty() || m_albums_update_request))
+			{
+				m_albums_update_request = false;
+				sunfilter_albums.set(ReapplyFilter::Yes, true);
+				auto &primary_tag = Tags.current()->value().tag();
+				setAlbums(primary_tag, index.albums(primary_tag));
+			}
+		}
+	}
+
+	ScopedUnfilteredMenu<MPD::Song> sunfilter_songs(ReapplyFilter::No, Songs);
+	if (!Albums.empty() && (Songs.empty() || m_songs_update_request))
+	{
+		m_songs_update_request = false;
+		sunfilter_songs.set(ReapplyFilter::Yes, true);
+		setSongs(index.songs(getAlbumQuery(Albums.current()->value())));
+	}
+}
+
+std::vector<MPD::Song> MediaLibrary::findSongs(const MPD::TagConstraints &query)
+{
+	if (libraryIndexReady())
+		return m_library_index->songs(query);
+	Mpd.StartSearch(true);
+	for (const auto &constraint : query)
+		Mpd.AddSearch(constraint.first, constraint.second);
+	return std::vector<MPD::Song>(
+		std::make_move_iterator(Mpd.CommitSearchSongs()),
+		std::make_move_iterator(MPD::SongIterator()));
+}
+
+void MediaLibrary::fetchLibrary()
+{
+	// Listing the whole database may take a while, so it's done using the
+	// background connection and songs are collected as they arrive.
+	m_library_stream.cancel();
+	m_library_albums.clear();
+	m_library_tags.clear();
+	m_library_stream = MpdWorker.streamDatabase();
+}
+
+void MediaLibrary::receiveLibrary(bool wait)
+{
+	std::vector<MPD::Song> songs;
+	bool more;
+	try
+	{
+		more = m_library_stream.take(songs, wait);
+	}
+	catch (MPD::Error &e)
+	{
+		// If there was a problem, fall back to a different column or sorting mode.
+		if (hasTwoColumns)
+			toggleColumnsMode();
+		else
+			toggleSortMode();
+		throw;
+	}
+
+	for (const auto &s : songs)
+	{
+		std::string tag;
+		unsigned idx = 0;
+		while (!(tag = s.get(Config.media_lib_primary_tag, idx++)).empty())
+		{
+			if (hasTwoColumns)
+			{
+				auto key = std::make_tuple(
+					isAlbumOnly ? "" : std::move(tag),
+					s.getAlbum(),
+					Date_(s.getDate()));
+				auto it = m_library_albums.find(key);
+				if (it == m_library_albums.end())
+					m_library_albums[std::move(key)] = s.getMTime();
+				else
+					it->second = s.getMTime();
+			}
+			else
+			{
+				auto it = m_library_tags.find(tag);
+				if (it == m_library_tags.end())
+					m_library_tags[std::move(tag)] = s.getMTime();
+				else
+					it->second = std::max(it->second, s.getMTime());
+			}
+		}
+	}
+
+	if (!more)
+	{
+		if (hasTwoColumns)
+		{
+			ScopedUnfilteredMenu<AlbumEntry> sunfilter_albums(ReapplyFilter::Yes, Albums);
+			setAlbums(m_library_albums);
+		}
+		else
+		{
+			ScopedUnfilteredMenu<PrimaryTag> sunfilter_tags(ReapplyFilter::Yes, Tags);
+			setTags(m_library_tags);
+		}
+		m_library_albums.clear();
+		m_library_tags.clear();
+		if (isVisible(this))
+			refresh();
+	}
+}
+
+void MediaLibrary::setTags(const std::map<std::string, time_t> &tags)
+{
+	size_t idx = 0;
+	for (const auto &tag : tags)
+	{
+		auto ptag = PrimaryTag(tag.first, tag.second);
+		if (idx < Tags.size())
+			Tags[idx].value() = std::move(ptag);
+		else
+			Tags.addItem(std::move(ptag));
+		++idx;
+	}
+	if (idx < Tags.size())
+		Tags.resizeList(idx);
+	sortByKey(Tags.beginV(), Tags.endV(), SortPrimaryTags());
+}
+
+void MediaLibrary::setAlbums(const std::map<std::tuple<std::string, std::string, std::string>, time_t> &albums)
+{
+	size_t idx = 0;
+	for (const auto &album : albums)
+	{
+		auto entry = AlbumEntry(
+			Album(std::get<0>(album.first),
+			      std::get<1>(album.first),
+			      std::get<2>(album.first),
+			      album.second));
+		if (idx < Albums.size())
+			Albums[idx].value() = std::move(entry);
+		else
+			Albums.addItem(std::move(entry));
+		++idx;
+	}
+	if (idx < Albums.size())
+		Albums.resizeList(idx);
+	sortByKey(Albums.beginV(), Albums.endV(), SortAlbumEntries());
+}
+
+void MediaLibrary::setAlbums(const std::string &primary_tag, const MPD::LibraryIndex::TagAlbums &albums)
+{
+	size_t idx = 0;
+	for (const auto &album : albums)
+	{
+		auto entry = AlbumEntry(
+			Album(primary_tag,
+			      std::get<0>(album.first),
+			      std::get<1>(album.first),
+			      album.second));
+		if (idx < Albums.size())
+		{
+			Albums[idx].value() = std::move(entry);
+			Albums[idx].setSeparator(false);
+		}
+		else
+			Albums.addItem(std::move(entry));
+		++idx;
+	}
+	if (idx < Albums.size())
+		Albums.resizeList(idx);
+	sortByKey(Albums.beginV(), Albums.endV(), SortAlbumEntries());
+	if (albums.size() > 1)
+	{
+		Albums.addSeparator();
+		Albums.addItem(AlbumEntry::mkAllTracksEntry(primary_tag));
+	}
+}
+
+void MediaLibrary::setSongs(std::vector<MPD::Song> songs)
+{
+	size_t idx = 0;
+	for (auto &s : songs)
+	{
+		if (idx < Songs.size())
+			Songs[idx].value() = std::move(s);
+		else
+			Songs.addItem(std::move(s));
+		++idx;
+	}
+	if (idx < Songs.size())
+		Songs.resizeList(idx);
+	sortByKey(Songs.begin(), Songs.end(), SortSongs());
+}
+
 void MediaLibrary::updateTimer()
 {
 	m_timer = Global::Timer;
@@ -916,6 +1130,7 @@ void MediaLibrary::toggleColumnsMode()
 	else
 		hasTwoColumns = 1;
 
+	m_library_stream.cancel();
 	Tags.clear();
 	Albums.clear();
 	Albums.reset();
@@ -953,16 +1168,57 @@ int MediaLibrary::columns()
 		return 3;
 }
 
+void MediaLibrary::databaseChanged(const MPD::DatabaseDelta *delta)
+{
+	m_library_index.reset();
+	m_library_index_requested = false;
+	if (delta == nullptr)
+	{
+		requestTagsUpdate();
+		requestAlbumsUpdate();
+		requestSongsUpdate();
+		return;
+	}
+
+	auto affected = [delta](const MPD::TagConstraints &query) {
+		auto matches = [&query](const MPD::Song &s) { return MPD::songMatches(s, query); };
+		return std::any_of(delta->added.begin(), delta->added.end(), matches)
+		    || std::any_of(delta->removed.begin(), delta->removed.end(), matches);
+	};
+	// The first column covers the whole database, the others only need to
+	// be updated if the changed songs belong to the selected item.
+	if (hasTwoColumns)
+		requestAlbumsUpdate();
+	else
+	{
+		requestTagsUpdate();
+		if (!Tags.empty()
+		    && affected({{Config.media_lib_primary_tag, Tags.current()->value().tag()}}))
+			requestAlbumsUpdate();
+	}
+	if (!Albums.empty() && affected(getAlbumQuery(Albums.current()->value())))
+		requestSongsUpdate();
+}
+
 void MediaLibrary::toggleSortMode()
 {
 	Config.media_library_sort_by_mtime = !Config.media_library_sort_by_mtime;
 	Statusbar::printf("Sorting library by: %1%",
 		Config.media_library_sort_by_mtime ? "modification time" : "name");
+	m_library_stream.cancel();
 	if (hasTwoColumns)
 	{
 		ScopedUnfilteredMenu<AlbumEntry> sunfilter_albums(ReapplyFilter::No, Albums);
-		std::sort(Albums.beginV(), Albums.endV(), SortAlbumEntries());
-		Albums.refresh();
+		// if we already have modification times (or don't need them), just
+		// resort. otherwise refetch the list.
+		if (!Config.media_library_sort_by_mtime
+		    || (!Albums.empty() && Albums.beginV()->entry().mtime() > 0))
+		{
+			sortByKey(Albums.beginV(), Albums.endV(), SortAlbumEntries());
+			Albums.refresh();
+		}
+		else
+			Albums.clear();
 		Songs.clear();
 		if (Config.titles_visibility)
 		{
@@ -986,7 +1242,7 @@ void MediaLibrary::toggleSortMode()
 		// if we already have modification times, just resort. otherwise refetch the list.
 		if (!Tags.empty() && Tags[0].value().mtime() > 0)
 		{
-			std::sort(Tags.beginV(), Tags.endV(), SortPrimaryTags());
+			sortByKey(Tags.beginV(), Tags.endV(), SortPrimaryTags());
 			Tags.refresh();
 		}
 		else
@@ -1028,6 +1284,8 @@ void MediaLibrary::locateSong(const MPD::Song &s)
 		{
 			requestTagsUpdate();
 			update();
+			if (m_library_stream.active())
+				receiveLibrary(true);
 		}
 
 		if (!MoveToTag(Tags, primary_tag))
@@ -1038,7 +1296,7 @@ void MediaLibrary::locateSong(const MPD::Song &s)
 			// possible to list all of the library, e.g. mopidy with mopidy-spotify.
 			// To workaround this we simply insert the missing tag.
 			Tags.addItem(PrimaryTag(primary_tag, s.getMTime()));
-			std::sort(Tags.beginV(), Tags.endV(), SortPrimaryTags());
+			sortByKey(Tags.beginV(), Tags.endV(), SortPrimaryTags());
 			Tags.refresh();
 			MoveToTag(Tags, primary_tag);
 		}
@@ -1050,6 +1308,11 @@ void MediaLibrary::locateSong(const MPD::Song &s)
 	{
 		requestAlbumsUpdate();
 		update();
+		if (m_library_stream.active())
+		{
+			receiveLibrary(true);
+			update();
+		}
 	}
 
 	// When you locate a song in the media library, if no albums or no songs
@@ -1082,7 +1345,7 @@ void MediaLibrary::locateSong(const MPD::Song &s)
 			                                s.getAlbum(),
 			                                Date_(s.getDate()),
 			                                s.getMTime())));
-			std::sort(Albums.beginV(), Albums.endV(), SortAlbumEntries());
+			sortByKey(Albums.beginV(), Albums.endV(), SortAlbumEntries());
 			Albums.refresh();
 			MoveToAlbum(Albums, primary_tag, s, true);
 		}
@@ -1148,7 +1411,7 @@ bool TagEntryMatcher(const Regex::Regex &rx, const PrimaryTag &pt)
 	return Regex::search(pt.tag(), rx, Config.ignore_diacritics);
 }
 
-bool AlbumEntryMatcher(const Regex::Regex &rx, const NC::Menu<AlbumEntry>::Item &item, bool filter)
+bool AlbumEntryMatcher(const Regex::Regex &rx, const NC::Menu<AlbumEntry>::ItemRef &item, bool filter)
 {
 	if (item.isSeparator() || item.value().isAllTracksEntry())
 		return filter;
@@ -22,13 +22,16 @@
 #define NCMPCPP_MEDIA_LIBRARY_H
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <map>
+#include <tuple>
 
 #include "interfaces.h"
+#include "mpd_worker.h"
 #include "regex_filter.h"
 #include "screens/screen.h"
 #include "song_list.h"
 
-struct MediaLibrary: Screen<NC::Window *>, Filterable, HasColumns, HasSongs, Searchable, Tabbable
+struct MediaLibrary: Screen<NC::Window *>, Filterable, HasColumns, HasSongs, HasSongQueries, Searchable, Tabbable
 {
 	MediaLibrary();
 	
@@ -64,6 +67,9 @@ struct MediaLibrary: Screen<NC::Window *>, Filterable, HasColumns, HasSongs, Sea
 	virtual bool itemAvailable() override;
 	virtual bool addItemToPlaylist(bool play) override;
 	virtual std::vector<MPD::Song> getSelectedSongs() override;
+
+	// HasSongQueries implementation
+	virtual std::vector<MPD::TagConstraints> getSelectedQueries() override;
 	
 	// HasColumns implementation
 	virtual bool previousColumnAvailable() override;
@@ -82,6 +88,10 @@ struct MediaLibrary: Screen<NC::Window *>, Filterable, HasColumns, HasSongs, Sea
 	void requestTagsUpdate() { m_tags_update_request = true; }
 	void requestAlbumsUpdate() { m_albums_update_request = true; }
 	void requestSongsUpdate() { m_songs_update_request = true; }
+
+	// Update only columns affected by the changes in the database (all of
+	// them if the changes are not known).
+	void databaseChanged(const MPD::DatabaseDelta *delta);
 	
 	struct PrimaryTag
 	{
@@ -139,12 +149,34 @@ struct MediaLibrary: Screen<NC::Window *>, Filterable, HasColumns, HasSongs, Sea
 	SongMenu Songs;
 	
 private:
+	// Whether the index can be used, if not it's requested from the worker.
+	bool libraryIndexReady();
+	void updateFromIndex();
+	// Songs found by the query, taken from the index if it's available.
+	std::vector<MPD::Song> findSongs(const MPD::TagConstraints &query);
+	// Queries matching songs of the selected items of the tag or album column
+	// (or the current one if none is selected).
+	std::vector<MPD::TagConstraints> selectedItemQueries();
+
+	void fetchLibrary();
+	void receiveLibrary(bool wait);
+	void setTags(const std::map<std::string, time_t> &tags);
+	void setAlbums(const std::map<std::tuple<std::string, std::string, std::string>, time_t> &albums);
+	void setAlbums(const std::string &primary_tag, const MPD::LibraryIndex::TagAlbums &albums);
+	void setSongs(std::vector<MPD::Song> songs);
+
 	bool m_tags_update_request;
 	bool m_albums_update_request;
 	bool m_songs_update_request;
 
 	boost::posix_time::ptime m_timer;
 
+	MPD::SongStream m_library_stream;
+	std::shared_ptr<const MPD::LibraryIndex> m_library_index;
+	bool m_library_index_requested;
+	std::map<std::tuple<std::string, std::string, std::string>, time_t> m_library_albums;
+	std::map<std::string, time_t> m_library_tags;
+
 	const int m_window_timeout;
 	const boost::posix_time::time_duration m_fetching_delay;
 
@@ -26,6 +26,7 @@
 #include "display.h"
 #include "global.h"
 #include "helpers.h"
+#include "mpd_worker.h"
 #include "screens/playlist.h"
 #include "screens/screen_switcher.h"
 #include "song.h"
@@ -46,8 +47,7 @@ Playlist *myPlaylist;
 
 namespace {
 
-std::string songToString(const MPD::Song &s);
-bool playlistEntryMatcher(const Regex::Regex &rx, const MPD::Song &s);
+const Format::AST<char> &songFormat();
 
 }
 
@@ -55,6 +55,7 @@ Playlist::Playlist()
 : m_total_length(0), m_remaining_time(0), m_scroll_begin(0)
 , m_timer(boost::posix_time::from_time_t(0))
 , m_reload_total_length(false), m_reload_remaining(false)
+, m_filtering_in_place(false)
 {
 	w = NC::Menu<MPD::Song>(0, MainStartY, COLS, MainHeight, Config.playlist_display_mode == DisplayMode::Columns && Config.titles_visibility ? Display::Columns(COLS) : "", Config.main_color, NC::Border());
 	w.cyclicScrolling(Config.use_cyclic_scrolling);
@@ -75,6 +76,7 @@ Playlist::Playlist()
 			));
 			break;
 	}
+	w.setRowKey(std::bind(Display::SongsKey, ph::_1, std::cref(w)));
 }
 
 void Playlist::switchTo()
@@ -129,6 +131,8 @@ void Playlist::update()
 		w.setHighlighting(false);
 		w.refresh();
 	}
+	if (loadVisibleSongs())
+		w.refresh();
 }
 
 void Playlist::mouseButtonPressed(MEVENT me)
@@ -163,7 +167,7 @@ void Playlist::setSearchConstraint(const std::string &constraint)
 	m_search_predicate = Regex::Filter<MPD::Song>(
 		constraint,
 		Config.regex_type,
-		playlistEntryMatcher);
+		std::bind(&Playlist::entryMatches, this, ph::_1, ph::_2));
 }
 
 void Playlist::clearSearchConstraint()
@@ -173,6 +177,7 @@ void Playlist::clearSearchConstraint()
 
 bool Playlist::search(SearchDirection direction, bool wrap, bool skip_current)
 {
+	loadAllSongs();
 	return ::search(w, m_search_predicate, direction, wrap, skip_current);
 }
 
@@ -195,13 +200,83 @@ void Playlist::applyFilter(const std::string &constraint)
 {
 	if (!constraint.empty())
 	{
-		w.applyFilter(Regex::Filter<MPD::Song>(
-			              constraint,
-			              Config.regex_type,
-			              playlistEntryMatcher));
+		Regex::Filter<MPD::Song> filter(
+			constraint,
+			Config.regex_type,
+			std::bind(&Playlist::entryMatches, this, ph::_1, ph::_2));
+		loadAllSongs();
+		// If the filter was only extended, it's enough to look at the songs
+		// that matched the previous one.
+		bool narrows = (w.isFiltered() || m_filter.running())
+			&& SongFilter::narrows(currentFilter(), constraint, Config.regex_type);
+		startFilter(std::move(filter), narrows);
 	}
 	else
+	{
+		m_filter.cancel();
 		w.clearFilter();
+	}
+}
+
+void Playlist::reapplyFilter(size_t begin, size_t end)
+{
+	if (m_filter.running())
+	{
+		// Rows the scan in progress refers to might have changed, start over.
+		auto filter = w.filterPredicate<Regex::Filter<MPD::Song>>();
+		assert(filter != nullptr);
+		startFilter(*filter, false);
+	}
+	else
+		w.reapplyFilter(begin, end);
+}
+
+void Playlist::startFilter(Regex::Filter<MPD::Song> filter, bool narrows)
+{
+	// Rows that may match the previous filter.
+	std::vector<size_t> rows;
+	if (m_filter.running())
+		rows = m_filter.cancel();
+	else if (narrows)
+		rows = w.filteredRows();
+
+	std::vector<SongFilter::Candidate> candidates;
+	{
+		ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, w);
+		if (narrows)
+		{
+			candidates.reserve(rows.size());
+			for (auto row : rows)
+				candidates.emplace_back(row, w[row].value());
+		}
+		else
+		{
+			candidates.reserve(w.size());
+			for (size_t row = 0; row < w.size(); ++row)
+				candidates.emplace_back(row, w[row].value());
+			m_filter.setCacheCapacity(w.size());
+		}
+	}
+
+	auto rx = filter.regex();
+	w.setFilterPredicate(std::move(filter));
+	m_filtering_in_place = true;
+	m_filter.start(rx, songFormat(), std::move(candidates),
+	               [this](std::vector<size_t> filtered_rows, bool replace) {
+		if (replace)
+			w.setFilteredRows(std::move(filtered_rows));
+		else
+			w.appendFilteredRows(filtered_rows);
+		// Results found in the background are shown as they come.
+		if (!m_filtering_in_place && isVisible(this))
+			w.refresh();
+	});
+	m_filtering_in_place = false;
+}
+
+bool Playlist::entryMatches(const Regex::Regex &rx, const MPD::Song &s)
+{
+	return m_filter.matches(rx, songFormat(), s);
 }
 
 /***********************************************************************/
@@ -220,6 +295,24 @@ bool Playlist::addItemToPlaylist(bool play)
 
 std::vector<MPD::Song> Playlist::getSelectedSongs()
 {
+	if (Config.playlist_lazy_loading && !w.isFiltered())
+	{
+		// load the range spanned by selected songs (or the current one)
+		auto first = w.end(), last = w.end();
+		for (auto it = w.begin(); it != w.end(); ++it)
+		{
+			if (it->isSelected())
+			{
+				if (first == w.end())
+					first = it;
+				last = it;
+			}
+		}
+		if (first == w.end() && !w.empty())
+			first = last = w.current();
+		if (first != w.end())
+			loadSongs(first - w.begin(), last - w.begin() + 1);
+	}
 	return w.getSelectedSongs();
 }
 
@@ -233,7 +326,10 @@ MPD::Song Playlist::nowPlayingSong()
 		ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, w);
 		auto sp = Status::State::currentSongPosition();
 		if (sp >= 0 && size_t(sp) < w.size())
+		{
+			loadSongs(sp, sp + 1);
 			s = w.at(sp).value();
+		}
 	}
 	return s;
 }
@@ -268,17 +364,34 @@ std::string Playlist::getTotalLength()
 	
 	if (m_reload_total_length)
 	{
-		m_total_length = 0;
-		for (const auto &s : w)
-			m_total_length += s.value().getDuration();
+		if (Config.playlist_lazy_loading)
+		{
+			m_total_length = 0;
+			for (const auto &entry : m_entries)
+				m_total_length += entry.duration;
+		}
+		else
+		{
+			m_total_length = 0;
+			for (const auto &s : w)
+				m_total_length += s.value().getDuration();
+		}
 		m_reload_total_length = false;
 	}
 	if (Config.playlist_show_remaining_time && m_reload_remaining)
 	{
 		ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, w);
 		m_remaining_time = 0;
-		for (size_t i = Status::State::currentSongPosition(); i < w.size(); ++i)
-			m_remaining_time += w[i].value().getDuration();
+		if (Config.playlist_lazy_loading)
+		{
+			for (size_t i = Status::State::currentSongPosition(); i < m_entries.size(); ++i)
+				m_remaining_time += m_entries[i].duration;
+		}
+		else
+		{
+			for (size_t i = Status::State::currentSongPosition(); i < w.size(); ++i)
+				m_remaining_time += w[i].value().getDuration();
+		}
 		m_reload_remaining = false;
 	}
 	
@@ -304,6 +417,163 @@ std::string Playlist::getTotalLength()
 	return result.str();
 }
 
+bool Playlist::loadSongs(size_t begin, size_t end)
+{
+	ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, w);
+	end = std::min(end, w.size());
+	bool result = false;
+	while (begin < end)
+	{
+		// fetch each run of placeholders with a single command
+		for (; begin < end && !w[begin].value().isPlaceholder(); ++begin) { }
+		size_t run_end = begin;
+		for (; run_end < end && w[run_end].value().isPlaceholder(); ++run_end) { }
+		if (begin == run_end)
+			break;
+		MPD::SongIterator s = Mpd.GetPlaylistContentRange(begin, run_end), s_end;
+		for (; s != s_end; ++s)
+		{
+			size_t pos = s->getPosition();
+			if (pos >= w.size())
+				continue;
+			// If the playlist was changed in the meantime, leave the placeholder
+			// alone, it will be replaced when status of MPD is updated.
+			MPD::Song &old_s = w[pos].value();
+			if (old_s.isPlaceholder() && old_s.getID() == s->getID())
+			{
+				registerSong(*s);
+				old_s = std::move(*s);
+			}
+		}
+		begin = run_end;
+		result = true;
+	}
+	return result;
+}
+
+bool Playlist::loadVisibleSongs()
+{
+	// Filtered playlist is always fully loaded.
+	if (!Config.playlist_lazy_loading || w.isFiltered())
+		return false;
+	// Along with the visible part of the playlist fetch a page of songs on both
+	// sides, so that scrolling by a line or a page doesn't have to wait for it.
+	size_t height = w.getHeight();
+	size_t first = w.firstVisible();
+	size_t begin = first > height ? first - height : 0;
+	return loadSongs(begin, first + 2*height);
+}
+
+void Playlist::updateEntries(size_t length,
+                             const std::vector<std::pair<size_t, size_t>> &moved,
+                             const std::vector<size_t> &unknown)
+{
+	// Take entries of moved songs out before any of them is overwritten, the
+	// songs stay in the playlist.
+	std::vector<Entry> moved_entries;
+	moved_entries.reserve(moved.size());
+	for (const auto &m : moved)
+		moved_entries.push_back(m.second < m_entries.size()
+		                        ? std::move(m_entries[m.second])
+		                        : Entry());
+	// Whatever else is left at changed positions or past the end of the
+	// playlist was removed from it.
+	size_t fetch_begin = std::numeric_limits<size_t>::max(), fetch_end = 0;
+	for (size_t pos : unknown)
+	{
+		if (pos < m_entries.size())
+		{
+			setEntryURI(pos, std::string());
+			m_entries[pos].duration = 0;
+		}
+		fetch_begin = std::min(fetch_begin, pos);
+		fetch_end = std::max(fetch_end, pos+1);
+	}
+	for (size_t i = length; i < m_entries.size(); ++i)
+		setEntryURI(i, std::string());
+	m_entries.resize(length);
+	for (size_t i = 0; i < moved.size(); ++i)
+	{
+		size_t pos = moved[i].first;
+		if (pos < length)
+		{
+			setEntryURI(pos, std::string());
+			m_entries[pos] = std::move(moved_entries[i]);
+		}
+	}
+	fetch_end = std::min(fetch_end, length);
+	if (fetch_begin < fetch_end)
+		fetchEntries(fetch_begin, fetch_end);
+	m_reload_total_length = true;
+	m_reload_remaining = true;
+}
+
+void Playlist::fetchEntries(unsigned begin, unsigned end)
+{
+	MpdWorker.run([this, begin, end](MPD::Connection &c) {
+		auto entries = std::make_shared<std::vector<MPD::QueueEntry>>();
+		try
+		{
+			*entries = c.GetPlaylistEntries(begin, end);
+		}
+		catch (MPD::ServerError &)
+		{
+			// The playlist got shorter in the meantime, the range is invalid.
+			entries.reset();
+		}
+		MpdWorker.post([this, entries] {
+			ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, w);
+			bool outdated = entries == nullptr;
+			if (entries)
+			{
+				for (auto &entry : *entries)
+				{
+					// Songs are matched by id, so that the playlist changing while
+					// entries were fetched is noticed.
+					if (entry.position < m_entries.size()
+					    && entry.position < w.size()
+					    && w[entry.position].value().getID() == entry.id)
+					{
+						setEntryURI(entry.position, std::move(entry.uri));
+						m_entries[entry.position].duration = entry.duration;
+					}
+					else
+						outdated = true;
+				}
+			}
+			// Entries of songs that were moved in the meantime may be missing, so
+			// all of them need to be fetched again.
+			if (outdated)
+				fetchEntries(0, std::numeric_limits<unsigned>::max());
+			m_reload_total_length = true;
+			m_reload_remaining = true;
+			if (Global::myScreen == this)
+			{
+				drawHeader();
+				// songs might have been marked as being in the playlist
+				w.refresh();
+			}
+		});
+	});
+}
+
+void Playlist::setEntryURI(size_t position, std::string uri)
+{
+	auto &entry = m_entries[position];
+	if (!entry.uri.empty())
+	{
+		auto it = m_uri_refs.find(entry.uri);
+		assert(it != m_uri_refs.end());
+		if (it->second == 1)
+			m_uri_refs.erase(it);
+		else
+			--it->second;
+	}
+	entry.uri = std::move(uri);
+	if (!entry.uri.empty())
+		++m_uri_refs[entry.uri];
+}
+
 void Playlist::setSelectedItemsPriority(int prio)
 {
 	auto list = getSelectedOrCurrent(w.begin(), w.end(), w.current());
@@ -316,16 +586,23 @@ void Playlist::setSelectedItemsPriority(int prio)
 
 bool Playlist::checkForSong(const MPD::Song &s)
 {
+	// Placeholders don't know their URIs, so if the playlist is loaded lazily,
+	// its songs are looked up among the separately listed entries.
+	if (Config.playlist_lazy_loading)
+		return m_uri_refs.find(std::string(s.uri())) != m_uri_refs.end();
 	return m_song_refs.find(s) != m_song_refs.end();
 }
 
 void Playlist::registerSong(const MPD::Song &s)
 {
-	++m_song_refs[s];
+	if (!Config.playlist_lazy_loading && !s.isPlaceholder())
+		++m_song_refs[s];
 }
 
 void Playlist::unregisterSong(const MPD::Song &s)
 {
+	if (Config.playlist_lazy_loading || s.isPlaceholder())
+		return;
 	auto it = m_song_refs.find(s);
 	assert(it != m_song_refs.end());
 	if (it->second == 1)
@@ -336,23 +613,12 @@ void Playlist::unregisterSong(const MPD::Song &s)
 
 namespace {
 
-std::string songToString(const MPD::Song &s)
-{
-	std::string result;
-	switch (Config.playlist_display_mode)
-	{
-		case DisplayMode::Classic:
-			result = Format::stringify<char>(Config.song_list_format, &s);
-			break;
-		case DisplayMode::Columns:
-			result = Format::stringify<char>(Config.song_columns_mode_format, &s);
-	}
-	return result;
-}
-
-bool playlistEntryMatcher(const Regex::Regex &rx, const MPD::Song &s)
+const Format::AST<char> &songFormat()
 {
-	return Regex::search(songToString(s), rx, Config.ignore_diacritics);
+	if (Config.playlist_display_mode == DisplayMode::Columns)
+		return Config.song_columns_mode_format;
+	else
+		return Config.song_list_format;
 }
 
 }
@@ -22,12 +22,15 @@
 #define NCMPCPP_PLAYLIST_H
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <limits>
 #include <unordered_map>
+#include <vector>
 
 #include "interfaces.h"
 #include "regex_filter.h"
 #include "screens/screen.h"
 #include "song.h"
+#include "song_filter.h"
 #include "song_list.h"
 
 struct Playlist: Screen<SongMenu>, Filterable, HasSongs, Searchable, Tabbable
@@ -59,6 +62,17 @@ struct Playlist: Screen<SongMenu>, Filterable, HasSongs, Searchable, Tabbable
 	virtual bool allowsFiltering() override;
 	virtual std::string currentFilter() override;
 	virtual void applyFilter(const std::string &filter) override;
+
+	// True if the playlist is filtered or it's being done in the background.
+	bool isFiltered() const { return w.isFiltered() || m_filter.running(); }
+
+	// Reapply the filter to the given range of rows of the unfiltered playlist
+	// after they changed.
+	void reapplyFilter(size_t begin, size_t end);
+
+	// Results of filtering in the background (see SongFilter::notificationFD).
+	int filterNotificationFD() const { return m_filter.notificationFD(); }
+	void dispatchFilterResults() { m_filter.dispatch(); }
 	
 	// HasSongs implementation
 	virtual bool itemAvailable() override;
@@ -81,9 +95,31 @@ struct Playlist: Screen<SongMenu>, Filterable, HasSongs, Searchable, Tabbable
 	
 	void reloadTotalLength() { m_reload_total_length = true; }
 	void reloadRemaining() { m_reload_remaining = true; }
+
+	// Replace placeholders in the given range of the unfiltered playlist with
+	// songs fetched from MPD. Return true if anything was fetched.
+	bool loadSongs(size_t begin, size_t end);
+	bool loadVisibleSongs();
+	void loadAllSongs() { loadSongs(0, std::numeric_limits<size_t>::max()); }
+
+	// If the playlist is loaded lazily, durations and URIs of all its songs
+	// are listed separately for the playlist statistics and checkForSong().
+	// Update them after the playlist changed: moved songs are given as pairs
+	// of their new and previous positions, songs at unknown positions are
+	// fetched in the background.
+	void updateEntries(size_t length,
+	                   const std::vector<std::pair<size_t, size_t>> &moved,
+	                   const std::vector<size_t> &unknown);
 	
 private:
 	std::string getTotalLength();
+	void fetchEntries(unsigned begin, unsigned end);
+	void setEntryURI(size_t position, std::string uri);
+
+	// Filter songs in the background if there are many of them. If the filter
+	// narrows down the previous one, only songs matching it are checked.
+	void startFilter(Regex::Filter<MPD::Song> filter, bool narrows);
+	bool entryMatches(const Regex::Regex &rx, const MPD::Song &s);
 
 	std::string m_stats;
 	
@@ -92,6 +128,16 @@ private:
 	size_t m_total_length;;
 	size_t m_remaining_time;
 	size_t m_scroll_begin;
+
+	struct Entry
+	{
+		Entry() : duration(0) { }
+
+		unsigned duration;
+		std::string uri;
+	};
+	std::vector<Entry> m_entries;
+	std::unordered_map<std::string, int> m_uri_refs;
 	
 	boost::posix_time::ptime m_timer;
 
@@ -99,6 +145,9 @@ private:
 	bool m_reload_remaining;
 
 	Regex::Filter<MPD::Song> m_search_predicate;
+
+	SongFilter m_filter;
+	bool m_filtering_in_place;
 };
 
 extern Playlist *myPlaylist;
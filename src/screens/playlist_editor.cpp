@@ -88,6 +88,8 @@ PlaylistEditor::PlaylistEditor()
 	setHighlightInactiveColumnFixes(Content);
 	Content.cyclicScrolling(Config.use_cyclic_scrolling);
 	Content.centeredCursor(Config.centered_cursor);
+	// SongEntryMatcher only formats the song with the configured format.
+	Content.parallelFilter(true);
 	Content.setSelectedPrefix(Config.selected_item_prefix);
 	Content.setSelectedSuffix(Config.selected_item_suffix);
 	switch (Config.playlist_editor_display_mode)
@@ -103,6 +105,7 @@ PlaylistEditor::PlaylistEditor()
 			));
 			break;
 	}
+	Content.setRowKey(std::bind(Display::SongsKey, ph::_1, std::cref(Content)));
 	
 	w = &Playlists;
 }
@@ -414,7 +417,7 @@ std::vector<MPD::Song> PlaylistEditor::getSelectedSongs()
 	if (isActiveWindow(Playlists))
 	{
 		bool any_selected = false;
-		for (auto &e : Playlists)
+		for (auto &&e : Playlists)
 		{
 			if (e.isSelected())
 			{
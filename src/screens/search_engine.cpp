@@ -19,13 +19,13 @@
  ***************************************************************************/
 
 #include <array>
-#include <boost/range/detail/any_iterator.hpp>
 #include <iomanip>
 
 #include "curses/menu_impl.h"
 #include "display.h"
 #include "global.h"
 #include "helpers.h"
+#include "mpd_worker.h"
 #include "screens/playlist.h"
 #include "screens/search_engine.h"
 #include "settings.h"
@@ -34,6 +34,7 @@
 #include "format_impl.h"
 #include "helpers/song_iterator_maker.h"
 #include "utility/comparators.h"
+#include "utility/parallel.h"
 #include "title.h"
 #include "screens/screen_switcher.h"
 
@@ -73,9 +74,28 @@ namespace pos {
 	const size_t reset = search+1;
 }*/
 
+// Number of results of MPD-side search requested at once.
+const unsigned SearchWindowSize = 1000;
+
+// Names of tags matching the constraints in filter expressions.
+const char *ConstraintsFilterTags[] =
+{
+	"any",
+	"Artist",
+	"AlbumArtist",
+	"Title",
+	"Album",
+	"file",
+	"Composer",
+	"Performer",
+	"Genre",
+	"Date",
+	"Comment"
+};
+
 std::string SEItemToString(const SEItem &ei);
 bool SEItemEntryMatcher(const Regex::Regex &rx,
-                        const NC::Menu<SEItem>::Item &item,
+                        const NC::Menu<SEItem>::ItemRef &item,
                         bool filter);
 
 }
@@ -84,7 +104,7 @@ template <>
 struct SongPropertiesExtractor<SEItem>
 {
 	template <typename ItemT>
-	auto &operator()(ItemT &item) const
+	auto &operator()(ItemT &&item) const
 	{
 		auto s = !item.isSeparator() && item.value().isSong()
 			? &item.value().song()
@@ -129,7 +149,7 @@ ConstSongIterator SearchEngineWindow::endS() const
 std::vector<MPD::Song> SearchEngineWindow::getSelectedSongs()
 {
 	std::vector<MPD::Song> result;
-	for (auto &item : *this)
+	for (auto &&item : *this)
 	{
 		if (item.isSelected())
 		{
@@ -174,11 +194,16 @@ size_t SearchEngine::SearchButton = 15;
 
 SearchEngine::SearchEngine()
 : Screen(NC::Menu<SEItem>(0, MainStartY, COLS, MainHeight, "", Config.main_color, NC::Border()))
+, m_search_with_filter(false)
+, m_filter_unsupported(false)
 {
 	setHighlightFixes(w);
 	w.cyclicScrolling(Config.use_cyclic_scrolling);
 	w.centeredCursor(Config.centered_cursor);
+	// SEItemEntryMatcher doesn't touch option buffers and only formats songs.
+	w.parallelFilter(true);
 	w.setItemDisplayer(std::bind(Display::SEItems, ph::_1, std::cref(w)));
+	w.setRowKey(std::bind(Display::SEItemsKey, ph::_1, std::cref(w)));
 	w.setSelectedPrefix(Config.selected_item_prefix);
 	w.setSelectedSuffix(Config.selected_item_suffix);
 	SearchMode = &SearchModes[Config.search_engine_default_search_mode];
@@ -203,6 +228,43 @@ void SearchEngine::resize()
 	hasToBeResized = 0;
 }
 
+void SearchEngine::update()
+{
+	if (m_search_stream.active())
+	{
+		std::vector<MPD::Song> songs;
+		bool more;
+		try
+		{
+			more = m_search_stream.take(songs);
+		}
+		catch (MPD::ServerError &)
+		{
+			if (!m_search_with_filter)
+				throw;
+			// MPD can't handle the filter expression (e.g. it was built without
+			// support for regular expressions), search the old way instead.
+			m_filter_unsupported = true;
+			w.resizeList(StaticOptions-3);
+			searchWithoutFilter();
+			if (!m_search_stream.active())
+				finishSearch();
+			return;
+		}
+		if (m_search_with_filter)
+		{
+			for (const auto &s : songs)
+				w.addItem(s);
+		}
+		else
+			addMatchingSongs(songs.begin(), songs.size());
+		if (!more)
+			finishSearch();
+		if ((!songs.empty() || !more) && isVisible(this))
+			w.refresh();
+	}
+}
+
 void SearchEngine::switchTo()
 {
 	SwitchTo::execute(this);
@@ -339,33 +401,8 @@ void SearchEngine::runAction()
 		if (w.size() > StaticOptions)
 			Prepare();
 		Search();
-		if (w.rbegin()->value().isSong())
-		{
-			if (Config.search_engine_display_mode == DisplayMode::Columns)
-				w.setTitle(Config.titles_visibility ? Display::Columns(w.getWidth()) : "");
-			size_t found = w.size()-SearchEngine::StaticOptions;
-			found += 3; // don't count options inserted below
-			w.insertSeparator(ResetButton+1);
-			w.insertItem(ResetButton+2, SEItem(), NC::List::Properties::Inactive);
-			w.at(ResetButton+2).value().mkBuffer()
-				<< NC::Format::Bold
-				<< Config.color1
-				<< "Search results: "
-				<< NC::FormattedColor::End<>(Config.color1)
-				<< Config.color2
-				<< "Found " << found << (found > 1 ? " songs" : " song")
-				<< NC::FormattedColor::End<>(Config.color2)
-				<< NC::Format::NoBold;
-			w.insertSeparator(ResetButton+3);
-				Statusbar::print("Searching finished");
-			if (Config.block_search_constraints_change)
-				for (size_t i = 0; i < StaticOptions-4; ++i)
-					w.at(i).setInactive(true);
-			w.scroll(NC::Scroll::Down);
-			w.scroll(NC::Scroll::Down);
-		}
-		else
-			Statusbar::print("No results found");
+		if (!m_search_stream.active())
+			finishSearch();
 	}
 	else if (option == ResetButton)
 	{
@@ -396,11 +433,12 @@ std::vector<MPD::Song> SearchEngine::getSelectedSongs()
 
 void SearchEngine::Prepare()
 {
+	m_search_stream.cancel();
 	w.setTitle("");
 	w.clear();
 	w.resizeList(StaticOptions-3);
 
-	for (auto &item : w)
+	for (auto &&item : w)
 		item.setSelectable(false);
 	
 	w.at(ConstraintsNumber).setSeparator(true);
@@ -431,6 +469,18 @@ void SearchEngine::reset()
 	Statusbar::print("Search state reset");
 }
 
+void SearchEngine::databaseChanged()
+{
+	if (!m_search_stream.active() || !m_search_with_filter)
+		return;
+	Prepare();
+	Search();
+	if (!m_search_stream.active())
+		finishSearch();
+	if (isVisible(this))
+		w.refresh();
+}
+
 void SearchEngine::Search()
 {
 	bool constraints_empty = 1;
@@ -444,7 +494,27 @@ void SearchEngine::Search()
 	}
 	if (constraints_empty)
 		return;
-	
+
+	m_search_with_filter = false;
+	if (Config.search_in_db)
+	{
+		std::string expression = filterExpression();
+		if (!expression.empty())
+		{
+			// Let MPD do the whole search and fetch results in windows using the
+			// background connection, they're added in update() as they arrive.
+			m_search_with_filter = true;
+			m_search_stream = MpdWorker.streamSearch(
+				expression, SearchMode == &SearchModes[2], SearchWindowSize);
+			return;
+		}
+	}
+	searchWithoutFilter();
+}
+
+void SearchEngine::searchWithoutFilter()
+{
+	m_search_with_filter = false;
 	if (Config.search_in_db && (SearchMode == &SearchModes[0] || SearchMode == &SearchModes[2])) // use built-in mpd searching
 	{
 		Mpd.StartSearch(SearchMode == &SearchModes[2]);
@@ -475,7 +545,8 @@ void SearchEngine::Search()
 		return;
 	}
 
-	Regex::Regex rx[ConstraintsNumber];
+	for (size_t i = 0; i < ConstraintsNumber; ++i)
+		m_search_rx[i] = Regex::Regex();
 	if (SearchMode != &SearchModes[2]) // match to pattern
 	{
 		for (size_t i = 0; i < ConstraintsNumber; ++i)
@@ -484,111 +555,215 @@ void SearchEngine::Search()
 			{
 				try
 				{
-					rx[i] = Regex::make(itsConstraints[i], Config.regex_type);
+					m_search_rx[i] = Regex::make(itsConstraints[i], Config.regex_type);
 				}
 				catch (boost::bad_expression &) { }
 			}
 		}
 	}
 
-	typedef boost::range_detail::any_iterator<
-		const MPD::Song,
-		boost::single_pass_traversal_tag,
-		const MPD::Song &,
-		std::ptrdiff_t
-	> input_song_iterator;
-	input_song_iterator s, end;
 	if (Config.search_in_db)
 	{
-		s = input_song_iterator(Mpd.GetDirectoryRecursive("/"));
-		end = input_song_iterator(MPD::SongIterator());
+		// Go through the database using the background connection, songs are
+		// matched in update() as they arrive. If the search index can be used,
+		// only songs that may match are sent.
+		m_search_stream = MpdWorker.streamDatabase(indexQueries());
 	}
+	else
+		addMatchingSongs(myPlaylist->main().beginV(), myPlaylist->main().size());
+}
+
+std::string SearchEngine::filterExpression() const
+{
+	// Filter expressions are supported since MPD 0.21.
+	if (m_filter_unsupported || Mpd.Version() < 21)
+		return "";
+
+	const char *op;
+	if (SearchMode == &SearchModes[0])
+		op = " contains ";
+	else if (SearchMode == &SearchModes[2])
+		op = " == ";
 	else
 	{
-		s = input_song_iterator(myPlaylist->main().beginV());
-		end = input_song_iterator(myPlaylist->main().endV());
+		// MPD matches regular expressions using PCRE, so only perl syntax gives
+		// the same results. Also, it can't ignore diacritics.
+		if (Config.ignore_diacritics)
+			return "";
+		auto syntax = Config.regex_type & ~boost::regex::icase;
+		if (syntax == boost::regex::literal)
+			op = " contains ";
+		else if (syntax == boost::regex::perl)
+			op = " =~ ";
+		else
+			return "";
 	}
 
-	LocaleStringComparison cmp(std::locale(), Config.ignore_leading_the);
-	for (; s != end; ++s)
+	std::string result;
+	size_t constraints = 0;
+	for (size_t i = 0; i < ConstraintsNumber; ++i)
 	{
-		bool any_found = true, found = true;
+		if (itsConstraints[i].empty())
+			continue;
+		if (constraints++ > 0)
+			result += " AND ";
+		result += '(';
+		result += ConstraintsFilterTags[i];
+		result += op;
+		result += MPD::quoteFilterValue(itsConstraints[i]);
+		result += ')';
+	}
+	if (constraints > 1)
+		result = "(" + result + ")";
+	return result;
+}
 
-		if (SearchMode != &SearchModes[2]) // match to pattern
-		{
-			if (!rx[0].empty())
-				any_found =
-					   Regex::search(s->getArtist(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getAlbumArtist(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getTitle(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getAlbum(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getName(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getComposer(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getPerformer(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getGenre(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getDate(), rx[0], Config.ignore_diacritics)
-					|| Regex::search(s->getComment(), rx[0], Config.ignore_diacritics);
-			if (found && !rx[1].empty())
-				found = Regex::search(s->getArtist(), rx[1], Config.ignore_diacritics);
-			if (found && !rx[2].empty())
-				found = Regex::search(s->getAlbumArtist(), rx[2], Config.ignore_diacritics);
-			if (found && !rx[3].empty())
-				found = Regex::search(s->getTitle(), rx[3], Config.ignore_diacritics);
-			if (found && !rx[4].empty())
-				found = Regex::search(s->getAlbum(), rx[4], Config.ignore_diacritics);
-			if (found && !rx[5].empty())
-				found = Regex::search(s->getName(), rx[5], Config.ignore_diacritics);
-			if (found && !rx[6].empty())
-				found = Regex::search(s->getComposer(), rx[6], Config.ignore_diacritics);
-			if (found && !rx[7].empty())
-				found = Regex::search(s->getPerformer(), rx[7], Config.ignore_diacritics);
-			if (found && !rx[8].empty())
-				found = Regex::search(s->getGenre(), rx[8], Config.ignore_diacritics);
-			if (found && !rx[9].empty())
-				found = Regex::search(s->getDate(), rx[9], Config.ignore_diacritics);
-			if (found && !rx[10].empty())
-				found = Regex::search(s->getComment(), rx[10], Config.ignore_diacritics);
-		}
-		else // match only if values are equal
-		{
-			if (!itsConstraints[0].empty())
-				any_found =
-				   !cmp(s->getArtist(), itsConstraints[0])
-				|| !cmp(s->getAlbumArtist(), itsConstraints[0])
-				|| !cmp(s->getTitle(), itsConstraints[0])
-				|| !cmp(s->getAlbum(), itsConstraints[0])
-				|| !cmp(s->getName(), itsConstraints[0])
-				|| !cmp(s->getComposer(), itsConstraints[0])
-				|| !cmp(s->getPerformer(), itsConstraints[0])
-				|| !cmp(s->getGenre(), itsConstraints[0])
-				|| !cmp(s->getDate(), itsConstraints[0])
-				|| !cmp(s->getComment(), itsConstraints[0]);
-			
-			if (found && !itsConstraints[1].empty())
-				found = !cmp(s->getArtist(), itsConstraints[1]);
-			if (found && !itsConstraints[2].empty())
-				found = !cmp(s->getAlbumArtist(), itsConstraints[2]);
-			if (found && !itsConstraints[3].empty())
-				found = !cmp(s->getTitle(), itsConstraints[3]);
-			if (found && !itsConstraints[4].empty())
-				found = !cmp(s->getAlbum(), itsConstraints[4]);
-			if (found && !itsConstraints[5].empty())
-				found = !cmp(s->getName(), itsConstraints[5]);
-			if (found && !itsConstraints[6].empty())
-				found = !cmp(s->getComposer(), itsConstraints[6]);
-			if (found && !itsConstraints[7].empty())
-				found = !cmp(s->getPerformer(), itsConstraints[7]);
-			if (found && !itsConstraints[8].empty())
-				found = !cmp(s->getGenre(), itsConstraints[8]);
-			if (found && !itsConstraints[9].empty())
-				found = !cmp(s->getDate(), itsConstraints[9]);
-			if (found && !itsConstraints[10].empty())
-				found = !cmp(s->getComment(), itsConstraints[10]);
-		}
+std::vector<MPD::SearchIndex::Query> SearchEngine::indexQueries() const
+{
+	std::vector<MPD::SearchIndex::Query> result;
+	// Diacritics are stripped only while matching, so the index can't be used.
+	if (SearchMode != &SearchModes[1] || Config.ignore_diacritics)
+		return result;
+	bool literal = (Config.regex_type & ~boost::regex::icase) == boost::regex::literal;
+	for (size_t i = 0; i < ConstraintsNumber; ++i)
+	{
+		// constraints that failed to compile are ignored by songMatches()
+		if (m_search_rx[i].empty())
+			continue;
+		result.emplace_back(
+			i == 0 ? MPD::SearchIndex::AnyField : static_cast<int>(i - 1),
+			literal
+			? std::vector<std::string>{itsConstraints[i]}
+			: MPD::SearchIndex::requiredLiterals(itsConstraints[i]));
+	}
+	return result;
+}
+
+template <typename SongIteratorT>
+void SearchEngine::addMatchingSongs(SongIteratorT first, size_t count)
+{
+	LocaleStringComparison cmp(std::locale(), Config.ignore_leading_the);
+	// Big lists are matched in multiple threads, each one gets its own copy
+	// of the lambda and thus of the regular expressions and the comparator.
+	auto matches = [this, first, rx = m_search_rx, cmp](size_t i) {
+		return songMatches(first[i], rx, cmp);
+	};
+	for (size_t i : Parallel::filter(0, count, matches))
+		w.addItem(first[i]);
+}
+
+bool SearchEngine::songMatches(const MPD::Song &s, const SearchRegexes &rx,
+                               const LocaleStringComparison &cmp) const
+{
+	// Tags are matched in place, songs here are never modified.
+	// The file constraint is matched with the whole URI, as MPD does it when
+	// the search is done with a filter expression.
+	bool any_found = true, found = true;
+
+	if (SearchMode != &SearchModes[2]) // match to pattern
+	{
+		if (!rx[0].empty())
+			any_found =
+				   Regex::search(s.tag(MPD_TAG_ARTIST), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_ALBUM_ARTIST), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_TITLE), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_ALBUM), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.name(), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_COMPOSER), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_PERFORMER), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_GENRE), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_DATE), rx[0], Config.ignore_diacritics)
+				|| Regex::search(s.tag(MPD_TAG_COMMENT), rx[0], Config.ignore_diacritics);
+		if (found && !rx[1].empty())
+			found = Regex::search(s.tag(MPD_TAG_ARTIST), rx[1], Config.ignore_diacritics);
+		if (found && !rx[2].empty())
+			found = Regex::search(s.tag(MPD_TAG_ALBUM_ARTIST), rx[2], Config.ignore_diacritics);
+		if (found && !rx[3].empty())
+			found = Regex::search(s.tag(MPD_TAG_TITLE), rx[3], Config.ignore_diacritics);
+		if (found && !rx[4].empty())
+			found = Regex::search(s.tag(MPD_TAG_ALBUM), rx[4], Config.ignore_diacritics);
+		if (found && !rx[5].empty())
+			found = Regex::search(s.uri(), rx[5], Config.ignore_diacritics);
+		if (found && !rx[6].empty())
+			found = Regex::search(s.tag(MPD_TAG_COMPOSER), rx[6], Config.ignore_diacritics);
+		if (found && !rx[7].empty())
+			found = Regex::search(s.tag(MPD_TAG_PERFORMER), rx[7], Config.ignore_diacritics);
+		if (found && !rx[8].empty())
+			found = Regex::search(s.tag(MPD_TAG_GENRE), rx[8], Config.ignore_diacritics);
+		if (found && !rx[9].empty())
+			found = Regex::search(s.tag(MPD_TAG_DATE), rx[9], Config.ignore_diacritics);
+		if (found && !rx[10].empty())
+			found = Regex::search(s.tag(MPD_TAG_COMMENT), rx[10], Config.ignore_diacritics);
+	}
+	else // match only if values are equal
+	{
+		if (!itsConstraints[0].empty())
+			any_found =
+			   !cmp(s.tag(MPD_TAG_ARTIST), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_ALBUM_ARTIST), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_TITLE), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_ALBUM), itsConstraints[0])
+			|| !cmp(s.name(), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_COMPOSER), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_PERFORMER), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_GENRE), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_DATE), itsConstraints[0])
+			|| !cmp(s.tag(MPD_TAG_COMMENT), itsConstraints[0]);
 		
-		if (any_found && found)
-			w.addItem(*s);
+		if (found && !itsConstraints[1].empty())
+			found = !cmp(s.tag(MPD_TAG_ARTIST), itsConstraints[1]);
+		if (found && !itsConstraints[2].empty())
+			found = !cmp(s.tag(MPD_TAG_ALBUM_ARTIST), itsConstraints[2]);
+		if (found && !itsConstraints[3].empty())
+			found = !cmp(s.tag(MPD_TAG_TITLE), itsConstraints[3]);
+		if (found && !itsConstraints[4].empty())
+			found = !cmp(s.tag(MPD_TAG_ALBUM), itsConstraints[4]);
+		if (found && !itsConstraints[5].empty())
+			found = !cmp(s.uri(), itsConstraints[5]);
+		if (found && !itsConstraints[6].empty())
+			found = !cmp(s.tag(MPD_TAG_COMPOSER), itsConstraints[6]);
+		if (found && !itsConstraints[7].empty())
+			found = !cmp(s.tag(MPD_TAG_PERFORMER), itsConstraints[7]);
+		if (found && !itsConstraints[8].empty())
+			found = !cmp(s.tag(MPD_TAG_GENRE), itsConstraints[8]);
+		if (found && !itsConstraints[9].empty())
+			found = !cmp(s.tag(MPD_TAG_DATE), itsConstraints[9]);
+		if (found && !itsConstraints[10].empty())
+			found = !cmp(s.tag(MPD_TAG_COMMENT), itsConstraints[10]);
+	}
+	
+	return any_found && found;
+}
+
+void SearchEngine::finishSearch()
+{
+	if (w.rbegin()->value().isSong())
+	{
+		if (Config.search_engine_display_mode == DisplayMode::Columns)
+			w.setTitle(Config.titles_visibility ? Display::Columns(w.getWidth()) : "");
+		size_t found = w.size()-SearchEngine::StaticOptions;
+		found += 3; // don't count options inserted below
+		w.insertSeparator(ResetButton+1);
+		w.insertItem(ResetButton+2, SEItem(), NC::List::Properties::Inactive);
+		w.at(ResetButton+2).value().mkBuffer()
+			<< NC::Format::Bold
+			<< Config.color1
+			<< "Search results: "
+			<< NC::FormattedColor::End<>(Config.color1)
+			<< Config.color2
+			<< "Found " << found << (found > 1 ? " songs" : " song")
+			<< NC::FormattedColor::End<>(Config.color2)
+			<< NC::Format::NoBold;
+		w.insertSeparator(ResetButton+3);
+		Statusbar::print("Searching finished");
+		if (Config.block_search_constraints_change)
+			for (size_t i = 0; i < StaticOptions-4; ++i)
+				w.at(i).setInactive(true);
+		w.scroll(NC::Scroll::Down);
+		w.scroll(NC::Scroll::Down);
 	}
+	else
+		Statusbar::print("No results found");
 }
 
 namespace {
@@ -613,7 +788,7 @@ std::string SEItemToString(const SEItem &ei)
 	return result;
 }
 
-bool SEItemEntryMatcher(const Regex::Regex &rx, const NC::Menu<SEItem>::Item &item, bool filter)
+bool SEItemEntryMatcher(const Regex::Regex &rx, const NC::Menu<SEItem>::ItemRef &item, bool filter)
 {
 	if (item.isSeparator() || !item.value().isSong())
 		return filter;
@@ -21,19 +21,23 @@
 #ifndef NCMPCPP_SEARCH_ENGINE_H
 #define NCMPCPP_SEARCH_ENGINE_H
 
+#include <array>
 #include <cassert>
 
 #include "interfaces.h"
+#include "mpd_worker.h"
 #include "mpdpp.h"
 #include "regex_filter.h"
 #include "screens/screen.h"
 #include "song_list.h"
 
+class LocaleStringComparison;
+
 struct SEItem
 {
-	SEItem() : m_is_song(false), m_buffer(0) { }
-	SEItem(NC::Buffer *buf) : m_is_song(false), m_buffer(buf) { }
-	SEItem(const MPD::Song &s) : m_is_song(true), m_song(s) { }
+	SEItem() : m_is_song(false), m_buffer(0), m_buffer_serial(nextBufferSerial()) { }
+	SEItem(NC::Buffer *buf) : m_is_song(false), m_buffer(buf), m_buffer_serial(nextBufferSerial()) { }
+	SEItem(const MPD::Song &s) : m_is_song(true), m_buffer(0), m_buffer_serial(0), m_song(s) { }
 	SEItem(const SEItem &ei) { *this = ei; }
 	~SEItem() {
 		if (!m_is_song)
@@ -44,12 +48,21 @@ struct SEItem
 		assert(!m_is_song);
 		delete m_buffer;
 		m_buffer = new NC::Buffer();
+		m_buffer_serial = nextBufferSerial();
 		return *m_buffer;
 	}
 
 	bool isSong() const { return m_is_song; }
 
-	NC::Buffer &buffer() { assert(!m_is_song && m_buffer); return *m_buffer; }
+	/// @return number that changes whenever the buffer might have been
+	/// modified, unique among all items
+	size_t bufferSerial() const { assert(!m_is_song); return m_buffer_serial; }
+
+	NC::Buffer &buffer() {
+		assert(!m_is_song && m_buffer);
+		m_buffer_serial = nextBufferSerial();
+		return *m_buffer;
+	}
 	MPD::Song &song() { assert(m_is_song); return m_song; }
 
 	const NC::Buffer &buffer() const { assert(!m_is_song && m_buffer); return *m_buffer; }
@@ -65,13 +78,20 @@ struct SEItem
 			m_buffer = new NC::Buffer(*se.m_buffer);
 		else
 			m_buffer = 0;
+		m_buffer_serial = se.m_buffer_serial;
 		return *this;
 	}
 
 private:
+	static size_t nextBufferSerial() {
+		static size_t serial = 0;
+		return ++serial;
+	}
+
 	bool m_is_song;
 
 	NC::Buffer *m_buffer;
+	size_t m_buffer_serial;
 	MPD::Song m_song;
 };
 
@@ -102,7 +122,7 @@ struct SearchEngine: Screen<SearchEngineWindow>, Filterable, HasActions, HasSong
 	virtual std::wstring title() override;
 	virtual ScreenType type() override { return ScreenType::SearchEngine; }
 	
-	virtual void update() override { }
+	virtual void update() override;
 	
 	virtual void mouseButtonPressed(MEVENT me) override;
 	
@@ -132,14 +152,35 @@ struct SearchEngine: Screen<SearchEngineWindow>, Filterable, HasActions, HasSong
 	
 	// private members
 	void reset();
+
+	// Restart the search if MPD is doing it, as later windows of results
+	// would come from a different state of the database than earlier ones.
+	void databaseChanged();
 	
 	static size_t StaticOptions;
 	static size_t SearchButton;
 	static size_t ResetButton;
 	
 private:
+	static const size_t ConstraintsNumber = 11;
+	typedef std::array<Regex::Regex, ConstraintsNumber> SearchRegexes;
+
 	void Prepare();
 	void Search();
+	void searchWithoutFilter();
+	std::string filterExpression() const;
+	std::vector<MPD::SearchIndex::Query> indexQueries() const;
+	bool songMatches(const MPD::Song &s, const SearchRegexes &rx,
+	                 const LocaleStringComparison &cmp) const;
+	template <typename SongIteratorT>
+	void addMatchingSongs(SongIteratorT first, size_t count);
+	void finishSearch();
+
+	MPD::SongStream m_search_stream;
+	// Whether the current search is done by MPD using filter expression.
+	bool m_search_with_filter;
+	// Set if MPD failed to handle the filter expression.
+	bool m_filter_unsupported;
 
 	Regex::ItemFilter<SEItem> m_search_predicate;
 	
@@ -147,9 +188,9 @@ private:
 	
 	static const char *SearchModes[];
 	
-	static const size_t ConstraintsNumber = 11;
 	static const char *ConstraintsNames[];
 	std::string itsConstraints[ConstraintsNumber];
+	SearchRegexes m_search_rx;
 	
 	static bool MatchToPattern;
 };
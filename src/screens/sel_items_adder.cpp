@@ -42,7 +42,7 @@ void DisplayComponent(SelectedItemsAdder::Component &menu)
 	menu << Charset::utf8ToLocale(menu.drawn()->value().item());
 }
 
-bool EntryMatcher(const Regex::Regex &rx, const NC::Menu<SelectedItemsAdder::Entry>::Item &item)
+bool EntryMatcher(const Regex::Regex &rx, const NC::Menu<SelectedItemsAdder::Entry>::ItemRef &item)
 {
 	if (!item.isSeparator())
 		return Regex::search(item.value().item(), rx, Config.ignore_diacritics);
@@ -53,6 +53,7 @@ bool EntryMatcher(const Regex::Regex &rx, const NC::Menu<SelectedItemsAdder::Ent
 }
 
 SelectedItemsAdder::SelectedItemsAdder()
+: m_songs_source(nullptr)
 {
 	using Global::MainHeight;
 	using Global::MainStartY;
@@ -117,12 +118,20 @@ void SelectedItemsAdder::switchTo()
 	if (!hs)
 		return;
 	
-	Statusbar::print(1, "Fetching selected songs...");
-	m_selected_items = hs->getSelectedSongs();
-	if (m_selected_items.empty())
+	m_songs_source = hs;
+	m_selected_queries.clear();
+	m_selected_items.clear();
+	if (auto hq = dynamic_cast<HasSongQueries *>(myScreen))
+		m_selected_queries = hq->getSelectedQueries();
+	if (m_selected_queries.empty())
 	{
-		Statusbar::print("No selected songs");
-		return;
+		Statusbar::print(1, "Fetching selected songs...");
+		m_selected_items = hs->getSelectedSongs();
+		if (m_selected_items.empty())
+		{
+			Statusbar::print("No selected songs");
+			return;
+		}
 	}
 	populatePlaylistSelector(myScreen);
 	SwitchTo::execute(this);
@@ -282,23 +291,64 @@ void SelectedItemsAdder::addToNewPlaylist() const
 
 void SelectedItemsAdder::addToExistingPlaylist(const std::string &playlist) const
 {
-	Mpd.StartCommandsList();
-	for (auto s = m_selected_items.begin(); s != m_selected_items.end(); ++s)
-		Mpd.AddToPlaylist(playlist, *s);
-	Mpd.CommitCommandsList();
+	bool added = false;
+	if (!m_selected_queries.empty())
+	{
+		try
+		{
+			Mpd.StartCommandsList();
+			for (const auto &query : m_selected_queries)
+				Mpd.SearchAddToPlaylist(playlist, query);
+			Mpd.CommitCommandsList();
+			added = true;
+		}
+		catch (MPD::ServerError &e)
+		{
+			// searchaddpl with filter expressions requires MPD >= 0.21, fall
+			// back to adding songs one by one if it's not supported.
+			if (e.code() != MPD_SERVER_ERROR_ARG && e.code() != MPD_SERVER_ERROR_UNKNOWN_CMD)
+				throw;
+		}
+	}
+	if (!added)
+	{
+		auto songs = selectedSongs();
+		Mpd.StartCommandsList();
+		for (auto s = songs.begin(); s != songs.end(); ++s)
+			Mpd.AddToPlaylist(playlist, *s);
+		Mpd.CommitCommandsList();
+	}
 	Statusbar::printf("Selected item(s) added to playlist \"%1%\"", playlist);
 	switchToPreviousScreen();
 }
 
 void SelectedItemsAdder::addAtTheEndOfPlaylist() const
 {
-	bool success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, -1);
+	bool success = true;
+	if (!m_selected_queries.empty())
+	{
+		try
+		{
+			Mpd.StartCommandsList();
+			for (const auto &query : m_selected_queries)
+				Mpd.FindAdd(query);
+			Mpd.CommitCommandsList();
+		}
+		catch (MPD::ServerError &e)
+		{
+			Status::handleServerError(e);
+			success = false;
+		}
+	}
+	else
+		success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, -1);
 	exitSuccessfully(success);
 }
 
 void SelectedItemsAdder::addAtTheBeginningOfPlaylist() const
 {
-	bool success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, 0);
+	auto songs = selectedSongs();
+	bool success = addSongsToPlaylist(songs.begin(), songs.end(), false, 0);
 	exitSuccessfully(success);
 }
 
@@ -308,7 +358,8 @@ void SelectedItemsAdder::addAfterCurrentSong() const
 		return;
 	size_t pos = Status::State::currentSongPosition();
 	++pos;
-	bool success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, pos);
+	auto songs = selectedSongs();
+	bool success = addSongsToPlaylist(songs.begin(), songs.end(), false, pos);
 	exitSuccessfully(success);
 }
 
@@ -321,7 +372,8 @@ void SelectedItemsAdder::addAfterCurrentAlbum() const
 	std::string album =  pl[pos].value().getAlbum();
 	while (pos < pl.size() && pl[pos].value().getAlbum() == album)
 		++pos;
-	bool success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, pos);
+	auto songs = selectedSongs();
+	bool success = addSongsToPlaylist(songs.begin(), songs.end(), false, pos);
 	exitSuccessfully(success);
 }
 
@@ -329,7 +381,8 @@ void SelectedItemsAdder::addAfterHighlightedSong() const
 {
 	size_t pos = myPlaylist->main().current()->value().getPosition();
 	++pos;
-	bool success = addSongsToPlaylist(m_selected_items.begin(), m_selected_items.end(), false, pos);
+	auto songs = selectedSongs();
+	bool success = addSongsToPlaylist(songs.begin(), songs.end(), false, pos);
 	exitSuccessfully(success);
 }
 
@@ -347,6 +400,14 @@ void SelectedItemsAdder::exitSuccessfully(bool success) const
 	switchToPreviousScreen();
 }
 
+std::vector<MPD::Song> SelectedItemsAdder::selectedSongs() const
+{
+	if (m_selected_queries.empty())
+		return m_selected_items;
+	Statusbar::print(1, "Fetching selected songs...");
+	return m_songs_source->getSelectedSongs();
+}
+
 void SelectedItemsAdder::setDimensions()
 {
 	using Global::MainHeight;
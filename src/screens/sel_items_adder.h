@@ -31,7 +31,7 @@ struct SelectedItemsAdder: Screen<NC::Menu<RunnableItem<std::string, void()>> *>
 {
 	typedef SelectedItemsAdder Self;
 	typedef typename std::remove_pointer<WindowType>::type Component;
-	typedef Component::Item::Type Entry;
+	typedef Component::ItemRef::Type Entry;
 	
 	SelectedItemsAdder();
 	
@@ -73,6 +73,8 @@ private:
 	void addAfterHighlightedSong() const;
 	void cancel();
 	void exitSuccessfully(bool success) const;
+
+	std::vector<MPD::Song> selectedSongs() const;
 	
 	void setDimensions();
 	
@@ -85,6 +87,10 @@ private:
 	Component m_playlist_selector;
 	Component m_position_selector;
 	
+	// If the screen can describe its selection as database queries, songs are
+	// fetched only if they need to be added at a specific position.
+	HasSongs *m_songs_source;
+	std::vector<MPD::TagConstraints> m_selected_queries;
 	std::vector<MPD::Song> m_selected_items;
 
 	Regex::ItemFilter<Entry> m_search_predicate;
@@ -23,7 +23,9 @@
 
 #include "global.h"
 #include "helpers.h"
+#include "mpd_worker.h"
 #include "screens/server_info.h"
+#include "status.h"
 #include "statusbar.h"
 #include "screens/screen_switcher.h"
 
@@ -108,6 +110,12 @@ void ServerInfo::update()
 	w << NC::Format::Bold << "Songs in database: " << NC::Format::NoBold << stats.songs() << '\n';
 	w << '\n';
 	w << NC::Format::Bold << "Last DB update: " << NC::Format::NoBold << Timestamp(stats.dbUpdateTime()) << '\n';
+	w << NC::Format::Bold << "Merged idle events: " << NC::Format::NoBold << Status::State::mergedIdleEvents() << '\n';
+	const auto &index = MpdWorker.indexStatistics();
+	if (index.songs > 0)
+		w << NC::Format::Bold << "Search index: " << NC::Format::NoBold
+		  << index.songs << " songs, " << index.bytes / 1024 << " KiB, built in "
+		  << static_cast<unsigned>(index.buildTime) << " ms\n";
 	w << '\n';
 	w << NC::Format::Bold << "URL Handlers:" << NC::Format::NoBold;
 	for (auto it = m_url_handlers.begin(); it != m_url_handlers.end(); ++it)
@@ -34,7 +34,7 @@ SortPlaylistDialog *mySortPlaylistDialog;
 
 SortPlaylistDialog::SortPlaylistDialog()
 {
-	typedef WindowType::Item::Type Entry;
+	typedef WindowType::ItemRef::Type Entry;
 	
 	using Global::MainHeight;
 	using Global::MainStartY;
@@ -172,6 +172,7 @@ void SortPlaylistDialog::sort() const
 		return;
 
 	size_t start_pos = begin - pl.begin();
+	myPlaylist->loadSongs(start_pos, end - pl.begin());
 	std::vector<MPD::Song> playlist;
 	playlist.reserve(end - begin);
 	for (; begin != end; ++begin)
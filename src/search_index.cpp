@@ -0,0 +1,390 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cassert>
+
+#include "search_index.h"
+
+namespace {
+
+const mpd_tag_type FieldTags[MPD::SearchIndex::FieldCount] = {
+	MPD_TAG_ARTIST, MPD_TAG_ALBUM_ARTIST, MPD_TAG_TITLE, MPD_TAG_ALBUM,
+	MPD_TAG_NAME, MPD_TAG_COMPOSER, MPD_TAG_PERFORMER, MPD_TAG_GENRE,
+	MPD_TAG_DATE, MPD_TAG_COMMENT,
+};
+
+char toLower(char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+std::string lowercase(std::string_view s)
+{
+	std::string result(s);
+	std::transform(result.begin(), result.end(), result.begin(), toLower);
+	return result;
+}
+
+uint32_t trigramKey(int field, const char *s)
+{
+	return static_cast<uint32_t>(field) << 24
+		| static_cast<uint32_t>(static_cast<uint8_t>(s[0])) << 16
+		| static_cast<uint32_t>(static_cast<uint8_t>(s[1])) << 8
+		| static_cast<uint32_t>(static_cast<uint8_t>(s[2]));
+}
+
+// Split strings into lowercased parts consisting of ASCII characters only.
+// Other characters can be matched case insensitively by the regex engine in
+// ways that can't be replicated here, so they are not relied on.
+std::vector<std::string> asciiSegments(const std::vector<std::string> &literals)
+{
+	std::vector<std::string> result;
+	std::string segment;
+	auto flush = [&] {
+		if (!segment.empty())
+			result.push_back(std::move(segment));
+		segment.clear();
+	};
+	for (const auto &literal : literals)
+	{
+		for (char c : literal)
+		{
+			if (static_cast<uint8_t>(c) < 0x80)
+				segment += toLower(c);
+			else
+				flush();
+		}
+		flush();
+	}
+	return result;
+}
+
+bool containsAll(std::string_view value, const std::vector<std::string> &segments)
+{
+	return std::all_of(segments.begin(), segments.end(), [&value](const std::string &segment) {
+		return value.find(segment) != std::string_view::npos;
+	});
+}
+
+template <typename FunctionT>
+void forEachValue(const MPD::Song &s, FunctionT f)
+{
+	for (int field = 0; field < MPD::SearchIndex::FieldCount; ++field)
+	{
+		// The search engine matches the file constraint with the URI and any
+		// tag with the name, which is the URI's last component if there is no
+		// Name tag, so both of them are indexed.
+		if (field == MPD::SearchIndex::Name)
+		{
+			f(field, s.uri());
+			std::string_view name = s.tag(MPD_TAG_NAME);
+			if (!name.empty())
+				f(field, name);
+		}
+		else if (const auto &row = s.row())
+		{
+			const char *value;
+			for (unsigned idx = 0; (value = row.tag(FieldTags[field], idx)) != nullptr; ++idx)
+				f(field, std::string_view(value));
+		}
+		else
+		{
+			std::string value;
+			for (unsigned idx = 0; !(value = s.get(FieldTags[field], idx)).empty(); ++idx)
+				f(field, std::string_view(value));
+		}
+	}
+}
+
+void intersect(std::vector<uint32_t> &result, const std::vector<uint32_t> &other)
+{
+	auto end = std::set_intersection(result.begin(), result.end(),
+	                                 other.begin(), other.end(),
+	                                 result.begin());
+	result.erase(end, result.end());
+}
+
+}
+
+namespace MPD {
+
+void SearchIndex::Postings::append(uint32_t id)
+{
+	assert(count == 0 || id > last);
+	uint32_t delta = id - last;
+	do
+	{
+		uint8_t byte = delta & 0x7f;
+		delta >>= 7;
+		if (delta != 0)
+			byte |= 0x80;
+		data.push_back(byte);
+	}
+	while (delta != 0);
+	last = id;
+	++count;
+}
+
+std::vector<uint32_t> SearchIndex::Postings::decode() const
+{
+	std::vector<uint32_t> result;
+	result.reserve(count);
+	uint32_t id = 0;
+	for (size_t i = 0; i < data.size();)
+	{
+		uint32_t delta = 0;
+		int shift = 0;
+		uint8_t byte;
+		do
+		{
+			byte = data[i++];
+			delta |= static_cast<uint32_t>(byte & 0x7f) << shift;
+			shift += 7;
+		}
+		while (byte & 0x80);
+		id += delta;
+		result.push_back(id);
+	}
+	return result;
+}
+
+void SearchIndex::add(const Song &s)
+{
+	remove(s);
+	uint32_t slot = m_songs.size();
+	m_songs.push_back(s);
+	m_slots.emplace(m_songs.back().c_uri(), slot);
+	++m_alive;
+
+	std::vector<uint32_t> keys;
+	forEachValue(s, [&](int field, std::string_view value) {
+		std::string lowercased = lowercase(value);
+		uint32_t id;
+		auto it = m_value_ids[field].find(lowercased);
+		if (it == m_value_ids[field].end())
+		{
+			id = m_values.size();
+			const char *text = m_strings.add(lowercased);
+			m_values.emplace_back(text, lowercased.size(), field);
+			m_value_ids[field].emplace(std::string_view(text, lowercased.size()), id);
+			keys.clear();
+			for (size_t i = 0; i + 3 <= lowercased.size(); ++i)
+				keys.push_back(trigramKey(field, text + i));
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+			for (auto key : keys)
+				m_postings[key].append(id);
+		}
+		else
+			id = it->second;
+		// the same value may be present more than once
+		auto &songs = m_values[id].songs;
+		if (songs.empty() || songs.back() != slot)
+			songs.push_back(slot);
+	});
+}
+
+void SearchIndex::remove(const Song &s)
+{
+	auto it = m_slots.find(s.c_uri());
+	if (it == m_slots.end())
+		return;
+	uint32_t slot = it->second;
+	// Values without songs stay in the index, they just don't match anything.
+	forEachValue(m_songs[slot], [&](int field, std::string_view value) {
+		auto id = m_value_ids[field].find(lowercase(value));
+		if (id != m_value_ids[field].end())
+		{
+			auto &songs = m_values[id->second].songs;
+			songs.erase(std::remove(songs.begin(), songs.end(), slot), songs.end());
+		}
+	});
+	m_slots.erase(it);
+	m_songs[slot] = Song();
+	--m_alive;
+}
+
+bool SearchIndex::candidates(const std::vector<Query> &queries, std::vector<Song> &result) const
+{
+	bool narrowed = false;
+	std::vector<uint32_t> slots;
+	for (const auto &query : queries)
+	{
+		auto segments = asciiSegments(query.literals);
+		if (segments.empty())
+			continue;
+		std::vector<uint32_t> query_slots;
+		for (int field = 0; field < FieldCount; ++field)
+		{
+			if (query.field != AnyField && query.field != field)
+				continue;
+			for (auto id : queryValues(field, segments))
+				query_slots.insert(query_slots.end(),
+				                   m_values[id].songs.begin(), m_values[id].songs.end());
+		}
+		std::sort(query_slots.begin(), query_slots.end());
+		query_slots.erase(std::unique(query_slots.begin(), query_slots.end()), query_slots.end());
+		if (narrowed)
+			intersect(slots, query_slots);
+		else
+		{
+			slots = std::move(query_slots);
+			narrowed = true;
+		}
+	}
+	if (!narrowed)
+		return false;
+	result.reserve(result.size() + slots.size());
+	for (auto slot : slots)
+		result.push_back(m_songs[slot]);
+	return true;
+}
+
+std::vector<uint32_t> SearchIndex::queryValues(int field, const std::vector<std::string> &segments) const
+{
+	std::vector<uint32_t> result;
+	std::vector<const Postings *> postings;
+	for (const auto &segment : segments)
+	{
+		for (size_t i = 0; i + 3 <= segment.size(); ++i)
+		{
+			auto it = m_postings.find(trigramKey(field, segment.data() + i));
+			if (it == m_postings.end())
+				return result;
+			postings.push_back(&it->second);
+		}
+	}
+
+	if (postings.empty())
+	{
+		// Segments are too short, check all values of the field.
+		for (uint32_t id = 0; id < m_values.size(); ++id)
+		{
+			const auto &value = m_values[id];
+			if (value.field == field && containsAll(std::string_view(value.text, value.size), segments))
+				result.push_back(id);
+		}
+		return result;
+	}
+
+	// Start with the shortest list so that intermediate results are small.
+	std::sort(postings.begin(), postings.end());
+	postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+	std::sort(postings.begin(), postings.end(), [](const Postings *a, const Postings *b) {
+		return a->count < b->count;
+	});
+	result = postings[0]->decode();
+	for (size_t i = 1; i < postings.size() && !result.empty(); ++i)
+		intersect(result, postings[i]->decode());
+
+	// Trigrams don't need to be adjacent, check that the value really contains
+	// the segments.
+	result.erase(
+		std::remove_if(result.begin(), result.end(), [this, &segments](uint32_t id) {
+			const auto &value = m_values[id];
+			return !containsAll(std::string_view(value.text, value.size), segments);
+		}),
+		result.end());
+	return result;
+}
+
+std::vector<std::string> SearchIndex::requiredLiterals(const std::string &pattern)
+{
+	std::vector<std::string> result;
+	if (pattern.find_first_of("|()") != std::string::npos)
+		return result;
+	std::string literal;
+	auto flush = [&] {
+		if (!literal.empty())
+			result.push_back(std::move(literal));
+		literal.clear();
+	};
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		switch (pattern[i])
+		{
+			case '*':
+			case '?':
+			case '{':
+				// The preceding character is optional, remove it (with all bytes
+				// if it's a multibyte one).
+				while (!literal.empty() && (literal.back() & 0xc0) == 0x80)
+					literal.pop_back();
+				if (!literal.empty())
+					literal.pop_back();
+				if (pattern[i] == '{')
+					i = std::min(pattern.find('}', i), pattern.size());
+				flush();
+				break;
+			case '[':
+			{
+				size_t end = i + 1;
+				if (end < pattern.size() && pattern[end] == '^')
+					++end;
+				if (end < pattern.size() && pattern[end] == ']')
+					++end;
+				i = std::min(pattern.find(']', end), pattern.size());
+				flush();
+				break;
+			}
+			case '\\':
+				// it might be a character class, skip it
+				++i;
+				flush();
+				break;
+			case '.':
+			case '^':
+			case '$':
+			case '+':
+			case ']':
+			case '}':
+				flush();
+				break;
+			default:
+				literal += pattern[i];
+		}
+	}
+	flush();
+	return result;
+}
+
+size_t SearchIndex::bytes() const
+{
+	// approximate size of a hash table node
+	auto table = [](const auto &map) {
+		typedef typename std::decay_t<decltype(map)>::value_type ValueType;
+		return map.bucket_count()*sizeof(void *) + map.size()*(sizeof(ValueType) + sizeof(void *));
+	};
+	size_t result = m_strings.bytes();
+	result += m_values.capacity()*sizeof(Value);
+	for (const auto &value : m_values)
+		result += value.songs.capacity()*sizeof(uint32_t);
+	for (const auto &ids : m_value_ids)
+		result += table(ids);
+	result += table(m_postings);
+	for (const auto &postings : m_postings)
+		result += postings.second.data.capacity();
+	result += m_songs.capacity()*sizeof(Song);
+	result += table(m_slots);
+	return result;
+}
+
+}
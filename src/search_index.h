@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_SEARCH_INDEX_H
+#define NCMPCPP_SEARCH_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "song.h"
+#include "song_store.h"
+
+namespace MPD {
+
+// Trigram index over tags of songs used by the search engine for finding
+// songs that may match the query before the exact (usually regex) matching
+// is done. Values of each tag are stored once and trigrams point to values
+// they occur in, which in turn point to songs. Songs can be added and
+// removed at any time.
+struct SearchIndex
+{
+	// Tags that can be searched, in the order of search engine constraints.
+	// Name holds the URI of songs and their Name tag if they have one, so
+	// that it covers both the file constraint and Song::name().
+	enum Field { Artist, AlbumArtist, Title, Album, Name, Composer, Performer,
+	             Genre, Date, Comment, FieldCount };
+	static const int AnyField = -1;
+
+	struct Query
+	{
+		Query(int field_, std::vector<std::string> literals_)
+		: field(field_), literals(std::move(literals_))
+		{ }
+
+		// One of the fields or AnyField.
+		int field;
+		// Strings that need to be present in the value of the field.
+		std::vector<std::string> literals;
+	};
+
+	SearchIndex() : m_alive(0) { }
+
+	SearchIndex(const SearchIndex &) = delete;
+	SearchIndex &operator=(const SearchIndex &) = delete;
+
+	void add(const Song &s);
+	void remove(const Song &s);
+
+	// Put songs that may match all the queries into result (in the order they
+	// were added). Returns false if the queries can't narrow down the search,
+	// i.e. all songs are candidates.
+	bool candidates(const std::vector<Query> &queries, std::vector<Song> &result) const;
+
+	// Strings that need to be present in any string matched by the regular
+	// expression. Alternatives and groups are not analyzed, for them no
+	// strings are returned.
+	static std::vector<std::string> requiredLiterals(const std::string &pattern);
+
+	size_t songs() const { return m_alive; }
+	size_t bytes() const;
+
+private:
+	struct Value
+	{
+		Value(const char *text_, uint32_t size_, uint8_t field_)
+		: text(text_), size(size_), field(field_)
+		{ }
+
+		// lowercased
+		const char *text;
+		uint32_t size;
+		uint8_t field;
+		std::vector<uint32_t> songs;
+	};
+
+	// Ids of values containing the trigram in a field, delta encoded as
+	// variable length integers.
+	struct Postings
+	{
+		Postings() : last(0), count(0) { }
+
+		void append(uint32_t id);
+		std::vector<uint32_t> decode() const;
+
+		std::vector<uint8_t> data;
+		uint32_t last;
+		uint32_t count;
+	};
+
+	std::vector<uint32_t> queryValues(int field, const std::vector<std::string> &segments) const;
+
+	SongStore::StringPool m_strings;
+	std::vector<Value> m_values;
+	std::unordered_map<std::string_view, uint32_t> m_value_ids[FieldCount];
+	std::unordered_map<uint32_t, Postings> m_postings;
+
+	// Removed songs leave empty slots behind.
+	std::vector<Song> m_songs;
+	std::unordered_map<std::string_view, uint32_t> m_slots;
+	size_t m_alive;
+};
+
+}
+
+#endif // NCMPCPP_SEARCH_INDEX_H
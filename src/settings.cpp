@@ -29,6 +29,7 @@
 #include "settings.h"
 #include "utility/conversion.h"
 #include "utility/option_parser.h"
+#include "utility/parallel.h"
 #include "utility/type_conversions.h"
 
 #ifdef HAVE_LANGINFO_H
@@ -215,6 +216,7 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 	// keep the same order of variables as in configuration file
 	p.add("ncmpcpp_directory", &ncmpcpp_directory, "~/.config/ncmpcpp/", adjust_directory);
 	p.add("lyrics_directory", &lyrics_directory, "~/.lyrics/", adjust_directory);
+	p.add("cache_directory", &cache_directory, "~/.cache/ncmpcpp/", adjust_directory);
 	p.add<void>("mpd_host", nullptr, "localhost", [](std::string host) {
 			expand_home(host);
 			Mpd.SetHostname(host);
@@ -228,6 +230,8 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 		});
 	p.add("mpd_music_dir", &mpd_music_dir, "~/music", adjust_directory);
 	p.add("mpd_connection_timeout", &mpd_connection_timeout, "5");
+	p.add("mpd_negotiate_tag_types", &mpd_negotiate_tag_types, "no", yes_no);
+	p.add("database_snapshot", &database_snapshot, "yes", yes_no);
 	p.add("mpd_crossfade_time", &crossfade_time, "5");
 	p.add("random_exclude_pattern", &random_exclude_pattern, "");
 	p.add("visualizer_data_source", &visualizer_data_source, "/tmp/mpd.fifo", adjust_path);
@@ -299,6 +303,10 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 		      return boost::posix_time::seconds(verbose_lexical_cast<unsigned>(v));
 	      });
 	p.add("message_delay_time", &message_delay_time, "5");
+	p.add("idle_events_coalescing_delay", &idle_events_coalescing_delay,
+	      "100", [](std::string v) {
+		      return boost::posix_time::milliseconds(verbose_lexical_cast<unsigned>(v));
+	      });
 	p.add("song_list_format", &song_list_format,
 	      "{%a - }{%t}|{$8%f$9}$R{$3%l$9}", [](std::string v) {
 		      return Format::parse(v);
@@ -399,6 +407,7 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 	p.add("playlist_show_remaining_time", &playlist_show_remaining_time, "no", yes_no);
 	p.add("playlist_shorten_total_times", &playlist_shorten_total_times, "no", yes_no);
 	p.add("playlist_separate_albums", &playlist_separate_albums, "no", yes_no);
+	p.add("playlist_lazy_loading", &playlist_lazy_loading, "no", yes_no);
 	p.add("playlist_display_mode", &playlist_display_mode, "columns");
 	p.add("browser_display_mode", &browser_display_mode, "classic");
 	p.add("search_engine_display_mode", &search_engine_display_mode, "classic");
@@ -564,6 +573,8 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 	});
 	p.add("ignore_leading_the", &ignore_leading_the, "no", yes_no);
 	p.add("ignore_diacritics", &ignore_diacritics, "no", yes_no);
+	p.add("parallel_filter_threshold", &Parallel::Threshold, "20000");
+	p.add("parallel_filter_threads", &Parallel::Threads, "0");
 	p.add("block_search_constraints_change_if_items_found",
 	      &block_search_constraints_change, "yes", yes_no);
 	p.add("mouse_support", &mouse_support, "yes", yes_no);
@@ -614,7 +625,7 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 	p.add("active_window_border", &active_window_border, "red",
 	      verbose_lexical_cast<NC::Color>);
 
-	return std::all_of(
+	bool success = std::all_of(
 		config_paths.begin(),
 		config_paths.end(),
 		[&](const std::string &config_path) {
@@ -624,4 +635,40 @@ bool Configuration::read(const std::vector<std::string> &config_paths, bool igno
 			return p.run(f, ignore_errors);
 		}
 	) && p.initialize_undefined(ignore_errors);
+
+	mpd_tag_types.clear();
+	if (success && mpd_negotiate_tag_types)
+		mpd_tag_types = usedTagTypes();
+	return success;
+}
+
+std::vector<mpd_tag_type> Configuration::usedTagTypes() const
+{
+	// Tags needed regardless of formats (media library, sorting,
+	// lyrics fetching, window title).
+	std::vector<mpd_tag_type> result = {
+		MPD_TAG_ARTIST, MPD_TAG_ALBUM_ARTIST, MPD_TAG_ALBUM, MPD_TAG_TITLE,
+		MPD_TAG_DATE, MPD_TAG_TRACK, MPD_TAG_DISC, media_lib_primary_tag
+	};
+	auto add_tags = [&result](const std::vector<MPD::Song::GetFunction> &functions) {
+		for (const auto &f : functions)
+		{
+			auto tag = getFunctionToTagType(f);
+			if (tag && std::find(result.begin(), result.end(), *tag) == result.end())
+				result.push_back(*tag);
+		}
+	};
+	add_tags(Format::songTags(song_list_format));
+	add_tags(Format::songTags(song_window_title_format));
+	add_tags(Format::songTags(song_library_format));
+	add_tags(Format::songTags(song_columns_mode_format));
+	add_tags(Format::songTags(browser_sort_format));
+	add_tags(Format::songTags(song_status_format));
+	add_tags(Format::songTags(song_status_wformat));
+	add_tags(Format::songTags(new_header_first_line));
+	add_tags(Format::songTags(new_header_second_line));
+	// media_lib_primary_tag might duplicate one of the defaults.
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
 }
@@ -53,12 +53,17 @@ struct Configuration
 {
 	Configuration()
 	: playlist_disable_highlight_delay(0)
+	, idle_events_coalescing_delay(0)
 	{ }
 
 	bool read(const std::vector<std::string> &config_paths, bool ignore_errors);
 
+	// tag types referenced by formats and needed internally
+	std::vector<mpd_tag_type> usedTagTypes() const;
+
 	std::string ncmpcpp_directory;
 	std::string lyrics_directory;
+	std::string cache_directory;
 
 	std::string mpd_music_dir;
 	std::string visualizer_fifo_path; // deprecated
@@ -151,6 +156,7 @@ struct Configuration
 	bool playlist_show_remaining_time;
 	bool playlist_shorten_total_times;
 	bool playlist_separate_albums;
+	bool playlist_lazy_loading;
 	bool set_window_title;
 	bool header_visibility;
 	bool header_text_scrolling;
@@ -194,6 +200,9 @@ struct Configuration
 	bool startup_slave_screen_focus;
 
 	unsigned mpd_connection_timeout;
+	bool mpd_negotiate_tag_types;
+	bool database_snapshot;
+	std::vector<mpd_tag_type> mpd_tag_types;
 	unsigned crossfade_time;
 	unsigned seek_time;
 	unsigned volume_change_step;
@@ -205,6 +214,7 @@ struct Configuration
 	boost::regex::flag_type regex_type;
 
 	boost::posix_time::seconds playlist_disable_highlight_delay;
+	boost::posix_time::milliseconds idle_events_coalescing_delay;
 
 	double locked_screen_width_part;
 
@@ -18,6 +18,7 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <boost/format.hpp>
@@ -60,7 +61,7 @@ bool Song::ShowDuplicateTags = true;
 std::string Song::get(mpd_tag_type type, unsigned idx) const
 {
 	std::string result;
-	const char *tag = mpd_song_get_tag(m_song.get(), type, idx);
+	const char *tag = c_tag(type, idx);
 	if (tag)
 		result = tag;
 	return result;
@@ -71,27 +72,37 @@ Song::Song(mpd_song *s)
 	assert(s);
 	m_song = std::shared_ptr<mpd_song>(s, mpd_song_free);
 	m_hash = calc_hash(mpd_song_get_uri(s));
+	m_serial = SongStore::reserveSerials(1);
+}
+
+Song::Song(std::shared_ptr<const SongStore> store, SongStore::Row row)
+: m_store(std::move(store))
+, m_row(row)
+{
+	assert(m_store);
+	assert(m_row);
+	m_hash = calc_hash(m_row.uri());
+	m_serial = m_row.serial();
 }
 
 std::string Song::getURI(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	if (idx > 0)
 		return "";
 	else
-		return mpd_song_get_uri(m_song.get());
+		return c_uri();
 }
 
 std::string Song::getName(unsigned idx) const
 {
-	assert(m_song);
-	mpd_song *s = m_song.get();
-	const char *res = mpd_song_get_tag(s, MPD_TAG_NAME, idx);
+	assert(!empty());
+	const char *res = c_tag(MPD_TAG_NAME, idx);
 	if (res)
 		return res;
 	else if (idx > 0)
 		return "";
-	const char *uri = mpd_song_get_uri(s);
+	const char *uri = c_uri();
 	const char *name = strrchr(uri, '/');
 	if (name)
 		return name+1;
@@ -101,10 +112,10 @@ std::string Song::getName(unsigned idx) const
 
 std::string Song::getDirectory(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	if (idx > 0 || isStream())
 		return "";
-	const char *uri = mpd_song_get_uri(m_song.get());
+	const char *uri = c_uri();
 	const char *name = strrchr(uri, '/');
 	if (name)
 		return std::string(uri, name-uri);
@@ -114,31 +125,31 @@ std::string Song::getDirectory(unsigned idx) const
 
 std::string Song::getArtist(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_ARTIST, idx);
 }
 
 std::string Song::getTitle(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_TITLE, idx);
 }
 
 std::string Song::getAlbum(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_ALBUM, idx);
 }
 
 std::string Song::getAlbumArtist(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_ALBUM_ARTIST, idx);
 }
 
 std::string Song::getTrack(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	std::string track = get(MPD_TAG_TRACK, idx);
 	format_numeric_tag(track);
 	return track;
@@ -146,7 +157,7 @@ std::string Song::getTrack(unsigned idx) const
 
 std::string Song::getTrackNumber(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	std::string track = getTrack(idx);
 	size_t slash = track.find('/');
 	if (slash != std::string::npos)
@@ -156,31 +167,31 @@ std::string Song::getTrackNumber(unsigned idx) const
 
 std::string Song::getDate(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_DATE, idx);
 }
 
 std::string Song::getGenre(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_GENRE, idx);
 }
 
 std::string Song::getComposer(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_COMPOSER, idx);
 }
 
 std::string Song::getPerformer(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_PERFORMER, idx);
 }
 
 std::string Song::getDisc(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	std::string disc = get(MPD_TAG_DISC, idx);
 	format_numeric_tag(disc);
 	return disc;
@@ -188,13 +199,13 @@ std::string Song::getDisc(unsigned idx) const
 
 std::string Song::getComment(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	return get(MPD_TAG_COMMENT, idx);
 }
 
 std::string Song::getLength(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	if (idx > 0)
 		return "";
 	unsigned len = getDuration();
@@ -206,17 +217,84 @@ std::string Song::getLength(unsigned idx) const
 
 std::string Song::getPriority(unsigned idx) const
 {
-	assert(m_song);
+	assert(!empty());
 	if (idx > 0)
 		return "";
 	return boost::lexical_cast<std::string>(getPrio());
 }
 
+std::string_view Song::name() const
+{
+	assert(!empty());
+	std::string_view result = tag(MPD_TAG_NAME);
+	if (!result.empty())
+		return result;
+	const char *uri = c_uri();
+	const char *name = strrchr(uri, '/');
+	if (name)
+		return name+1;
+	else
+		return uri;
+}
+
+std::string_view Song::directory() const
+{
+	assert(!empty());
+	if (isStream())
+		return std::string_view();
+	const char *uri = c_uri();
+	const char *name = strrchr(uri, '/');
+	if (name)
+		return std::string_view(uri, name-uri);
+	else
+		return "/";
+}
+
+mpd_tag_type Song::tagType(GetFunction f)
+{
+	if (f == &Song::getArtist)
+		return MPD_TAG_ARTIST;
+	else if (f == &Song::getTitle)
+		return MPD_TAG_TITLE;
+	else if (f == &Song::getAlbum)
+		return MPD_TAG_ALBUM;
+	else if (f == &Song::getAlbumArtist)
+		return MPD_TAG_ALBUM_ARTIST;
+	else if (f == &Song::getDate)
+		return MPD_TAG_DATE;
+	else if (f == &Song::getGenre)
+		return MPD_TAG_GENRE;
+	else if (f == &Song::getComposer)
+		return MPD_TAG_COMPOSER;
+	else if (f == &Song::getPerformer)
+		return MPD_TAG_PERFORMER;
+	else if (f == &Song::getComment)
+		return MPD_TAG_COMMENT;
+	else
+		return MPD_TAG_UNKNOWN;
+}
+
 std::string MPD::Song::getTags(GetFunction f) const
 {
-	assert(m_song);
+	assert(!empty());
 	unsigned idx = 0;
 	std::string result;
+	// Plain tags are joined straight from the storage, without a temporary
+	// string for each value.
+	mpd_tag_type type = tagType(f);
+	if (type != MPD_TAG_UNKNOWN && !hasModifiedTags())
+	{
+		auto values = tags(type);
+		for (auto it = values.begin(); it != values.end(); ++it)
+		{
+			if (!ShowDuplicateTags && std::find(values.begin(), it, *it) != it)
+				continue;
+			if (!result.empty())
+				result += TagsSeparator;
+			result += *it;
+		}
+		return result;
+	}
 	if (ShowDuplicateTags)
 	{
 		for (std::string tag; !(tag = (this->*f)(idx)).empty(); ++idx)
@@ -255,52 +333,90 @@ std::string MPD::Song::getTags(GetFunction f) const
 
 unsigned Song::getDuration() const
 {
-	assert(m_song);
-	return mpd_song_get_duration(m_song.get());
+	assert(!empty());
+	if (m_row)
+		return m_row.duration();
+	else
+		return mpd_song_get_duration(m_song.get());
 }
 
 unsigned Song::getPosition() const
 {
-	assert(m_song);
-	return mpd_song_get_pos(m_song.get());
+	assert(!empty());
+	if (m_row)
+		return m_row.position();
+	else
+		return mpd_song_get_pos(m_song.get());
+}
+
+Song Song::withPosition(unsigned position, const std::shared_ptr<SongStore> &store) const
+{
+	assert(!empty());
+	if (m_row)
+	{
+		store->adopt(m_store);
+		return Song(store, store->copy(m_row, position));
+	}
+	mpd_song *s = mpd_song_dup(m_song.get());
+	if (s == nullptr)
+		throw std::bad_alloc();
+	mpd_song_set_pos(s, position);
+	return Song(s);
 }
 
 unsigned Song::getID() const
 {
-	assert(m_song);
-	return mpd_song_get_id(m_song.get());
+	assert(!empty());
+	if (m_row)
+		return m_row.id();
+	else
+		return mpd_song_get_id(m_song.get());
 }
 
 unsigned Song::getPrio() const
 {
-	assert(m_song);
-	return mpd_song_get_prio(m_song.get());
+	assert(!empty());
+	if (m_row)
+		return m_row.prio();
+	else
+		return mpd_song_get_prio(m_song.get());
 }
 
 time_t Song::getMTime() const
 {
-	assert(m_song);
-	return mpd_song_get_last_modified(m_song.get());
+	assert(!empty());
+	if (m_row)
+		return m_row.mtime();
+	else
+		return mpd_song_get_last_modified(m_song.get());
 }
 
 bool Song::isFromDatabase() const
 {
-	assert(m_song);
-	const char *uri = mpd_song_get_uri(m_song.get());
+	assert(!empty());
+	const char *uri = c_uri();
 	return uri[0] != '/' || !strrchr(uri, '/');
 }
 
 bool Song::isStream() const
 {
-	assert(m_song);
-	const char *song_uri = mpd_song_get_uri(m_song.get());
+	assert(!empty());
+	const char *song_uri = c_uri();
 	// Stream schemas: http, https
 	return !strncmp(song_uri, "http://", 7) || !strncmp(song_uri, "https://", 8);
 }
 
 bool Song::empty() const
 {
-	return m_song.get() == 0;
+	return m_song.get() == 0 && !m_row;
+}
+
+const char *Song::c_tag(mpd_tag_type type, unsigned idx) const
+{
+	if (m_row)
+		return m_row.tag(type, idx);
+	else
+		return mpd_song_get_tag(m_song.get(), type, idx);
 }
 
 std::string Song::ShowTime(unsigned length)
@@ -23,12 +23,16 @@
 
 #include <cstring>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <mpd/client.h>
 
+#include "song_store.h"
+
 namespace MPD {
 
 struct Song
@@ -39,17 +43,25 @@ struct Song
 
 	typedef std::string (Song::*GetFunction)(unsigned) const;
 	
-	Song() : m_hash(0) { }
+	Song() : m_hash(0), m_serial(0) { }
 	virtual ~Song() { }
 	
 	Song(mpd_song *s);
+	Song(std::shared_ptr<const SongStore> store, SongStore::Row row);
 
-	Song(const Song &rhs) : m_song(rhs.m_song), m_hash(rhs.m_hash) { }
-	Song(Song &&rhs) : m_song(std::move(rhs.m_song)), m_hash(rhs.m_hash) { }
+	Song(const Song &rhs)
+	: m_song(rhs.m_song), m_store(rhs.m_store)
+	, m_row(rhs.m_row), m_hash(rhs.m_hash), m_serial(rhs.m_serial) { }
+	Song(Song &&rhs) noexcept
+	: m_song(std::move(rhs.m_song)), m_store(std::move(rhs.m_store))
+	, m_row(rhs.m_row), m_hash(rhs.m_hash), m_serial(rhs.m_serial) { }
 	Song &operator=(Song rhs)
 	{
 		m_song = std::move(rhs.m_song);
+		m_store = std::move(rhs.m_store);
+		m_row = rhs.m_row;
 		m_hash = rhs.m_hash;
+		m_serial = rhs.m_serial;
 		return *this;
 	}
 	
@@ -74,9 +86,106 @@ struct Song
 	virtual std::string getPriority(unsigned idx = 0) const;
 	
 	virtual std::string getTags(GetFunction f) const;
+
+	// Type of the tag returned by the getter as is, MPD_TAG_UNKNOWN if it's
+	// formatted or computed.
+	static mpd_tag_type tagType(GetFunction f);
+
+	// Tags as they are stored, without copying. Unlike the getters they don't
+	// format track and disc numbers and don't reflect modifications of a
+	// MutableSong (see hasModifiedTags()). Missing tags are empty.
+	std::string_view tag(mpd_tag_type type, unsigned idx = 0) const
+	{
+		const char *value = c_tag(type, idx);
+		return value != nullptr ? value : std::string_view();
+	}
+	std::string_view uri() const { return c_uri(); }
+	// Same as getName() and getDirectory().
+	std::string_view name() const;
+	std::string_view directory() const;
+
+	// Iterator over values of a tag, the end iterator is default constructed.
+	struct TagIterator
+	{
+		typedef std::forward_iterator_tag iterator_category;
+		typedef std::string_view value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const std::string_view *pointer;
+		typedef const std::string_view &reference;
+
+		TagIterator() : m_song(nullptr), m_type(MPD_TAG_UNKNOWN), m_idx(0) { }
+		TagIterator(const Song *song, mpd_tag_type type)
+		: m_song(song), m_type(type), m_idx(0)
+		{
+			fetch();
+		}
+
+		reference operator*() const { return m_value; }
+		pointer operator->() const { return &m_value; }
+
+		TagIterator &operator++()
+		{
+			++m_idx;
+			fetch();
+			return *this;
+		}
+		TagIterator operator++(int)
+		{
+			TagIterator result = *this;
+			++*this;
+			return result;
+		}
+
+		bool operator==(const TagIterator &rhs) const
+		{
+			return m_song == rhs.m_song && m_idx == rhs.m_idx;
+		}
+		bool operator!=(const TagIterator &rhs) const
+		{
+			return !(*this == rhs);
+		}
+
+	private:
+		void fetch()
+		{
+			m_value = m_song->tag(m_type, m_idx);
+			// values end with the first empty one, like with the getters
+			if (m_value.empty())
+			{
+				m_song = nullptr;
+				m_idx = 0;
+			}
+		}
+
+		const Song *m_song;
+		mpd_tag_type m_type;
+		unsigned m_idx;
+		std::string_view m_value;
+	};
+
+	struct TagRange
+	{
+		TagRange(TagIterator begin_) : m_begin(begin_) { }
+
+		TagIterator begin() const { return m_begin; }
+		TagIterator end() const { return TagIterator(); }
+
+	private:
+		TagIterator m_begin;
+	};
+
+	// Values of the tag, e.g. for (std::string_view artist : s.tags(MPD_TAG_ARTIST)).
+	TagRange tags(mpd_tag_type type) const { return TagRange(TagIterator(this, type)); }
+
+	// Whether the getters may return different tags than the views.
+	virtual bool hasModifiedTags() const { return false; }
 	
 	virtual unsigned getDuration() const;
 	virtual unsigned getPosition() const;
+	// Songs are shared (between lists, caches etc.), so instead of changing
+	// the position in place, make a copy of the song with a different one.
+	// Copies of songs backed by a store are put into the given one.
+	Song withPosition(unsigned position, const std::shared_ptr<SongStore> &store) const;
 	virtual unsigned getID() const;
 	virtual unsigned getPrio() const;
 	virtual time_t getMTime() const;
@@ -85,6 +194,22 @@ struct Song
 	virtual bool isStream() const;
 	
 	virtual bool empty() const;
+
+	// Placeholders stand for songs in the queue whose metadata was not
+	// fetched yet, only their position and id are known.
+	bool isPlaceholder() const { return m_row && *m_row.uri() == '\0'; }
+
+	// Store backing the song and its row in it, if any.
+	const std::shared_ptr<const SongStore> &store() const { return m_store; }
+	const SongStore::Row &row() const { return m_row; }
+
+	// Identifies the song along with its metadata for the lifetime of the
+	// program (see SongStore::Row::serial()), zero if it's empty or its tags
+	// were modified.
+	uint64_t serial() const
+	{
+		return !hasModifiedTags() ? m_serial : 0;
+	}
 	
 	bool operator==(const Song &rhs) const
 	{
@@ -97,7 +222,13 @@ struct Song
 		return !(operator==(rhs));
 	}
 
-	const char *c_uri() const { return m_song ? mpd_song_get_uri(m_song.get()) : ""; }
+	const char *c_uri() const
+	{
+		if (m_row)
+			return m_row.uri();
+		else
+			return m_song ? mpd_song_get_uri(m_song.get()) : "";
+	}
 
 	static std::string ShowTime(unsigned length);
 
@@ -106,8 +237,14 @@ struct Song
 	static bool ShowDuplicateTags;
 
 private:
+	const char *c_tag(mpd_tag_type type, unsigned idx) const;
+
+	// song is backed either by mpd_song or by a row in the store
 	std::shared_ptr<mpd_song> m_song;
+	std::shared_ptr<const SongStore> m_store;
+	SongStore::Row m_row;
 	size_t m_hash;
+	uint64_t m_serial;
 };
 
 }
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "format_impl.h"
+#include "settings.h"
+#include "song_filter.h"
+#include "utility/parallel.h"
+
+namespace {
+
+bool isPlainCharacter(char c)
+{
+	return (c >= 'a' && c <= 'z')
+		|| (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9')
+		|| c == ' '
+		// part of a multibyte UTF-8 character
+		|| (c & 0x80);
+}
+
+}
+
+SongFilter::SongFilter()
+: m_format(nullptr)
+, m_cache(BackgroundThreshold)
+{
+	if (pipe(m_notification_pipe) == 0)
+	{
+		for (int fd : m_notification_pipe)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	else
+		m_notification_pipe[0] = m_notification_pipe[1] = -1;
+}
+
+SongFilter::~SongFilter()
+{
+	cancel();
+	for (int fd : m_notification_pipe)
+		if (fd >= 0)
+			close(fd);
+}
+
+void SongFilter::dispatch()
+{
+	char buf[64];
+	while (read(m_notification_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	// Notifications of a cancelled scan might still be in the pipe, report()
+	// ignores the ones that come before the current scan has any results.
+	if (m_job != nullptr)
+		report(m_job);
+}
+
+bool SongFilter::narrows(const std::string &previous,
+                         const std::string &constraint,
+                         boost::regex::flag_type flags)
+{
+	if (previous.empty()
+	    || constraint.size() < previous.size()
+	    || constraint.compare(0, previous.size(), previous) != 0)
+		return false;
+	if (flags & boost::regex::literal)
+		return true;
+	// Appending plain characters to a regular expression narrows it down unless
+	// they change the meaning of an escape sequence at its end (e.g. \x4 and
+	// \x41), so be conservative and give up if there are any.
+	if (previous.find('\\') != std::string::npos)
+		return false;
+	return std::all_of(constraint.begin() + previous.size(), constraint.end(),
+	                   isPlainCharacter);
+}
+
+void SongFilter::start(const Regex::Regex &rx, const Format::AST<char> &format,
+                       std::vector<Candidate> candidates, ResultCallback callback)
+{
+	cancel();
+	setFormat(format);
+
+	// Without notifications results of the background scan wouldn't be seen.
+	if (candidates.size() < BackgroundThreshold || m_notification_pipe[1] < 0)
+	{
+		std::vector<size_t> rows;
+		for (const auto &candidate : candidates)
+			if (Regex::search(*haystack(candidate.second), rx, Config.ignore_diacritics))
+				rows.push_back(candidate.first);
+		callback(std::move(rows), true);
+		return;
+	}
+
+	auto job = std::make_shared<Job>(
+		rx, format, std::move(candidates), Config.ignore_diacritics);
+	job->haystacks.reserve(job->candidates.size());
+	for (const auto &candidate : job->candidates)
+	{
+		auto haystack = m_cache.find(key(candidate.second));
+		if (haystack != nullptr)
+			job->haystacks.push_back(*haystack);
+		else
+			job->haystacks.emplace_back();
+	}
+
+	m_job = job;
+	m_callback = std::move(callback);
+	job->thread = std::thread(scan, job, [fd = m_notification_pipe[1]] {
+		[[maybe_unused]] ssize_t written = write(fd, "", 1);
+	});
+}
+
+std::vector<size_t> SongFilter::cancel()
+{
+	std::vector<size_t> rows;
+	if (m_job == nullptr)
+		return rows;
+	m_job->cancelled = true;
+	m_job->thread.join();
+	rows = std::move(m_job->matches);
+	for (size_t i = m_job->scanned; i < m_job->candidates.size(); ++i)
+		rows.push_back(m_job->candidates[i].first);
+	finish();
+	return rows;
+}
+
+bool SongFilter::matches(const Regex::Regex &rx, const Format::AST<char> &format,
+                         const MPD::Song &s)
+{
+	setFormat(format);
+	return Regex::search(*haystack(s), rx, Config.ignore_diacritics);
+}
+
+void SongFilter::setCacheCapacity(size_t songs)
+{
+	m_cache.setCapacity(std::max(songs, BackgroundThreshold));
+}
+
+void SongFilter::scan(std::shared_ptr<Job> job, std::function<void()> notify)
+{
+	const size_t size = job->candidates.size();
+	// With multiple threads each report covers one chunk per thread.
+	const unsigned threads = Parallel::Threshold > 0 && size >= Parallel::Threshold
+		? Parallel::threadCount()
+		: 1;
+	const size_t chunk_size = ChunkSize*threads;
+	// Threads write haystacks of different candidates, so they don't collide.
+	auto matches = [job, rx = job->rx](size_t i) {
+		auto &haystack = job->haystacks[i];
+		if (haystack == nullptr)
+			haystack = std::make_shared<std::string>(
+				Format::stringify<char>(job->format, &job->candidates[i].second));
+		return Regex::search(*haystack, rx, job->ignore_diacritics);
+	};
+	for (size_t begin = 0; begin < size && !job->cancelled; begin += chunk_size)
+	{
+		size_t end = std::min(begin + chunk_size, size);
+		auto rows = Parallel::filter(begin, end, matches, threads);
+		for (auto &row : rows)
+			row = job->candidates[row].first;
+		{
+			std::lock_guard<std::mutex> lock(job->mutex);
+			job->matches.insert(job->matches.end(), rows.begin(), rows.end());
+			job->scanned = end;
+			job->finished = end == size;
+		}
+		notify();
+	}
+}
+
+void SongFilter::report(const std::shared_ptr<Job> &job)
+{
+	std::vector<size_t> rows;
+	bool finished;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		if (job->scanned == 0)
+			return;
+		rows.assign(job->matches.begin() + job->reported, job->matches.end());
+		job->reported = job->matches.size();
+		finished = job->finished;
+	}
+	bool replace = !job->replaced;
+	job->replaced = true;
+	auto callback = m_callback;
+	if (finished)
+	{
+		job->thread.join();
+		finish();
+	}
+	// Notifications may pile up, in which case the first one takes everything.
+	if (replace || !rows.empty())
+		callback(std::move(rows), replace);
+}
+
+void SongFilter::finish()
+{
+	for (size_t i = 0; i < m_job->haystacks.size(); ++i)
+	{
+		auto &haystack = m_job->haystacks[i];
+		if (haystack == nullptr)
+			continue;
+		uint64_t song_key = key(m_job->candidates[i].second);
+		if (song_key != 0)
+			m_cache.insert(song_key, std::move(haystack));
+	}
+	m_job.reset();
+	m_callback = nullptr;
+}
+
+SongFilter::Haystack SongFilter::haystack(const MPD::Song &s)
+{
+	uint64_t song_key = key(s);
+	if (song_key != 0)
+	{
+		if (auto cached = m_cache.find(song_key))
+			return *cached;
+	}
+	auto result = std::make_shared<std::string>(Format::stringify<char>(*m_format, &s));
+	if (song_key != 0)
+		m_cache.insert(song_key, result);
+	return result;
+}
+
+void SongFilter::setFormat(const Format::AST<char> &format)
+{
+	if (&format != m_format)
+	{
+		m_cache.clear();
+		m_format = &format;
+	}
+}
@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_SONG_FILTER_H
+#define NCMPCPP_SONG_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "regex_filter.h"
+#include "song.h"
+#include "utility/lru_cache.h"
+
+// Matches a regular expression against songs formatted with the given format
+// (their haystacks), which are cached between filters and rebuilt when the
+// song or the format changes. Scans of many songs run in a background thread
+// in chunks, so the interface stays responsive. Results are reported as they
+// come (see notificationFD()), and the scan can be cancelled at any point,
+// e.g. when the filter changes.
+struct SongFilter
+{
+	// Song along with its row in the list that is being filtered.
+	typedef std::pair<size_t, MPD::Song> Candidate;
+
+	// Called in the main thread with rows of matching candidates, in order. The
+	// first call of a scan has replace set, the following ones append to it.
+	typedef std::function<void(std::vector<size_t> rows, bool replace)> ResultCallback;
+
+	// Scans of fewer songs are done in place.
+	static const size_t BackgroundThreshold = 16384;
+	// Number of songs matched by each background thread between reports.
+	static const size_t ChunkSize = 4096;
+
+	SongFilter();
+	~SongFilter();
+
+	SongFilter(const SongFilter &) = delete;
+	SongFilter &operator=(const SongFilter &) = delete;
+
+	// Descriptor that becomes readable when a background scan has new results,
+	// which should then be passed to the callback by calling dispatch().
+	int notificationFD() const { return m_notification_pipe[0]; }
+	void dispatch();
+
+	// Check whether songs matching the constraint are a subset of the ones
+	// matching the previous constraint, so that only these need to be scanned.
+	static bool narrows(const std::string &previous,
+	                    const std::string &constraint,
+	                    boost::regex::flag_type flags);
+
+	// Start matching the regular expression against the candidates (sorted by
+	// row), cancelling the previous scan.
+	void start(const Regex::Regex &rx, const Format::AST<char> &format,
+	           std::vector<Candidate> candidates, ResultCallback callback);
+
+	// Stop the scan and return rows of candidates that matched so far along
+	// with the ones that weren't checked yet, i.e. the ones that may match.
+	std::vector<size_t> cancel();
+
+	// True if a scan is running in the background.
+	bool running() const { return m_job != nullptr; }
+
+	// Match a single song in the main thread.
+	bool matches(const Regex::Regex &rx, const Format::AST<char> &format,
+	             const MPD::Song &s);
+
+	// Keep haystacks of at most that many songs (e.g. all songs of the list
+	// that is filtered), dropping the ones that were least recently matched.
+	void setCacheCapacity(size_t songs);
+
+private:
+	typedef std::shared_ptr<const std::string> Haystack;
+
+	struct Job
+	{
+		Job(const Regex::Regex &rx_, const Format::AST<char> &format_,
+		    std::vector<Candidate> &&candidates_, bool ignore_diacritics_)
+		: rx(rx_), format(format_), candidates(std::move(candidates_))
+		, ignore_diacritics(ignore_diacritics_), cancelled(false)
+		, scanned(0), reported(0), finished(false)
+		, replaced(false)
+		{ }
+
+		// Not modified while the scan runs.
+		const Regex::Regex rx;
+		const Format::AST<char> format;
+		const std::vector<Candidate> candidates;
+		const bool ignore_diacritics;
+
+		// Haystacks of candidates. Missing ones are filled in by the background
+		// thread and can be read in the main thread only after it's joined.
+		std::vector<Haystack> haystacks;
+
+		std::atomic<bool> cancelled;
+		std::thread thread;
+
+		std::mutex mutex;
+		// Number of candidates checked so far.
+		size_t scanned;
+		// Rows of candidates that matched so far.
+		std::vector<size_t> matches;
+		// Number of matches passed to the callback.
+		size_t reported;
+		bool finished;
+
+		// Only accessed from the main thread.
+		bool replaced;
+	};
+
+	static void scan(std::shared_ptr<Job> job, std::function<void()> notify);
+
+	// Pass new results of the job to the callback.
+	void report(const std::shared_ptr<Job> &job);
+
+	// Stop using the job and put haystacks it made into the cache.
+	void finish();
+
+	// Haystacks are keyed by serials of songs they are made of, which identify
+	// them along with their tags. Songs with key 0 are not cached.
+	static uint64_t key(const MPD::Song &s)
+	{
+		return s.isPlaceholder() ? 0 : s.serial();
+	}
+
+	Haystack haystack(const MPD::Song &s);
+	void setFormat(const Format::AST<char> &format);
+
+	std::shared_ptr<Job> m_job;
+	ResultCallback m_callback;
+
+	const Format::AST<char> *m_format;
+	LRUCache<uint64_t, Haystack> m_cache;
+
+	int m_notification_pipe[2];
+};
+
+#endif // NCMPCPP_SONG_FILTER_H
@@ -0,0 +1,302 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "song_store.h"
+
+namespace {
+
+const size_t MinChunkRows = 64;
+const size_t MaxChunkRows = 4096;
+const size_t TagsPerRow = 16;
+const size_t PoolBlockSize = 1 << 16;
+
+// Serial number of the next row of any store.
+std::atomic<uint64_t> next_row_serial(1);
+
+time_t parseISO8601(const char *s)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	char *end = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+	if (end == nullptr)
+		return 0;
+	return timegm(&tm);
+}
+
+}
+
+namespace MPD {
+
+const char *SongStore::Row::tag(mpd_tag_type type, unsigned idx) const
+{
+	uint32_t end = m_chunk->tagsBegin[m_index+1];
+	for (uint32_t i = m_chunk->tagsBegin[m_index]; i < end; ++i)
+	{
+		if (m_chunk->tagTypes[i] == type && idx-- == 0)
+			return m_chunk->tagValues[i];
+	}
+	return nullptr;
+}
+
+size_t SongStore::Row::tagsCount() const
+{
+	return m_chunk->tagsBegin[m_index+1] - m_chunk->tagsBegin[m_index];
+}
+
+std::pair<mpd_tag_type, const char *> SongStore::Row::tagAt(size_t i) const
+{
+	i += m_chunk->tagsBegin[m_index];
+	return { static_cast<mpd_tag_type>(m_chunk->tagTypes[i]), m_chunk->tagValues[i] };
+}
+
+SongStore::Chunk::Chunk(size_t rows_capacity, size_t tags_capacity)
+: rowsCapacity(rows_capacity)
+, tagsCapacity(tags_capacity)
+, rows(0)
+, tags(0)
+, uri(new const char *[rows_capacity])
+, mtime(new time_t[rows_capacity])
+, duration(new uint32_t[rows_capacity])
+, position(new uint32_t[rows_capacity])
+, id(new uint32_t[rows_capacity])
+, prio(new uint32_t[rows_capacity])
+, tagsBegin(new uint32_t[rows_capacity+1])
+, tagTypes(new uint8_t[tags_capacity])
+, tagValues(new const char *[tags_capacity])
+, firstSerial(reserveSerials(rows_capacity))
+{
+	tagsBegin[0] = 0;
+}
+
+const char *SongStore::StringPool::add(std::string_view s)
+{
+	size_t size = s.size() + 1;
+	if (size > m_left)
+	{
+		size_t block_size = std::max(size, PoolBlockSize);
+		m_blocks.emplace_back(new char[block_size]);
+		m_pos = m_blocks.back().get();
+		m_left = block_size;
+		m_bytes += block_size;
+	}
+	char *result = m_pos;
+	memcpy(result, s.data(), s.size());
+	result[s.size()] = '\0';
+	m_pos += size;
+	m_left -= size;
+	m_used += size;
+	return result;
+}
+
+const char *SongStore::Dictionary::intern(std::string_view s, bool stable)
+{
+	++references;
+	auto it = values.find(s);
+	if (it != values.end())
+		return it->second;
+	const char *value = stable ? s.data() : pool.add(s);
+	values.emplace(std::string_view(value, s.size()), value);
+	return value;
+}
+
+SongStore::SongStore()
+: m_songs(0)
+{ }
+
+void SongStore::begin(const mpd_pair *pair)
+{
+	assert(strcmp(pair->name, "file") == 0);
+	m_current_mtime = 0;
+	m_current_duration = 0;
+	m_current_position = 0;
+	m_current_id = 0;
+	m_current_prio = 0;
+	m_current_tags.clear();
+	m_current_strings.clear();
+	m_current_strings.insert(m_current_strings.end(),
+	                         pair->value, pair->value + strlen(pair->value) + 1);
+}
+
+void SongStore::feed(const mpd_pair *pair)
+{
+	if (strcmp(pair->name, "Last-Modified") == 0)
+		m_current_mtime = parseISO8601(pair->value);
+	else if (strcmp(pair->name, "Time") == 0)
+		m_current_duration = strtoul(pair->value, nullptr, 10);
+	else if (strcmp(pair->name, "duration") == 0)
+	{
+		// "duration" is more precise, but like libmpdclient prefer "Time" if
+		// it's available.
+		if (m_current_duration == 0)
+			m_current_duration = strtod(pair->value, nullptr) + 0.5;
+	}
+	else if (strcmp(pair->name, "Pos") == 0)
+		m_current_position = strtoul(pair->value, nullptr, 10);
+	else if (strcmp(pair->name, "Id") == 0)
+		m_current_id = strtoul(pair->value, nullptr, 10);
+	else if (strcmp(pair->name, "Prio") == 0)
+		m_current_prio = strtoul(pair->value, nullptr, 10);
+	else
+	{
+		mpd_tag_type type = mpd_tag_name_parse(pair->name);
+		if (type != MPD_TAG_UNKNOWN)
+		{
+			m_current_tags.emplace_back(type, m_current_strings.size());
+			m_current_strings.insert(m_current_strings.end(),
+			                         pair->value, pair->value + strlen(pair->value) + 1);
+		}
+	}
+}
+
+SongStore::Row SongStore::commit()
+{
+	assert(!m_current_strings.empty());
+	m_current_tag_values.clear();
+	for (const auto &tag : m_current_tags)
+		m_current_tag_values.emplace_back(tag.first, m_current_strings.data() + tag.second);
+	return store(m_current_strings.data(), m_current_mtime, m_current_duration,
+	             m_current_tag_values, false,
+	             m_current_position, m_current_id, m_current_prio);
+}
+
+SongStore::Row SongStore::add(const char *uri, time_t mtime, unsigned duration,
+                              const Tags &tags, bool stable_strings)
+{
+	return store(uri, mtime, duration, tags, stable_strings, 0, 0, 0);
+}
+
+uint64_t SongStore::reserveSerials(size_t count)
+{
+	return next_row_serial.fetch_add(count);
+}
+
+SongStore::Row SongStore::placeholder(unsigned position, unsigned id)
+{
+	return store("", 0, 0, Tags(), true, position, id, 0);
+}
+
+SongStore::Row SongStore::copy(const Row &row, unsigned position)
+{
+	Tags tags;
+	tags.reserve(row.tagsCount());
+	for (size_t i = 0; i < row.tagsCount(); ++i)
+		tags.push_back(row.tagAt(i));
+	return store(row.uri(), row.mtime(), row.duration(), tags, true,
+	             position, row.id(), row.prio());
+}
+
+void SongStore::adopt(std::shared_ptr<const void> memory)
+{
+	// the same memory is often adopted many times in a row
+	if (m_adopted.empty() || m_adopted.back() != memory)
+		m_adopted.push_back(std::move(memory));
+}
+
+size_t SongStore::bytes() const
+{
+	size_t result = 0;
+	for (const auto &column : memoryUsage())
+		result += column.bytes;
+	return result;
+}
+
+std::vector<SongStore::ColumnUsage> SongStore::memoryUsage() const
+{
+	size_t rows = 0, tags = 0;
+	for (const auto &chunk : m_chunks)
+	{
+		rows += chunk->rowsCapacity;
+		tags += chunk->tagsCapacity;
+	}
+	std::vector<ColumnUsage> result = {
+		{ "uri", m_uris.bytes() + rows*sizeof(const char *), m_songs, m_songs },
+		{ "mtime", rows*sizeof(time_t), m_songs, 0 },
+		{ "duration", rows*sizeof(uint32_t), m_songs, 0 },
+		{ "position", rows*sizeof(uint32_t), m_songs, 0 },
+		{ "id", rows*sizeof(uint32_t), m_songs, 0 },
+		{ "prio", rows*sizeof(uint32_t), m_songs, 0 },
+		{ "tag references", rows*sizeof(uint32_t) + tags*(sizeof(uint8_t) + sizeof(const char *)), 0, 0 },
+	};
+	size_t references = result.size() - 1;
+	for (int type = 0; type < MPD_TAG_COUNT; ++type)
+	{
+		const auto &dictionary = m_dictionaries[type];
+		if (dictionary.references == 0)
+			continue;
+		result[references].values += dictionary.references;
+		// approximate size of the hash table
+		size_t table = dictionary.values.bucket_count()*sizeof(void *)
+			+ dictionary.values.size()*(sizeof(std::string_view) + 2*sizeof(void *));
+		result.push_back({
+			mpd_tag_name(static_cast<mpd_tag_type>(type)),
+			dictionary.pool.bytes() + table,
+			dictionary.references,
+			dictionary.values.size()
+		});
+	}
+	return result;
+}
+
+SongStore::Chunk &SongStore::reserve(size_t tags)
+{
+	if (m_chunks.empty()
+	    || m_chunks.back()->rows == m_chunks.back()->rowsCapacity
+	    || m_chunks.back()->tags + tags > m_chunks.back()->tagsCapacity)
+	{
+		size_t rows = m_chunks.empty()
+			? MinChunkRows
+			: std::min(m_chunks.back()->rowsCapacity*2, MaxChunkRows);
+		m_chunks.emplace_back(new Chunk(rows, std::max(rows*TagsPerRow, tags)));
+	}
+	return *m_chunks.back();
+}
+
+SongStore::Row SongStore::store(const char *uri, time_t mtime, unsigned duration,
+                                const Tags &tags, bool stable_strings,
+                                unsigned position, unsigned id, unsigned prio)
+{
+	Chunk &chunk = reserve(tags.size());
+	size_t row = chunk.rows;
+	chunk.uri[row] = stable_strings ? uri : m_uris.add(uri);
+	chunk.mtime[row] = mtime;
+	chunk.duration[row] = duration;
+	chunk.position[row] = position;
+	chunk.id[row] = id;
+	chunk.prio[row] = prio;
+	for (const auto &tag : tags)
+	{
+		assert(tag.first >= 0 && tag.first < MPD_TAG_COUNT);
+		chunk.tagTypes[chunk.tags] = tag.first;
+		chunk.tagValues[chunk.tags] = m_dictionaries[tag.first].intern(tag.second, stable_strings);
+		++chunk.tags;
+	}
+	chunk.tagsBegin[row+1] = chunk.tags;
+	++chunk.rows;
+	++m_songs;
+	return Row(&chunk, row);
+}
+
+}
@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_SONG_STORE_H
+#define NCMPCPP_SONG_STORE_H
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mpd/client.h>
+
+namespace MPD {
+
+// Column oriented storage for songs received in bulk (e.g. from listallinfo).
+// Rows are kept in chunks, each holding a column per field and a list of tag
+// references per row. Tag values are interned in a dictionary per tag type,
+// so a value shared by many songs (artist, album, genre) is stored once and
+// referenced by a pointer that doubles as its id. URIs are stored in a single
+// string pool. Chunks and pools never move, so rows can be referenced while
+// the store is still being filled by another thread.
+struct SongStore
+{
+	struct Chunk;
+
+	// Handle to a single row of the store.
+	struct Row
+	{
+		Row() : m_chunk(nullptr), m_index(0) { }
+		Row(const Chunk *chunk, uint32_t index) : m_chunk(chunk), m_index(index) { }
+
+		explicit operator bool() const { return m_chunk != nullptr; }
+
+		const char *uri() const { return m_chunk->uri[m_index]; }
+		const char *tag(mpd_tag_type type, unsigned idx) const;
+
+		// Tags of the row in the order they were received.
+		size_t tagsCount() const;
+		std::pair<mpd_tag_type, const char *> tagAt(size_t i) const;
+
+		unsigned duration() const { return m_chunk->duration[m_index]; }
+		unsigned position() const { return m_chunk->position[m_index]; }
+		unsigned id() const { return m_chunk->id[m_index]; }
+		unsigned prio() const { return m_chunk->prio[m_index]; }
+		time_t mtime() const { return m_chunk->mtime[m_index]; }
+
+		// Number of the row unique among rows of all stores for the lifetime of
+		// the program. Rows don't change, so it identifies the song along with
+		// its metadata.
+		uint64_t serial() const { return m_chunk->firstSerial + m_index; }
+
+	private:
+		const Chunk *m_chunk;
+		uint32_t m_index;
+	};
+
+	struct Chunk
+	{
+		Chunk(size_t rows_capacity, size_t tags_capacity);
+
+		size_t rowsCapacity;
+		size_t tagsCapacity;
+		size_t rows;
+		size_t tags;
+
+		std::unique_ptr<const char *[]> uri;
+		std::unique_ptr<time_t[]> mtime;
+		std::unique_ptr<uint32_t[]> duration;
+		std::unique_ptr<uint32_t[]> position;
+		std::unique_ptr<uint32_t[]> id;
+		std::unique_ptr<uint32_t[]> prio;
+		// Tags of the i-th row are in [tagsBegin[i], tagsBegin[i+1]).
+		std::unique_ptr<uint32_t[]> tagsBegin;
+		std::unique_ptr<uint8_t[]> tagTypes;
+		std::unique_ptr<const char *[]> tagValues;
+		// Serial number of the first row.
+		uint64_t firstSerial;
+	};
+
+	// Memory taken by a single column of the store.
+	struct ColumnUsage
+	{
+		std::string name;
+		size_t bytes;
+		// number of stored values and distinct ones (for interned columns)
+		size_t values;
+		size_t distinct;
+	};
+
+	SongStore();
+
+	SongStore(const SongStore &) = delete;
+	SongStore &operator=(const SongStore &) = delete;
+
+	// Start decoding a new song, the pair needs to be the "file" one.
+	void begin(const mpd_pair *pair);
+	// Feed a pair belonging to the song that is being decoded.
+	void feed(const mpd_pair *pair);
+	// Finish decoding the song and store it.
+	Row commit();
+
+	// Store a song with the given fields. If strings are stable, i.e. live in
+	// memory adopted by the store, they are referenced instead of copied.
+	typedef std::vector<std::pair<mpd_tag_type, const char *>> Tags;
+	Row add(const char *uri, time_t mtime, unsigned duration, const Tags &tags,
+	        bool stable_strings = false);
+
+	// Store a row with no URI and tags that only holds position and id of a
+	// song in the queue, used in place of songs that weren't fetched yet.
+	Row placeholder(unsigned position, unsigned id);
+
+	// Store a copy of the row with a different position in the queue. Strings
+	// are referenced, so the store the row belongs to needs to be adopted.
+	Row copy(const Row &row, unsigned position);
+
+	// Keep memory that stable strings passed to add() live in (e.g. mapped
+	// from a file) alive for as long as the store exists.
+	void adopt(std::shared_ptr<const void> memory);
+
+	size_t songs() const { return m_songs; }
+	size_t bytes() const;
+	std::vector<ColumnUsage> memoryUsage() const;
+
+	// Reserve serial numbers (see Row::serial()) for count songs that are not
+	// stored in any store. Returns the first one.
+	static uint64_t reserveSerials(size_t count);
+
+	// Storage for strings that never moves (also used by the search index).
+	struct StringPool
+	{
+		StringPool() : m_pos(nullptr), m_left(0), m_bytes(0), m_used(0) { }
+
+		const char *add(std::string_view s);
+
+		size_t bytes() const { return m_bytes; }
+		size_t used() const { return m_used; }
+
+	private:
+		std::vector<std::unique_ptr<char[]>> m_blocks;
+		char *m_pos;
+		size_t m_left;
+		size_t m_bytes;
+		size_t m_used;
+	};
+
+private:
+	struct Dictionary
+	{
+		Dictionary() : references(0) { }
+
+		const char *intern(std::string_view s, bool stable);
+
+		StringPool pool;
+		std::unordered_map<std::string_view, const char *> values;
+		size_t references;
+	};
+
+	Chunk &reserve(size_t tags);
+	Row store(const char *uri, time_t mtime, unsigned duration, const Tags &tags,
+	          bool stable_strings, unsigned position, unsigned id, unsigned prio);
+
+	std::vector<std::unique_ptr<Chunk>> m_chunks;
+	StringPool m_uris;
+	Dictionary m_dictionaries[MPD_TAG_COUNT];
+	std::vector<std::shared_ptr<const void>> m_adopted;
+	size_t m_songs;
+
+	// state of the song being decoded, reused between songs
+	time_t m_current_mtime;
+	unsigned m_current_duration;
+	unsigned m_current_position;
+	unsigned m_current_id;
+	unsigned m_current_prio;
+	std::vector<std::pair<mpd_tag_type, size_t>> m_current_tags;
+	std::vector<char> m_current_strings;
+	Tags m_current_tag_values;
+};
+
+}
+
+#endif // NCMPCPP_SONG_STORE_H
@@ -19,6 +19,9 @@
  ***************************************************************************/
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 
@@ -29,6 +32,7 @@
 #include "global.h"
 #include "helpers.h"
 #include "macro_utilities.h"
+#include "mpd_worker.h"
 #include "screens/lyrics.h"
 #include "screens/media_library.h"
 #include "screens/outputs.h"
@@ -79,6 +83,22 @@ unsigned m_playlist_length;
 unsigned m_total_time;
 int m_volume;
 
+int m_pending_events = 0;
+boost::posix_time::ptime m_pending_since;
+unsigned m_merged_idle_events = 0;
+
+void flushPendingEvents()
+{
+	int event = m_pending_events;
+	m_pending_events = 0;
+	if (int flags = Mpd.noidle())
+	{
+		event |= flags;
+		++m_merged_idle_events;
+	}
+	Status::update(event);
+}
+
 void drawTitle(const MPD::Song &np)
 {
 	assert(!np.empty());
@@ -170,6 +190,10 @@ void initialize_status()
 
 	m_status_initialized = true;
 	wFooter->addFDCallback(Mpd.GetFD(), Statusbar::Helpers::mpd);
+	if (MpdWorker.notificationFD() >= 0)
+		wFooter->addFDCallback(MpdWorker.notificationFD(), [] { MpdWorker.dispatch(); });
+	if (myPlaylist->filterNotificationFD() >= 0)
+		wFooter->addFDCallback(myPlaylist->filterNotificationFD(), [] { myPlaylist->dispatchFilterResults(); });
 	if (Config.connected_message_on_startup)
 	{
 		Statusbar::printf("Connected to %1%", Mpd.GetHostname());
@@ -239,6 +263,10 @@ void Status::trace(bool update_timer, bool update_window_timeout)
 			past = Timer;
 		}
 
+		if (m_pending_events
+		&&  Timer - m_pending_since >= Config.idle_events_coalescing_delay)
+			flushPendingEvents();
+
 		applyToVisibleWindows(&BaseScreen::update);
 		Statusbar::tryRedraw();
 
@@ -252,12 +280,29 @@ void Status::trace(bool update_timer, bool update_window_timeout)
 		applyToVisibleWindows([&nc_wtimeout](BaseScreen *s) {
 			nc_wtimeout = std::min(nc_wtimeout, s->windowTimeout());
 		});
+		// wake up in time to process pending events
+		if (m_pending_events)
+		{
+			auto remaining = m_pending_since
+				+ Config.idle_events_coalescing_delay
+				- Timer;
+			nc_wtimeout = std::min<int64_t>(
+				nc_wtimeout, std::max<int64_t>(0, remaining.total_milliseconds()));
+		}
 		wFooter->setTimeout(nc_wtimeout);
 	}
 }
 
 void Status::update(int event)
 {
+	// Process events gathered so far along with the current ones.
+	if (m_pending_events)
+	{
+		event |= m_pending_events;
+		m_pending_events = 0;
+		++m_merged_idle_events;
+	}
+
 	auto st = Mpd.getStatus();
 	m_current_song_pos = st.currentSongPosition();
 	m_elapsed_time = st.elapsedTime();
@@ -342,10 +387,28 @@ void Status::update(int event)
 		applyToVisibleWindows(&BaseScreen::refreshWindow);
 }
 
+void Status::queueUpdate(int event)
+{
+	if (event == 0)
+		return;
+	if (!m_status_initialized
+	||  Config.idle_events_coalescing_delay.total_milliseconds() == 0)
+	{
+		update(event);
+		return;
+	}
+	if (m_pending_events)
+		++m_merged_idle_events;
+	else
+		m_pending_since = boost::posix_time::microsec_clock::local_time();
+	m_pending_events |= event;
+}
+
 void Status::clear()
 {
 	// reset local variables
 	m_status_initialized = false;
+	m_pending_events = 0;
 	m_repeat = 0;
 	m_random = 0;
 	m_single = 0;
@@ -424,38 +487,107 @@ int Status::State::volume()
 	return m_volume;
 }
 
+unsigned Status::State::mergedIdleEvents()
+{
+	return m_merged_idle_events;
+}
+
 /*************************************************************************/
 
 void Status::Changes::playlist(unsigned previous_version)
 {
+	bool was_filtered = myPlaylist->isFiltered();
 	{
-		ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::Yes, myPlaylist->main());
+		// The filter is reapplied only to the songs that changed below.
+		ScopedUnfilteredMenu<MPD::Song> sunfilter(ReapplyFilter::No, myPlaylist->main());
+		auto &pl = myPlaylist->main();
 
-		if (m_playlist_length < myPlaylist->main().size())
+		// Fetch only positions and ids of changed songs first, so that songs that
+		// were merely moved can be reused instead of transferring their metadata
+		// again.
+		std::vector<MPD::Song> changes;
+		MPD::SongIterator s = Mpd.GetPlaylistChangesPosId(previous_version), end;
+		for (; s != end; ++s)
+			changes.push_back(std::move(*s));
+
+		// Song that was moved was previously either at one of the changed
+		// positions or past the end of the new playlist.
+		std::unordered_map<unsigned, MPD::Song> local_songs;
+		for (const auto &change : changes)
 		{
-			auto it = myPlaylist->main().begin()+m_playlist_length;
-			auto end = myPlaylist->main().end();
-			for (; it != end; ++it)
+			if (change.getPosition() < pl.size())
+			{
+				const MPD::Song &old_s = pl[change.getPosition()].value();
+				local_songs.emplace(old_s.getID(), old_s);
+			}
+		}
+		for (size_t i = m_playlist_length; i < pl.size(); ++i)
+			local_songs.emplace(pl[i].value().getID(), pl[i].value());
+
+		if (m_playlist_length < pl.size())
+		{
+			auto it = pl.begin()+m_playlist_length;
+			for (; it != pl.end(); ++it)
 				myPlaylist->unregisterSong(it->value());
-			myPlaylist->main().resizeList(m_playlist_length);
+			pl.resizeList(m_playlist_length);
 		}
 
-		MPD::SongIterator s = Mpd.GetPlaylistChanges(previous_version), end;
-		for (; s != end; ++s)
+		size_t unknown_begin = std::numeric_limits<size_t>::max(), unknown_end = 0;
+		size_t changed_begin = std::numeric_limits<size_t>::max(), changed_end = 0;
+		std::vector<std::pair<size_t, size_t>> moved;
+		std::vector<size_t> unknown;
+		auto moved_songs = std::make_shared<MPD::SongStore>();
+		for (auto &change : changes)
 		{
-			size_t pos = s->getPosition();
-			myPlaylist->registerSong(*s);
-			if (pos < myPlaylist->main().size())
+			size_t pos = change.getPosition();
+			changed_begin = std::min(changed_begin, pos);
+			changed_end = std::max(changed_end, pos+1);
+			auto local = local_songs.find(change.getID());
+			// If song didn't move, it's reported because its metadata changed, so
+			// it needs to be fetched again.
+			if (local != local_songs.end() && local->second.getPosition() != pos)
+			{
+				moved.emplace_back(pos, local->second.getPosition());
+				change = local->second.withPosition(pos, moved_songs);
+			}
+			else
+			{
+				unknown.push_back(pos);
+				unknown_begin = std::min(unknown_begin, pos);
+				unknown_end = std::max(unknown_end, pos+1);
+			}
+			myPlaylist->registerSong(change);
+			if (pos < pl.size())
 			{
 				// if song's already in playlist, replace it with a new one
-				MPD::Song &old_s = myPlaylist->main()[pos].value();
+				MPD::Song &old_s = pl[pos].value();
 				myPlaylist->unregisterSong(old_s);
-				old_s = std::move(*s);
+				old_s = std::move(change);
 			}
 			else // otherwise just add it to playlist
-				myPlaylist->main().addItem(std::move(*s));
+				pl.addItem(std::move(change));
 		}
+
+		// In lazy mode songs that are not known yet are left as placeholders and
+		// loaded when they're needed.
+		if (!Config.playlist_lazy_loading && unknown_begin < unknown_end)
+			myPlaylist->loadSongs(unknown_begin, unknown_end);
+
+		if (Config.playlist_lazy_loading)
+		{
+			// Filter can only be applied to loaded songs. Filtered playlist is
+			// fully loaded, so only the new ones need to be fetched.
+			if (was_filtered && unknown_begin < unknown_end)
+				myPlaylist->loadSongs(unknown_begin, unknown_end);
+			// Only entries of songs that are not known are fetched, i.e. all of
+			// them when the playlist is loaded for the first time.
+			myPlaylist->updateEntries(pl.size(), moved, unknown);
+		}
+
+		if (was_filtered)
+			myPlaylist->reapplyFilter(changed_begin, changed_end);
 	}
+	myPlaylist->loadVisibleSongs();
 
 	myPlaylist->reloadTotalLength();
 	myPlaylist->reloadRemaining();
@@ -482,13 +614,21 @@ void Status::Changes::storedPlaylists()
 
 void Status::Changes::database()
 {
-	myBrowser->requestUpdate();
-#	ifdef HAVE_TAGLIB_H
-	myTagEditor->Dirs->clear();
-#	endif // HAVE_TAGLIB_H
-	myLibrary->requestTagsUpdate();
-	myLibrary->requestAlbumsUpdate();
-	myLibrary->requestSongsUpdate();
+	mySearcher->databaseChanged();
+	// Find out what changed using the background connection so that only the
+	// affected parts of screens are updated.
+	MpdWorker.syncDatabase([](std::shared_ptr<const MPD::DatabaseDelta> delta) {
+		if (delta && delta->empty())
+			return;
+		if (!delta || myBrowser->isLocal()
+		    || delta->directoryChanged(myBrowser->inRootDirectory()
+		                               ? "" : myBrowser->currentDirectory()))
+			myBrowser->requestUpdate();
+#		ifdef HAVE_TAGLIB_H
+		myTagEditor->Dirs->clear();
+#		endif // HAVE_TAGLIB_H
+		myLibrary->databaseChanged(delta.get());
+	});
 }
 
 void Status::Changes::playerState()
@@ -581,7 +721,7 @@ void Status::Changes::songID(int song_id)
 			return s.getID() == unsigned(song_id);
 		});
 		// if it's not there (playlist may be outdated), fetch it
-		const auto &s = it != pl.endV() ? *it : Mpd.GetCurrentSong();
+		const auto &s = it != pl.endV() && !it->isPlaceholder() ? *it : Mpd.GetCurrentSong();
 		if (!s.empty())
 		{
 			if (!Config.execute_on_song_change.empty())
@@ -32,6 +32,7 @@ void handleServerError(MPD::ServerError &e);
 void trace(bool update_timer, bool update_window_timeout);
 inline void trace() { trace(true, false); }
 void update(int event);
+void queueUpdate(int event);
 void clear();
 
 namespace State {
@@ -52,6 +53,9 @@ MPD::PlayerState player();
 unsigned totalTime();
 int volume();
 
+// number of idle events processed together with earlier ones
+unsigned mergedIdleEvents();
+
 }
 
 namespace Changes {
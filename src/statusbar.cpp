@@ -189,7 +189,7 @@ void Statusbar::print(int delay, const std::string &message)
 
 void Statusbar::Helpers::mpd()
 {
-	Status::update(Mpd.noidle());
+	Status::queueUpdate(Mpd.noidle());
 }
 
 bool Statusbar::Helpers::mainHook(const char *)
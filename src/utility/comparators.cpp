@@ -18,16 +18,23 @@
  *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
  ***************************************************************************/
 
+#include <algorithm>
 #include <locale>
 #include "comparators.h"
 #include "format_impl.h"
+#include "utility/parallel.h"
 #include "utility/string.h"
 
 namespace {
 
-bool hasTheWord(const std::string &s)
+bool isDigit(char c)
 {
-	return s.length() >= 4
+	return c >= '0' && c <= '9';
+}
+
+bool hasTheWord(const char *s, size_t len)
+{
+	return len >= 4
 	&&     (s[0] == 't' || s[0] == 'T')
 	&&     (s[1] == 'h' || s[1] == 'H')
 	&&     (s[2] == 'e' || s[2] == 'E')
@@ -42,21 +49,100 @@ long long strToLL(const char *s, size_t len)
 	return n;
 }
 
+// Escape zero bytes so that the terminator sorts before any continuation.
+void appendField(std::string &key, const char *s, size_t len)
+{
+	for (; len > 0; --len, ++s)
+	{
+		key.push_back(*s);
+		if (*s == '\0')
+			key.push_back('\xff');
+	}
+	key.push_back('\0');
+	key.push_back('\1');
+}
+
+// One range per thread.
+std::vector<size_t> sortRanges(size_t size)
+{
+	size_t threads = Parallel::threadCount(size);
+	std::vector<size_t> bounds;
+	for (size_t i = 0; i <= threads; ++i)
+		bounds.push_back(i * size / threads);
+	return bounds;
+}
+
+bool sortKeyLess(const SortKey &a, const SortKey &b)
+{
+	int result = a.key.compare(b.key);
+	return result < 0 || (result == 0 && a.index < b.index);
+}
+
+}
+
+void appendBinarySortKey(std::string &key, const std::string &s)
+{
+	appendField(key, s.c_str(), s.length());
+}
+
+void appendReverseSortKey(std::string &key, time_t t)
+{
+	// Flip the sign bit to order negative values first, then all the bits to
+	// reverse the order. The key has a fixed length, so it needs no escaping.
+	uint64_t value = ~(static_cast<uint64_t>(t) ^ (uint64_t(1) << 63));
+	for (int shift = 56; shift >= 0; shift -= 8)
+		key.push_back(static_cast<char>(value >> shift));
+}
+
+void forEachSortRange(size_t size, const std::function<void(size_t, size_t)> &f)
+{
+	auto bounds = sortRanges(size);
+	size_t ranges = bounds.size() - 1;
+	Parallel::forEach(ranges, [&](size_t i) {
+		f(bounds[i], bounds[i+1]);
+	}, ranges);
+}
+
+void sortKeys(std::vector<SortKey> &keys)
+{
+	auto bounds = sortRanges(keys.size());
+	forEachSortRange(keys.size(), [&keys](size_t begin, size_t end) {
+		std::sort(keys.begin()+begin, keys.begin()+end, sortKeyLess);
+	});
+	// Merge sorted ranges pairwise until one is left.
+	while (bounds.size() > 2)
+	{
+		size_t ranges = bounds.size() - 1;
+		std::vector<size_t> merged_bounds;
+		for (size_t i = 0; i+1 < ranges; i += 2)
+			merged_bounds.push_back(bounds[i]);
+		if (ranges % 2 == 1)
+			merged_bounds.push_back(bounds[ranges-1]);
+		merged_bounds.push_back(bounds[ranges]);
+		size_t merges = ranges / 2;
+		Parallel::forEach(merges, [&](size_t i) {
+			std::inplace_merge(keys.begin()+bounds[2*i],
+			                   keys.begin()+bounds[2*i+1],
+			                   keys.begin()+bounds[2*i+2],
+			                   sortKeyLess);
+		}, merges);
+		bounds = std::move(merged_bounds);
+	}
 }
 
 int LocaleStringComparison::compare(const char *a, size_t a_len, const char *b, size_t b_len) const
 {
 	// If both strings are numbers, compare them as such.
-	if (   a_len > 0 && std::all_of(a, a + a_len, isdigit)
-	    && b_len > 0 && std::all_of(b, b + b_len, isdigit))
+	if (   a_len > 0 && std::all_of(a, a + a_len, isDigit)
+	    && b_len > 0 && std::all_of(b, b + b_len, isDigit))
 		return strToLL(a, a_len) - strToLL(b, b_len);
 
 	size_t ac_off = 0, bc_off = 0;
 	if (m_ignore_the)
 	{
-		if (hasTheWord(a))
+		if (hasTheWord(a, a_len))
 			ac_off += 4;
-		if (hasTheWord(b))
+		if (hasTheWord(b, b_len))
 			bc_off += 4;
 	}
 	return std::use_facet<std::collate<char>>(m_locale).compare(
@@ -64,64 +150,88 @@ int LocaleStringComparison::compare(const char *a, size_t a_len, const char *b,
 	);
 }
 
-bool LocaleBasedItemSorting::operator()(const MPD::Item &a, const MPD::Item &b) const
+void LocaleStringComparison::appendSortKey(std::string &key, const char *s, size_t len) const
+{
+	if (m_ignore_the && hasTheWord(s, len))
+	{
+		s += 4;
+		len -= 4;
+	}
+	// Empty strings have an empty field, strings starting with a number are
+	// marked with 1 followed by its length and digits, the rest with 2.
+	std::string field;
+	const char *digits_end = std::find_if_not(s, s + len, isDigit);
+	if (digits_end != s)
+	{
+		const char *number = std::find_if(s, digits_end - 1,
+		                                  [](char c) { return c != '0'; });
+		uint32_t number_len = digits_end - number;
+		field.push_back('\1');
+		for (int shift = 24; shift >= 0; shift -= 8)
+			field.push_back(static_cast<char>(number_len >> shift));
+		field.append(number, number_len);
+		len -= digits_end - s;
+		s = digits_end;
+	}
+	else if (len > 0)
+		field.push_back('\2');
+	if (len > 0)
+		field += std::use_facet<std::collate<char>>(m_locale).transform(s, s + len);
+	appendField(key, field.data(), field.size());
+}
+
+void LocaleBasedItemSorting::operator()(std::string &key, const MPD::Item &item) const
 {
-	bool result = false;
-	if (a.type() == b.type())
+	// Items of different types are never mixed, types have a fixed width.
+	key.push_back(static_cast<char>(item.type()));
+	switch (m_sort_mode)
 	{
-		switch (m_sort_mode)
-		{
-			case SortMode::Type:
-				result = a.type() > b.type();
-				break;
-			case SortMode::Name:
-				switch (a.type())
-				{
-					case MPD::Item::Type::Directory:
-						result = m_cmp(a.directory().path(), b.directory().path());
-						break;
-					case MPD::Item::Type::Playlist:
-						result = m_cmp(a.playlist().path(), b.playlist().path());
-						break;
-					case MPD::Item::Type::Song:
-						result = m_cmp(a.song(), b.song());
-						break;
-				}
-				break;
-			case SortMode::CustomFormat:
-				switch (a.type())
-				{
-					case MPD::Item::Type::Directory:
-						result = m_cmp(a.directory().path(), b.directory().path());
-						break;
-					case MPD::Item::Type::Playlist:
-						result = m_cmp(a.playlist().path(), b.playlist().path());
-						break;
-					case MPD::Item::Type::Song:
-						result = m_cmp(Format::stringify<char>(Config.browser_sort_format, &a.song()),
-						               Format::stringify<char>(Config.browser_sort_format, &b.song()));
-						break;
-				}
-				break;
-			case SortMode::ModificationTime:
-				switch (a.type())
-				{
-					case MPD::Item::Type::Directory:
-						result = a.directory().lastModified() > b.directory().lastModified();
-						break;
-					case MPD::Item::Type::Playlist:
-						result = a.playlist().lastModified() > b.playlist().lastModified();
-						break;
-					case MPD::Item::Type::Song:
-						result = a.song().getMTime() > b.song().getMTime();
-						break;
-				}
-				break;
-			case SortMode::None:
-				throw std::logic_error("can't sort with None sorting mode");
-		}
+		case SortMode::Type:
+			break;
+		case SortMode::Name:
+			switch (item.type())
+			{
+				case MPD::Item::Type::Directory:
+					m_cmp.appendSortKey(key, item.directory().path());
+					break;
+				case MPD::Item::Type::Playlist:
+					m_cmp.appendSortKey(key, item.playlist().path());
+					break;
+				case MPD::Item::Type::Song:
+					m_cmp.appendSortKey(key, item.song().getName());
+					break;
+			}
+			break;
+		case SortMode::CustomFormat:
+			switch (item.type())
+			{
+				case MPD::Item::Type::Directory:
+					m_cmp.appendSortKey(key, item.directory().path());
+					break;
+				case MPD::Item::Type::Playlist:
+					m_cmp.appendSortKey(key, item.playlist().path());
+					break;
+				case MPD::Item::Type::Song:
+					m_cmp.appendSortKey(key, Format::stringify<char>(
+						Config.browser_sort_format, &item.song()));
+					break;
+			}
+			break;
+		case SortMode::ModificationTime:
+			switch (item.type())
+			{
+				case MPD::Item::Type::Directory:
+					appendReverseSortKey(key, item.directory().lastModified());
+					break;
+				case MPD::Item::Type::Playlist:
+					appendReverseSortKey(key, item.playlist().lastModified());
+					break;
+				case MPD::Item::Type::Song:
+					appendReverseSortKey(key, item.song().getMTime());
+					break;
+			}
+			break;
+		case SortMode::None:
+			throw std::logic_error("can't sort with None sorting mode");
 	}
-	else
-		result = a.type() < b.type();
-	return result;
 }
@@ -21,7 +21,11 @@
 #ifndef NCMPCPP_UTILITY_COMPARATORS_H
 #define NCMPCPP_UTILITY_COMPARATORS_H
 
+#include <functional>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "runnable_item.h"
 #include "mpdpp.h"
 #include "settings.h"
@@ -42,10 +46,66 @@ public:
 	int operator()(const std::string &a, const std::string &b) const {
 		return compare(a.c_str(), a.length(), b.c_str(), b.length());
 	}
+	int operator()(std::string_view a, std::string_view b) const {
+		return compare(a.data(), a.length(), b.data(), b.length());
+	}
 
 	int compare(const char *a, size_t a_len, const char *b, size_t b_len) const;
+
+	// Append a collation key of the string to key. Keys are compared bytewise
+	// and keys of consecutive fields can be concatenated. Strings starting
+	// with a number are ordered by its value first, so plain numbers compare
+	// like in compare() and dates such as 2001 and 2001-05-03 stay together.
+	void appendSortKey(std::string &key, const char *s, size_t len) const;
+	void appendSortKey(std::string &key, std::string_view s) const {
+		appendSortKey(key, s.data(), s.length());
+	}
 };
 
+// Append a key ordering the string bytewise, like operator<.
+void appendBinarySortKey(std::string &key, const std::string &s);
+
+// Append a key ordering times from the newest to the oldest.
+void appendReverseSortKey(std::string &key, time_t t);
+
+struct SortKey
+{
+	std::string key;
+	size_t index;
+};
+
+// Run f on consecutive subranges of [0, size), in parallel if size is at
+// least Parallel::Threshold.
+void forEachSortRange(size_t size, const std::function<void(size_t, size_t)> &f);
+
+// Sort keys by key and index, in parallel if there are many of them.
+void sortKeys(std::vector<SortKey> &keys);
+
+// Stable sort of the range using keys computed once per element by
+// key_function(std::string &key, const value_type &value).
+template <typename IteratorT, typename KeyFunctionT>
+void sortByKey(IteratorT first, IteratorT last, KeyFunctionT key_function)
+{
+	typedef typename std::iterator_traits<IteratorT>::value_type ValueT;
+	size_t size = last - first;
+	if (size < 2)
+		return;
+	std::vector<SortKey> keys(size);
+	forEachSortRange(size, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			keys[i].index = i;
+			key_function(keys[i].key, *(first + i));
+		}
+	});
+	sortKeys(keys);
+	std::vector<ValueT> sorted;
+	sorted.reserve(size);
+	for (const auto &key : keys)
+		sorted.push_back(std::move(*(first + key.index)));
+	std::move(sorted.begin(), sorted.end(), first);
+}
+
 class LocaleBasedSorting
 {
 	LocaleStringComparison m_cmp;
@@ -76,21 +136,20 @@ public:
 	}
 };
 
+// Sort key function for sortByKey.
 class LocaleBasedItemSorting
 {
-	LocaleBasedSorting m_cmp;
+	LocaleStringComparison m_cmp;
 	SortMode m_sort_mode;
 	
 public:
 	LocaleBasedItemSorting(const std::locale &loc, bool ignore_the, SortMode mode)
 	: m_cmp(loc, ignore_the), m_sort_mode(mode) { }
 	
-	bool operator()(const MPD::Item &a, const MPD::Item &b) const;
+	void operator()(std::string &key, const MPD::Item &item) const;
 	
-	bool operator()(const NC::Menu<MPD::Item>::Item &a,
-	                const NC::Menu<MPD::Item>::Item &b) const
-	{
-		return (*this)(a.value(), b.value());
+	void operator()(std::string &key, const NC::Menu<MPD::Item>::ItemRef &item) const {
+		(*this)(key, item.value());
 	}
 };
 
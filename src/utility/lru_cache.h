@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_UTILITY_LRU_CACHE_H
+#define NCMPCPP_UTILITY_LRU_CACHE_H
+
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Map holding at most the given number of values, the least recently used
+// one is evicted when a new one doesn't fit.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>>
+struct LRUCache
+{
+	explicit LRUCache(size_t capacity)
+	: m_capacity(capacity)
+	{
+		assert(m_capacity > 0);
+	}
+
+	// Value of the key (marked as the most recently used) or nullptr.
+	ValueT *find(const KeyT &key)
+	{
+		auto it = m_index.find(key);
+		if (it == m_index.end())
+			return nullptr;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return &it->second->second;
+	}
+
+	// Store the value of the key, replacing the previous one if there is any.
+	ValueT &insert(const KeyT &key, ValueT value)
+	{
+		auto it = m_index.find(key);
+		if (it != m_index.end())
+		{
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			it->second->second = std::move(value);
+			return it->second->second;
+		}
+		if (m_entries.size() >= m_capacity)
+		{
+			m_index.erase(m_entries.back().first);
+			m_entries.pop_back();
+		}
+		m_entries.emplace_front(key, std::move(value));
+		m_index.emplace(key, m_entries.begin());
+		return m_entries.front().second;
+	}
+
+	void clear()
+	{
+		m_index.clear();
+		m_entries.clear();
+	}
+
+	// Change the capacity, evicting the least recently used values that no
+	// longer fit.
+	void setCapacity(size_t capacity)
+	{
+		assert(capacity > 0);
+		m_capacity = capacity;
+		while (m_entries.size() > m_capacity)
+		{
+			m_index.erase(m_entries.back().first);
+			m_entries.pop_back();
+		}
+	}
+
+	size_t size() const { return m_entries.size(); }
+	size_t capacity() const { return m_capacity; }
+
+private:
+	typedef std::list<std::pair<KeyT, ValueT>> Entries;
+
+	Entries m_entries;
+	std::unordered_map<KeyT, typename Entries::iterator, HashT> m_index;
+	size_t m_capacity;
+};
+
+#endif // NCMPCPP_UTILITY_LRU_CACHE_H
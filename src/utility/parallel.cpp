@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "utility/parallel.h"
+
+namespace {
+
+// Threads that are kept waiting for jobs once they're started.
+struct Pool
+{
+	Pool() : m_stop(false) { }
+
+	~Pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_all();
+		for (auto &thread : m_threads)
+			thread.join();
+	}
+
+	// Run the job in the given number of threads.
+	void post(const std::function<void()> &job, size_t threads)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			while (m_threads.size() < threads)
+				m_threads.emplace_back(&Pool::loop, this);
+			for (size_t i = 0; i < threads; ++i)
+				m_jobs.push_back(job);
+		}
+		m_cv.notify_all();
+	}
+
+private:
+	void loop()
+	{
+		while (true)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+				if (m_stop)
+					break;
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::function<void()>> m_jobs;
+	std::vector<std::thread> m_threads;
+	bool m_stop;
+};
+
+Pool &pool()
+{
+	static Pool instance;
+	return instance;
+}
+
+}
+
+namespace Parallel {
+
+size_t Threshold = 20000;
+unsigned Threads = 0;
+
+unsigned threadCount()
+{
+	if (Threads > 0)
+		return Threads;
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+unsigned threadCount(size_t items)
+{
+	if (Threshold == 0 || items < Threshold)
+		return 1;
+	size_t chunks = (items + ChunkSize - 1) / ChunkSize;
+	return std::max<size_t>(1, std::min<size_t>(threadCount(), chunks));
+}
+
+void run(unsigned threads, const std::function<void()> &work)
+{
+	if (threads <= 1)
+	{
+		work();
+		return;
+	}
+
+	std::mutex mutex;
+	std::condition_variable done;
+	unsigned running = threads;
+	std::exception_ptr error;
+	auto job = [&] {
+		std::exception_ptr job_error;
+		try
+		{
+			work();
+		}
+		catch (...)
+		{
+			job_error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (job_error && !error)
+			error = job_error;
+		if (--running == 0)
+			done.notify_one();
+	};
+	pool().post(job, threads - 1);
+	job();
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&running] { return running == 0; });
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void forEach(size_t count, const std::function<void(size_t)> &f, unsigned threads)
+{
+	std::atomic<size_t> next(0);
+	run(std::max<size_t>(1, std::min<size_t>(threads, count)), [&] {
+		try
+		{
+			for (size_t i; (i = next++) < count;)
+				f(i);
+		}
+		catch (...)
+		{
+			// Make the other threads stop.
+			next = count;
+			throw;
+		}
+	});
+}
+
+}
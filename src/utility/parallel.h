@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) 2008-2021 by Andrzej Rybczak                            *
+ *   andrzej@rybczak.net                                                   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.              *
+ ***************************************************************************/
+
+#ifndef NCMPCPP_UTILITY_PARALLEL_H
+#define NCMPCPP_UTILITY_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace Parallel {
+
+/// Number of items from which lists are filtered and sorted in parallel,
+/// 0 turns it off.
+extern size_t Threshold;
+
+/// Number of threads used for parallel evaluation, 0 means one per core.
+extern unsigned Threads;
+
+/// Number of items that are claimed by a thread at once.
+const size_t ChunkSize = 1024;
+
+/// @return number of threads to use (at least 1)
+unsigned threadCount();
+
+/// @return number of threads to use for the given number of items, i.e. 1 if
+/// it's below the threshold, otherwise at most one per chunk
+unsigned threadCount(size_t items);
+
+/// Run the function in the given number of threads at once and wait until
+/// all of them are done. The calling thread is one of them, the rest are
+/// taken from a pool of threads that are started when they're first needed,
+/// so the function should split the work itself (e.g. by claiming its parts
+/// with an atomic counter). It must not call run() recursively.
+/// @throws the first exception thrown by the function
+void run(unsigned threads, const std::function<void()> &work);
+
+/// Call f(i) for i in [0, count) using at most the given number of threads.
+void forEach(size_t count, const std::function<void(size_t)> &f, unsigned threads);
+
+/// Evaluate the predicate for indices in [first, last) using the given number
+/// of threads, each one with its own copy of the predicate (so e.g. regular
+/// expressions in it aren't shared). Threads claim chunks of the range until
+/// there are none left, so faster ones take over the work of slower ones.
+/// @return indices for which the predicate returned true, in order
+template <typename PredicateT>
+std::vector<size_t> filter(size_t first, size_t last, const PredicateT &pred,
+                           unsigned threads)
+{
+	std::vector<size_t> result;
+	if (first >= last)
+		return result;
+	const size_t chunks = (last - first + ChunkSize - 1) / ChunkSize;
+	threads = std::max(1u, std::min<unsigned>(threads, chunks));
+	if (threads == 1)
+	{
+		for (size_t i = first; i < last; ++i)
+			if (pred(i))
+				result.push_back(i);
+		return result;
+	}
+
+	std::vector<std::vector<size_t>> matches(chunks);
+	std::atomic<size_t> next_chunk(0);
+	run(threads, [&] {
+		PredicateT local_pred = pred;
+		try
+		{
+			for (size_t chunk; (chunk = next_chunk++) < chunks;)
+			{
+				size_t begin = first + chunk*ChunkSize;
+				size_t end = std::min(begin + ChunkSize, last);
+				for (size_t i = begin; i < end; ++i)
+					if (local_pred(i))
+						matches[chunk].push_back(i);
+			}
+		}
+		catch (...)
+		{
+			// Make the other threads stop.
+			next_chunk = chunks;
+			throw;
+		}
+	});
+
+	size_t size = 0;
+	for (const auto &chunk : matches)
+		size += chunk.size();
+	result.reserve(size);
+	for (const auto &chunk : matches)
+		result.insert(result.end(), chunk.begin(), chunk.end());
+	return result;
+}
+
+/// Same as above, but the range is evaluated in parallel only if it's at
+/// least as big as the threshold.
+template <typename PredicateT>
+std::vector<size_t> filter(size_t first, size_t last, const PredicateT &pred)
+{
+	return filter(first, last, pred, threadCount(last > first ? last - first : 0));
+}
+
+}
+
+#endif // NCMPCPP_UTILITY_PARALLEL_H
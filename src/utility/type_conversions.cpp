@@ -211,7 +211,7 @@ boost::optional<mpd_tag_type> getFunctionToTagType(MPD::Song::GetFunction f)
 		return MPD_TAG_ALBUM;
 	else if (f == &MPD::Song::getAlbumArtist)
 		return MPD_TAG_ALBUM_ARTIST;
-	else if (f == &MPD::Song::getTrack)
+	else if (f == &MPD::Song::getTrack || f == &MPD::Song::getTrackNumber)
 		return MPD_TAG_TRACK;
 	else if (f == &MPD::Song::getDate)
 		return MPD_TAG_DATE;
@@ -225,8 +225,8 @@ boost::optional<mpd_tag_type> getFunctionToTagType(MPD::Song::GetFunction f)
 		return MPD_TAG_COMMENT;
 	else if (f == &MPD::Song::getDisc)
 		return MPD_TAG_DISC;
-	else if (f == &MPD::Song::getComment)
-		return MPD_TAG_COMMENT;
+	else if (f == &MPD::Song::getName)
+		return MPD_TAG_NAME;
 	else
 		return boost::none;
 }